@@ -6,10 +6,16 @@
 // ---------------------------------------------------------------------------
 
 #include "colorist/colorist.h"
+#include "colorist/raw.h"
+#include "colorist/transform.h"
+
+#include "cJSON.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-// #include <string.h>
+#include <string.h>
+
+#define DEFAULT_SYNTHETIC_IMAGE "1920x1080,#ff0000..#000000,#000000..#00ff00,#0000ff..#ffffff"
 
 static void clContextSilentLog(clContext * C, const char * section, int indent, const char * format, va_list args)
 {
@@ -26,29 +32,11 @@ static void clContextSilentLogError(clContext * C, const char * format, va_list
     COLORIST_UNUSED(args);
 }
 
-int main(int argc, char * argv[])
-{
-    if (argc < 2) {
-        printf("colorist-benchmark [input image filename] [optional attempts]\n");
-        return 1;
-    }
-
-    int attempts = 1;
-    if (argc > 2) {
-        attempts = atoi(argv[2]);
-        if (attempts < 1) {
-            attempts = 1;
-        }
-    }
-
-    clContextSystem silentSystem;
-    silentSystem.alloc = clContextDefaultAlloc;
-    silentSystem.free = clContextDefaultFree;
-    silentSystem.log = clContextSilentLog;
-    silentSystem.error = clContextSilentLogError;
+// ---------------------------------------------------------------------------
+// Decode benchmark
 
-    const char * inputFilename = argv[1];
-    clContext * C = clContextCreate(&silentSystem);
+static int benchmarkRead(clContext * C, const char * inputFilename, int attempts)
+{
     struct clImage * image = NULL;
 
     int width = 0;
@@ -74,6 +62,10 @@ int main(int argc, char * argv[])
             height = image->height;
             depth = image->depth;
             error = "false";
+            if (attempt < (attempts - 1)) {
+                clImageDestroy(C, image);
+                image = NULL;
+            }
         } else {
             break;
         }
@@ -100,6 +92,516 @@ int main(int argc, char * argv[])
     if (image) {
         clImageDestroy(C, image);
     }
-    clContextDestroy(C);
     return 0;
 }
+
+// ---------------------------------------------------------------------------
+// Suite
+//
+// Every benchmark is a single call into one of the library's hot paths, timed after some warmup runs,
+// repeatedly, at each thread count from 1 up to --jobs.
+
+typedef struct Fixture
+{
+    const char * inputFilename;
+    clImage * image;     // source image, sRGB unless it was read from a file with another profile
+    clImage * composite; // quarter-size copy of image, for blending
+    float * srcPixels;   // image as F32
+    float * dstPixels;   // scratch, same size as srcPixels
+    int pixelCount;
+    clProfile * srgb;
+    clProfile * pq;
+    clProfile * hlg;
+    clProfile * gamma24;
+    clLUT3D * lut;
+} Fixture;
+
+typedef struct Benchmark Benchmark;
+// Returns the seconds spent in the code being measured (setup excluded), or a negative value on failure
+typedef double (*BenchmarkFunc)(clContext * C, Fixture * fixture, const Benchmark * benchmark);
+
+struct Benchmark
+{
+    const char * name;
+    BenchmarkFunc func;
+
+    // Per-benchmark settings, meaning depends on func
+    clBool ccmm;
+    clProfile ** srcProfile;
+    clProfile ** dstProfile;
+    clTonemap tonemap;
+    clFilter filter;
+    clLUTInterpolation interpolation;
+    const char * formatName;
+    int depth;
+    int quality;
+    int rate;
+    int speed;
+};
+
+static double runRead(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    COLORIST_UNUSED(benchmark);
+
+    Timer t;
+    timerStart(&t);
+    clImage * image = clContextRead(C, fixture->inputFilename, NULL, NULL);
+    double elapsed = timerElapsedSeconds(&t);
+    if (!image) {
+        return -1.0;
+    }
+    clImageDestroy(C, image);
+    return elapsed;
+}
+
+static double runTransform(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    Timer t;
+    timerStart(&t);
+    C->ccmmAllowed = benchmark->ccmm;
+    clTransform * transform = clTransformCreate(C, *benchmark->srcProfile, CL_XF_RGBA, *benchmark->dstProfile, CL_XF_RGBA, benchmark->tonemap);
+    clTransformRun(C, transform, fixture->srcPixels, fixture->dstPixels, fixture->pixelCount);
+    clTransformDestroy(C, transform);
+    C->ccmmAllowed = clTrue;
+    return timerElapsedSeconds(&t);
+}
+
+static double runConvert(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    Timer t;
+    timerStart(&t);
+    clImage * converted = clImageConvert(C, fixture->image, benchmark->depth, *benchmark->dstProfile, benchmark->tonemap, NULL);
+    double elapsed = timerElapsedSeconds(&t);
+    if (!converted) {
+        return -1.0;
+    }
+    clImageDestroy(C, converted);
+    return elapsed;
+}
+
+static double runResize(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    int width = CL_MAX(fixture->image->width / 2, 1);
+    int height = CL_MAX(fixture->image->height / 2, 1);
+    Timer t;
+    timerStart(&t);
+    clImage * resized = clImageResize(C, fixture->image, width, height, benchmark->filter);
+    double elapsed = timerElapsedSeconds(&t);
+    clImageDestroy(C, resized);
+    return elapsed;
+}
+
+static double runLUT3D(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    fixture->lut->interpolation = benchmark->interpolation;
+    Timer t;
+    timerStart(&t);
+    clImage * applied = clImageApplyLUT3D(C, fixture->image, fixture->lut);
+    double elapsed = timerElapsedSeconds(&t);
+    clImageDestroy(C, applied);
+    return elapsed;
+}
+
+static double runBlend(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    COLORIST_UNUSED(benchmark);
+
+    clBlendParams blendParams;
+    clBlendParamsSetDefaults(C, &blendParams);
+    blendParams.offsetX = fixture->image->width / 4;
+    blendParams.offsetY = fixture->image->height / 4;
+    Timer t;
+    timerStart(&t);
+    clImage * blended = clImageBlend(C, fixture->image, fixture->composite, &blendParams);
+    double elapsed = timerElapsedSeconds(&t);
+    if (!blended) {
+        return -1.0;
+    }
+    clImageDestroy(C, blended);
+    return elapsed;
+}
+
+static double runWrite(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    clFormat * format = clContextFindFormat(C, benchmark->formatName);
+    if (!format || !format->writeFunc) {
+        return -1.0;
+    }
+
+    // Writers expect an image already at a depth they support, so the conversion isn't timed
+    int depth = clFormatBestDepth(C, benchmark->formatName, benchmark->depth);
+    clImage * image = fixture->image;
+    if (image->depth != depth) {
+        image = clImageConvert(C, fixture->image, depth, fixture->image->profile, CL_TONEMAP_OFF, NULL);
+    }
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    writeParams.quality = benchmark->quality;
+    writeParams.rate = benchmark->rate;
+    writeParams.speed = benchmark->speed;
+
+    clRaw output = CL_RAW_EMPTY;
+    Timer t;
+    timerStart(&t);
+    clBool result = format->writeFunc(C, image, benchmark->formatName, &output, &writeParams);
+    double elapsed = timerElapsedSeconds(&t);
+    clRawFree(C, &output);
+    if (image != fixture->image) {
+        clImageDestroy(C, image);
+    }
+    return result ? elapsed : -1.0;
+}
+
+static double runMeasureHDR(clContext * C, Fixture * fixture, const Benchmark * benchmark)
+{
+    COLORIST_UNUSED(benchmark);
+
+    // Same pixels, read as PQ so that there are highlights to find
+    clProfile * profile = fixture->image->profile;
+    fixture->image->profile = fixture->pq;
+
+    clImage * highlight = NULL;
+    clImageHDRStats stats;
+    clImageHDRQuantization * quantization = malloc(sizeof(clImageHDRQuantization));
+    Timer t;
+    timerStart(&t);
+    clImageMeasureHDR(C, fixture->image, 300, 10000.0f, &highlight, &stats, NULL, quantization);
+    double elapsed = timerElapsedSeconds(&t);
+    free(quantization);
+
+    fixture->image->profile = profile;
+    if (!highlight) {
+        return -1.0;
+    }
+    clImageDestroy(C, highlight);
+    return elapsed;
+}
+
+#define TRANSFORM(NAME, CCMM, SRC, DST, TONEMAP) \
+    { NAME, runTransform, CCMM, SRC, DST, TONEMAP, CL_FILTER_AUTO, CL_LUT_INTERPOLATION_TETRAHEDRAL, NULL, 0, 0, 0, 0 }
+#define CONVERT(NAME, DST, DEPTH, TONEMAP) \
+    { NAME, runConvert, clTrue, NULL, DST, TONEMAP, CL_FILTER_AUTO, CL_LUT_INTERPOLATION_TETRAHEDRAL, NULL, DEPTH, 0, 0, 0 }
+#define RESIZE(NAME, FILTER) \
+    { NAME, runResize, clTrue, NULL, NULL, CL_TONEMAP_AUTO, FILTER, CL_LUT_INTERPOLATION_TETRAHEDRAL, NULL, 0, 0, 0, 0 }
+#define LUT3D(NAME, INTERPOLATION) \
+    { NAME, runLUT3D, clTrue, NULL, NULL, CL_TONEMAP_AUTO, CL_FILTER_AUTO, INTERPOLATION, NULL, 0, 0, 0, 0 }
+#define WRITE(NAME, FORMAT, DEPTH, QUALITY, RATE, SPEED) \
+    { NAME, runWrite, clTrue, NULL, NULL, CL_TONEMAP_AUTO, CL_FILTER_AUTO, CL_LUT_INTERPOLATION_TETRAHEDRAL, FORMAT, DEPTH, QUALITY, RATE, SPEED }
+#define OTHER(NAME, FUNC) \
+    { NAME, FUNC, clTrue, NULL, NULL, CL_TONEMAP_AUTO, CL_FILTER_AUTO, CL_LUT_INTERPOLATION_TETRAHEDRAL, NULL, 0, 0, 0, 0 }
+
+static Fixture fixture;
+static const Benchmark benchmarks[] = {
+    OTHER("read", runRead), // only with --input
+
+    TRANSFORM("transform/ccmm/srgb-pq", clTrue, &fixture.srgb, &fixture.pq, CL_TONEMAP_OFF),
+    TRANSFORM("transform/ccmm/pq-srgb/tonemap", clTrue, &fixture.pq, &fixture.srgb, CL_TONEMAP_ON),
+    TRANSFORM("transform/ccmm/pq-srgb", clTrue, &fixture.pq, &fixture.srgb, CL_TONEMAP_OFF),
+    TRANSFORM("transform/ccmm/hlg-gamma24", clTrue, &fixture.hlg, &fixture.gamma24, CL_TONEMAP_AUTO),
+    TRANSFORM("transform/ccmm/gamma24-hlg", clTrue, &fixture.gamma24, &fixture.hlg, CL_TONEMAP_OFF),
+    TRANSFORM("transform/ccmm/pq-hlg/tonemap", clTrue, &fixture.pq, &fixture.hlg, CL_TONEMAP_ON),
+    TRANSFORM("transform/lcms/srgb-pq", clFalse, &fixture.srgb, &fixture.pq, CL_TONEMAP_OFF),
+    TRANSFORM("transform/lcms/pq-srgb/tonemap", clFalse, &fixture.pq, &fixture.srgb, CL_TONEMAP_ON),
+    TRANSFORM("transform/lcms/pq-srgb", clFalse, &fixture.pq, &fixture.srgb, CL_TONEMAP_OFF),
+    TRANSFORM("transform/lcms/hlg-gamma24", clFalse, &fixture.hlg, &fixture.gamma24, CL_TONEMAP_AUTO),
+    TRANSFORM("transform/lcms/gamma24-hlg", clFalse, &fixture.gamma24, &fixture.hlg, CL_TONEMAP_OFF),
+    TRANSFORM("transform/lcms/pq-hlg/tonemap", clFalse, &fixture.pq, &fixture.hlg, CL_TONEMAP_ON),
+
+    CONVERT("convert/pq-10", &fixture.pq, 10, CL_TONEMAP_AUTO),
+    CONVERT("convert/gamma24-8", &fixture.gamma24, 8, CL_TONEMAP_AUTO),
+    CONVERT("convert/gamma24-32", &fixture.gamma24, 32, CL_TONEMAP_OFF),
+
+    RESIZE("resize/box", CL_FILTER_BOX),
+    RESIZE("resize/triangle", CL_FILTER_TRIANGLE),
+    RESIZE("resize/cubicbspline", CL_FILTER_CUBICBSPLINE),
+    RESIZE("resize/catmullrom", CL_FILTER_CATMULLROM),
+    RESIZE("resize/mitchell", CL_FILTER_MITCHELL),
+    RESIZE("resize/nearest", CL_FILTER_NEAREST),
+
+    LUT3D("hald/tetrahedral", CL_LUT_INTERPOLATION_TETRAHEDRAL),
+    LUT3D("hald/trilinear", CL_LUT_INTERPOLATION_TRILINEAR),
+
+    OTHER("blend", runBlend),
+    OTHER("measurehdr", runMeasureHDR),
+
+    WRITE("write/png/8", "png", 8, 0, 0, -1),
+    WRITE("write/png/16", "png", 16, 0, 0, -1),
+    WRITE("write/jpg/q50", "jpg", 8, 50, 0, -1),
+    WRITE("write/jpg/q90", "jpg", 8, 90, 0, -1),
+    WRITE("write/webp/q50", "webp", 8, 50, 0, -1),
+    WRITE("write/webp/q90", "webp", 8, 90, 0, -1),
+    WRITE("write/webp/lossless", "webp", 8, 100, 0, -1),
+    WRITE("write/avif/8/q60/speed10", "avif", 8, 60, 0, 10),
+    WRITE("write/avif/10/q60/speed6", "avif", 10, 60, 0, 6),
+    WRITE("write/jp2/8/r100", "jp2", 8, 0, 100, -1),
+    WRITE("write/jp2/10/lossless", "jp2", 10, 100, 0, -1),
+    WRITE("write/tiff/16", "tiff", 16, 0, 0, -1),
+    WRITE("write/bmp/8", "bmp", 8, 0, 0, -1),
+};
+static const int benchmarkCount = (int)(sizeof(benchmarks) / sizeof(benchmarks[0]));
+
+static int compareDoubles(const void * a, const void * b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+// Returns NULL if the benchmark failed
+static cJSON * runBenchmark(clContext * C, const Benchmark * benchmark, int jobs, int warmup, int repetitions)
+{
+    double * samples = malloc(sizeof(double) * (size_t)repetitions);
+
+    C->jobs = jobs;
+    for (int i = 0; i < warmup; ++i) {
+        if (benchmark->func(C, &fixture, benchmark) < 0.0) {
+            free(samples);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < repetitions; ++i) {
+        samples[i] = benchmark->func(C, &fixture, benchmark);
+        if (samples[i] < 0.0) {
+            free(samples);
+            return NULL;
+        }
+    }
+
+    double total = 0.0;
+    for (int i = 0; i < repetitions; ++i) {
+        total += samples[i];
+    }
+    qsort(samples, (size_t)repetitions, sizeof(double), compareDoubles);
+    double median = samples[repetitions / 2];
+    if ((repetitions % 2) == 0) {
+        median = (median + samples[(repetitions / 2) - 1]) * 0.5;
+    }
+    int p95Index = (int)((0.95 * repetitions) + 0.999999) - 1;
+    double p95 = samples[CL_CLAMP(p95Index, 0, repetitions - 1)];
+
+    cJSON * result = cJSON_CreateObject();
+    cJSON_AddNumberToObject(result, "jobs", jobs);
+    cJSON_AddNumberToObject(result, "median", median);
+    cJSON_AddNumberToObject(result, "p95", p95);
+    cJSON_AddNumberToObject(result, "mean", total / repetitions);
+    cJSON_AddNumberToObject(result, "min", samples[0]);
+    cJSON_AddNumberToObject(result, "max", samples[repetitions - 1]);
+    cJSON_AddNumberToObject(result, "megapixelsPerSecond", (median > 0.0) ? (fixture.pixelCount / median) / 1000000.0 : 0.0);
+    free(samples);
+    return result;
+}
+
+static clBool fixtureCreate(clContext * C, const char * inputFilename, const char * imageString)
+{
+    memset(&fixture, 0, sizeof(fixture));
+    fixture.inputFilename = inputFilename;
+    if (inputFilename) {
+        fixture.image = clContextRead(C, inputFilename, NULL, NULL);
+        if (!fixture.image) {
+            fprintf(stderr, "ERROR: Can't read input file: %s\n", inputFilename);
+            return clFalse;
+        }
+    } else {
+        fixture.image = clImageParseString(C, imageString, 16, NULL);
+        if (!fixture.image) {
+            fprintf(stderr, "ERROR: Can't parse image string: %s\n", imageString);
+            return clFalse;
+        }
+    }
+    fixture.composite = clImageResize(C, fixture.image, CL_MAX(fixture.image->width / 4, 1), CL_MAX(fixture.image->height / 4, 1), CL_FILTER_BOX);
+
+    fixture.pixelCount = fixture.image->width * fixture.image->height;
+    clImagePrepareReadPixels(C, fixture.image, CL_PIXELFORMAT_F32);
+    size_t bytes = (size_t)fixture.pixelCount * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
+    fixture.srcPixels = malloc(bytes);
+    fixture.dstPixels = malloc(bytes);
+    memcpy(fixture.srcPixels, fixture.image->pixelsF32, bytes);
+
+    clProfilePrimaries bt2020;
+    clProfileCurve curve;
+    clContextGetStockPrimaries(C, "bt2020", &bt2020);
+    fixture.srgb = clProfileCreateStock(C, CL_PS_SRGB);
+    curve.type = CL_PCT_PQ;
+    curve.implicitScale = 1.0f;
+    curve.gamma = 1.0f;
+    fixture.pq = clProfileCreate(C, &bt2020, &curve, 10000, NULL);
+    curve.type = CL_PCT_HLG;
+    fixture.hlg = clProfileCreate(C, &bt2020, &curve, CL_LUMINANCE_UNSPECIFIED, NULL);
+    curve.type = CL_PCT_GAMMA;
+    curve.gamma = 2.4f;
+    fixture.gamma24 = clProfileCreate(C, &bt2020, &curve, 300, NULL);
+    fixture.lut = clLUT3DCreate(C, 33);
+    return clTrue;
+}
+
+static void fixtureDestroy(clContext * C)
+{
+    if (fixture.image) {
+        clImageDestroy(C, fixture.image);
+    }
+    if (fixture.composite) {
+        clImageDestroy(C, fixture.composite);
+    }
+    free(fixture.srcPixels);
+    free(fixture.dstPixels);
+    if (fixture.srgb) {
+        clProfileDestroy(C, fixture.srgb);
+        clProfileDestroy(C, fixture.pq);
+        clProfileDestroy(C, fixture.hlg);
+        clProfileDestroy(C, fixture.gamma24);
+        clLUT3DDestroy(C, fixture.lut);
+    }
+}
+
+static void printSuiteSyntax(void)
+{
+    printf("Syntax: colorist-benchmark suite [OPTIONS]\n");
+    printf("    -i,--input FILE     : Benchmark with this image (default: a synthetic image)\n");
+    printf("    -s,--string STRING  : Benchmark with a synthetic image from this image string (see colorist generate)\n");
+    printf("    -r,--repeat N       : Timed repetitions of each benchmark (default: 5)\n");
+    printf("    -w,--warmup N       : Untimed runs before the timed ones (default: 1)\n");
+    printf("    -j,--jobs N         : Measure thread scaling for 1, 2, 4 ... N jobs (default: all cores)\n");
+    printf("    -f,--filter STRING  : Only run benchmarks whose names contain STRING\n");
+    printf("    -o,--output FILE    : Write JSON here instead of stdout\n");
+}
+
+static int benchmarkSuite(clContext * C, int argc, char * argv[])
+{
+    const char * inputFilename = NULL;
+    const char * imageString = DEFAULT_SYNTHETIC_IMAGE;
+    const char * filter = NULL;
+    const char * outputFilename = NULL;
+    int repetitions = 5;
+    int warmup = 1;
+    int maxJobs = clTaskLimit();
+
+    for (int argIndex = 2; argIndex < argc; ++argIndex) {
+        const char * arg = argv[argIndex];
+        const char * value = (argIndex + 1 < argc) ? argv[argIndex + 1] : NULL;
+        if (!value) {
+            printSuiteSyntax();
+            return 1;
+        }
+        if (!strcmp(arg, "-i") || !strcmp(arg, "--input")) {
+            inputFilename = value;
+        } else if (!strcmp(arg, "-s") || !strcmp(arg, "--string")) {
+            imageString = value;
+        } else if (!strcmp(arg, "-r") || !strcmp(arg, "--repeat")) {
+            repetitions = CL_MAX(atoi(value), 1);
+        } else if (!strcmp(arg, "-w") || !strcmp(arg, "--warmup")) {
+            warmup = CL_MAX(atoi(value), 0);
+        } else if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs")) {
+            maxJobs = atoi(value);
+            if ((maxJobs <= 0) || (maxJobs > clTaskLimit())) {
+                maxJobs = clTaskLimit();
+            }
+        } else if (!strcmp(arg, "-f") || !strcmp(arg, "--filter")) {
+            filter = value;
+        } else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
+            outputFilename = value;
+        } else {
+            printSuiteSyntax();
+            return 1;
+        }
+        ++argIndex;
+    }
+
+    if (!fixtureCreate(C, inputFilename, imageString)) {
+        fixtureDestroy(C);
+        return 1;
+    }
+
+    cJSON * output = cJSON_CreateObject();
+    cJSON_AddStringToObject(output, "input", inputFilename ? inputFilename : imageString);
+    cJSON_AddNumberToObject(output, "width", fixture.image->width);
+    cJSON_AddNumberToObject(output, "height", fixture.image->height);
+    cJSON_AddNumberToObject(output, "depth", fixture.image->depth);
+    cJSON_AddNumberToObject(output, "repetitions", repetitions);
+    cJSON_AddNumberToObject(output, "warmup", warmup);
+    cJSON_AddStringToObject(output, "simd", clTransformSIMDName(C));
+    cJSON * jsonBenchmarks = cJSON_CreateArray();
+    cJSON_AddItemToObject(output, "benchmarks", jsonBenchmarks);
+
+    for (int i = 0; i < benchmarkCount; ++i) {
+        const Benchmark * benchmark = &benchmarks[i];
+        if (filter && !strstr(benchmark->name, filter)) {
+            continue;
+        }
+        if ((benchmark->func == runRead) && !inputFilename) {
+            continue;
+        }
+        if (benchmark->formatName && !clFormatExists(C, benchmark->formatName)) {
+            continue;
+        }
+
+        fprintf(stderr, "%s ...\n", benchmark->name);
+        cJSON * jsonBenchmark = cJSON_CreateObject();
+        cJSON_AddStringToObject(jsonBenchmark, "name", benchmark->name);
+        cJSON * scaling = cJSON_CreateArray();
+        clBool ok = clTrue;
+        for (int jobs = 1; jobs <= maxJobs; jobs = (jobs == maxJobs) ? (maxJobs + 1) : CL_MIN(jobs * 2, maxJobs)) {
+            cJSON * result = runBenchmark(C, benchmark, jobs, warmup, repetitions);
+            if (!result) {
+                ok = clFalse;
+                break;
+            }
+            cJSON_AddItemToArray(scaling, result);
+        }
+        cJSON_AddBoolToObject(jsonBenchmark, "ok", ok ? 1 : 0);
+        cJSON_AddItemToObject(jsonBenchmark, "threads", scaling);
+        cJSON_AddItemToArray(jsonBenchmarks, jsonBenchmark);
+    }
+
+    int returnCode = 0;
+    char * jsonString = cJSON_Print(output);
+    if (outputFilename) {
+        FILE * f = fopen(outputFilename, "wb");
+        if (f) {
+            fprintf(f, "%s\n", jsonString);
+            fclose(f);
+        } else {
+            fprintf(stderr, "ERROR: Can't open output file: %s\n", outputFilename);
+            returnCode = 1;
+        }
+    } else {
+        printf("%s\n", jsonString);
+    }
+    free(jsonString);
+    cJSON_Delete(output);
+    fixtureDestroy(C);
+    return returnCode;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2) {
+        printf("colorist-benchmark [input image filename] [optional attempts]\n");
+        printf("colorist-benchmark suite [OPTIONS] (-h for options)\n");
+        return 1;
+    }
+
+    clContextSystem silentSystem;
+    silentSystem.alloc = clContextDefaultAlloc;
+    silentSystem.free = clContextDefaultFree;
+    silentSystem.log = clContextSilentLog;
+    silentSystem.error = clContextSilentLogError;
+    clContext * C = clContextCreate(&silentSystem);
+
+    int returnCode;
+    if (!strcmp(argv[1], "suite")) {
+        returnCode = benchmarkSuite(C, argc, argv);
+    } else {
+        int attempts = 1;
+        if (argc > 2) {
+            attempts = atoi(argv[2]);
+            if (attempts < 1) {
+                attempts = 1;
+            }
+        }
+        returnCode = benchmarkRead(C, argv[1], attempts);
+    }
+
+    clContextDestroy(C);
+    return returnCode;
+}
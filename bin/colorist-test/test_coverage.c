@@ -7,6 +7,15 @@
 
 #include "main.h"
 
+#include "colorist/pixelmath.h"
+#include "colorist/transform.h"
+
+#include "lcms2.h"
+#include "stb_image_resize.h"
+
+#include <math.h>
+#include <stdio.h>
+
 // ------------------------------------------------------------------------------------------------
 // The tests in here are to attempt to hit 100% code coverage (when running scripts/coverage.sh).
 // colorist-test shouldn't have to run any other test suites but test_coverage() to achieve this.
@@ -283,6 +292,12 @@ static void test_clContextParseArgs(void)
         TEST_ASSERT_FALSE(clContextParseArgs(C, ARGS(argv)));
     }
 
+    {
+        // invalid Hald CLUT interpolation
+        const char * argv[] = { "colorist", "convert", "input.png", "output.png", "--hald-interp", "cubic" };
+        TEST_ASSERT_FALSE(clContextParseArgs(C, ARGS(argv)));
+    }
+
     {
         // test everything that requires an argument
         const char * needsArgs[] = { "-b",       "-c", "-d", "-f",          "-g", "--hald", "--iccin", "-j",    "-l",
@@ -505,6 +520,111 @@ static void test_resize(void)
     clContextDestroy(C);
 }
 
+static void resizeReference(int srcW, int srcH, float * srcPixels, int dstW, int dstH, float * dstPixels, clFilter filter)
+{
+    if (filter == CL_FILTER_NEAREST) {
+        float scaleW = (float)srcW / (float)dstW;
+        float scaleH = (float)srcH / (float)dstH;
+        for (int j = 0; j < dstH; ++j) {
+            int srcY = CL_CLAMP((int)(((float)j + 0.5f) * scaleH), 0, srcH - 1);
+            for (int i = 0; i < dstW; ++i) {
+                int srcX = CL_CLAMP((int)(((float)i + 0.5f) * scaleW), 0, srcW - 1);
+                memcpy(&dstPixels[4 * (i + (j * dstW))], &srcPixels[4 * (srcX + (srcY * srcW))], sizeof(float) * 4);
+            }
+        }
+        return;
+    }
+    stbir_resize_float_generic(srcPixels,
+                               srcW,
+                               srcH,
+                               srcW * 4 * sizeof(float),
+                               dstPixels,
+                               dstW,
+                               dstH,
+                               dstW * 4 * sizeof(float),
+                               4,
+                               3,
+                               0,
+                               STBIR_EDGE_CLAMP,
+                               (stbir_filter)filter,
+                               STBIR_COLORSPACE_LINEAR,
+                               NULL);
+}
+
+static void test_resizeExact(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // Overranged, negative and transparent pixels included
+    int srcW = 40;
+    int srcH = 32;
+    float * srcPixels = clAllocate(sizeof(float) * 4 * srcW * srcH);
+    uint32_t seed = 12345;
+    for (int i = 0; i < (4 * srcW * srcH); ++i) {
+        seed = (seed * 1103515245) + 12345;
+        srcPixels[i] = (float)((seed >> 8) % 3000) / 1000.0f - 0.5f;
+        if ((i % 4) == 3) {
+            srcPixels[i] = ((i % 7) == 0) ? 0.0f : CL_CLAMP(srcPixels[i], 0.0f, 1.0f);
+        }
+    }
+
+    // Down, up, mixed and unchanged sizes, all of them twice (the second time from C->resizeCache). Downscales
+    // stick to whole ratios, as stb_image_resize asserts on some others with CL_FILTER_BOX.
+    static const int sizes[][2] = { { 20, 8 }, { 80, 71 }, { 5, 64 }, { 40, 32 }, { 1, 1 } };
+    const int sizeCount = (int)(sizeof(sizes) / sizeof(sizes[0]));
+    float * expected = clAllocate(sizeof(float) * 4 * 80 * 71);
+    float * actual = clAllocate(sizeof(float) * 4 * 80 * 71);
+    for (int pass = 0; pass < 4; ++pass) {
+        C->jobs = (pass & 1) ? 3 : 1;
+        C->simdAllowed = (pass & 2) ? clFalse : clTrue;
+        for (int filter = CL_FILTER_AUTO; filter <= CL_FILTER_NEAREST; ++filter) {
+            for (int i = 0; i < sizeCount; ++i) {
+                int dstW = sizes[i][0];
+                int dstH = sizes[i][1];
+                resizeReference(srcW, srcH, srcPixels, dstW, dstH, expected, (clFilter)filter);
+                clPixelMathResize(C, srcW, srcH, srcPixels, dstW, dstH, actual, (clFilter)filter);
+                TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(float) * 4 * dstW * dstH);
+            }
+        }
+    }
+    C->jobs = 1;
+    C->simdAllowed = clTrue;
+
+    // Each axis is built once, then reused
+    clResizeCache * cache = C->resizeCache;
+    clResizeCacheClear(C, cache);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_MITCHELL);
+    TEST_ASSERT_EQUAL_INT(0, cache->hits);
+    TEST_ASSERT_EQUAL_INT(2, cache->misses);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_MITCHELL);
+    TEST_ASSERT_EQUAL_INT(2, cache->hits);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_TRIANGLE);
+    TEST_ASSERT_EQUAL_INT(4, cache->misses);
+    TEST_ASSERT_EQUAL_INT(4, cache->count);
+
+    // Least recently used tables are dropped first, and nothing is cached without room
+    C->resizeCache = clResizeCacheCreate(C, 2);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_MITCHELL);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_TRIANGLE);
+    TEST_ASSERT_EQUAL_INT(2, C->resizeCache->count);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_TRIANGLE);
+    TEST_ASSERT_EQUAL_INT(2, C->resizeCache->hits);
+    clResizeCacheDestroy(C, C->resizeCache);
+    C->resizeCache = clResizeCacheCreate(C, 0);
+    clPixelMathResize(C, srcW, srcH, srcPixels, 20, 8, actual, CL_FILTER_MITCHELL);
+    TEST_ASSERT_EQUAL_INT(0, C->resizeCache->count);
+    resizeReference(srcW, srcH, srcPixels, 20, 8, expected, CL_FILTER_MITCHELL);
+    TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(float) * 4 * 20 * 8);
+    clResizeCacheDestroy(C, C->resizeCache);
+    C->resizeCache = cache;
+
+    clFree(expected);
+    clFree(actual);
+    clFree(srcPixels);
+    clContextDestroy(C);
+}
+
 static void test_clTask(void)
 {
     clContext * C = clContextCreate(&silentSystem);
@@ -538,6 +658,1611 @@ static void test_clTask(void)
     clContextDestroy(C);
 }
 
+static void taskPoolSumFunc(void * userData, int start, int count)
+{
+    int * values = (int *)userData;
+    for (int i = start; i < (start + count); ++i) {
+        values[i] += i;
+    }
+}
+
+static void test_clTaskPool(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    const int valueCount = 10000;
+    int * values = clAllocate(sizeof(int) * valueCount);
+
+    // Run twice to reuse the pool, then shrink -j to force it to be rebuilt
+    C->jobs = 4;
+    clTaskParallelFor(C, valueCount, 1, taskPoolSumFunc, values);
+    clTaskParallelFor(C, valueCount, 1, taskPoolSumFunc, values);
+    TEST_ASSERT_NOT_NULL(C->taskPool);
+    C->jobs = 2;
+    clTaskParallelFor(C, valueCount, 1, taskPoolSumFunc, values);
+    TEST_ASSERT_EQUAL_INT(1, C->taskPool->workerCount);
+
+    // Single job runs inline
+    C->jobs = 1;
+    clTaskParallelFor(C, valueCount, 1, taskPoolSumFunc, values);
+
+    for (int i = 0; i < valueCount; ++i) {
+        TEST_ASSERT_EQUAL_INT(i * 4, values[i]);
+    }
+
+    clFree(values);
+    clContextDestroy(C);
+}
+
+// Runs the same pixels through the SIMD and scalar CCMM paths and compares them
+static void transformSIMDCompare(clContext * C, clProfile * srcProfile, clProfile * dstProfile, clTransformFormat dstFormat, clTonemap tonemap)
+{
+    const int steps = 24;
+    const int pixelCount = steps * steps * steps;
+    int dstChannelCount = (dstFormat == CL_XF_RGBA) ? 4 : 3;
+    float * srcPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float * simdPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float * scalarPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float maxError = 0.0f;
+    float totalError = 0.0f;
+
+    for (int i = 0; i < pixelCount; ++i) {
+        srcPixels[(i * 4) + 0] = (float)(i % steps) / (steps - 1);
+        srcPixels[(i * 4) + 1] = (float)((i / steps) % steps) / (steps - 1);
+        srcPixels[(i * 4) + 2] = (float)(i / (steps * steps)) / (steps - 1);
+        srcPixels[(i * 4) + 3] = 1.0f;
+    }
+
+    clTransform * transform = clTransformCreate(C, srcProfile, CL_XF_RGBA, dstProfile, dstFormat, tonemap);
+    C->simdAllowed = clTrue;
+    clTransformRun(C, transform, srcPixels, simdPixels, pixelCount);
+    C->simdAllowed = clFalse;
+    clTransformRun(C, transform, srcPixels, scalarPixels, pixelCount);
+    C->simdAllowed = clTrue;
+    clTransformDestroy(C, transform);
+
+    for (int i = 0; i < (pixelCount * dstChannelCount); ++i) {
+        float error = fabsf(simdPixels[i] - scalarPixels[i]);
+        if (scalarPixels[i] > 1.0f) {
+            error /= scalarPixels[i]; // relative, for XYZ
+        }
+        maxError = CL_MAX(maxError, error);
+        totalError += error;
+    }
+
+    // The curve approximations themselves are well under 1 LSB at 16-bit. Isolated larger
+    // differences come from channels that land on ~0 after the matrix math (either path may produce
+    // 0 or a tiny positive value), where the gamma and HLG curves are nearly vertical.
+    TEST_ASSERT_FLOAT_WITHIN(0.5f / 65535.0f, 0.0f, totalError / (pixelCount * dstChannelCount));
+    TEST_ASSERT_FLOAT_WITHIN(1.0f / 255.0f, 0.0f, maxError);
+
+    clFree(srcPixels);
+    clFree(simdPixels);
+    clFree(scalarPixels);
+}
+
+// A BT.2020 profile with the given curve, which most of the HDR tests below convert to and from
+static clProfile * createBT2020Profile(clContext * C,
+                                       clProfileCurveType curveType,
+                                       float gamma,
+                                       int maxLuminance,
+                                       const char * description)
+{
+    clProfilePrimaries bt2020;
+    clProfileCurve curve;
+    TEST_ASSERT_TRUE(clContextGetStockPrimaries(C, "bt2020", &bt2020));
+    curve.type = curveType;
+    curve.implicitScale = 1.0f;
+    curve.gamma = gamma;
+    return clProfileCreate(C, &bt2020, &curve, maxLuminance, description);
+}
+
+static void test_transformSIMD(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * sRGB = clProfileCreateStock(C, CL_PS_SRGB);
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+    clProfile * hlg = createBT2020Profile(C, CL_PCT_HLG, 1.0f, CL_LUMINANCE_UNSPECIFIED, NULL);
+    clProfile * gamma24 = createBT2020Profile(C, CL_PCT_GAMMA, 2.4f, 300, NULL);
+
+    clContextLog(C, "simd", 0, "SIMD: %s", clTransformSIMDName(C));
+    transformSIMDCompare(C, sRGB, pq, CL_XF_RGBA, CL_TONEMAP_AUTO);
+    transformSIMDCompare(C, pq, sRGB, CL_XF_RGBA, CL_TONEMAP_ON);
+    transformSIMDCompare(C, hlg, gamma24, CL_XF_RGBA, CL_TONEMAP_AUTO);
+    transformSIMDCompare(C, gamma24, hlg, CL_XF_RGB, CL_TONEMAP_OFF);
+    transformSIMDCompare(C, sRGB, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
+
+    clProfileDestroy(C, sRGB);
+    clProfileDestroy(C, pq);
+    clProfileDestroy(C, hlg);
+    clProfileDestroy(C, gamma24);
+    clContextDestroy(C);
+}
+
+static void test_pixelPool(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    clPixelPoolClear(C, C->pixelPool);
+
+    // Same size class: recycled, aligned, and only zeroed on request
+    uint8_t * first = clPixelPoolAllocate(C, 1000000, clFalse);
+    TEST_ASSERT_EQUAL_INT(0, (int)((uintptr_t)first % 64));
+    memset(first, 0xab, 1000000);
+    clPixelPoolFree(C, first);
+    uint8_t * second = clPixelPoolAllocate(C, 999000, clFalse);
+    TEST_ASSERT_EQUAL_PTR(first, second);
+    TEST_ASSERT_EQUAL_UINT8(0xab, second[998999]);
+    clPixelPoolFree(C, second);
+    second = clPixelPoolAllocate(C, 999000, clTrue);
+    TEST_ASSERT_EQUAL_PTR(first, second);
+    TEST_ASSERT_EQUAL_UINT8(0, second[0]);
+    TEST_ASSERT_EQUAL_UINT8(0, second[998999]);
+
+    // Different size class, and buffers too small to pool
+    uint8_t * larger = clPixelPoolAllocate(C, 4000000, clFalse);
+    TEST_ASSERT_TRUE(larger != second);
+    uint8_t * small = clPixelPoolAllocate(C, 100, clFalse);
+    TEST_ASSERT_EQUAL_INT(0, (int)((uintptr_t)small % 64));
+    clPixelPoolFree(C, small);
+    clPixelPoolFree(C, larger);
+    clPixelPoolFree(C, second);
+    clPixelPoolFree(C, NULL);
+
+    int allocations, reuses;
+    clPixelPoolGetStats(C, &allocations, &reuses);
+    TEST_ASSERT_EQUAL_INT(5, allocations);
+    TEST_ASSERT_EQUAL_INT(2, reuses);
+
+    // Stages of a conversion recycle each other's buffers
+    clImage * image = clImageCreate(C, 256, 256, 16, NULL);
+    clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
+    clImage * rotated = clImageRotate(C, image, 1);
+    clImageDestroy(C, image);
+    clImage * cropped = clImageCrop(C, rotated, 0, 0, 256, 256, clFalse);
+    clImageDestroy(C, cropped);
+    clPixelPoolGetStats(C, &allocations, &reuses);
+    TEST_ASSERT_EQUAL_INT(8, allocations);
+    TEST_ASSERT_EQUAL_INT(3, reuses); // the crop takes over the source's pixels
+
+    // Nothing is kept without a budget
+    clPixelPoolClear(C, C->pixelPool);
+    C->pixelPool->budget = 0;
+    first = clPixelPoolAllocate(C, 1000000, clFalse);
+    clPixelPoolFree(C, first);
+    TEST_ASSERT_EQUAL_INT(0, (int)C->pixelPool->idleBytes);
+    clPixelPoolGetStats(C, &allocations, &reuses);
+    TEST_ASSERT_EQUAL_INT(0, reuses);
+
+    clContextDestroy(C);
+}
+
+static void test_trace(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // Without a trace, spans and counters are free no-ops
+    clTraceSpan span;
+    clTraceBegin(C, &span, "untraced");
+    clTraceEnd(C, &span);
+    clTraceCount(C, CL_TRACE_BYTES_READ, 1);
+    TEST_ASSERT_FALSE(clTraceWriteChrome(C, "test_trace.json"));
+
+    C->trace = clTraceCreate(C);
+    C->jobs = 2;
+    clImage * image = clImageCreate(C, 128, 64, 8, NULL);
+    clImage * resized = clImageResize(C, image, 64, 32, CL_FILTER_BOX);
+    clImageDestroy(C, resized);
+    clTraceCount(C, CL_TRACE_BYTES_READ, 10);
+    clTraceCount(C, CL_TRACE_BYTES_READ, 5);
+
+    int resizeSpans = 0;
+    for (int i = 0; i < C->trace->eventCount; ++i) {
+        clTraceEvent * event = &C->trace->events[i];
+        TEST_ASSERT_TRUE(event->duration >= 0.0);
+        TEST_ASSERT_TRUE((event->thread >= 0) && (event->thread < C->trace->threadCount));
+        if (!strcmp(event->name, "resize")) {
+            ++resizeSpans;
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(1, resizeSpans);
+
+    struct cJSON * jsonOutput = cJSON_CreateObject();
+    clTraceSummarize(C, jsonOutput);
+    struct cJSON * summary = cJSON_GetObjectItem(jsonOutput, "trace");
+    TEST_ASSERT_NOT_NULL(summary);
+    TEST_ASSERT_NOT_NULL(cJSON_GetObjectItem(cJSON_GetObjectItem(summary, "spans"), "resize"));
+    TEST_ASSERT_TRUE(cJSON_GetArraySize(cJSON_GetObjectItem(summary, "threads")) > 0);
+    TEST_ASSERT_EQUAL_INT(15, cJSON_GetObjectItem(cJSON_GetObjectItem(summary, "counters"), "bytesRead")->valueint);
+    cJSON_Delete(jsonOutput);
+
+    TEST_ASSERT_TRUE(clTraceWriteChrome(C, "test_trace.json"));
+    TEST_ASSERT_TRUE(clFileSize("test_trace.json") > 0);
+    remove("test_trace.json");
+
+    clImageDestroy(C, image);
+    clContextDestroy(C);
+}
+
+static void test_pixelConvert(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 4;
+
+    // Odd enough to leave SIMD tails and uneven thread chunks
+    const int pixelCount = 40001;
+    const int channelCount = pixelCount * CL_CHANNELS_PER_PIXEL;
+    const float specialValues[] = { -0.0f, -0.2f, -1e-7f, 1.5f, 70000.0f, 1e20f, -1e20f, INFINITY, -INFINITY, NAN };
+    const int specialValueCount = sizeof(specialValues) / sizeof(specialValues[0]);
+    void * srcPixels[CL_PIXELFORMAT_COUNT];
+    uint8_t * scalarPixels = clAllocate(channelCount * sizeof(float));
+    uint8_t * simdPixels = clAllocate(channelCount * sizeof(float));
+
+    uint8_t * u8 = clAllocate(channelCount * sizeof(uint8_t));
+    uint16_t * u16 = clAllocate(channelCount * sizeof(uint16_t));
+    float * f32 = clAllocate(channelCount * sizeof(float));
+    for (int i = 0; i < channelCount; ++i) {
+        u8[i] = (uint8_t)((i * 7) % 256);
+        u16[i] = (uint16_t)((i * 7919) % 65536);
+        if ((i % 97) == 0) {
+            f32[i] = specialValues[(i / 97) % specialValueCount];
+        } else {
+            f32[i] = (float)((i * 7919) % 30011) / 20000.0f - 0.1f; // includes overranged colors
+        }
+    }
+    srcPixels[CL_PIXELFORMAT_U8] = u8;
+    srcPixels[CL_PIXELFORMAT_U16] = u16;
+    srcPixels[CL_PIXELFORMAT_F32] = f32;
+
+    const uint32_t maxChannels[] = { 1023, 65535 };
+    for (int m = 0; m < 2; ++m) {
+        for (clPixelFormat srcFormat = CL_PIXELFORMAT_FIRST; srcFormat != CL_PIXELFORMAT_COUNT; ++srcFormat) {
+            for (clPixelFormat dstFormat = CL_PIXELFORMAT_FIRST; dstFormat != CL_PIXELFORMAT_COUNT; ++dstFormat) {
+                if (srcFormat == dstFormat) {
+                    continue;
+                }
+                C->simdAllowed = clFalse;
+                clPixelMathConvertPixels(C, srcFormat, srcPixels[srcFormat], dstFormat, scalarPixels, maxChannels[m], pixelCount);
+                C->simdAllowed = clTrue;
+                clPixelMathConvertPixels(C, srcFormat, srcPixels[srcFormat], dstFormat, simdPixels, maxChannels[m], pixelCount);
+                TEST_ASSERT_EQUAL_MEMORY(scalarPixels, simdPixels, pixelCount * CL_BYTES_PER_PIXEL(dstFormat));
+            }
+        }
+    }
+
+    // Spot check the scalar results against the original rounding
+    C->simdAllowed = clFalse;
+    clPixelMathConvertPixels(C, CL_PIXELFORMAT_F32, f32, CL_PIXELFORMAT_U16, scalarPixels, 1023, pixelCount);
+    for (int i = 0; i < pixelCount; i += 101) {
+        const float * src = &f32[i * CL_CHANNELS_PER_PIXEL];
+        const uint16_t * dst = &((const uint16_t *)scalarPixels)[i * CL_CHANNELS_PER_PIXEL];
+        float largestChannel = 1.0f;
+        largestChannel = CL_MAX(largestChannel, src[0]);
+        largestChannel = CL_MAX(largestChannel, src[1]);
+        largestChannel = CL_MAX(largestChannel, src[2]);
+        TEST_ASSERT_EQUAL_UINT16(clPixelMathRoundUNorm(src[1] / largestChannel, 1023), dst[1]);
+        TEST_ASSERT_EQUAL_UINT16(clPixelMathRoundUNorm(src[3], 1023), dst[3]);
+    }
+
+    clFree(u8);
+    clFree(u16);
+    clFree(f32);
+    clFree(scalarPixels);
+    clFree(simdPixels);
+    clContextDestroy(C);
+}
+
+static void transformLUTCompare(clContext * C, clProfile * srcProfile, clProfile * dstProfile, clTonemap tonemap)
+{
+    const int depth = 10;
+    const int maxChannel = (1 << depth) - 1;
+    const int pixelCount = 1 << 15;
+    float * srcPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float * exactPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float * lutPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float maxError = 0.0f;
+
+    for (int i = 0; i < pixelCount; ++i) {
+        srcPixels[(i * 4) + 0] = (float)(i % (maxChannel + 1)) / (float)maxChannel;
+        srcPixels[(i * 4) + 1] = (float)((i * 37) % (maxChannel + 1)) / (float)maxChannel;
+        srcPixels[(i * 4) + 2] = (float)((i * 101) % (maxChannel + 1)) / (float)maxChannel;
+        srcPixels[(i * 4) + 3] = 1.0f;
+    }
+
+    C->simdAllowed = clFalse;
+    clTransform * exact = clTransformCreate(C, srcProfile, CL_XF_RGBA, dstProfile, CL_XF_RGBA, tonemap);
+    clTransformRun(C, exact, srcPixels, exactPixels, pixelCount);
+    clTransformDestroy(C, exact);
+
+    clTransform * lut = clTransformCreate(C, srcProfile, CL_XF_RGBA, dstProfile, CL_XF_RGBA, tonemap);
+    clTransformSetSourceDepth(C, lut, depth);
+    clTransformRun(C, lut, srcPixels, lutPixels, pixelCount);
+    TEST_ASSERT_NOT_NULL(lut->lutSrcEOTF);
+    TEST_ASSERT_NOT_NULL(lut->lutDstOETF);
+    TEST_ASSERT_FLOAT_WITHIN(0.1f / 65535.0f, 0.0f, lut->lutDstOETFMaxError);
+    clTransformDestroy(C, lut);
+    C->simdAllowed = clTrue;
+
+    for (int i = 0; i < (pixelCount * 4); ++i) {
+        maxError = CL_MAX(maxError, fabsf(lutPixels[i] - exactPixels[i]));
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.5f / 65535.0f, 0.0f, maxError);
+
+    clFree(srcPixels);
+    clFree(exactPixels);
+    clFree(lutPixels);
+}
+
+static void test_transformLUT(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * sRGB = clProfileCreateStock(C, CL_PS_SRGB);
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+    clProfile * hlg = createBT2020Profile(C, CL_PCT_HLG, 1.0f, CL_LUMINANCE_UNSPECIFIED, NULL);
+
+    transformLUTCompare(C, sRGB, pq, CL_TONEMAP_AUTO);
+    transformLUTCompare(C, pq, sRGB, CL_TONEMAP_ON);
+    transformLUTCompare(C, hlg, sRGB, CL_TONEMAP_AUTO);
+    transformLUTCompare(C, sRGB, hlg, CL_TONEMAP_OFF);
+
+    clProfileDestroy(C, sRGB);
+    clProfileDestroy(C, pq);
+    clProfileDestroy(C, hlg);
+    clContextDestroy(C);
+}
+
+static void test_transformInteger(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * sRGB = clProfileCreateStock(C, CL_PS_SRGB);
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+
+    // 10-bit PQ -> 8-bit sRGB, compared against the F32 path quantized by clImagePrepareReadPixels()
+    clImage * srcImage = clImageCreate(C, 64, 64, 10, pq);
+    clImage * floatImage = clImageCreate(C, 64, 64, 8, sRGB);
+    clImage * integerImage = clImageCreate(C, 64, 64, 8, sRGB);
+    int pixelCount = srcImage->width * srcImage->height;
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U16);
+    for (int i = 0; i < (pixelCount * CL_CHANNELS_PER_PIXEL); ++i) {
+        srcImage->pixelsU16[i] = (uint16_t)((i * 37) % 1024);
+    }
+
+    clTransform * transform = clTransformCreate(C, pq, CL_XF_RGBA, sRGB, CL_XF_RGBA, CL_TONEMAP_ON);
+    clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_F32);
+    clImagePrepareWritePixels(C, floatImage, CL_PIXELFORMAT_F32);
+    clTransformRun(C, transform, srcImage->pixelsF32, floatImage->pixelsF32, pixelCount);
+    clImagePrepareReadPixels(C, floatImage, CL_PIXELFORMAT_U8);
+
+    clImagePrepareWritePixels(C, integerImage, CL_PIXELFORMAT_U8);
+    clTransformRunInteger(C, transform, CL_PIXELFORMAT_U16, 10, srcImage->pixelsU16, CL_PIXELFORMAT_U8, 8, integerImage->pixelsU8, pixelCount);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(floatImage->pixelsU8, integerImage->pixelsU8, pixelCount * CL_CHANNELS_PER_PIXEL);
+    clTransformDestroy(C, transform);
+
+    clImageDestroy(C, srcImage);
+    clImageDestroy(C, floatImage);
+    clImageDestroy(C, integerImage);
+    clProfileDestroy(C, sRGB);
+    clProfileDestroy(C, pq);
+    clContextDestroy(C);
+}
+
+static void transformLCMSCompare(clContext * C, clProfile * srcProfile, clProfile * dstProfile, clTonemap tonemap, clBool expectScaling)
+{
+    const int pixelCount = 3000; // a few LittleCMS tiles, plus a partial one
+    float * srcPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float * ccmmPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    float * lcmsPixels = clAllocate(sizeof(float) * 4 * pixelCount);
+    for (int i = 0; i < pixelCount; ++i) {
+        srcPixels[(i * 4) + 0] = (float)(i % 17) / 16.0f;
+        srcPixels[(i * 4) + 1] = (float)(i % 29) / 28.0f;
+        srcPixels[(i * 4) + 2] = (float)(i % 7) / 6.0f;
+        srcPixels[(i * 4) + 3] = (float)(i % 101) / 100.0f;
+    }
+
+    clTransform * ccmm = clTransformCreate(C, srcProfile, CL_XF_RGBA, dstProfile, CL_XF_RGBA, tonemap);
+    clTransformRun(C, ccmm, srcPixels, ccmmPixels, pixelCount);
+    clTransformDestroy(C, ccmm);
+
+    C->ccmmAllowed = clFalse;
+    clTransform * lcms = clTransformCreate(C, srcProfile, CL_XF_RGBA, dstProfile, CL_XF_RGBA, tonemap);
+    clTransformRun(C, lcms, srcPixels, lcmsPixels, pixelCount);
+    TEST_ASSERT_EQUAL_INT(expectScaling, lcms->luminanceScaleEnabled);
+    clTransformDestroy(C, lcms);
+    C->ccmmAllowed = clTrue;
+
+    for (int i = 0; i < pixelCount; ++i) {
+        TEST_ASSERT_FLOAT_WITHIN(0.002f, ccmmPixels[(i * 4) + 0], lcmsPixels[(i * 4) + 0]);
+        TEST_ASSERT_FLOAT_WITHIN(0.002f, ccmmPixels[(i * 4) + 1], lcmsPixels[(i * 4) + 1]);
+        TEST_ASSERT_FLOAT_WITHIN(0.002f, ccmmPixels[(i * 4) + 2], lcmsPixels[(i * 4) + 2]);
+        TEST_ASSERT_EQUAL_FLOAT(srcPixels[(i * 4) + 3], lcmsPixels[(i * 4) + 3]);
+    }
+
+    clFree(srcPixels);
+    clFree(ccmmPixels);
+    clFree(lcmsPixels);
+}
+
+static void test_transformLCMS(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * sRGB = clProfileCreateStock(C, CL_PS_SRGB);
+    clProfile * sameLuminance = createBT2020Profile(C, CL_PCT_GAMMA, 2.4f, 80, "BT2020 80");
+    clProfile * brighter = createBT2020Profile(C, CL_PCT_GAMMA, 2.4f, 300, "BT2020 300");
+
+    // Matching luminances use the combined LittleCMS transform, otherwise src -> XYZ -> scale -> dst
+    transformLCMSCompare(C, sRGB, sameLuminance, CL_TONEMAP_AUTO, clFalse);
+    transformLCMSCompare(C, sRGB, brighter, CL_TONEMAP_AUTO, clTrue);
+    transformLCMSCompare(C, brighter, sRGB, CL_TONEMAP_ON, clTrue);
+
+    clProfileDestroy(C, sRGB);
+    clProfileDestroy(C, sameLuminance);
+    clProfileDestroy(C, brighter);
+    clContextDestroy(C);
+}
+
+static void transformCacheRun(clContext * C, clProfile * srcProfile, clProfile * dstProfile, clTonemap tonemap, float dstPixel[4])
+{
+    float srcPixel[4] = { 0.25f, 0.5f, 1.0f, 1.0f };
+    clTransform * transform = clTransformCreate(C, srcProfile, CL_XF_RGBA, dstProfile, CL_XF_RGBA, tonemap);
+    clTransformRun(C, transform, srcPixel, dstPixel, 1);
+    clTransformDestroy(C, transform);
+}
+
+static void test_transformCache(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+    clProfile * sRGB = clProfileCreateStock(C, CL_PS_SRGB);
+    clProfile * sRGBClone = clProfileClone(C, sRGB);
+    clTransformCache * cache = C->transformCache;
+    clTransformCacheClear(C, cache);
+
+    // Identical profiles (by signature) reuse the prepared transform, and produce identical results
+    float first[4], second[4], third[4];
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_AUTO, first);
+    TEST_ASSERT_EQUAL_INT(0, cache->hits);
+    TEST_ASSERT_EQUAL_INT(1, cache->misses);
+    TEST_ASSERT_EQUAL_INT(1, cache->count);
+    transformCacheRun(C, pq, sRGBClone, CL_TONEMAP_AUTO, second);
+    TEST_ASSERT_EQUAL_INT(1, cache->hits);
+    TEST_ASSERT_EQUAL_INT(1, cache->count);
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(first, second, 4);
+
+    // Anything that changes the prepared state doesn't
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_OFF, third);
+    TEST_ASSERT_EQUAL_INT(2, cache->misses);
+    C->ccmmAllowed = clFalse;
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_AUTO, third);
+    TEST_ASSERT_EQUAL_INT(3, cache->misses);
+    C->ccmmAllowed = clTrue;
+    TEST_ASSERT_EQUAL_INT(3, cache->count);
+
+    // Least recently used entries are dropped first
+    C->transformCache = clTransformCacheCreate(C, 2);
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_AUTO, third);
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_OFF, third);
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_AUTO, third);
+    transformCacheRun(C, sRGB, pq, CL_TONEMAP_AUTO, third);
+    TEST_ASSERT_EQUAL_INT(2, C->transformCache->count);
+    TEST_ASSERT_EQUAL_INT(1, C->transformCache->hits);
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_AUTO, third);
+    TEST_ASSERT_EQUAL_INT(2, C->transformCache->hits);
+    transformCacheRun(C, pq, sRGB, CL_TONEMAP_OFF, third);
+    TEST_ASSERT_EQUAL_INT(2, C->transformCache->hits);
+    clTransformCacheDestroy(C, C->transformCache);
+    C->transformCache = cache;
+
+    clProfileDestroy(C, pq);
+    clProfileDestroy(C, sRGB);
+    clProfileDestroy(C, sRGBClone);
+    clContextDestroy(C);
+}
+
+static void test_streamConvert(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+
+    // Wide enough that a 1MB budget needs several strips
+    clImage * srcImage = clImageCreate(C, 2048, 64, 16, pq);
+    int pixelCount = srcImage->width * srcImage->height;
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U16);
+    for (int i = 0; i < (pixelCount * CL_CHANNELS_PER_PIXEL); ++i) {
+        srcImage->pixelsU16[i] = (uint16_t)(((uint32_t)i * 4099) % 65536);
+    }
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_stream_src.png", NULL, &writeParams));
+
+    // Crop and tonemap (auto, which measures the source in an extra pass) to SDR, both ways
+    C->inputFilename = "test_stream_src.png";
+    C->params.rect[0] = 7;
+    C->params.rect[1] = 5;
+    C->params.rect[2] = 2000;
+    C->params.rect[3] = 50;
+    TEST_ASSERT_TRUE(clContextGetRawStockPrimaries(C, "bt709", C->params.primaries));
+    C->params.curveType = CL_PCT_GAMMA;
+    C->params.gamma = 2.2f;
+    C->params.luminance = 300;
+    C->outputFilename = "test_stream_whole.png";
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    C->params.streamBudget = 1;
+    C->outputFilename = "test_stream_strips.png";
+    C->trace = clTraceCreate(C);
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+
+    // The streamed conversion still gets its top-level convert span, around the strips' own spans
+    int convertSpans = 0;
+    int stripSpans = 0;
+    for (int i = 0; i < C->trace->eventCount; ++i) {
+        if (!strcmp(C->trace->events[i].name, "convert")) {
+            ++convertSpans;
+        } else if (!strcmp(C->trace->events[i].name, "convert strip")) {
+            ++stripSpans;
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(1, convertSpans);
+    TEST_ASSERT_TRUE(stripSpans > 1);
+
+    clImage * wholeImage = clContextRead(C, "test_stream_whole.png", NULL, NULL);
+    clImage * stripsImage = clContextRead(C, "test_stream_strips.png", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(wholeImage);
+    TEST_ASSERT_NOT_NULL(stripsImage);
+    TEST_ASSERT_EQUAL_INT(2000, stripsImage->width);
+    TEST_ASSERT_EQUAL_INT(50, stripsImage->height);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(wholeImage->pixelsU16, stripsImage->pixelsU16, 2000 * 50 * CL_CHANNELS_PER_PIXEL);
+
+    clImageDestroy(C, srcImage);
+    clImageDestroy(C, wholeImage);
+    clImageDestroy(C, stripsImage);
+    clProfileDestroy(C, pq);
+    clContextDestroy(C);
+    remove("test_stream_src.png");
+    remove("test_stream_whole.png");
+    remove("test_stream_strips.png");
+}
+
+static void test_pipeline(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+    clProfile * sRGB = clProfileCreateStock(C, CL_PS_SRGB);
+
+    clImage * srcImage = clImageCreate(C, 70, 50, 10, pq);
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U16);
+    for (int i = 0; i < (srcImage->width * srcImage->height * CL_CHANNELS_PER_PIXEL); ++i) {
+        srcImage->pixelsU16[i] = (uint16_t)((i * 37) % 1024);
+    }
+
+    // A 4x4x4 Hald CLUT that rotates the channels
+    clImage * hald = clImageCreate(C, 8, 8, 32, NULL);
+    clImagePrepareWritePixels(C, hald, CL_PIXELFORMAT_F32);
+    for (int i = 0; i < 64; ++i) {
+        float * pixel = &hald->pixelsF32[i * CL_CHANNELS_PER_PIXEL];
+        setFloat4(pixel, (float)((i / 4) % 4) / 3.0f, (float)(i / 16) / 3.0f, (float)(i % 4) / 3.0f, 1.0f);
+    }
+
+    clImage * compositeImage = clImageParseString(C, "20x10,#ff000080", 8, NULL);
+    clBlendParams blendParams;
+    clBlendParamsSetDefaults(C, &blendParams);
+    blendParams.offsetX = 50;
+    blendParams.offsetY = 3;
+
+    // Crop -> convert -> composite -> HALD -> rotate, one pass at a time
+    int rect[4] = { 7, 5, 60, 40 };
+    clImage * croppedImage = clImageCrop(C, srcImage, rect[0], rect[1], rect[2], rect[3], clTrue);
+    clImage * convertedImage = clImageConvert(C, croppedImage, 32, sRGB, CL_TONEMAP_ON, NULL);
+    clImage * blendedImage = clImageBlend(C, convertedImage, compositeImage, &blendParams);
+    clLUT3D * lut = clLUT3DCreateHALD(C, hald, 4);
+    clImage * appliedImage = clImageApplyLUT3D(C, blendedImage, lut);
+    clImage * expectedImage = clImageRotate(C, appliedImage, 1);
+    int pixelCount = expectedImage->width * expectedImage->height;
+
+    // The same thing, fused
+    clPipeline * pipeline = clPipelineCreate(C);
+    TEST_ASSERT_TRUE(clPipelineAddBlend(C, pipeline, sRGB, compositeImage, &blendParams));
+    clPipelineAddLUT3D(C, pipeline, lut);
+    pipeline->rotate = 1;
+    clImage * fusedImage = clImageConvertPipeline(C, srcImage, rect, 32, sRGB, CL_TONEMAP_ON, NULL, pipeline);
+    TEST_ASSERT_EQUAL_INT(40, fusedImage->width);
+    TEST_ASSERT_EQUAL_INT(60, fusedImage->height);
+    TEST_ASSERT_NULL(fusedImage->pixelsU16);
+    TEST_ASSERT_EQUAL_FLOAT_ARRAY(expectedImage->pixelsF32, fusedImage->pixelsF32, pixelCount * CL_CHANNELS_PER_PIXEL);
+
+    // Integer dsts are quantized once, straight from the fused pass. Like the unfused steps (which blend and look up
+    // clImageConvert()'s float output), the stages see unquantized colors, so only the final pixels are rounded.
+    clImage * fusedImage16 = clImageConvertPipeline(C, srcImage, rect, 16, sRGB, CL_TONEMAP_ON, NULL, pipeline);
+    TEST_ASSERT_NULL(fusedImage16->pixelsF32);
+    expectedImage->depth = 16;
+    clImagePrepareReadPixels(C, expectedImage, CL_PIXELFORMAT_U16);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(expectedImage->pixelsU16, fusedImage16->pixelsU16, pixelCount * CL_CHANNELS_PER_PIXEL);
+    clImage * fusedImage8 = clImageConvertPipeline(C, srcImage, rect, 8, sRGB, CL_TONEMAP_ON, NULL, pipeline);
+    TEST_ASSERT_NULL(fusedImage8->pixelsF32);
+    expectedImage->depth = 8;
+    clImagePrepareReadPixels(C, expectedImage, CL_PIXELFORMAT_U8);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expectedImage->pixelsU8, fusedImage8->pixelsU8, pixelCount * CL_CHANNELS_PER_PIXEL);
+    clPipelineDestroy(C, pipeline);
+
+    // Every other rotation
+    for (int rotate = 0; rotate < 4; ++rotate) {
+        clImage * rotatedImage = clImageRotate(C, convertedImage, rotate);
+        pipeline = clPipelineCreate(C);
+        pipeline->rotate = rotate;
+        clImage * fusedRotatedImage = clImageConvertPipeline(C, srcImage, rect, 32, sRGB, CL_TONEMAP_ON, NULL, pipeline);
+        TEST_ASSERT_EQUAL_INT(rotatedImage->width, fusedRotatedImage->width);
+        TEST_ASSERT_EQUAL_FLOAT_ARRAY(rotatedImage->pixelsF32, fusedRotatedImage->pixelsF32, pixelCount * CL_CHANNELS_PER_PIXEL);
+        clImageDestroy(C, rotatedImage);
+        clImageDestroy(C, fusedRotatedImage);
+        clPipelineDestroy(C, pipeline);
+    }
+
+    clImageDestroy(C, srcImage);
+    clImageDestroy(C, hald);
+    clLUT3DDestroy(C, lut);
+    clImageDestroy(C, compositeImage);
+    clImageDestroy(C, croppedImage);
+    clImageDestroy(C, convertedImage);
+    clImageDestroy(C, blendedImage);
+    clImageDestroy(C, appliedImage);
+    clImageDestroy(C, expectedImage);
+    clImageDestroy(C, fusedImage);
+    clImageDestroy(C, fusedImage16);
+    clImageDestroy(C, fusedImage8);
+    clProfileDestroy(C, pq);
+    clProfileDestroy(C, sRGB);
+    clContextDestroy(C);
+}
+
+static int batchConvertLogs = 0;
+static int batchErrorLogs = 0;
+
+static void batchCountingLog(clContext * C, const char * section, int indent, const char * format, va_list args)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(section);
+    COLORIST_UNUSED(indent);
+    char line[256];
+    vsnprintf(line, sizeof(line), format, args);
+    if (!strncmp(line, "Convert [", 9)) {
+        ++batchConvertLogs;
+    }
+}
+
+static void batchCountingLogError(clContext * C, const char * format, va_list args)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(format);
+    COLORIST_UNUSED(args);
+    ++batchErrorLogs;
+}
+
+static void test_batch(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    const char * srcFilenames[3] = { "test_batch_a.png", "test_batch_b.png", "test_batch_c.png" };
+    for (int f = 0; f < 3; ++f) {
+        clImage * srcImage = clImageCreate(C, 64, 48, 16, NULL);
+        int pixelCount = srcImage->width * srcImage->height;
+        clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U16);
+        for (int i = 0; i < (pixelCount * CL_CHANNELS_PER_PIXEL); ++i) {
+            srcImage->pixelsU16[i] = (uint16_t)((i * (4099 + f)) % 65536);
+        }
+        TEST_ASSERT_TRUE(clContextWrite(C, srcImage, srcFilenames[f], NULL, &writeParams));
+        clImageDestroy(C, srcImage);
+    }
+
+    // Templated outputs, an explicit output, and one missing input
+    FILE * manifest = fopen("test_batch.txt", "w");
+    TEST_ASSERT_NOT_NULL(manifest);
+    fprintf(manifest, "# comment\n\ntest_batch_a.png\ntest_batch_b.png\r\ntest_batch_c.png\ttest_batch_explicit.png\ntest_batch_missing.png\n");
+    fclose(manifest);
+
+    C->jobs = 4;
+    C->inputFilename = "test_batch.txt";
+    C->outputFilename = "test_batch_out_%s.png";
+    C->params.gamma = 2.2f;
+    C->params.luminance = 300;
+    struct cJSON * jsonOutput = cJSON_CreateObject();
+    C->system.log = batchCountingLog;
+    C->system.error = batchCountingLogError;
+    TEST_ASSERT_EQUAL_INT(1, clContextBatch(C, jsonOutput));
+    C->system.log = silentSystem.log;
+    C->system.error = silentSystem.error;
+    TEST_ASSERT_EQUAL_INT(4, batchConvertLogs); // every file's own log reaches the batch's context
+    TEST_ASSERT_TRUE(batchErrorLogs > 0);
+    TEST_ASSERT_EQUAL_INT(4, cJSON_GetObjectItem(jsonOutput, "fileCount")->valueint);
+    TEST_ASSERT_EQUAL_INT(1, cJSON_GetObjectItem(jsonOutput, "failureCount")->valueint);
+    TEST_ASSERT_EQUAL_INT(2, cJSON_GetObjectItem(jsonOutput, "profileCacheHits")->valueint);
+    cJSON * jsonFiles = cJSON_GetObjectItem(jsonOutput, "files");
+    TEST_ASSERT_EQUAL_INT(4, cJSON_GetArraySize(jsonFiles));
+    TEST_ASSERT_EQUAL_STRING("test_batch_out_test_batch_b.png", cJSON_GetObjectItem(cJSON_GetArrayItem(jsonFiles, 1), "output")->valuestring);
+    TEST_ASSERT_TRUE(cJSON_IsTrue(cJSON_GetObjectItem(cJSON_GetArrayItem(jsonFiles, 2), "ok")));
+    TEST_ASSERT_TRUE(cJSON_IsFalse(cJSON_GetObjectItem(cJSON_GetArrayItem(jsonFiles, 3), "ok")));
+    cJSON_Delete(jsonOutput);
+
+    // Batched output matches a lone conversion
+    C->inputFilename = "test_batch_c.png";
+    C->outputFilename = "test_batch_single.png";
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    clImage * singleImage = clContextRead(C, "test_batch_single.png", NULL, NULL);
+    clImage * batchImage = clContextRead(C, "test_batch_explicit.png", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(singleImage);
+    TEST_ASSERT_NOT_NULL(batchImage);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(singleImage->pixelsU16, batchImage->pixelsU16, 64 * 48 * CL_CHANNELS_PER_PIXEL);
+    clImageDestroy(C, singleImage);
+    clImageDestroy(C, batchImage);
+
+    // Templates need exactly one %s
+    C->inputFilename = "test_batch.txt";
+    C->outputFilename = "test_batch_out.png";
+    TEST_ASSERT_EQUAL_INT(1, clContextBatch(C, NULL));
+
+    clContextDestroy(C);
+    remove("test_batch.txt");
+    remove("test_batch_a.png");
+    remove("test_batch_b.png");
+    remove("test_batch_c.png");
+    remove("test_batch_out_test_batch_a.png");
+    remove("test_batch_out_test_batch_b.png");
+    remove("test_batch_explicit.png");
+    remove("test_batch_single.png");
+}
+
+static void test_convertResizeCrop(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clImage * srcImage = clImageParseString(C, "64x48,#ff0000..#0000ff", 8, NULL);
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_resizecrop_src.png", NULL, &writeParams));
+    clImageDestroy(C, srcImage);
+
+    // Crops that can't be fused with the conversion (resize, stats) convert the smaller image as a whole
+    C->inputFilename = "test_resizecrop_src.png";
+    C->outputFilename = "test_resizecrop_out.png";
+    C->params.resizeW = 20;
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    clImage * image = clContextRead(C, "test_resizecrop_out.png", NULL, NULL);
+    TEST_ASSERT_EQUAL_INT(20, image->width);
+    TEST_ASSERT_EQUAL_INT(15, image->height);
+    clImageDestroy(C, image);
+
+    C->params.resizeW = 0;
+    C->params.stats = clTrue;
+    C->params.rect[0] = 5;
+    C->params.rect[1] = 6;
+    C->params.rect[2] = 30;
+    C->params.rect[3] = 10;
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    image = clContextRead(C, "test_resizecrop_out.png", NULL, NULL);
+    TEST_ASSERT_EQUAL_INT(30, image->width);
+    TEST_ASSERT_EQUAL_INT(10, image->height);
+    clImageDestroy(C, image);
+
+    clContextDestroy(C);
+    remove("test_resizecrop_src.png");
+    remove("test_resizecrop_out.png");
+}
+
+static void test_ladder(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    clImage * srcImage = clImageCreate(C, 160, 120, 16, NULL);
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U16);
+    for (int i = 0; i < (srcImage->width * srcImage->height * CL_CHANNELS_PER_PIXEL); ++i) {
+        srcImage->pixelsU16[i] = (uint16_t)(((uint32_t)i * 4099) % 65536);
+    }
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_ladder_src.png", NULL, &writeParams));
+    clImageDestroy(C, srcImage);
+
+    // Every level written, at its own size and format. 40 and 20 are resized from 80, the 70 wide level from the source.
+    C->jobs = 3;
+    C->inputFilename = "test_ladder_src.png";
+    C->outputFilename = "test_ladder_%d.png";
+    C->params.ladder = "20,80x0,0x30:jpg:50,70x70,mitchell";
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    static const struct
+    {
+        const char * filename;
+        int width;
+        int height;
+    } expected[] = { { "test_ladder_20.png", 20, 15 }, { "test_ladder_80.png", 80, 60 }, { "test_ladder_40.jpg", 40, 30 }, { "test_ladder_70.png", 70, 70 } };
+    for (int i = 0; i < 4; ++i) {
+        clImage * image = clContextRead(C, expected[i].filename, NULL, NULL);
+        TEST_ASSERT_NOT_NULL(image);
+        TEST_ASSERT_EQUAL_INT(expected[i].width, image->width);
+        TEST_ASSERT_EQUAL_INT(expected[i].height, image->height);
+        clImageDestroy(C, image);
+    }
+
+    // A level resized from the source matches a lone --resize conversion
+    C->params.ladder = NULL;
+    C->params.resizeW = 70;
+    C->params.resizeH = 70;
+    C->params.resizeFilter = CL_FILTER_MITCHELL;
+    C->outputFilename = "test_ladder_single.png";
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    clImage * singleImage = clContextRead(C, "test_ladder_single.png", NULL, NULL);
+    clImage * ladderImage = clContextRead(C, "test_ladder_70.png", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(singleImage);
+    TEST_ASSERT_NOT_NULL(ladderImage);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(singleImage->pixelsU16, ladderImage->pixelsU16, 70 * 70 * CL_CHANNELS_PER_PIXEL);
+    clImageDestroy(C, singleImage);
+    clImageDestroy(C, ladderImage);
+
+    // Bad specs, templates and combinations
+    C->outputFilename = "test_ladder_%d.png";
+    C->params.ladder = "20";
+    TEST_ASSERT_EQUAL_INT(1, clContextConvert(C)); // with --resize
+    C->params.resizeW = 0;
+    C->params.resizeH = 0;
+    static const char * badLadders[] = { "", "0x0", "20:nope", "20:jpg:101", "20y30", "bicubic" };
+    for (int i = 0; i < (int)(sizeof(badLadders) / sizeof(badLadders[0])); ++i) {
+        C->params.ladder = badLadders[i];
+        TEST_ASSERT_EQUAL_INT(1, clContextConvert(C));
+    }
+    C->params.ladder = "20";
+    C->outputFilename = "test_ladder.png";
+    TEST_ASSERT_EQUAL_INT(1, clContextConvert(C));
+    C->outputFilename = "test_ladder_%d_%s.png";
+    TEST_ASSERT_EQUAL_INT(1, clContextConvert(C));
+
+    clContextDestroy(C);
+    remove("test_ladder_src.png");
+    remove("test_ladder_20.png");
+    remove("test_ladder_80.png");
+    remove("test_ladder_40.jpg");
+    remove("test_ladder_70.png");
+    remove("test_ladder_single.png");
+}
+
+static void test_pngEncode(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // Big enough for several bands at either depth, and lossless at every speed no matter how many jobs encode it
+    static const int depths[] = { 8, 16 };
+    static const int speeds[] = { -1, 0, 7, 9, 10 };
+    clFormat * format = clContextFindFormat(C, "png");
+    TEST_ASSERT_NOT_NULL(format);
+    for (int d = 0; d < 2; ++d) {
+        clImage * srcImage = clImageCreate(C, 611, 450, depths[d], NULL);
+        int channelCount = srcImage->width * srcImage->height * CL_CHANNELS_PER_PIXEL;
+        if (depths[d] == 16) {
+            clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U16);
+            for (int i = 0; i < channelCount; ++i) {
+                srcImage->pixelsU16[i] = (uint16_t)(((uint32_t)i * 2654435761u) >> 16);
+            }
+        } else {
+            clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U8);
+            for (int i = 0; i < channelCount; ++i) {
+                srcImage->pixelsU8[i] = (uint8_t)((i / 4 % 611) + (((uint32_t)i * 2654435761u) >> 29));
+            }
+        }
+
+        clRaw reference = CL_RAW_EMPTY;
+        for (int s = 0; s < (int)(sizeof(speeds) / sizeof(speeds[0])); ++s) {
+            for (int jobs = 1; jobs <= 3; jobs += 2) {
+                C->jobs = jobs;
+                clWriteParams writeParams;
+                clWriteParamsSetDefaults(C, &writeParams);
+                writeParams.speed = speeds[s];
+                clRaw raw = CL_RAW_EMPTY;
+                TEST_ASSERT_TRUE(format->writeFunc(C, srcImage, "png", &raw, &writeParams));
+                clImage * image = format->readFunc(C, "png", NULL, &raw);
+                TEST_ASSERT_NOT_NULL(image);
+                TEST_ASSERT_EQUAL_INT(srcImage->width, image->width);
+                TEST_ASSERT_EQUAL_INT(srcImage->height, image->height);
+                if (depths[d] == 16) {
+                    TEST_ASSERT_EQUAL_UINT16_ARRAY(srcImage->pixelsU16, image->pixelsU16, channelCount);
+                } else {
+                    TEST_ASSERT_EQUAL_UINT8_ARRAY(srcImage->pixelsU8, image->pixelsU8, channelCount);
+                }
+                clImageDestroy(C, image);
+
+                if (jobs == 1) {
+                    clRawClone(C, &reference, &raw);
+                } else {
+                    TEST_ASSERT_EQUAL_UINT(reference.size, raw.size);
+                    TEST_ASSERT_EQUAL_MEMORY(reference.ptr, raw.ptr, raw.size);
+                }
+                clRawFree(C, &raw);
+            }
+        }
+        clRawFree(C, &reference);
+        clImageDestroy(C, srcImage);
+    }
+
+    clContextDestroy(C);
+}
+
+// Fills image (8 or 16 bit) with pixels from fill(x, y, channel, userData)
+static void traitsFillImage(clContext * C, clImage * image, uint16_t (*fill)(int, int, int))
+{
+    clImagePrepareWritePixels(C, image, (image->depth == 8) ? CL_PIXELFORMAT_U8 : CL_PIXELFORMAT_U16);
+    for (int y = 0; y < image->height; ++y) {
+        for (int x = 0; x < image->width; ++x) {
+            for (int c = 0; c < CL_CHANNELS_PER_PIXEL; ++c) {
+                int i = (((y * image->width) + x) * CL_CHANNELS_PER_PIXEL) + c;
+                if (image->depth == 8) {
+                    image->pixelsU8[i] = (uint8_t)fill(x, y, c);
+                } else {
+                    image->pixelsU16[i] = fill(x, y, c);
+                }
+            }
+        }
+    }
+}
+
+static uint16_t traitsGrayOpaque(int x, int y, int c)
+{
+    return (uint16_t)((c == 3) ? 255 : ((x + y) & 0xff));
+}
+static uint16_t traitsFewColors(int x, int y, int c)
+{
+    static const uint8_t colors[5][4] = { { 255, 0, 0, 255 }, { 0, 255, 0, 128 }, { 0, 0, 255, 255 }, { 10, 20, 30, 0 }, { 9, 9, 9, 255 } };
+    return colors[((x / 7) + (y / 3)) % 5][c];
+}
+static uint16_t traitsColorOpaque(int x, int y, int c)
+{
+    return (uint16_t)((c == 3) ? 255 : ((x * (c + 1) + (y * 3)) & 0xff));
+}
+static uint16_t traitsColorAlpha(int x, int y, int c)
+{
+    return (uint16_t)((x * (c + 1) + (y * 3)) & 0xff);
+}
+static uint16_t traitsGrayAlpha16(int x, int y, int c)
+{
+    return (uint16_t)((c == 3) ? (x * 200) : (y * 300));
+}
+static uint16_t traitsGrayOpaque16(int x, int y, int c)
+{
+    return (uint16_t)((c == 3) ? 65535 : ((x * 211) + (y * 97)));
+}
+
+static void test_imageTraits(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 3;
+    clFormat * png = clContextFindFormat(C, "png");
+    TEST_ASSERT_NOT_NULL(png);
+
+    // Traits, the PNG color type they lead to (IHDR's byte 25), and an exact round trip
+    static const struct
+    {
+        uint16_t (*fill)(int, int, int);
+        int depth;
+        clBool opaque;
+        clBool gray;
+        int colorCount;
+        clBool writeProfile; // gray color types can't have an RGB ICC profile
+        int pngColorType;
+    } cases[] = {
+        { traitsGrayOpaque, 8, clTrue, clTrue, 256, clFalse, 0 },   { traitsGrayOpaque, 8, clTrue, clTrue, 256, clTrue, 3 },
+        { traitsFewColors, 8, clFalse, clFalse, 5, clTrue, 3 },     { traitsColorOpaque, 8, clTrue, clFalse, 0, clTrue, 2 },
+        { traitsColorAlpha, 8, clFalse, clFalse, 0, clTrue, 6 },    { traitsGrayAlpha16, 16, clFalse, clTrue, 0, clFalse, 4 },
+        { traitsGrayAlpha16, 16, clFalse, clTrue, 0, clTrue, 6 },
+    };
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); ++i) {
+        clImage * image = clImageCreate(C, 300, 200, cases[i].depth, NULL);
+        traitsFillImage(C, image, cases[i].fill);
+        const clImageTraits * traits = clImageGetTraits(C, image);
+        TEST_ASSERT_EQUAL_INT(cases[i].opaque, traits->opaque);
+        TEST_ASSERT_EQUAL_INT(cases[i].gray, traits->gray);
+        TEST_ASSERT_EQUAL_INT(cases[i].colorCount, traits->colorCount);
+        TEST_ASSERT_EQUAL_PTR(traits, clImageGetTraits(C, image));
+
+        clWriteParams writeParams;
+        clWriteParamsSetDefaults(C, &writeParams);
+        writeParams.writeProfile = cases[i].writeProfile;
+        clRaw raw = CL_RAW_EMPTY;
+        TEST_ASSERT_TRUE(png->writeFunc(C, image, "png", &raw, &writeParams));
+        TEST_ASSERT_EQUAL_INT(cases[i].pngColorType, raw.ptr[25]);
+        clImage * readImage = png->readFunc(C, "png", NULL, &raw);
+        TEST_ASSERT_NOT_NULL(readImage);
+        clImagePrepareReadPixels(C, readImage, (cases[i].depth == 8) ? CL_PIXELFORMAT_U8 : CL_PIXELFORMAT_U16);
+        int channelCount = image->width * image->height * CL_CHANNELS_PER_PIXEL;
+        if (cases[i].depth == 8) {
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(image->pixelsU8, readImage->pixelsU8, channelCount);
+        } else {
+            TEST_ASSERT_EQUAL_UINT16_ARRAY(image->pixelsU16, readImage->pixelsU16, channelCount);
+        }
+        clImageDestroy(C, readImage);
+        clRawFree(C, &raw);
+        clImageDestroy(C, image);
+    }
+
+    // Writing pixels drops the cached traits
+    clImage * image = clImageCreate(C, 64, 64, 8, NULL);
+    traitsFillImage(C, image, traitsGrayOpaque);
+    TEST_ASSERT_TRUE(clImageGetTraits(C, image)->opaque);
+    clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
+    image->pixelsU8[3] = 0;
+    TEST_ASSERT_FALSE(clImageGetTraits(C, image)->opaque);
+
+    // Gray JPEGs come back exactly gray, and opaque JP2s still round trip losslessly
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    writeParams.writeProfile = clFalse;
+    traitsFillImage(C, image, traitsGrayOpaque);
+    TEST_ASSERT_TRUE(clContextWrite(C, image, "test_imageTraits.jpg", NULL, &writeParams));
+    clImage * jpgImage = clContextRead(C, "test_imageTraits.jpg", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(jpgImage);
+    clImagePrepareReadPixels(C, jpgImage, CL_PIXELFORMAT_U8);
+    for (int i = 0; i < (jpgImage->width * jpgImage->height); ++i) {
+        uint8_t * pixel = &jpgImage->pixelsU8[i * CL_CHANNELS_PER_PIXEL];
+        TEST_ASSERT_EQUAL_UINT8(pixel[0], pixel[1]);
+        TEST_ASSERT_EQUAL_UINT8(pixel[0], pixel[2]);
+    }
+    clImageDestroy(C, jpgImage);
+
+    // ... but stay RGB when they carry an (RGB) ICC profile, rather than coming back as gray levels
+    writeParams.writeProfile = clTrue;
+    TEST_ASSERT_TRUE(clContextWrite(C, image, "test_imageTraits.jpg", NULL, &writeParams));
+    jpgImage = clContextRead(C, "test_imageTraits.jpg", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(jpgImage);
+    TEST_ASSERT_NULL(jpgImage->palette);
+    TEST_ASSERT_EQUAL_UINT32(cmsSigRgbData, cmsGetColorSpace(jpgImage->profile->handle));
+    TEST_ASSERT_TRUE(clProfileMatches(C, image->profile, jpgImage->profile));
+    clImageDestroy(C, jpgImage);
+    traitsFillImage(C, image, traitsColorOpaque);
+    writeParams.quality = 100;
+    TEST_ASSERT_TRUE(clContextWrite(C, image, "test_imageTraits.jp2", NULL, &writeParams));
+    clImage * jp2Image = clContextRead(C, "test_imageTraits.jp2", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(jp2Image);
+    clImagePrepareReadPixels(C, jp2Image, CL_PIXELFORMAT_U8);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(image->pixelsU8, jp2Image->pixelsU8, 64 * 64 * CL_CHANNELS_PER_PIXEL);
+    clImageDestroy(C, jp2Image);
+    clImageDestroy(C, image);
+
+    clContextDestroy(C);
+    remove("test_imageTraits.jpg");
+    remove("test_imageTraits.jp2");
+}
+
+static void test_paletteConvert(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 3;
+    clFormat * png = clContextFindFormat(C, "png");
+    TEST_ASSERT_NOT_NULL(png);
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    clImage * image = clImageCreate(C, 300, 200, 8, NULL);
+    traitsFillImage(C, image, traitsFewColors);
+    clRaw raw = CL_RAW_EMPTY;
+    TEST_ASSERT_TRUE(png->writeFunc(C, image, "png", &raw, &writeParams));
+    TEST_ASSERT_EQUAL_INT(3, raw.ptr[25]);
+
+    // Indexed PNGs are just their palette (a byte per pixel) until their pixels are needed, and writing pixels drops it
+    clImage * indexedImage = png->readFunc(C, "png", NULL, &raw);
+    TEST_ASSERT_NOT_NULL(indexedImage);
+    TEST_ASSERT_NOT_NULL(indexedImage->palette);
+    TEST_ASSERT_EQUAL_INT(5, indexedImage->palette->colors->width);
+    TEST_ASSERT_NOT_NULL(indexedImage->palette->indicesU8);
+    TEST_ASSERT_NULL(indexedImage->palette->indicesU16);
+    TEST_ASSERT_NULL(indexedImage->pixelsU8);
+    TEST_ASSERT_NULL(indexedImage->pixelsU16);
+    TEST_ASSERT_NULL(indexedImage->pixelsF32);
+    clImagePrepareReadPixels(C, indexedImage, CL_PIXELFORMAT_U8);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(image->pixelsU8, indexedImage->pixelsU8, 300 * 200 * CL_CHANNELS_PER_PIXEL);
+    TEST_ASSERT_NOT_NULL(indexedImage->palette);
+    clImage * expandedImage = png->readFunc(C, "png", NULL, &raw);
+    TEST_ASSERT_NOT_NULL(expandedImage);
+    clImagePrepareWritePixels(C, expandedImage, CL_PIXELFORMAT_U8);
+    TEST_ASSERT_NULL(expandedImage->palette);
+
+    // Converting just the palette matches converting every pixel, and the result can be indexed again
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+    static const int depths[] = { 8, 16 };
+    for (int i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); ++i) {
+        clImage * fromPalette = clImageConvert(C, indexedImage, depths[i], pq, CL_TONEMAP_AUTO, NULL);
+        clImage * fromPixels = clImageConvert(C, expandedImage, depths[i], pq, CL_TONEMAP_AUTO, NULL);
+        TEST_ASSERT_NOT_NULL(fromPalette->palette);
+        TEST_ASSERT_NULL(fromPalette->pixelsU8);
+        TEST_ASSERT_NULL(fromPalette->pixelsU16);
+        TEST_ASSERT_NULL(fromPixels->palette);
+        int channelCount = 300 * 200 * CL_CHANNELS_PER_PIXEL;
+        if (depths[i] == 8) {
+            clImagePrepareReadPixels(C, fromPalette, CL_PIXELFORMAT_U8);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(fromPixels->pixelsU8, fromPalette->pixelsU8, channelCount);
+            clRaw convertedRaw = CL_RAW_EMPTY;
+            TEST_ASSERT_TRUE(png->writeFunc(C, fromPalette, "png", &convertedRaw, &writeParams));
+            TEST_ASSERT_EQUAL_INT(3, convertedRaw.ptr[25]);
+            clImage * readImage = png->readFunc(C, "png", NULL, &convertedRaw);
+            TEST_ASSERT_NOT_NULL(readImage);
+            clImagePrepareReadPixels(C, readImage, CL_PIXELFORMAT_U8);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(fromPixels->pixelsU8, readImage->pixelsU8, channelCount);
+            clImageDestroy(C, readImage);
+            clRawFree(C, &convertedRaw);
+        } else {
+            clImagePrepareReadPixels(C, fromPalette, CL_PIXELFORMAT_U16);
+            TEST_ASSERT_EQUAL_UINT16_ARRAY(fromPixels->pixelsU16, fromPalette->pixelsU16, channelCount);
+        }
+        clImageDestroy(C, fromPixels);
+        clImageDestroy(C, fromPalette);
+    }
+
+    // Anything that moves pixels around falls back to converting all of them
+    clPipeline * pipeline = clPipelineCreate(C);
+    pipeline->rotate = 1;
+    clImage * rotatedImage = clImageConvertPipeline(C, indexedImage, NULL, 8, pq, CL_TONEMAP_AUTO, NULL, pipeline);
+    TEST_ASSERT_NULL(rotatedImage->palette);
+    clImageDestroy(C, rotatedImage);
+    clPipelineDestroy(C, pipeline);
+    int rect[4] = { 10, 10, 100, 100 };
+    clImage * croppedImage = clImageConvertPipeline(C, indexedImage, rect, 8, pq, CL_TONEMAP_AUTO, NULL, NULL);
+    TEST_ASSERT_NULL(croppedImage->palette);
+    clImageDestroy(C, croppedImage);
+
+    clProfileDestroy(C, pq);
+    clImageDestroy(C, expandedImage);
+    clImageDestroy(C, indexedImage);
+    clRawFree(C, &raw);
+    clImageDestroy(C, image);
+    clContextDestroy(C);
+}
+
+static void test_grayLevels(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 3;
+
+    clProfile * gamma24 = createBT2020Profile(C, CL_PCT_GAMMA, 2.4f, 300, NULL);
+
+    // Gray images come back with their levels as a palette, and convert (almost) the same as their pixels would
+    static const struct
+    {
+        const char * formatName;
+        int depth;
+        uint16_t (*fill)(int, int, int);
+        clBool lossless;
+    } cases[] = {
+        { "png", 8, traitsGrayOpaque, clTrue },
+        { "png", 16, traitsGrayOpaque16, clTrue },
+        { "tiff", 8, traitsGrayOpaque, clTrue },
+        { "tiff", 16, traitsGrayOpaque16, clTrue },
+        { "jpg", 8, traitsGrayOpaque, clFalse },
+    };
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); ++i) {
+        clFormat * format = clContextFindFormat(C, cases[i].formatName);
+        TEST_ASSERT_NOT_NULL(format);
+        clImage * image = clImageCreate(C, 300, 200, cases[i].depth, NULL);
+        traitsFillImage(C, image, cases[i].fill);
+
+        clWriteParams writeParams;
+        clWriteParamsSetDefaults(C, &writeParams);
+        writeParams.writeProfile = clFalse;
+        writeParams.quality = 100;
+        clRaw raw = CL_RAW_EMPTY;
+        TEST_ASSERT_TRUE(format->writeFunc(C, image, cases[i].formatName, &raw, &writeParams));
+        clImage * grayImage = format->readFunc(C, cases[i].formatName, NULL, &raw);
+        TEST_ASSERT_NOT_NULL(grayImage);
+        TEST_ASSERT_NOT_NULL(grayImage->palette);
+        TEST_ASSERT_EQUAL_INT(cases[i].depth, grayImage->depth);
+        TEST_ASSERT_TRUE(clImageGetTraits(C, grayImage)->gray);
+
+        // Just the levels are kept (a byte per pixel for up to 256 of them; the 16 bit fill uses more), not RGBA
+        // pixels, and they're written out again without being expanded
+        TEST_ASSERT_NULL(grayImage->pixelsU8);
+        TEST_ASSERT_NULL(grayImage->pixelsU16);
+        TEST_ASSERT_EQUAL_INT(cases[i].depth == 8, grayImage->palette->indicesU8 != NULL);
+        TEST_ASSERT_EQUAL_INT(cases[i].depth != 8, grayImage->palette->indicesU16 != NULL);
+        clRaw rewrittenRaw = CL_RAW_EMPTY;
+        TEST_ASSERT_TRUE(format->writeFunc(C, grayImage, cases[i].formatName, &rewrittenRaw, &writeParams));
+        TEST_ASSERT_NULL(grayImage->pixelsU8);
+        TEST_ASSERT_NULL(grayImage->pixelsU16);
+        if (cases[i].lossless) {
+            TEST_ASSERT_EQUAL_INT((int)raw.size, (int)rewrittenRaw.size);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(raw.ptr, rewrittenRaw.ptr, raw.size);
+        }
+        clRawFree(C, &rewrittenRaw);
+
+        clImage * expandedImage = format->readFunc(C, cases[i].formatName, NULL, &raw);
+        TEST_ASSERT_NOT_NULL(expandedImage);
+        int channelCount = 300 * 200 * CL_CHANNELS_PER_PIXEL;
+        if (cases[i].depth == 8) {
+            if (cases[i].lossless) {
+                clImagePrepareReadPixels(C, grayImage, CL_PIXELFORMAT_U8);
+                TEST_ASSERT_EQUAL_UINT8_ARRAY(image->pixelsU8, grayImage->pixelsU8, channelCount);
+            }
+            clImagePrepareWritePixels(C, expandedImage, CL_PIXELFORMAT_U8);
+        } else {
+            clImagePrepareReadPixels(C, grayImage, CL_PIXELFORMAT_U16);
+            TEST_ASSERT_EQUAL_UINT16_ARRAY(image->pixelsU16, grayImage->pixelsU16, channelCount);
+            clImagePrepareWritePixels(C, expandedImage, CL_PIXELFORMAT_U16);
+        }
+        TEST_ASSERT_NOT_NULL(grayImage->palette);
+        TEST_ASSERT_NULL(expandedImage->palette);
+
+        clImage * fromLevels = clImageConvert(C, grayImage, 16, gamma24, CL_TONEMAP_AUTO, NULL);
+        clImage * fromPixels = clImageConvert(C, expandedImage, 16, gamma24, CL_TONEMAP_AUTO, NULL);
+        TEST_ASSERT_NOT_NULL(fromLevels->palette);
+        clImagePrepareReadPixels(C, fromLevels, CL_PIXELFORMAT_U16);
+        for (int c = 0; c < channelCount; ++c) {
+            // The colors and the rows split differently between SIMD and scalar code
+            TEST_ASSERT_INT_WITHIN(1, fromPixels->pixelsU16[c], fromLevels->pixelsU16[c]);
+        }
+        clImageDestroy(C, fromPixels);
+        clImageDestroy(C, fromLevels);
+
+        clImageDestroy(C, expandedImage);
+        clImageDestroy(C, grayImage);
+        clRawFree(C, &raw);
+        clImageDestroy(C, image);
+    }
+
+    clProfileDestroy(C, gamma24);
+    clContextDestroy(C);
+}
+
+static void test_readScaled(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    clImage * srcImage = clImageCreate(C, 160, 120, 8, NULL);
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U8);
+    for (int i = 0; i < (srcImage->width * srcImage->height * CL_CHANNELS_PER_PIXEL); ++i) {
+        srcImage->pixelsU8[i] = (uint8_t)((i * 7) & 0xff);
+    }
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_readScaled.jpg", NULL, &writeParams));
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_readScaled.jp2", NULL, &writeParams));
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_readScaled.png", NULL, &writeParams));
+    clImageDestroy(C, srcImage);
+
+    // The smallest cheap scale that still covers the minimum, and the full size either way
+    static const struct
+    {
+        const char * filename;
+        int minWidth;
+        int minHeight;
+        int width;
+        int height;
+    } expected[] = {
+        { "test_readScaled.jpg", 40, 0, 40, 30 },   { "test_readScaled.jpg", 41, 0, 60, 45 },
+        { "test_readScaled.jpg", 0, 0, 20, 15 },    { "test_readScaled.jpg", 200, 0, 160, 120 },
+        { "test_readScaled.jp2", 40, 0, 40, 30 },   { "test_readScaled.jp2", 41, 0, 80, 60 },
+        { "test_readScaled.jp2", 0, 100, 160, 120 }, { "test_readScaled.png", 40, 0, 160, 120 },
+    };
+    for (int i = 0; i < (int)(sizeof(expected) / sizeof(expected[0])); ++i) {
+        clReadScale scale;
+        scale.minWidth = expected[i].minWidth;
+        scale.minHeight = expected[i].minHeight;
+        clImage * image = clContextReadScaled(C, expected[i].filename, NULL, &scale, NULL);
+        TEST_ASSERT_NOT_NULL(image);
+        TEST_ASSERT_EQUAL_INT(expected[i].width, image->width);
+        TEST_ASSERT_EQUAL_INT(expected[i].height, image->height);
+        TEST_ASSERT_EQUAL_INT(160, scale.fullWidth);
+        TEST_ASSERT_EQUAL_INT(120, scale.fullHeight);
+        clImageDestroy(C, image);
+    }
+
+    // A --resize conversion decodes smaller, but still lands on the size the full image would resize to
+    C->inputFilename = "test_readScaled.jpg";
+    C->outputFilename = "test_readScaled_out.png";
+    C->params.resizeW = 50;
+    TEST_ASSERT_EQUAL_INT(0, clContextConvert(C));
+    clImage * image = clContextRead(C, "test_readScaled_out.png", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(image);
+    TEST_ASSERT_EQUAL_INT(50, image->width);
+    TEST_ASSERT_EQUAL_INT(37, image->height);
+    clImageDestroy(C, image);
+
+    clContextDestroy(C);
+    remove("test_readScaled.jpg");
+    remove("test_readScaled.jp2");
+    remove("test_readScaled.png");
+    remove("test_readScaled_out.png");
+}
+
+static void test_jpegSpeed(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // A smooth gradient, so the fast DCT and plain upsampling stay close to the default decode
+    clImage * srcImage = clImageCreate(C, 100, 75, 8, NULL);
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U8);
+    for (int j = 0; j < srcImage->height; ++j) {
+        for (int i = 0; i < srcImage->width; ++i) {
+            uint8_t * pixel = &srcImage->pixelsU8[(i + (j * srcImage->width)) * CL_CHANNELS_PER_PIXEL];
+            pixel[0] = (uint8_t)(i * 2);
+            pixel[1] = (uint8_t)(j * 3);
+            pixel[2] = 128;
+            pixel[3] = 255;
+        }
+    }
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_jpegSpeed.jpg", NULL, &writeParams));
+    clImage * defaultImage = clContextRead(C, "test_jpegSpeed.jpg", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(defaultImage);
+
+    static const int speeds[] = { 0, 10 };
+    for (int s = 0; s < (int)(sizeof(speeds) / sizeof(speeds[0])); ++s) {
+        writeParams.speed = speeds[s];
+        TEST_ASSERT_TRUE(clContextWrite(C, srcImage, "test_jpegSpeed.jpg", NULL, &writeParams));
+        for (int readSpeed = -1; readSpeed <= 10; readSpeed += 11) {
+            C->params.readSpeed = readSpeed;
+            clImage * image = clContextRead(C, "test_jpegSpeed.jpg", NULL, NULL);
+            TEST_ASSERT_NOT_NULL(image);
+            TEST_ASSERT_EQUAL_INT(srcImage->width, image->width);
+            TEST_ASSERT_EQUAL_INT(srcImage->height, image->height);
+            for (int i = 0; i < (image->width * image->height * CL_CHANNELS_PER_PIXEL); ++i) {
+                TEST_ASSERT_INT_WITHIN(12, defaultImage->pixelsU8[i], image->pixelsU8[i]);
+            }
+            clImageDestroy(C, image);
+        }
+    }
+
+    clImageDestroy(C, defaultImage);
+    clImageDestroy(C, srcImage);
+    clContextDestroy(C);
+    remove("test_jpegSpeed.jpg");
+}
+
+static int compareFloats(const void * p, const void * q)
+{
+    const float x = *(const float *)p;
+    const float y = *(const float *)q;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static void test_measureHDR(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfilePrimaries bt2020;
+    TEST_ASSERT_TRUE(clContextGetStockPrimaries(C, "bt2020", &bt2020));
+    clProfile * pq = createBT2020Profile(C, CL_PCT_PQ, 1.0f, 10000, NULL);
+
+    // The gamut ceiling matches what running the linear transforms finds, in and out of gamut
+    clProfile * linearProfile = createBT2020Profile(C, CL_PCT_GAMMA, 1.0f, 1, NULL);
+    clTransform * linearToXYZ = clTransformCreate(C, linearProfile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
+    clTransform * linearFromXYZ = clTransformCreate(C, NULL, CL_XF_XYZ, linearProfile, CL_XF_RGB, CL_TONEMAP_OFF);
+    clTransformGamutCeiling ceiling;
+    clTransformGamutCeilingInit(C, &bt2020, &ceiling);
+    for (float x = 0.05f; x < 0.75f; x += 0.05f) {
+        for (float y = 0.05f; (x + y) < 0.95f; y += 0.05f) {
+            float expected = clTransformCalcMaxY(C, linearFromXYZ, linearToXYZ, x, y);
+            TEST_ASSERT_FLOAT_WITHIN(0.0005f * expected, expected, clTransformGamutCeilingMaxY(&ceiling, x, y));
+        }
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, 1.0f, clTransformGamutCeilingMaxY(&ceiling, bt2020.white[0], bt2020.white[1]));
+    clTransformDestroy(C, linearToXYZ);
+    clTransformDestroy(C, linearFromXYZ);
+    clProfileDestroy(C, linearProfile);
+
+    // Enough pixels for several blocks, with plenty of repeated values
+    const int width = 400;
+    const int height = 400;
+    const int pixelCount = width * height;
+    clImage * image = clImageCreate(C, width, height, 10, pq);
+    clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
+    uint32_t seed = 1;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; ++i) {
+        seed = (seed * 1103515245) + 12345;
+        image->pixelsU16[i] = ((i % CL_CHANNELS_PER_PIXEL) == 3) ? 1023 : (uint16_t)(((seed >> 16) % 64) * 16);
+    }
+
+    const float satLuminance = 100.0f;
+    clImageHDRStats stats;
+    clImageHDRPixelInfo * pixelInfo = clImageHDRPixelInfoCreate(C, pixelCount);
+    clImageHDRQuantization * quantization = clAllocateStruct(clImageHDRQuantization);
+    clImage * highlight = NULL;
+    C->jobs = 3;
+    clImageMeasureHDR(C, image, 300, satLuminance, &highlight, &stats, pixelInfo, quantization);
+    TEST_ASSERT_NOT_NULL(highlight);
+
+    // Percentiles match what sorting every pixel finds
+    float * nits = clAllocate(sizeof(float) * pixelCount);
+    float * saturations = clAllocate(sizeof(float) * pixelCount);
+    for (int i = 0; i < pixelCount; ++i) {
+        nits[i] = pixelInfo->pixels[i].nits;
+        saturations[i] = (CL_CLAMP(nits[i], 0.0f, 10000.0f) >= satLuminance) ? pixelInfo->pixels[i].saturation : 0.0f;
+    }
+    qsort(nits, pixelCount, sizeof(float), compareFloats);
+    qsort(saturations, pixelCount, sizeof(float), compareFloats);
+    for (int i = 0; i <= 100; ++i) {
+        int index = (i < 100) ? (int)((float)i * (float)pixelCount / 100.0f) : (pixelCount - 1);
+        TEST_ASSERT_EQUAL_FLOAT(nits[index], quantization->percentiles[i].nits);
+        TEST_ASSERT_EQUAL_FLOAT(saturations[index], quantization->percentiles[i].saturation);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(stats.brightestPixelNits, quantization->percentiles[100].nits);
+
+    // Blocks measured in parallel still agree with each other
+    int firstBrightest = 0;
+    int bucketedPixelCount = 0;
+    for (int i = 0; i < pixelCount; ++i) {
+        if (pixelInfo->pixels[firstBrightest].nits < pixelInfo->pixels[i].nits) {
+            firstBrightest = i;
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(firstBrightest % width, stats.brightestPixelX);
+    TEST_ASSERT_EQUAL_INT(firstBrightest / width, stats.brightestPixelY);
+    for (int i = 0; i < CL_QUANTIZATION_BUCKET_COUNT; ++i) {
+        bucketedPixelCount += quantization->pixelCountsNitsPQ[i];
+    }
+    TEST_ASSERT_EQUAL_INT(pixelCount, bucketedPixelCount);
+    TEST_ASSERT_EQUAL_INT(stats.hdrPixelCount, stats.overbrightPixelCount + stats.outOfGamutPixelCount + stats.bothPixelCount);
+    TEST_ASSERT_TRUE(stats.hdrPixelCount > 0);
+
+    // A single repeated value, in fewer pixels than there are percentiles
+    clImage * solid = clImageParseString(C, "7x5,#808080", 8, pq);
+    clImageMeasureHDR(C, solid, 300, satLuminance, NULL, &stats, NULL, quantization);
+    for (int i = 0; i <= 100; ++i) {
+        TEST_ASSERT_EQUAL_FLOAT(stats.brightestPixelNits, quantization->percentiles[i].nits);
+    }
+    clImageDestroy(C, solid);
+
+    clFree(nits);
+    clFree(saturations);
+    clFree(quantization);
+    clImageDestroy(C, highlight);
+    clImageHDRPixelInfoDestroy(C, pixelInfo);
+    clImageDestroy(C, image);
+    clProfileDestroy(C, pq);
+    clContextDestroy(C);
+}
+
+static void test_lut3D(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // Pseudorandom colors, including some outside of [0, 1]
+    float srcPixels[256 * 4];
+    float dstPixels[256 * 4];
+    float simdPixels[256 * 4];
+    for (int i = 0; i < 256 * 4; ++i) {
+        srcPixels[i] = (float)((i * 7919) % 1201) / 1000.0f - 0.1f;
+    }
+
+    // A 4x4x4 Hald CLUT that rotates the channels: linear, so both interpolations should reproduce it exactly
+    clImage * hald = clImageCreate(C, 8, 8, 32, NULL);
+    clImagePrepareWritePixels(C, hald, CL_PIXELFORMAT_F32);
+    for (int i = 0; i < 64; ++i) {
+        float * pixel = &hald->pixelsF32[i * CL_CHANNELS_PER_PIXEL];
+        setFloat4(pixel, (float)((i / 4) % 4) / 3.0f, (float)(i / 16) / 3.0f, (float)(i % 4) / 3.0f, 1.0f);
+    }
+    clLUT3D * lut = clLUT3DCreateHALD(C, hald, 4);
+    clImageDestroy(C, hald);
+    for (int interpolation = 0; interpolation < 2; ++interpolation) {
+        lut->interpolation = (clLUTInterpolation)interpolation;
+        clLUT3DApply(C, lut, srcPixels, dstPixels, 256);
+        for (int i = 0; i < 256; ++i) {
+            const float * src = &srcPixels[i * 4];
+            const float * dst = &dstPixels[i * 4];
+            TEST_ASSERT_FLOAT_WITHIN(0.00001f, CL_CLAMP(src[1], 0.0f, 1.0f), dst[0]);
+            TEST_ASSERT_FLOAT_WITHIN(0.00001f, CL_CLAMP(src[2], 0.0f, 1.0f), dst[1]);
+            TEST_ASSERT_FLOAT_WITHIN(0.00001f, CL_CLAMP(src[0], 0.0f, 1.0f), dst[2]);
+            TEST_ASSERT_EQUAL_FLOAT(src[3], dst[3]);
+        }
+    }
+    clLUT3DDestroy(C, lut);
+
+    // A nonlinear LUT: the interpolations differ, but scalar and SIMD must agree, and lattice points are exact
+    lut = clLUT3DCreate(C, 5);
+    for (int i = 0; i < (5 * 5 * 5); ++i) {
+        for (int channel = 0; channel < 3; ++channel) {
+            float * v = &lut->lattice[(i * 4) + channel];
+            *v = *v * *v;
+        }
+    }
+    for (int interpolation = 0; interpolation < 2; ++interpolation) {
+        lut->interpolation = (clLUTInterpolation)interpolation;
+        C->simdAllowed = clFalse;
+        clLUT3DApply(C, lut, srcPixels, dstPixels, 256);
+        C->simdAllowed = clTrue;
+        memcpy(simdPixels, srcPixels, sizeof(simdPixels));
+        clLUT3DApply(C, lut, simdPixels, simdPixels, 256); // in place
+        for (int i = 0; i < 256 * 4; ++i) {
+            TEST_ASSERT_FLOAT_WITHIN(0.000001f, dstPixels[i], simdPixels[i]);
+        }
+
+        float latticePoint[4] = { 0.25f, 0.5f, 1.0f, 0.5f };
+        clLUT3DApply(C, lut, latticePoint, latticePoint, 1);
+        TEST_ASSERT_FLOAT_WITHIN(0.000001f, 0.0625f, latticePoint[0]);
+        TEST_ASSERT_FLOAT_WITHIN(0.000001f, 0.25f, latticePoint[1]);
+        TEST_ASSERT_FLOAT_WITHIN(0.000001f, 1.0f, latticePoint[2]);
+    }
+    clLUT3DDestroy(C, lut);
+
+    // .cube files: an inverting LUT over a [0, 2] domain
+    FILE * f = fopen("test_lut.cube", "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "# Inverts\nTITLE \"invert\"\nLUT_3D_SIZE 2\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 2 2 2\n\n");
+    for (int i = 0; i < 8; ++i) {
+        fprintf(f, "%d %d.0 %d\n", 1 - (i % 2), 1 - ((i / 2) % 2), 1 - (i / 4));
+    }
+    fclose(f);
+    lut = clLUT3DRead(C, "test_lut.cube");
+    TEST_ASSERT_NOT_NULL(lut);
+    TEST_ASSERT_EQUAL_INT(2, lut->size);
+    float pixel[4] = { 0.5f, 1.0f, 2.0f, 1.0f };
+    clLUT3DApply(C, lut, pixel, pixel, 1);
+    TEST_ASSERT_FLOAT_WITHIN(0.000001f, 0.75f, pixel[0]);
+    TEST_ASSERT_FLOAT_WITHIN(0.000001f, 0.5f, pixel[1]);
+    TEST_ASSERT_FLOAT_WITHIN(0.000001f, 0.0f, pixel[2]);
+    clLUT3DDestroy(C, lut);
+
+    // Truncated and 1D LUTs are rejected
+    f = fopen("test_lut.cube", "w");
+    fprintf(f, "LUT_3D_SIZE 2\n0 0 0\n1 0 0\n");
+    fclose(f);
+    TEST_ASSERT_NULL(clLUT3DRead(C, "test_lut.cube"));
+    f = fopen("test_lut.cube", "w");
+    fprintf(f, "LUT_1D_SIZE 2\n0 0 0\n1 1 1\n");
+    fclose(f);
+    TEST_ASSERT_NULL(clLUT3DRead(C, "test_lut.cube"));
+    TEST_ASSERT_NULL(clLUT3DRead(C, "nonexistent.cube"));
+    remove("test_lut.cube");
+
+    TEST_ASSERT_EQUAL(CL_LUT_INTERPOLATION_TRILINEAR, clLUTInterpolationFromString(C, "trilinear"));
+    TEST_ASSERT_EQUAL(CL_LUT_INTERPOLATION_INVALID, clLUTInterpolationFromString(C, "cubic"));
+    TEST_ASSERT_EQUAL_STRING("tetrahedral", clLUTInterpolationToString(C, CL_LUT_INTERPOLATION_TETRAHEDRAL));
+
+    clContextDestroy(C);
+}
+
+static void test_transformPQ(void)
+{
+    // Reference implementations of SMPTE ST.2084 in double precision
+    const double c1 = 3424.0 / 4096.0;
+    const double c2 = 2413.0 / 4096.0 * 32.0;
+    const double c3 = 2392.0 / 4096.0 * 32.0;
+    const double m1 = 2610.0 / 4096.0 / 4.0;
+    const double m2 = 2523.0 / 4096.0 * 128.0;
+    const float tolerance = 0.1f / 65535.0f;
+
+    for (int i = 0; i <= 65535; ++i) {
+        double v = (double)i / 65535.0;
+        double N1m2 = pow(v, 1.0 / m2);
+        double eotf = pow(CL_MAX(N1m2 - c1, 0.0) / (c2 - (c3 * N1m2)), 1.0 / m1);
+        double Lm1 = pow(v, m1);
+        double oetf = pow((c1 + (c2 * Lm1)) / (1.0 + (c3 * Lm1)), m2);
+        TEST_ASSERT_FLOAT_WITHIN(tolerance, (float)eotf, clTransformEOTF_PQ((float)v));
+        TEST_ASSERT_FLOAT_WITHIN(tolerance, (float)oetf, clTransformOETF_PQ((float)v));
+    }
+}
+
 static void test_types(void)
 {
     clContext * C = clContextCreate(&silentSystem);
@@ -595,6 +2320,28 @@ static void test_raw(void)
     clRawReadFile(C, &raw, "test_raw.bin");
     clFileSize("test_raw.bin");
 
+    // Mapped files match read ones, and turn back into heap copies when resized
+    clRaw mapped = CL_RAW_EMPTY;
+    TEST_ASSERT_TRUE(clRawMapFile(C, &mapped, "test_raw.bin"));
+    TEST_ASSERT_EQUAL_INT(raw.size, mapped.size);
+    TEST_ASSERT_EQUAL_MEMORY(raw.ptr, mapped.ptr, raw.size);
+    clRawRealloc(C, &mapped, 30);
+    TEST_ASSERT_FALSE(mapped.mapped);
+    TEST_ASSERT_EQUAL_MEMORY(raw.ptr, mapped.ptr, raw.size);
+    clRawFree(C, &mapped);
+    TEST_ASSERT_FALSE(clRawMapFile(C, &mapped, "not_a_file.bin"));
+    clRawWriteFile(C, &mapped, "test_raw_empty.bin");
+    TEST_ASSERT_FALSE(clRawMapFile(C, &mapped, "test_raw_empty.bin"));
+    remove("test_raw_empty.bin");
+
+    // Detection sniffs mapped contents; images read from a mapping match the original
+    TEST_ASSERT_TRUE(clRawMapFile(C, &mapped, "../test/red_png_no_ext"));
+    TEST_ASSERT_EQUAL_STRING("png", clFormatDetectContents(C, "red_png_no_ext", &mapped));
+    clRawFree(C, &mapped);
+    clImage * image = clContextRead(C, "../test/red_png_no_ext", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(image);
+    clImageDestroy(C, image);
+
     clRawFree(C, &raw);
 
     clContextDestroy(C);
@@ -613,10 +2360,34 @@ int test_coverage(void)
     RUN_TEST(test_clContextParseArgs);
     RUN_TEST(test_debugDump);
     RUN_TEST(test_resize);
+    RUN_TEST(test_resizeExact);
     RUN_TEST(test_clTask);
+    RUN_TEST(test_clTaskPool);
+    RUN_TEST(test_transformSIMD);
+    RUN_TEST(test_pixelConvert);
+    RUN_TEST(test_pixelPool);
+    RUN_TEST(test_transformLUT);
+    RUN_TEST(test_transformInteger);
+    RUN_TEST(test_transformLCMS);
+    RUN_TEST(test_transformCache);
+    RUN_TEST(test_streamConvert);
+    RUN_TEST(test_pipeline);
+    RUN_TEST(test_batch);
+    RUN_TEST(test_convertResizeCrop);
+    RUN_TEST(test_ladder);
+    RUN_TEST(test_readScaled);
+    RUN_TEST(test_jpegSpeed);
+    RUN_TEST(test_pngEncode);
+    RUN_TEST(test_imageTraits);
+    RUN_TEST(test_paletteConvert);
+    RUN_TEST(test_grayLevels);
+    RUN_TEST(test_lut3D);
+    RUN_TEST(test_measureHDR);
+    RUN_TEST(test_transformPQ);
     RUN_TEST(test_types);
     RUN_TEST(test_floorRound);
     RUN_TEST(test_raw);
+    RUN_TEST(test_trace);
 
     return UNITY_END();
 }
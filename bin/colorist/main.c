@@ -92,6 +92,9 @@ int main(int argc, char * argv[])
         case CL_ACTION_CONVERT:
             ret = clContextConvert(C);
             break;
+        case CL_ACTION_BATCH:
+            ret = clContextBatch(C, jsonOutput);
+            break;
         case CL_ACTION_GENERATE:
             ret = clContextGenerate(C, NULL);
             break;
@@ -108,6 +111,13 @@ int main(int argc, char * argv[])
             break;
     }
 
+    if (C->traceFilename) {
+        clTraceWriteChrome(C, C->traceFilename);
+    }
+    if (jsonOutput) {
+        clTraceSummarize(C, jsonOutput);
+    }
+
 cleanup:
 
     if (jsonOutput) {
@@ -10,9 +10,13 @@
 
 #include "colorist/context.h"
 #include "colorist/image.h"
+#include "colorist/lut.h"
+#include "colorist/pipeline.h"
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
+#include "colorist/strip.h"
 #include "colorist/task.h"
+#include "colorist/trace.h"
 #include "colorist/types.h"
 #include "colorist/version.h"
 
@@ -18,14 +18,19 @@ struct _cmsContext_struct;
 
 struct clContext;
 struct clImage;
+struct clMutex;
 struct clProfile;
 struct clProfilePrimaries;
 struct clRaw;
+struct clStripReader;
+struct clStripWriter;
+struct clTaskPool;
 struct cJSON;
 
 typedef enum clAction
 {
     CL_ACTION_NONE = 0,
+    CL_ACTION_BATCH,
     CL_ACTION_CALC,
     CL_ACTION_CONVERT,
     CL_ACTION_GENERATE,
@@ -45,12 +50,37 @@ typedef struct clImage * (*clFormatReadFunc)(struct clContext * C,
                                              const char * formatName,
                                              struct clProfile * overrideProfile,
                                              struct clRaw * input);
+// Decode-time downscaling (clContextReadScaled()). Readers that can decode a reduced size for less than a full
+// decode (JPEG DCT scaling, JPEG 2000 resolution levels) pick the smallest one that is at least minWidth x minHeight.
+typedef struct clReadScale
+{
+    int minWidth;   // 0 puts no limit on the width
+    int minHeight;  // 0 puts no limit on the height
+    int fullWidth;  // set by the reader: the size of the whole, unreduced image
+    int fullHeight; // set by the reader
+} clReadScale;
+typedef struct clImage * (*clFormatReadScaledFunc)(struct clContext * C,
+                                                   const char * formatName,
+                                                   struct clProfile * overrideProfile,
+                                                   struct clRaw * input,
+                                                   clReadScale * scale);
 typedef clBool (*clFormatWriteFunc)(struct clContext * C,
                                     struct clImage * image,
                                     const char * formatName,
                                     struct clRaw * output,
                                     struct clWriteParams * writeParams);
 
+// Optional streaming entry points, see strip.h. image only describes the image to be written (it has no pixels).
+typedef struct clStripReader * (*clFormatReadStripsFunc)(struct clContext * C,
+                                                         const char * formatName,
+                                                         struct clProfile * overrideProfile,
+                                                         const char * filename);
+typedef struct clStripWriter * (*clFormatWriteStripsFunc)(struct clContext * C,
+                                                          struct clImage * image,
+                                                          const char * formatName,
+                                                          const char * filename,
+                                                          struct clWriteParams * writeParams);
+
 typedef enum clFormatDepth
 {
     CL_FORMAT_DEPTH_8 = 0,
@@ -78,12 +108,17 @@ typedef struct clFormat
     clFormatDetectFunc detectFunc;
     clFormatReadFunc readFunc;
     clFormatWriteFunc writeFunc;
+    clFormatReadScaledFunc readScaledFunc;   // NULL if the format can only decode at full size
+    clFormatReadStripsFunc readStripsFunc;   // NULL if the format can't be streamed
+    clFormatWriteStripsFunc writeStripsFunc; // NULL if the format can't be streamed
 } clFormat;
 
 clBool clFormatExists(struct clContext * C, const char * formatName);
 int clFormatMaxDepth(struct clContext * C, const char * formatName);
 int clFormatBestDepth(struct clContext * C, const char * formatName, int reqDepth);
 const char * clFormatDetect(struct clContext * C, const char * filename);
+// Same as clFormatDetect(), but sniffs the already read (or mapped) contents of filename instead of reopening it
+const char * clFormatDetectContents(struct clContext * C, const char * filename, struct clRaw * contents);
 
 // TODO: consider merging with clTonemapParams (requires API refactor)
 typedef enum clTonemap
@@ -128,6 +163,18 @@ typedef enum clFilter
 clFilter clFilterFromString(struct clContext * C, const char * str);
 const char * clFilterToString(struct clContext * C, clFilter filter);
 
+// How 3D LUT (Hald CLUT / .cube) lookups blend the lattice points surrounding a color
+typedef enum clLUTInterpolation
+{
+    CL_LUT_INTERPOLATION_TETRAHEDRAL = 0, // 4 points; smoothest along the neutral axis, the usual choice
+    CL_LUT_INTERPOLATION_TRILINEAR = 1,   // All 8 points of the surrounding cube
+
+    CL_LUT_INTERPOLATION_INVALID = -1
+} clLUTInterpolation;
+
+clLUTInterpolation clLUTInterpolationFromString(struct clContext * C, const char * str);
+const char * clLUTInterpolationToString(struct clContext * C, clLUTInterpolation interpolation);
+
 typedef enum clPixelFormat
 {
     CL_PIXELFORMAT_FIRST = 0,
@@ -162,8 +209,8 @@ typedef struct clWriteParams
     int quantizerMax;      // AVIF only. 0-63 range. 0 is lossless. -1 is "ignore and use quality"
     int tileRowsLog2;      // AVIF only. 0-6 range. 0 is disabled. Requests 2^n tile rows during encoding.
     int tileColsLog2;      // AVIF only. 0-6 range. 0 is disabled. Requests 2^n tile cols during encoding.
-    int speed;             // AVIF only. [-1,10] range. -1 is "let the codec choose a default".
-                           //            0 is best quality, 10 is fastest encoding speed
+    int speed;             // AVIF, JPEG and PNG. [-1,10] range. -1 is "let the codec choose a default".
+                           //               0 is best quality/compression, 10 is fastest encoding speed
     const char * codec;    // AVIF only. Specify a codec to write with (NULL == auto)
 } clWriteParams;
 void clWriteParamsSetDefaults(struct clContext * C, clWriteParams * writeParams);
@@ -223,6 +270,7 @@ typedef struct clConversionParams
     uint32_t frameIndex;            // --frameindex
     float gamma;                    // -g
     const char * hald;              // --hald
+    clLUTInterpolation haldInterp;  // --hald-interp
     int luminance;                  // -l
     const char * iccOverrideOut;    // -o
     float primaries[8];             // -p
@@ -236,9 +284,12 @@ typedef struct clConversionParams
     clTonemapParams tonemapParams;  // -t
     clWriteParams writeParams;      // -n, -q, -r, --yuv
     const char * readCodec;         // AVIF only. Specify a codec to read with (NULL == auto)
+    int readSpeed;                  // --read-speed, JPEG only. [-1,10] range, like clWriteParams.speed
     int rect[4];                    // -z
     const char * compositeFilename; // --composite
     clBlendParams compositeParams;  // --composite-gamma, --composite-premultiplied
+    int streamBudget;               // --stream, in MB. 0 disables streaming
+    const char * ladder;            // --ladder, parsed by clContextConvertFile()
 } clConversionParams;
 void clConversionParamsSetDefaults(struct clContext * C, clConversionParams * params);
 
@@ -261,15 +312,23 @@ typedef struct clContext
 
     clAction action;
     clConversionParams params;     // see above
-    clReadExtraInfo readExtraInfo; // populated by some formats' readers
+    clReadExtraInfo readExtraInfo; // populated by some formats' readers (clContextBatch()'s workers fill their own)
     clBool help;                   // -h
     const char * iccOverrideIn;    // -i
     int jobs;                      // -j
     clBool verbose;                // -v
     clBool ccmmAllowed;            // --ccmm
+    clBool simdAllowed;            // --simd
+    const char * traceFilename;    // --trace
     const char * inputFilename;    // index 0
     const char * outputFilename;   // index 1
     int defaultLuminance;
+
+    struct clTaskPool * taskPool;            // worker threads for clTaskParallelFor(), created on first use
+    struct clTransformCache * transformCache; // prepared transforms, reused by identical clTransforms
+    struct clPixelPool * pixelPool;           // recycled pixel buffers, see clPixelPoolAllocate()
+    struct clResizeCache * resizeCache;       // resize tap tables, reused by same-sized resizes
+    struct clTrace * trace;                   // spans and counters, only when --trace or --json is used
 } clContext;
 
 struct clImage;
@@ -293,7 +352,16 @@ void clContextPrintVersions(clContext * C);
 clBool clContextParseArgs(clContext * C, int argc, const char * argv[]);
 
 struct clImage * clContextRead(clContext * C, const char * filename, const char * iccOverride, const char ** outFormatName);
+struct clImage * clContextReadWithProfile(clContext * C, const char * filename, struct clProfile * overrideProfile, const char ** outFormatName);
+// clContextReadWithProfile(), but allows the reader to decode a reduced size (see clReadScale). scale may be NULL.
+struct clImage * clContextReadScaled(clContext * C,
+                                     const char * filename,
+                                     struct clProfile * overrideProfile,
+                                     clReadScale * scale,
+                                     const char ** outFormatName);
 clBool clContextWrite(clContext * C, struct clImage * image, const char * filename, const char * formatName, clWriteParams * writeParams);
+struct clStripReader * clContextReadStrips(clContext * C, const char * filename, struct clProfile * overrideProfile, const char ** outFormatName);
+struct clStripWriter * clContextWriteStrips(clContext * C, struct clImage * image, const char * filename, const char * formatName, clWriteParams * writeParams);
 char * clContextWriteURI(struct clContext * C, struct clImage * image, const char * formatName, clWriteParams * writeParams);
 void clContextLogWrite(clContext * C, const char * filename, const char * formatName, clWriteParams * writeParams);
 
@@ -301,7 +369,37 @@ clBool clContextGetStockPrimaries(struct clContext * C, const char * name, struc
 clBool clContextGetRawStockPrimaries(struct clContext * C, const char * name, float outPrimaries[8]);
 const char * clContextFindStockPrimariesPrettyName(struct clContext * C, struct clProfilePrimaries * primaries); // returns NULL if not found
 
+// Per-file timings filled out by clContextConvertFile()
+typedef struct clConvertTimings
+{
+    double decodeSeconds;  // reading and cropping the source
+    double convertSeconds; // everything between decoding and encoding
+    double encodeSeconds;
+    double totalSeconds;
+} clConvertTimings;
+
+// Everything about a conversion that only depends on the conversion params, so many conversions with the
+// same params (clContextBatch()) can share it. Safe to use from several conversions at once.
+typedef struct clConvertCache
+{
+    struct clProfile * srcOverrideProfile; // -i
+    struct clProfile * dstOverrideProfile; // -o
+    struct clLUT3D * hald;                 // --hald
+
+    // Generated dst profiles (guarded by lock), so identical ones aren't rebuilt for every file
+    struct clConvertCacheProfile * dstProfiles;
+    int dstProfileCount;
+    int dstProfileHits;
+    struct clMutex * lock;
+} clConvertCache;
+
+clConvertCache * clConvertCacheCreate(clContext * C, clConversionParams * params, const char * iccOverrideIn); // NULL on failure
+void clConvertCacheDestroy(clContext * C, clConvertCache * cache);
+
 int clContextConvert(clContext * C);
+// Converts inputFilename -> outputFilename using C->params. cache and timings are optional.
+int clContextConvertFile(clContext * C, const char * inputFilename, const char * outputFilename, clConvertCache * cache, clConvertTimings * timings);
+int clContextBatch(clContext * C, struct cJSON * output); // output here only used with --json
 int clContextGenerate(clContext * C, struct cJSON * output); // output here only used in ACTION_CALC
 int clContextIdentify(clContext * C, struct cJSON * output);
 int clContextModify(clContext * C);
@@ -17,6 +17,10 @@ static const uint32_t CL_BYTES_PER_CHANNEL[CL_PIXELFORMAT_COUNT] = { (uint32_t)s
                                                                      (uint32_t)sizeof(float) };
 #define CL_BYTES_PER_PIXEL(PIXELFORMAT) (CL_CHANNELS_PER_PIXEL * CL_BYTES_PER_CHANNEL[PIXELFORMAT])
 
+struct clImagePalette;
+struct clImageTraits;
+struct clLUT3D;
+struct clPipeline;
 struct clProfile;
 struct clRaw;
 struct cJSON;
@@ -34,8 +38,34 @@ typedef struct clImage
     uint8_t * pixelsU8;
     uint16_t * pixelsU16;
     float * pixelsF32;
+
+    struct clImageTraits * traits;   // Cached by clImageGetTraits(), dropped by clImagePrepareWritePixels()
+    struct clImagePalette * palette; // Indexed images only (see clImageSetPalette), dropped by clImagePrepareWritePixels()
 } clImage;
 
+// An indexed or gray image's pixels, as indices into its colors (or gray levels). Until something prepares its
+// pixels, this is all an indexed image holds: clImagePrepareReadPixels() expands them through the indices, and
+// clImageConvertPipeline() and the writers use the colors and indices directly where they can.
+typedef struct clImagePalette
+{
+    struct clImage * colors; // colorCount (at most 65536) x 1, same depth and profile as the image, each used by some pixel
+    uint8_t * indicesU8;     // width * height, into colors, if there are at most 256 of them (indicesU16 is NULL)
+    uint16_t * indicesU16;   // width * height, into colors, otherwise (indicesU8 is NULL)
+} clImagePalette;
+#define CL_PALETTE_INDEX(PALETTE, I) ((PALETTE)->indicesU8 ? (PALETTE)->indicesU8[I] : (PALETTE)->indicesU16[I])
+
+// What an encoder can leave out of an image without losing anything
+#define CL_TRAITS_MAX_COLORS 256
+typedef struct clImageTraits
+{
+    clBool opaque;                         // Every alpha is at the image's max
+    clBool gray;                           // R == G == B everywhere
+    int colorCount;                        // Distinct RGBA values (8 bit only), 0 if more than CL_TRAITS_MAX_COLORS
+    uint32_t colors[CL_TRAITS_MAX_COLORS]; // Those values, ascending, packed by CL_TRAITS_PACK_COLOR()
+} clImageTraits;
+#define CL_TRAITS_PACK_COLOR(P) \
+    ((uint32_t)(P)[0] | ((uint32_t)(P)[1] << 8) | ((uint32_t)(P)[2] << 16) | ((uint32_t)(P)[3] << 24))
+
 typedef struct clImageSignals
 {
     float mseLinear;
@@ -136,10 +166,21 @@ clImage * clImageConvert(struct clContext * C,
                          struct clProfile * dstProfile,
                          clTonemap tonemap,
                          clTonemapParams * tonemapParams);
+// clImageConvert() of just srcRect (x, y, w, h, already adjusted to fit; NULL for all of srcImage), running the
+// converted pixels through pipeline's stages and rotation in the same pass (see pipeline.h). pipeline may be NULL.
+clImage * clImageConvertPipeline(struct clContext * C,
+                                 clImage * srcImage,
+                                 const int srcRect[4],
+                                 int depth,
+                                 struct clProfile * dstProfile,
+                                 clTonemap tonemap,
+                                 clTonemapParams * tonemapParams,
+                                 struct clPipeline * pipeline);
 clImage * clImageCrop(struct clContext * C, clImage * srcImage, int x, int y, int w, int h, clBool keepSrc);
-clImage * clImageApplyHALD(struct clContext * C, clImage * image, clImage * hald, int haldDims);
+clImage * clImageApplyLUT3D(struct clContext * C, clImage * image, const struct clLUT3D * lut); // Hald CLUT / .cube postprocessing
 clImage * clImageResize(struct clContext * C, clImage * image, int width, int height, clFilter resizeFilter);
 clImage * clImageBlend(struct clContext * C, clImage * image, clImage * compositeImage, clBlendParams * blendParams);
+struct clProfile * clImageBlendProfileCreate(struct clContext * C, struct clProfile * profile, float gamma); // The space clImageBlend() blends in
 void clImageMeasureHDR(clContext * C,
                        clImage * srcImage,
                        int srgbLuminance,
@@ -150,6 +191,22 @@ void clImageMeasureHDR(clContext * C,
                        clImageHDRQuantization * outQuantization);
 void clImagePrepareReadPixels(struct clContext * C, clImage * image, clPixelFormat pixelFormat);
 void clImagePrepareWritePixels(struct clContext * C, clImage * image, clPixelFormat pixelFormat);
+// Scans the image's pixels (in parallel) on first use; the result stays valid until clImagePrepareWritePixels()
+const clImageTraits * clImageGetTraits(struct clContext * C, clImage * image);
+// Replaces image's pixels with colors and indices (see clImagePalette; pass one of indicesU8 and indicesU16), taking
+// ownership of them
+void clImageSetPalette(struct clContext * C, clImage * image, clImage * colors, uint8_t * indicesU8, uint16_t * indicesU16);
+// Sets image's pixels to levels (one per pixel, each below levelCount; pass one of levelsU8 and levelsU16) and
+// levelColors (levelCount RGBA colors at the image's depth) as its palette, minus any level no pixel uses. Takes
+// ownership of the levels, which become 8 bit indices if at most 256 levels are used.
+void clImageSetLevels(struct clContext * C, clImage * image, uint8_t * levelsU8, uint16_t * levelsU16, int levelCount, const uint16_t * levelColors);
+// Prepares an indexed image that has no pixels yet in the format of its colors, for code that works with whichever
+// pixels an image already has. Does nothing to other images.
+void clImageExpandPalette(struct clContext * C, clImage * image);
+// Copies channel c of row y to dst, one uint8_t or uint16_t per pixel for pixelFormat (U8 or U16), reading an
+// unexpanded indexed image through its palette. Call clImagePrepareReadPixels() on (image->palette ? image->palette->colors
+// : image) for pixelFormat first; this can then run on several threads at once.
+void clImageCopyRowChannel(struct clContext * C, clImage * image, int y, int c, clPixelFormat pixelFormat, void * dst);
 clBool clImageAdjustRect(struct clContext * C, clImage * image, int * x, int * y, int * w, int * h);
 void clImageColorGrade(struct clContext * C, clImage * image, int dstColorDepth, int * outLuminance, float * outGamma, clBool verbose);
 void clImageDebugDump(struct clContext * C, clImage * image, int x, int y, int w, int h, int extraIndent);
@@ -160,7 +217,11 @@ void clImageLogCreate(struct clContext * C, int width, int height, int depth, st
 clImage * clImageParseString(struct clContext * C, const char * str, int depth, struct clProfile * profile);
 clBool clImageCalcSignals(struct clContext * C, clImage * srcImage, clImage * dstImage, clImageSignals * signals);
 float clImageLargestChannel(struct clContext * C, clImage * image);
+float clImageLargestChannelRect(struct clContext * C, clImage * image, const int rect[4]);
 float clImagePeakLuminance(struct clContext * C, clImage * image); // Doesn't return maxCLL, but the lum of (largestChannel, largestChannel, largestChannel)
+float clImageChannelLuminance(struct clContext * C, struct clProfile * profile, float largestChannel); // clImagePeakLuminance() without an image
+// Resolves CL_TONEMAP_AUTO for clImageConvert() (which doesn't use this for 32bpc dsts, as they can overrange)
+clTonemap clImageAutoTonemap(struct clContext * C, int srcPeakLuminance, int depth, struct clProfile * dstProfile, clBool verbose);
 void clImageClear(struct clContext * C, clImage * image, float color[4]);
 void clImageDrawCIE(struct clContext * C, clImage * image, float borderColor[4], int borderThickness);
 void clImageDrawGamut(struct clContext * C,
@@ -172,6 +233,34 @@ void clImageDrawGamut(struct clContext * C,
                       int wpThickness);
 void clImageDrawLine(struct clContext * C, clImage * image, int x0, int y0, int x1, int y1, float color[4], int thickness);
 
+// ---------------------------------------------------------------------------
+// clPixelPool
+
+// Recycles full-size pixel buffers (clImage pixels and per-stage float scratch) so that the next stage of a
+// conversion, or the next file of a batch, reuses memory that is already mapped in instead of faulting in a
+// fresh allocation. Buffers are 64-byte aligned and binned into size classes an eighth of a power of two apart;
+// idle buffers are kept up to budget bytes. Anything from clPixelPoolAllocate() must go back through
+// clPixelPoolFree() while the pool (C->pixelPool) is alive.
+typedef struct clPixelPool
+{
+    struct clPixelPoolBuffer ** idle; // per size class, most recently freed first
+    size_t idleBytes;
+    size_t budget; // 0 disables recycling
+    int allocations;
+    int reuses;
+    struct clMutex * lock;
+} clPixelPool;
+
+clPixelPool * clPixelPoolCreate(struct clContext * C, size_t budget);
+void clPixelPoolDestroy(struct clContext * C, clPixelPool * pool);
+void clPixelPoolClear(struct clContext * C, clPixelPool * pool); // releases idle buffers, also resets allocations/reuses
+
+// Returns a 64-byte aligned buffer from C->pixelPool. Pass zero if the caller doesn't overwrite all of it;
+// fresh buffers are zeroed like clAllocate(), recycled ones are only cleared on request.
+void * clPixelPoolAllocate(struct clContext * C, size_t bytes, clBool zero);
+void clPixelPoolFree(struct clContext * C, void * ptr);
+void clPixelPoolGetStats(struct clContext * C, int * outAllocations, int * outReuses); // totals since the last clear
+
 clImageDiff * clImageDiffCreate(struct clContext * C, clImage * image1, clImage * image2, float minIntensity, int threshold);
 void clImageDiffUpdate(struct clContext * C, clImageDiff * diff, int threshold);
 void clImageDiffDestroy(struct clContext * C, clImageDiff * diff);
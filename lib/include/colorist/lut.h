@@ -0,0 +1,42 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#ifndef COLORIST_LUT_H
+#define COLORIST_LUT_H
+
+#include "colorist/context.h"
+#include "colorist/types.h"
+
+struct clContext;
+struct clImage;
+
+// A 3D color lookup table, sampled on a size x size x size lattice. Each lattice point is stored as 4
+// floats (RGB + padding) so that any point is a single vector load, with red varying fastest
+// (the order of both Hald CLUTs and .cube files), so neighboring red entries share cache lines.
+typedef struct clLUT3D
+{
+    int size;                         // Lattice points per axis, at least 2
+    float * lattice;                  // size^3 * 4 floats
+    float domainMin[3];               // Input values mapping to the first lattice point (.cube DOMAIN_MIN)
+    float domainMax[3];               // Input values mapping to the last lattice point (.cube DOMAIN_MAX)
+    clLUTInterpolation interpolation; // How lookups between lattice points are blended
+} clLUT3D;
+
+clLUT3D * clLUT3DCreate(struct clContext * C, int size); // Identity LUT
+void clLUT3DDestroy(struct clContext * C, clLUT3D * lut);
+
+// haldDims is the lattice size of hald (the cube of its level, which is its width ^ (2/3))
+clLUT3D * clLUT3DCreateHALD(struct clContext * C, struct clImage * hald, int haldDims);
+// Reads an Adobe/Resolve .cube file if filename ends in .cube, otherwise a Hald CLUT image. Logs and returns NULL on failure.
+clLUT3D * clLUT3DRead(struct clContext * C, const char * filename);
+clLUT3D * clLUT3DReadCube(struct clContext * C, const char * filename);
+
+// Looks up RGB of pixelCount RGBA float pixels on the calling thread (alpha is copied). Inputs outside of the
+// LUT's domain are clamped to it. srcPixels and dstPixels may be the same buffer.
+void clLUT3DApply(struct clContext * C, const clLUT3D * lut, const float * srcPixels, float * dstPixels, int pixelCount);
+
+#endif // ifndef COLORIST_LUT_H
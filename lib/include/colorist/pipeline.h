@@ -0,0 +1,86 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#ifndef COLORIST_PIPELINE_H
+#define COLORIST_PIPELINE_H
+
+#include "colorist/context.h"
+#include "colorist/types.h"
+
+struct clContext;
+struct clImage;
+struct clLUT3D;
+struct clProfile;
+struct clTransform;
+
+// A pipeline fuses a conversion and everything done to its pixels afterwards into a single pass over
+// the image. Each worker reads a row-sized tile of the src rect (so cropping is free), normalizes it to
+// floats, runs the transform and then every stage on it while it is still in cache, and quantizes it
+// straight into its (possibly rotated) spot in the dst image. No intermediate images are allocated.
+
+// 1024 RGBA pixels in and out is 32KB of floats, which stays in cache while every stage runs
+#define CL_PIPELINE_TILE_PIXELS 1024
+
+// Runs on pixelCount (at most CL_PIPELINE_TILE_PIXELS) float RGBA pixels in place. (x, y) is the position
+// of the first pixel in the unrotated dst image; the rest of the pixels follow it on the same row.
+typedef void (*clPipelineStageFunc)(struct clContext * C, void * stageData, float * pixels, int x, int y, int pixelCount);
+typedef void (*clPipelineStageDestroyFunc)(struct clContext * C, void * stageData);
+
+typedef struct clPipelineStage
+{
+    const char * name;
+    clPipelineStageFunc func; // Called concurrently from several threads
+    clPipelineStageDestroyFunc destroyFunc;
+    void * stageData;
+    clBool colorOnly; // Ignores (x, y), so it maps a color the same way anywhere in the image
+} clPipelineStage;
+
+#define CL_PIPELINE_MAX_STAGES 8
+
+typedef struct clPipeline
+{
+    clPipelineStage stages[CL_PIPELINE_MAX_STAGES]; // In the order they run, after the transform
+    int stageCount;
+    int rotate; // Clockwise turns applied when writing (see clImageRotate)
+} clPipeline;
+
+clPipeline * clPipelineCreate(struct clContext * C);
+void clPipelineDestroy(struct clContext * C, clPipeline * pipeline);
+void clPipelineAddStage(struct clContext * C,
+                        clPipeline * pipeline,
+                        const char * name,
+                        clPipelineStageFunc func,
+                        clPipelineStageDestroyFunc destroyFunc,
+                        void * stageData);
+
+// True if pipeline (which may be NULL) has no rotation and only colorOnly stages, so it could just as well run on
+// an image's palette as on its pixels
+clBool clPipelineIsColorOnly(struct clContext * C, clPipeline * pipeline);
+
+// SourceOver blends compositeImage on top of pixels in profile (see clImageBlend). Takes a copy of
+// compositeImage's pixels (already in blend space), so it doesn't need to outlive the pipeline.
+clBool clPipelineAddBlend(struct clContext * C,
+                          clPipeline * pipeline,
+                          struct clProfile * profile,
+                          struct clImage * compositeImage,
+                          clBlendParams * blendParams);
+// Hald CLUT / .cube postprocessing (see clImageApplyLUT3D). lut must outlive the pipeline.
+void clPipelineAddLUT3D(struct clContext * C, clPipeline * pipeline, struct clLUT3D * lut);
+
+// Converts rect (x, y, w, h, already adjusted to fit) of srcImage with transform (RGBA -> RGBA), runs the
+// stages, and writes dstImage, which must be w x h (h x w if rotated by an odd number of turns). Reads
+// srcImage's F32 pixels if it has them, otherwise U16 or U8. Writes F32 pixels if dstImage->depth is 32,
+// otherwise U16 or U8 (scaling down overranged colors, same as clImagePrepareReadPixels()). pipeline may
+// be NULL, for just a conversion.
+void clPipelineRun(struct clContext * C,
+                   clPipeline * pipeline,
+                   struct clTransform * transform,
+                   struct clImage * srcImage,
+                   const int rect[4],
+                   struct clImage * dstImage);
+
+#endif // ifndef COLORIST_PIPELINE_H
@@ -29,7 +29,36 @@ void clPixelMathColorGrade(struct clContext * C,
                            int * outLuminance,
                            float * outGamma,
                            clBool verbose);
+// Converts pixelCount RGBA pixels between two different pixel formats exactly as clImagePrepareReadPixels() always has:
+// U16 channels are in [0, maxChannelU16], and overranged F32 colors are scaled down by their largest channel instead
+// of clipped. Vectorized (unless --simd off) and split across the task pool (pixelmath_convert.c).
+void clPixelMathConvertPixels(struct clContext * C,
+                              clPixelFormat srcFormat,
+                              const void * srcPixels,
+                              clPixelFormat dstFormat,
+                              void * dstPixels,
+                              uint32_t maxChannelU16,
+                              int pixelCount);
+// Resizes RGBA float pixels with the same results stb_image_resize gives (edges clamped, colors weighted by alpha).
+// Both passes are split across the task pool, and each axis' taps are kept in C->resizeCache (pixelmath_resize.c).
 void clPixelMathResize(struct clContext * C, int srcW, int srcH, float * srcPixels, int dstW, int dstH, float * dstPixels, clFilter filter);
-void clPixelMathHaldCLUTLookup(struct clContext * C, float * haldData, int haldDims, const float src[4], float dst[4]);
+
+// Per axis tap tables for clPixelMathResize(), keyed on (srcSize, dstSize, filter), so batches of same-sized
+// images only build them once. Tables in use are never evicted.
+typedef struct clResizeCache
+{
+    struct clResizeAxis ** axes; // most recently used first
+    int count;
+    int capacity; // 0 disables caching
+    int hits;
+    int misses;
+    struct clMutex * lock;
+} clResizeCache;
+
+clResizeCache * clResizeCacheCreate(struct clContext * C, int capacity);
+void clResizeCacheDestroy(struct clContext * C, clResizeCache * cache);
+void clResizeCacheClear(struct clContext * C, clResizeCache * cache); // also resets hits/misses
+
+void clPixelMathBlendSourceOver(const float src[4], const float cmp[4], clBool premultiplied, float dst[4]); // cmp over src, dst may be src
 
 #endif
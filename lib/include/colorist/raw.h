@@ -14,11 +14,12 @@ typedef struct clRaw
 {
     uint8_t * ptr;
     size_t size;
+    clBool mapped; // ptr is a read-only view of a file (see clRawMapFile()), never write through it
 } clRaw;
 
-#define CL_RAW_EMPTY \
-    {                \
-        NULL, 0      \
+#define CL_RAW_EMPTY     \
+    {                    \
+        NULL, 0, clFalse \
     }
 
 struct clContext;
@@ -30,6 +31,11 @@ char * clRawToBase64(struct clContext * C, clRaw * src);
 void clRawSet(struct clContext * C, clRaw * raw, const uint8_t * data, size_t len);
 void clRawFree(struct clContext * C, clRaw * raw);
 clBool clRawReadFile(struct clContext * C, clRaw * raw, const char * filename);
+// Maps filename read-only instead of copying it into the heap, so huge inputs cost no extra memory
+// and no copy (pages are only read in as the reader touches them). Files that can't be mapped (pipes,
+// /dev/stdin, empty files, etc) fall back to clRawReadFile(). clRawFree() unmaps, and clRawRealloc()
+// turns a mapped raw back into a heap copy.
+clBool clRawMapFile(struct clContext * C, clRaw * raw, const char * filename);
 clBool clRawReadFileHeader(struct clContext * C, clRaw * raw, const char * filename, size_t bytes);
 clBool clRawWriteFile(struct clContext * C, clRaw * raw, const char * filename);
 
@@ -0,0 +1,59 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#ifndef COLORIST_STRIP_H
+#define COLORIST_STRIP_H
+
+#include "colorist/types.h"
+
+struct clContext;
+struct clImage;
+struct clStripReader;
+struct clStripWriter;
+
+// Strip readers and writers stream an image through memory a handful of rows at a time, for formats
+// whose codecs are scanline based. A "strip" is just a clImage as wide as the whole image and some
+// number of rows tall. Strips must be read / written in order, top to bottom.
+
+typedef clBool (*clStripReadFunc)(struct clContext * C, struct clStripReader * reader, struct clImage * strip);
+typedef void (*clStripReaderDestroyFunc)(struct clContext * C, struct clStripReader * reader);
+
+typedef clBool (*clStripWriteFunc)(struct clContext * C, struct clStripWriter * writer, struct clImage * strip);
+typedef clBool (*clStripFinishFunc)(struct clContext * C, struct clStripWriter * writer);
+typedef void (*clStripWriterDestroyFunc)(struct clContext * C, struct clStripWriter * writer);
+
+typedef struct clStripReader
+{
+    struct clImage * image; // Dimensions, depth and profile of the whole image (never has pixels)
+    int rowsRead;
+    void * nativeData;
+    clStripReadFunc readFunc; // Fills every row in strip (U16 pixels if image->depth > 8, U8 otherwise)
+    clStripReaderDestroyFunc destroyFunc;
+} clStripReader;
+
+typedef struct clStripWriter
+{
+    struct clImage * image; // Dimensions, depth and profile of the whole image (never has pixels)
+    int rowsWritten;
+    void * nativeData;
+    clStripWriteFunc writeFunc;
+    clStripFinishFunc finishFunc; // Called once all rows are written
+    clStripWriterDestroyFunc destroyFunc;
+} clStripWriter;
+
+// Used by format plugins. Both take ownership of image.
+clStripReader * clStripReaderCreate(struct clContext * C, struct clImage * image);
+clStripWriter * clStripWriterCreate(struct clContext * C, struct clImage * image);
+
+// strip->width must match the image width, and it must fit in the rows remaining
+clBool clStripReaderRead(struct clContext * C, clStripReader * reader, struct clImage * strip);
+void clStripReaderDestroy(struct clContext * C, clStripReader * reader);
+clBool clStripWriterWrite(struct clContext * C, clStripWriter * writer, struct clImage * strip);
+clBool clStripWriterFinish(struct clContext * C, clStripWriter * writer); // fails if any rows are missing
+void clStripWriterDestroy(struct clContext * C, clStripWriter * writer);
+
+#endif // ifndef COLORIST_STRIP_H
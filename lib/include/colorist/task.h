@@ -26,5 +26,53 @@ clTask * clTaskCreate(struct clContext * C, clTaskFunc func, void * userData);
 void clTaskJoin(struct clContext * C, clTask * task);
 void clTaskDestroy(struct clContext * C, clTask * task);
 int clTaskLimit(void);
+uint64_t clTaskCurrentThreadID(void); // unique among running threads
+
+// ---------------------------------------------------------------------------
+// clMutex
+
+typedef struct clMutex
+{
+    void * nativeData;
+} clMutex;
+
+clMutex * clMutexCreate(struct clContext * C);
+void clMutexDestroy(struct clContext * C, clMutex * mutex);
+void clMutexLock(clMutex * mutex);
+void clMutexUnlock(clMutex * mutex);
+
+// ---------------------------------------------------------------------------
+// clTaskPool
+
+// Processes items [start, start + count). Called concurrently from several threads with disjoint ranges.
+typedef void (*clTaskRangeFunc)(void * userData, int start, int count);
+
+// A set of persistent worker threads, reused across clTaskPoolRun() calls. The thread calling
+// clTaskPoolRun() also works on the job, so a pool with N workers runs N+1 ranges at once.
+typedef struct clTaskPool
+{
+    int workerCount;
+    clTask ** workers;
+    void * nativeData;
+
+    // Current job; everything below is guarded by the pool's lock
+    clTaskRangeFunc func;
+    void * userData;
+    int itemCount;
+    int chunkSize;
+    int nextItem;
+    int itemsRemaining;
+    unsigned int generation;
+    clBool busy;
+    clBool shutdown;
+} clTaskPool;
+
+clTaskPool * clTaskPoolCreate(struct clContext * C, int workerCount);
+void clTaskPoolDestroy(struct clContext * C, clTaskPool * pool);
+void clTaskPoolRun(struct clContext * C, clTaskPool * pool, int itemCount, int chunkSize, clTaskRangeFunc func, void * userData);
+
+// Splits [0, itemCount) into chunks of at least minChunkSize items and runs them across C->jobs
+// threads using the context's pool (created on first use). Runs inline when there is nothing to split.
+void clTaskParallelFor(struct clContext * C, int itemCount, int minChunkSize, clTaskRangeFunc func, void * userData);
 
 #endif // ifndef COLORIST_TASK_H
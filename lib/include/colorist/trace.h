@@ -0,0 +1,70 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#ifndef COLORIST_TRACE_H
+#define COLORIST_TRACE_H
+
+#include "colorist/types.h"
+
+struct clContext;
+struct cJSON;
+
+#define CL_TRACE_MAX_THREADS 256
+
+typedef enum clTraceCounter
+{
+    CL_TRACE_BYTES_READ = 0,
+    CL_TRACE_BYTES_WRITTEN,
+    CL_TRACE_PIXELS_TRANSFORMED,
+
+    CL_TRACE_COUNTER_COUNT
+} clTraceCounter;
+
+typedef struct clTraceEvent
+{
+    const char * name; // not owned, see clTraceBegin()
+    double start;      // seconds since the trace was created
+    double duration;
+    int thread; // index into clTrace.threadIDs
+} clTraceEvent;
+
+// Timed spans and running counters for everything a context does, so a run can be exported as a Chrome
+// trace (--trace) or summarized in --json output. C->trace is NULL until enabled, and every clTrace*()
+// call below is then nearly free.
+typedef struct clTrace
+{
+    Timer epoch;
+    clTraceEvent * events;
+    int eventCount;
+    int eventCapacity;
+    uint64_t threadIDs[CL_TRACE_MAX_THREADS]; // in order of first appearance; events beyond the last slot share it
+    int threadCount;
+    uint64_t counters[CL_TRACE_COUNTER_COUNT];
+    struct clMutex * lock;
+} clTrace;
+
+typedef struct clTraceSpan
+{
+    const char * name;
+    double start;
+} clTraceSpan;
+
+clTrace * clTraceCreate(struct clContext * C);
+void clTraceDestroy(struct clContext * C, clTrace * trace);
+
+// Spans may nest, but must end on the thread that began them. name is stored as-is, so it must outlive
+// the trace (use string literals).
+void clTraceBegin(struct clContext * C, clTraceSpan * span, const char * name);
+void clTraceEnd(struct clContext * C, clTraceSpan * span);
+void clTraceCount(struct clContext * C, clTraceCounter counter, uint64_t amount);
+
+// Chrome trace event format (chrome://tracing, https://ui.perfetto.dev)
+clBool clTraceWriteChrome(struct clContext * C, const char * filename);
+// Adds a "trace" summary (per span totals, per thread utilization, counters) to output
+void clTraceSummarize(struct clContext * C, struct cJSON * output);
+
+#endif // ifndef COLORIST_TRACE_H
@@ -18,6 +18,7 @@
 #include "lcms2.h"
 
 struct clContext;
+struct clMutex;
 struct clProfile;
 struct clProfilePrimaries;
 
@@ -67,6 +68,14 @@ typedef struct clTransform
     float ccmmHLGLuminance;
     clBool ccmmReady;
 
+    // Optional CCMM curve LUTs (see clTransformSetSourceDepth)
+    int lutSrcDepth;          // 0 if src values aren't known to be integral
+    float * lutSrcEOTF;       // (1 << lutSrcDepth) entries, indexed by the integral src value
+    float * lutDstOETF;       // Indexed by float exponent + top mantissa bits, interpolated (see transform.c)
+    float lutDstOETFZero;     // OETF(0), as 0 is outside of the table's range
+    float lutDstOETFMaxError; // Worst case difference between the interpolated and exact OETF
+    clBool lutReady;
+
     // Cache for LittleCMS objects
     cmsHPROFILE lcmsXYZProfile;
     cmsHTRANSFORM lcmsSrcToXYZ;
@@ -86,7 +95,46 @@ void clTransformPrepare(struct clContext * C, struct clTransform * transform);
 clBool clTransformUsesCCMM(struct clContext * C, clTransform * transform);
 const char * clTransformCMMName(struct clContext * C, clTransform * transform);    // Convenience function
 float clTransformGetLuminanceScale(struct clContext * C, clTransform * transform); // Convenience function
+// Promises that every src channel value this transform will see is exactly N / ((1 << depth) - 1)
+// (e.g. pixels that came from a U8/U16 buffer), allowing clTransformPrepare() to replace the CCMM
+// curve math with LUTs. Pass 0 to go back to exact curve math. Must be called prior to clTransformPrepare().
+void clTransformSetSourceDepth(struct clContext * C, clTransform * transform, int depth);
 void clTransformRun(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount);
+// clTransformRun() on the calling thread only, for callers that already split their work across threads
+// (see pipeline.h). The transform must already be prepared, and srcPixels / dstPixels must not overlap.
+void clTransformRunSerial(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount);
+
+// Runs an RGBA -> RGBA transform straight from U8/U16 pixels to U8/U16 pixels (normalized and
+// quantized exactly as clImagePrepareReadPixels() would), a cache-sized tile at a time, instead of
+// requiring full F32 copies of both images. Depths are only used to find the max channel value of U16 pixels.
+void clTransformRunInteger(struct clContext * C,
+                           clTransform * transform,
+                           clPixelFormat srcFormat,
+                           int srcDepth,
+                           const void * srcPixels,
+                           clPixelFormat dstFormat,
+                           int dstDepth,
+                           void * dstPixels,
+                           int pixelCount);
+
+// Instead of freeing it, clTransformDestroy() parks an already prepared transform in the context's
+// transform cache, and clTransformPrepare() hands that prepared state to the next transform needing
+// an identical one (same profile signatures, formats, tonemap, tonemap params and source depth),
+// skipping the LittleCMS transform / matrix / LUT setup. Entries are handed out (not shared), so
+// transforms stay private to whoever created them. Least recently used entries are dropped when full.
+typedef struct clTransformCache
+{
+    struct clTransformCacheEntry * entries; // most recently used first
+    int count;
+    int capacity; // 0 disables caching
+    int hits;
+    int misses;
+    struct clMutex * lock;
+} clTransformCache;
+
+clTransformCache * clTransformCacheCreate(struct clContext * C, int capacity);
+void clTransformCacheDestroy(struct clContext * C, clTransformCache * cache);
+void clTransformCacheClear(struct clContext * C, clTransformCache * cache); // also resets hits/misses
 
 // if X+Y+Z is 0, clTransformXYZToXYY() returns (whitePointX, whitePointY, 0)
 void clTransformXYZToXYY(struct clContext * C, float * dstXYY, const float * srcXYZ, float whitePointX, float whitePointY);
@@ -95,11 +143,33 @@ void clTransformXYYToXYZ(struct clContext * C, float * dstXYZ, const float * src
 int clTransformCalcHLGLuminance(int diffuseWhite);
 int clTransformCalcDefaultLuminanceFromHLG(int hlgLuminance);
 float clTransformCalcMaxY(clContext * C, clTransform * linearFromXYZ, clTransform * linearToXYZ, float x, float y);
+
+// clTransformCalcMaxY() solved directly against the matrices a linear, 1 nit profile of primaries would use
+// (with the same clamping), derived once up front. clTransformGamutCeilingMaxY() runs no transforms and
+// touches nothing shared, so any number of threads can call it at once.
+typedef struct clTransformGamutCeiling
+{
+    gbMat3 xyzToRGB;
+    gbMat3 rgbToXYZ;
+} clTransformGamutCeiling;
+void clTransformGamutCeilingInit(struct clContext * C, struct clProfilePrimaries * primaries, clTransformGamutCeiling * ceiling);
+float clTransformGamutCeilingMaxY(const clTransformGamutCeiling * ceiling, float x, float y);
 void clTransformDeriveXYZMatrix(struct clContext * C, struct clProfilePrimaries * primaries, gbMat3 * toXYZ);
 
 float clTransformEOTF_PQ(float N);
 float clTransformOETF_PQ(float L);
 
+// Vectorized CCMM conversion (transform_simd.c). Returns clFalse (doing nothing) if SIMD is
+// disabled (--simd off) or unavailable, in which case the caller should use the scalar path.
+clBool clTransformSIMDConvert(struct clContext * C,
+                              clTransform * transform,
+                              const float * srcPixels,
+                              int srcChannelCount,
+                              float * dstPixels,
+                              int dstChannelCount,
+                              int pixelCount);
+const char * clTransformSIMDName(struct clContext * C); // "avx2", "sse2", or "none"
+
 // define to debug transform matrix math in colorist-test
 // #define DEBUG_MATRIX_MATH
 
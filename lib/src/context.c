@@ -7,8 +7,11 @@
 
 #include "colorist/context.h"
 
+#include "colorist/image.h"
+#include "colorist/pixelmath.h"
 #include "colorist/profile.h"
 #include "colorist/task.h"
+#include "colorist/trace.h"
 #include "colorist/transform.h"
 
 #include "lcms2.h"
@@ -23,6 +26,11 @@
 #define CL_DEFAULT_QUALITY 90 // ?
 #define CL_DEFAULT_RATE 0     // Choosing a value here is dangerous as it is heavily impacted by image size
 
+// Enough for every transform a conversion makes (plus composite / stats / highlight), times a few files
+#define COLORIST_TRANSFORM_CACHE_SIZE 32
+#define COLORIST_PIXEL_POOL_BUDGET ((size_t)512 * 1024 * 1024) // idle bytes kept for reuse
+#define COLORIST_RESIZE_CACHE_SIZE 8                            // both axes of a few distinct resizes
+
 // ------------------------------------------------------------------------------------------------
 // Stock Primaries
 
@@ -60,6 +68,8 @@ clAction clActionFromString(struct clContext * C, const char * str)
         return CL_ACTION_CALC;
     if (!strcmp(str, "convert"))
         return CL_ACTION_CONVERT;
+    if (!strcmp(str, "batch"))
+        return CL_ACTION_BATCH;
     if (!strcmp(str, "modify"))
         return CL_ACTION_MODIFY;
     return CL_ACTION_ERROR;
@@ -80,6 +90,8 @@ const char * clActionToString(struct clContext * C, clAction action)
             return "calc";
         case CL_ACTION_CONVERT:
             return "convert";
+        case CL_ACTION_BATCH:
+            return "batch";
         case CL_ACTION_MODIFY:
             return "modify";
         case CL_ACTION_ERROR:
@@ -92,29 +104,42 @@ const char * clActionToString(struct clContext * C, clAction action)
 // ------------------------------------------------------------------------------------------------
 // clFormat
 
-static char const * clFormatDetectHeader(struct clContext * C, const char * filename)
+// Sniffs contents if it isn't NULL, otherwise the first 1KB of filename
+static char const * clFormatDetectHeader(struct clContext * C, const char * filename, struct clRaw * contents)
 {
     clRaw raw = CL_RAW_EMPTY;
-    if (clRawReadFileHeader(C, &raw, filename, 1024)) {
-        for (clFormatRecord * record = C->formats; record != NULL; record = record->next) {
-            if (record->format.detectFunc(C, &record->format, &raw)) {
-                clRawFree(C, &raw);
-                return record->format.name;
-            }
+    struct clRaw * header = contents;
+    if (!header) {
+        if (!clRawReadFileHeader(C, &raw, filename, 1024)) {
+            return NULL;
+        }
+        header = &raw;
+    }
+
+    const char * formatName = NULL;
+    for (clFormatRecord * record = C->formats; record != NULL; record = record->next) {
+        if (record->format.detectFunc(C, &record->format, header)) {
+            formatName = record->format.name;
+            break;
         }
     }
     clRawFree(C, &raw);
-    return NULL;
+    return formatName;
 }
 
 const char * clFormatDetect(struct clContext * C, const char * filename)
+{
+    return clFormatDetectContents(C, filename, NULL);
+}
+
+const char * clFormatDetectContents(struct clContext * C, const char * filename, struct clRaw * contents)
 {
     // If either slash is AFTER the last period in the filename, there is no extension
     const char * lastBackSlash = strrchr(filename, '\\');
     const char * lastSlash = strrchr(filename, '/');
     const char * ext = strrchr(filename, '.');
     if ((ext == NULL) || (lastBackSlash && (lastBackSlash > ext)) || (lastSlash && (lastSlash > ext))) {
-        ext = clFormatDetectHeader(C, filename);
+        ext = clFormatDetectHeader(C, filename, contents);
         if (ext)
             return ext;
 
@@ -137,7 +162,7 @@ const char * clFormatDetect(struct clContext * C, const char * filename)
         }
     }
 
-    ext = clFormatDetectHeader(C, filename);
+    ext = clFormatDetectHeader(C, filename, contents);
     if (ext)
         return ext;
 
@@ -343,6 +368,36 @@ const char * clFilterToString(struct clContext * C, clFilter filter)
     return "invalid";
 }
 
+// ------------------------------------------------------------------------------------------------
+// clLUTInterpolation
+
+clLUTInterpolation clLUTInterpolationFromString(struct clContext * C, const char * str)
+{
+    COLORIST_UNUSED(C);
+
+    if (!strcmp(str, "tetrahedral"))
+        return CL_LUT_INTERPOLATION_TETRAHEDRAL;
+    if (!strcmp(str, "trilinear"))
+        return CL_LUT_INTERPOLATION_TRILINEAR;
+    return CL_LUT_INTERPOLATION_INVALID;
+}
+
+const char * clLUTInterpolationToString(struct clContext * C, clLUTInterpolation interpolation)
+{
+    COLORIST_UNUSED(C);
+
+    switch (interpolation) {
+        case CL_LUT_INTERPOLATION_TETRAHEDRAL:
+            return "tetrahedral";
+        case CL_LUT_INTERPOLATION_TRILINEAR:
+            return "trilinear";
+        case CL_LUT_INTERPOLATION_INVALID:
+        default:
+            break;
+    }
+    return "invalid";
+}
+
 // ------------------------------------------------------------------------------------------------
 // clYUVFormat
 
@@ -404,6 +459,7 @@ void clConversionParamsSetDefaults(clContext * C, clConversionParams * params)
     params->bpc = 0;
     params->formatName = NULL;
     params->hald = NULL;
+    params->haldInterp = CL_LUT_INTERPOLATION_TETRAHEDRAL;
     params->iccOverrideOut = NULL;
     params->rect[0] = 0;
     params->rect[1] = 0;
@@ -417,10 +473,13 @@ void clConversionParamsSetDefaults(clContext * C, clConversionParams * params)
     params->stats = clFalse;
     params->tonemap = CL_TONEMAP_AUTO;
     params->readCodec = NULL;
+    params->readSpeed = -1;
     clTonemapParamsSetDefaults(C, &params->tonemapParams);
     params->compositeFilename = NULL;
     clWriteParamsSetDefaults(C, &params->writeParams);
     clBlendParamsSetDefaults(C, &params->compositeParams);
+    params->streamBudget = 0;
+    params->ladder = NULL;
 }
 
 void clWriteParamsSetDefaults(struct clContext * C, clWriteParams * writeParams)
@@ -448,6 +507,8 @@ static void clContextSetDefaultArgs(clContext * C)
     C->jobs = clTaskLimit();
     C->verbose = clFalse;
     C->ccmmAllowed = clTrue;
+    C->simdAllowed = clTrue;
+    C->traceFilename = NULL;
     C->inputFilename = NULL;
     C->outputFilename = NULL;
     C->defaultLuminance = COLORIST_DEFAULT_LUMINANCE;
@@ -484,6 +545,12 @@ clContext * clContextCreate(clContextSystem * system)
     // to fully honor the chad tags in the profiles (if any).
     cmsSetAdaptationStateTHR(C->lcms, 0);
 
+    C->taskPool = NULL;
+    C->trace = NULL;
+    C->transformCache = clTransformCacheCreate(C, COLORIST_TRANSFORM_CACHE_SIZE);
+    C->pixelPool = clPixelPoolCreate(C, COLORIST_PIXEL_POOL_BUDGET);
+    C->resizeCache = clResizeCacheCreate(C, COLORIST_RESIZE_CACHE_SIZE);
+
     clContextSetDefaultArgs(C);
     clContextRegisterBuiltinFormats(C);
     return C;
@@ -498,7 +565,18 @@ void clContextDestroy(clContext * C)
         clFree(freeme);
     }
     C->formats = NULL;
+    if (C->taskPool) {
+        clTaskPoolDestroy(C, C->taskPool);
+        C->taskPool = NULL;
+    }
+    if (C->trace) {
+        clTraceDestroy(C, C->trace);
+        C->trace = NULL;
+    }
+    clTransformCacheDestroy(C, C->transformCache); // before C->lcms, which its transforms live in
     cmsDeleteContext(C->lcms);
+    clResizeCacheDestroy(C, C->resizeCache);
+    clPixelPoolDestroy(C, C->pixelPool);
     clFree(C);
 }
 
@@ -763,6 +841,13 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
             } else if (!strcmp(arg, "--hald")) {
                 NEXTARG();
                 C->params.hald = arg;
+            } else if (!strcmp(arg, "--hald-interp")) {
+                NEXTARG();
+                C->params.haldInterp = clLUTInterpolationFromString(C, arg);
+                if (C->params.haldInterp == CL_LUT_INTERPOLATION_INVALID) {
+                    clContextLogError(C, "Unknown Hald CLUT interpolation: %s", arg);
+                    return clFalse;
+                }
             } else if (!strcmp(arg, "-i") || !strcmp(arg, "--iccin")) {
                 NEXTARG();
                 C->iccOverrideIn = arg;
@@ -772,7 +857,10 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                 if ((C->jobs <= 0) || (C->jobs > taskLimit))
                     C->jobs = taskLimit;
             } else if (!strcmp(arg, "--json")) {
-                // Allow it to exist on the cmdline, it doesn't adjust any params
+                // Doesn't adjust any params, but the output gets a trace summary
+                if (!C->trace) {
+                    C->trace = clTraceCreate(C);
+                }
             } else if (!strcmp(arg, "-l") || !strcmp(arg, "--luminance")) {
                 NEXTARG();
                 if (arg[0] == 's') {
@@ -803,6 +891,16 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                 C->params.stripTags = arg;
             } else if (!strcmp(arg, "--stats")) {
                 C->params.stats = clTrue;
+            } else if (!strcmp(arg, "--ladder")) {
+                NEXTARG();
+                C->params.ladder = arg;
+            } else if (!strcmp(arg, "--stream")) {
+                NEXTARG();
+                C->params.streamBudget = atoi(arg);
+                if (C->params.streamBudget <= 0) {
+                    clContextLogError(C, "Invalid stream budget (in MB): %s", arg);
+                    return clFalse;
+                }
             } else if (!strcmp(arg, "-t") || !strcmp(arg, "--tonemap")) {
                 NEXTARG();
                 if (!clTonemapFromString(C, arg, &C->params.tonemap, &C->params.tonemapParams)) {
@@ -858,6 +956,22 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                     clContextLogError(C, "Unknown CMM: %s", arg);
                     return clFalse;
                 }
+            } else if (!strcmp(arg, "--trace")) {
+                NEXTARG();
+                C->traceFilename = arg;
+                if (!C->trace) {
+                    C->trace = clTraceCreate(C);
+                }
+            } else if (!strcmp(arg, "--simd")) {
+                NEXTARG();
+                if (!strcmp(arg, "auto") || !strcmp(arg, "on")) {
+                    C->simdAllowed = clTrue;
+                } else if (!strcmp(arg, "off")) {
+                    C->simdAllowed = clFalse;
+                } else {
+                    clContextLogError(C, "Unknown SIMD mode: %s", arg);
+                    return clFalse;
+                }
             } else if (!strcmp(arg, "--deflum")) {
                 NEXTARG();
                 C->defaultLuminance = atoi(arg);
@@ -907,6 +1021,14 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                 NEXTARG();
                 C->params.rotate = atoi(arg);
                 C->params.rotate = CL_MAX(C->params.rotate % 4, 0);
+            } else if (!strcmp(arg, "--read-speed")) {
+                NEXTARG();
+                if (!strcmp(arg, "auto")) {
+                    C->params.readSpeed = -1;
+                } else {
+                    C->params.readSpeed = atoi(arg);
+                    C->params.readSpeed = CL_CLAMP(C->params.readSpeed, 0, 10);
+                }
             } else if (!strcmp(arg, "--speed")) {
                 NEXTARG();
                 if (!strcmp(arg, "auto")) {
@@ -959,7 +1081,7 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
             if (C->action == CL_ACTION_NONE) {
                 C->action = clActionFromString(C, arg);
                 if (C->action == CL_ACTION_ERROR) {
-                    clContextLogError(C, "unknown action '%s', expecting convert, identify, or generate", arg);
+                    clContextLogError(C, "unknown action '%s', expecting convert, batch, identify, or generate", arg);
                 }
             } else if (filenames[0] == NULL) {
                 filenames[0] = arg;
@@ -1021,6 +1143,15 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
             }
             break;
 
+        case CL_ACTION_BATCH:
+            C->inputFilename = filenames[0];
+            if (!C->inputFilename) {
+                clContextLogError(C, "batch requires a manifest filename or an input glob.");
+                return clFalse;
+            }
+            C->outputFilename = filenames[1]; // optional output template
+            break;
+
         case CL_ACTION_MODIFY:
             C->inputFilename = filenames[0];
             if (!C->inputFilename) {
@@ -1067,6 +1198,7 @@ void clContextPrintSyntax(clContext * C)
     }
 
     clContextLog(C, NULL, 0, "Syntax: colorist convert  [input]        [output]       [OPTIONS]");
+    clContextLog(C, NULL, 0, "        colorist batch    [manifest|glob]  [template]     [OPTIONS]");
     clContextLog(C, NULL, 0, "        colorist identify [input]                       [OPTIONS]");
     clContextLog(C, NULL, 0, "        colorist generate                [output.icc]   [OPTIONS]");
     clContextLog(C, NULL, 0, "        colorist generate [image string] [output image] [OPTIONS]");
@@ -1078,6 +1210,8 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "    -j,--jobs JOBS           : Number of jobs to use when working. 0 for as many as possible (default)");
     clContextLog(C, NULL, 0, "    -v,--verbose             : Verbose mode.");
     clContextLog(C, NULL, 0, "    --cmm WHICH,--cms WHICH  : Choose Color Management Module/System: auto (default), lcms, colorist (built-in, uses when possible)");
+    clContextLog(C, NULL, 0, "    --simd MODE              : Vectorized built-in CMM math: auto (default), off (scalar, exact libm math)");
+    clContextLog(C, NULL, 0, "    --trace FILENAME         : Write a Chrome trace (chrome://tracing, ui.perfetto.dev) of where the time went");
     clContextLog(C,
                  NULL,
                  0,
@@ -1110,7 +1244,8 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "    --quantizer MIN,MAX      : Choose min and max quantizer values directly instead of using -q (AVIF only, 0-63 range, 0,0 is lossless)");
     clContextLog(C, NULL, 0, "    --tiling ROWS,COLS       : Enable tiling when encoding (AVIF only, 0-6 range, log2 based. Enables 2^ROWS rows and/or 2^COLS cols)");
     clContextLog(C, NULL, 0, "    --codec READ,WRITE       : Specify which internal codec to be used when decoding (AVIF only, auto,auto is default, see libavif version below for choices)");
-    clContextLog(C, NULL, 0, "    --speed SPEED            : Specify the quality/speed tradeoff when encoding (AVIF only, [0-10] range. auto = default (let the codec decide), 0=best quality, 10=fastest)");
+    clContextLog(C, NULL, 0, "    --speed SPEED            : Specify the quality/speed tradeoff when encoding (AVIF, JPEG and PNG, [0-10] range. auto = default (let the codec decide), 0=best quality/compression, 10=fastest)");
+    clContextLog(C, NULL, 0, "    --read-speed SPEED       : Specify the quality/speed tradeoff when decoding (JPEG only, [0-10] range. auto = default (full quality), 10=fastest)");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Convert Options:");
     clContextLog(C, NULL, 0, "    --resize w,h,filter      : Resize dst image to WxH. Use optional filter (auto (default), box, triangle, cubic, catmullrom, mitchell, nearest)");
@@ -1121,8 +1256,18 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "    --composite-premultiplied: When compositing, assume composite image's alpha is premultiplied (default: false)");
     clContextLog(C, NULL, 0, "    --composite-tonemap TM   : When compositing, determines if composite image is tonemapped before blend. auto (default), on, or off");
     clContextLog(C, NULL, 0, "    --composite-offset x,y   : When compositing, offsets source image onto destination image");
-    clContextLog(C, NULL, 0, "    --hald FILENAME          : Image containing valid Hald CLUT to be used after color conversion");
+    clContextLog(C, NULL, 0, "    --hald FILENAME          : Hald CLUT image or .cube 3D LUT to be used after color conversion");
+    clContextLog(C, NULL, 0, "    --hald-interp MODE       : Hald CLUT / 3D LUT interpolation: tetrahedral (default), trilinear");
     clContextLog(C, NULL, 0, "    --stats                  : Enable post-conversion stats (MSE, PSNR, etc)");
+    clContextLog(C, NULL, 0, "    --stream MB              : Convert in strips using roughly MB megabytes of pixel buffers (PNG/JPG, not with resize/rotate/composite/stats/-a)");
+    clContextLog(C, NULL, 0, "    --ladder LEVELS          : Write many sizes from one decode. Comma separated WxH[:FORMAT[:QUALITY]] (either W or H can be 0), optional filter.");
+    clContextLog(C, NULL, 0, "                               The output filename's %%d is replaced with each width, and its extension with FORMAT (if any)");
+    clContextLog(C, NULL, 0, "");
+    clContextLog(C, NULL, 0, "Batch Options (plus all convert options above):");
+    clContextLog(C, NULL, 0, "    manifest                 : Text file with one \"input\" or \"input<TAB>output\" per line (# comments)");
+    clContextLog(C, NULL, 0, "    glob                     : Any input containing * or ? is matched against files instead (quote it)");
+    clContextLog(C, NULL, 0, "    template                 : Output filename for inputs without one, %%s is the input's name without extension");
+    clContextLog(C, NULL, 0, "    --json                   : Output a JSON summary with per-file timings instead of standard log output");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Identify / Calc Options:");
     clContextLog(C, NULL, 0, "    -z,--rect x,y,w,h        : Pixels to dump. x,y,w,h");
@@ -1134,6 +1279,7 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "See image string examples here: https://joedrago.github.io/colorist/docs/Usage.html");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "CPUs Available: %d", clTaskLimit());
+    clContextLog(C, NULL, 0, "SIMD Available: %s", clTransformSIMDName(C));
     clContextLog(C, NULL, 0, "");
     clContextPrintVersions(C);
 }
@@ -0,0 +1,513 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/context.h"
+
+#include "colorist/image.h"
+#include "colorist/task.h"
+#include "colorist/trace.h"
+#include "colorist/transform.h"
+
+#include "cJSON.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <glob.h>
+#endif
+
+typedef struct clBatchFile
+{
+    char * inputFilename;
+    char * outputFilename;
+    int result;
+    clConvertTimings timings;
+} clBatchFile;
+
+typedef struct clBatchLogLine
+{
+    char * section; // NULL when the line had none
+    int indent;
+    char * text;
+    clBool error; // logged with clContextLogError()
+} clBatchLogLine;
+
+// One thread's share of the batch. Each worker converts with its own copy of the batch's context, so the
+// readers' per-file state (readExtraInfo) and the log of the file in flight belong to that worker alone. The
+// copy shares the formats, lcms context, caches, pixel pool and trace, which are all safe to use concurrently.
+typedef struct clBatchWorker
+{
+    clContext context; // first, so batchWorkerLog() can find its worker from the clContext it is handed
+    struct clBatch * batch;
+    clBatchLogLine * lines; // the current file's log, replayed on the batch's context once the file is done
+    int lineCount;
+    int lineCapacity;
+} clBatchWorker;
+
+typedef struct clBatch
+{
+    clContext * C;
+    clConvertCache * cache;
+    clBatchFile * files;
+    int fileCount;
+    int fileCapacity;
+
+    clBatchWorker * workers;
+    int workerCount;
+    int nextFile;   // next file a worker should pick up
+    clMutex * lock; // guards nextFile and logging to C
+} clBatch;
+
+// ---------------------------------------------------------------------------
+// File list
+
+// Expands template's %s with filename's name, minus its directory and extension
+static char * batchApplyTemplate(clContext * C, const char * template, const char * filename)
+{
+    const char * name = filename;
+    const char * p;
+    for (p = filename; *p; ++p) {
+        if ((*p == '/') || (*p == '\\')) {
+            name = p + 1;
+        }
+    }
+    const char * ext = strrchr(name, '.');
+    int nameLen = ext ? (int)(ext - name) : (int)strlen(name);
+
+    const char * marker = strstr(template, "%s");
+    int prefixLen = (int)(marker - template);
+    size_t outputLen = strlen(template) - 2 + (size_t)nameLen;
+    char * output = clAllocate(outputLen + 1);
+    memcpy(output, template, (size_t)prefixLen);
+    memcpy(output + prefixLen, name, (size_t)nameLen);
+    strcpy(output + prefixLen + nameLen, marker + 2);
+    return output;
+}
+
+static clBool batchAddFile(clBatch * batch, const char * inputFilename, const char * outputFilename, const char * template)
+{
+    clContext * C = batch->C;
+    if (!outputFilename && !template) {
+        clContextLogError(C, "No output filename for %s, and no output template was given", inputFilename);
+        return clFalse;
+    }
+
+    if (batch->fileCount == batch->fileCapacity) {
+        int newCapacity = batch->fileCapacity ? (batch->fileCapacity * 2) : 16;
+        clBatchFile * newFiles = clAllocate(sizeof(clBatchFile) * newCapacity);
+        if (batch->files) {
+            memcpy(newFiles, batch->files, sizeof(clBatchFile) * batch->fileCount);
+            clFree(batch->files);
+        }
+        batch->files = newFiles;
+        batch->fileCapacity = newCapacity;
+    }
+
+    clBatchFile * file = &batch->files[batch->fileCount];
+    memset(file, 0, sizeof(clBatchFile));
+    file->inputFilename = clContextStrdup(C, inputFilename);
+    if (outputFilename) {
+        file->outputFilename = clContextStrdup(C, outputFilename);
+    } else {
+        file->outputFilename = batchApplyTemplate(C, template, inputFilename);
+    }
+    ++batch->fileCount;
+    return clTrue;
+}
+
+// One input per line, optionally followed by a TAB and its output. Blank lines and lines starting with # are skipped.
+static clBool batchReadManifest(clBatch * batch, const char * manifestFilename, const char * template)
+{
+    clContext * C = batch->C;
+    clBool result = clTrue;
+    char line[4096];
+
+    FILE * f = fopen(manifestFilename, "r");
+    if (!f) {
+        clContextLogError(C, "Can't open batch manifest: %s", manifestFilename);
+        return clFalse;
+    }
+
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineNumber;
+
+        size_t len = strlen(line);
+        if ((len == sizeof(line) - 1) && (line[len - 1] != '\n') && !feof(f)) {
+            clContextLogError(C, "%s:%d: line too long", manifestFilename, lineNumber);
+            result = clFalse;
+            break;
+        }
+        while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) {
+            line[--len] = 0;
+        }
+        if ((len == 0) || (line[0] == '#')) {
+            continue;
+        }
+
+        char * outputFilename = strchr(line, '\t');
+        if (outputFilename) {
+            *outputFilename = 0;
+            ++outputFilename;
+            if (*outputFilename == 0) {
+                outputFilename = NULL;
+            }
+        }
+        if (!batchAddFile(batch, line, outputFilename, template)) {
+            result = clFalse;
+            break;
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+static clBool batchGlob(clBatch * batch, const char * pattern, const char * template)
+{
+    clContext * C = batch->C;
+    clBool result = clTrue;
+
+#ifdef _WIN32
+    // FindFirstFile only reports names, so keep the pattern's directory around to prepend
+    char path[MAX_PATH];
+    int dirLen = 0;
+    for (int i = 0; pattern[i]; ++i) {
+        if ((pattern[i] == '/') || (pattern[i] == '\\')) {
+            dirLen = i + 1;
+        }
+    }
+
+    WIN32_FIND_DATAA findData;
+    HANDLE findHandle = FindFirstFileA(pattern, &findData);
+    if (findHandle != INVALID_HANDLE_VALUE) {
+        do {
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                continue;
+            }
+            if ((dirLen + strlen(findData.cFileName)) >= MAX_PATH) {
+                continue;
+            }
+            memcpy(path, pattern, dirLen);
+            strcpy(path + dirLen, findData.cFileName);
+            if (!batchAddFile(batch, path, NULL, template)) {
+                result = clFalse;
+                break;
+            }
+        } while (FindNextFileA(findHandle, &findData));
+        FindClose(findHandle);
+    }
+#else
+    glob_t globResults;
+    int globResult = glob(pattern, GLOB_MARK, NULL, &globResults);
+    if (globResult == 0) {
+        for (size_t i = 0; i < globResults.gl_pathc; ++i) {
+            const char * path = globResults.gl_pathv[i];
+            size_t len = strlen(path);
+            if ((len > 0) && (path[len - 1] == '/')) {
+                continue; // directory (GLOB_MARK)
+            }
+            if (!batchAddFile(batch, path, NULL, template)) {
+                result = clFalse;
+                break;
+            }
+        }
+    } else if (globResult != GLOB_NOMATCH) {
+        clContextLogError(C, "Failed to expand batch glob: %s", pattern);
+        result = clFalse;
+    }
+    globfree(&globResults);
+#endif
+
+    if (result && (batch->fileCount == 0)) {
+        clContextLogError(C, "No files match batch glob: %s", pattern);
+        result = clFalse;
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Batch
+
+static void batchWorkerAddLine(clBatchWorker * worker,
+                               const char * section,
+                               int indent,
+                               clBool error,
+                               const char * format,
+                               va_list args)
+{
+    clContext * C = worker->batch->C;
+
+    va_list sizeArgs;
+    va_copy(sizeArgs, args);
+    int needed = vsnprintf(NULL, 0, format, sizeArgs);
+    va_end(sizeArgs);
+    if (needed < 0) {
+        return;
+    }
+
+    if (worker->lineCount == worker->lineCapacity) {
+        int newCapacity = worker->lineCapacity ? (worker->lineCapacity * 2) : 32;
+        clBatchLogLine * newLines = clAllocate(sizeof(clBatchLogLine) * newCapacity);
+        if (worker->lines) {
+            memcpy(newLines, worker->lines, sizeof(clBatchLogLine) * worker->lineCount);
+            clFree(worker->lines);
+        }
+        worker->lines = newLines;
+        worker->lineCapacity = newCapacity;
+    }
+
+    clBatchLogLine * line = &worker->lines[worker->lineCount];
+    line->section = section ? clContextStrdup(C, section) : NULL;
+    line->indent = indent;
+    line->text = clAllocate(needed + 1);
+    vsnprintf(line->text, needed + 1, format, args);
+    line->error = error;
+    ++worker->lineCount;
+}
+
+static void batchWorkerLog(clContext * C, const char * section, int indent, const char * format, va_list args)
+{
+    batchWorkerAddLine((clBatchWorker *)C, section, indent, clFalse, format, args);
+}
+
+static void batchWorkerLogError(clContext * C, const char * format, va_list args)
+{
+    batchWorkerAddLine((clBatchWorker *)C, NULL, 0, clTrue, format, args);
+}
+
+// Replays the worker's buffered lines on the batch's context in one go, so each file's log reads as a block
+static void batchWorkerFlush(clBatchWorker * worker)
+{
+    clBatch * batch = worker->batch;
+    clContext * C = batch->C;
+
+    clMutexLock(batch->lock);
+    for (int i = 0; i < worker->lineCount; ++i) {
+        clBatchLogLine * line = &worker->lines[i];
+        if (line->error) {
+            clContextLogError(C, "%s", line->text);
+        } else {
+            clContextLog(C, line->section, line->indent, "%s", line->text);
+        }
+    }
+    clMutexUnlock(batch->lock);
+
+    for (int i = 0; i < worker->lineCount; ++i) {
+        if (worker->lines[i].section) {
+            clFree(worker->lines[i].section);
+        }
+        clFree(worker->lines[i].text);
+    }
+    worker->lineCount = 0;
+}
+
+// Each item is a worker, which keeps taking the next unconverted file until there are none left
+static void batchWorkerFunc(void * userData, int start, int count)
+{
+    clBatch * batch = (clBatch *)userData;
+    for (int w = start; w < (start + count); ++w) {
+        clBatchWorker * worker = &batch->workers[w];
+        clContext * C = &worker->context;
+        for (;;) {
+            clMutexLock(batch->lock);
+            int fileIndex = batch->nextFile;
+            if (fileIndex < batch->fileCount) {
+                ++batch->nextFile;
+            }
+            clMutexUnlock(batch->lock);
+            if (fileIndex >= batch->fileCount) {
+                break;
+            }
+
+            clBatchFile * file = &batch->files[fileIndex];
+            clTraceSpan span;
+            clTraceBegin(C, &span, "file");
+            file->result = clContextConvertFile(C, file->inputFilename, file->outputFilename, batch->cache, &file->timings);
+            clTraceEnd(C, &span);
+            batchWorkerFlush(worker);
+        }
+    }
+}
+
+int clContextBatch(clContext * C, struct cJSON * output)
+{
+    Timer overall;
+    int returnCode = 0;
+    int failureCount = 0;
+
+    clBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.C = C;
+
+    timerStart(&overall);
+
+    const char * template = C->outputFilename;
+    if (template) {
+        const char * marker = strstr(template, "%s");
+        if (!marker || strchr(marker + 2, '%') || (strchr(template, '%') != marker)) {
+            clContextLogError(C, "Batch output template must contain exactly one %%s (and no other %%): %s", template);
+            returnCode = 1;
+            goto batchCleanup;
+        }
+    }
+
+    clBool isGlob = (strchr(C->inputFilename, '*') || strchr(C->inputFilename, '?')) ? clTrue : clFalse;
+    if (isGlob) {
+        if (!batchGlob(&batch, C->inputFilename, template)) {
+            returnCode = 1;
+            goto batchCleanup;
+        }
+    } else {
+        if (!batchReadManifest(&batch, C->inputFilename, template)) {
+            returnCode = 1;
+            goto batchCleanup;
+        }
+    }
+
+    clContextLog(C, "action", 0, "Batch [%d max threads]: %d file%s from %s", C->jobs, batch.fileCount, (batch.fileCount == 1) ? "" : "s", C->inputFilename);
+    if (batch.fileCount == 0) {
+        goto batchCleanup;
+    }
+
+    batch.cache = clConvertCacheCreate(C, &C->params, C->iccOverrideIn);
+    if (!batch.cache) {
+        returnCode = 1;
+        goto batchCleanup;
+    }
+
+    int transformHits = C->transformCache->hits;
+    int transformMisses = C->transformCache->misses;
+    int poolAllocations, poolReuses;
+    clPixelPoolGetStats(C, &poolAllocations, &poolReuses);
+
+    // The shared pool is busy running the workers, so a conversion's own clTaskParallelFor() calls would run
+    // inline. With fewer files than jobs, the spare jobs go to the workers instead, each of which then gets its
+    // own pool for them.
+    batch.workerCount = CL_MAX(1, CL_MIN(C->jobs, batch.fileCount));
+    batch.workers = clAllocate(sizeof(clBatchWorker) * batch.workerCount);
+    for (int w = 0; w < batch.workerCount; ++w) {
+        clBatchWorker * worker = &batch.workers[w];
+        memcpy(&worker->context, C, sizeof(clContext));
+        worker->context.system.log = batchWorkerLog;
+        worker->context.system.error = batchWorkerLogError;
+        worker->context.jobs = (C->jobs / batch.workerCount) + ((w < (C->jobs % batch.workerCount)) ? 1 : 0);
+        worker->context.taskPool = NULL;
+        memset(&worker->context.readExtraInfo, 0, sizeof(worker->context.readExtraInfo));
+        worker->batch = &batch;
+    }
+    batch.lock = clMutexCreate(C);
+    clTaskParallelFor(C, batch.workerCount, 1, batchWorkerFunc, &batch);
+    transformHits = C->transformCache->hits - transformHits;
+    transformMisses = C->transformCache->misses - transformMisses;
+    {
+        int allocations, reuses;
+        clPixelPoolGetStats(C, &allocations, &reuses);
+        poolAllocations = allocations - poolAllocations;
+        poolReuses = reuses - poolReuses;
+    }
+
+    cJSON * jsonFiles = NULL;
+    if (output) {
+        jsonFiles = cJSON_CreateArray();
+        cJSON_AddItemToObject(output, "files", jsonFiles);
+    }
+    for (int i = 0; i < batch.fileCount; ++i) {
+        clBatchFile * file = &batch.files[i];
+        if (file->result != 0) {
+            ++failureCount;
+        }
+        clContextLog(C,
+                     "batch",
+                     1,
+                     "%s: %s -> %s (decode: %.3f, convert: %.3f, encode: %.3f, total: %.3f sec)",
+                     (file->result == 0) ? "OK    " : "FAILED",
+                     file->inputFilename,
+                     file->outputFilename,
+                     file->timings.decodeSeconds,
+                     file->timings.convertSeconds,
+                     file->timings.encodeSeconds,
+                     file->timings.totalSeconds);
+
+        if (jsonFiles) {
+            cJSON * jsonFile = cJSON_CreateObject();
+            cJSON_AddStringToObject(jsonFile, "input", file->inputFilename);
+            cJSON_AddStringToObject(jsonFile, "output", file->outputFilename);
+            cJSON_AddBoolToObject(jsonFile, "ok", (file->result == 0) ? 1 : 0);
+            cJSON_AddNumberToObject(jsonFile, "outputBytes", (file->result == 0) ? clFileSize(file->outputFilename) : 0);
+            cJSON_AddNumberToObject(jsonFile, "decodeSeconds", file->timings.decodeSeconds);
+            cJSON_AddNumberToObject(jsonFile, "convertSeconds", file->timings.convertSeconds);
+            cJSON_AddNumberToObject(jsonFile, "encodeSeconds", file->timings.encodeSeconds);
+            cJSON_AddNumberToObject(jsonFile, "totalSeconds", file->timings.totalSeconds);
+            cJSON_AddItemToArray(jsonFiles, jsonFile);
+        }
+    }
+
+    double totalSeconds = timerElapsedSeconds(&overall);
+    clContextLog(C,
+                 "batch",
+                 0,
+                 "Converted %d of %d files, %d dst profile cache hit%s",
+                 batch.fileCount - failureCount,
+                 batch.fileCount,
+                 batch.cache->dstProfileHits,
+                 (batch.cache->dstProfileHits == 1) ? "" : "s");
+    clContextLog(C, "batch", 0, "Transform cache: %d hits, %d misses", transformHits, transformMisses);
+    clContextLog(C,
+                 "batch",
+                 0,
+                 "Pixel buffers: %d of %d reused (%d%%)",
+                 poolReuses,
+                 poolAllocations,
+                 (poolAllocations > 0) ? (100 * poolReuses) / poolAllocations : 0);
+    clContextLog(C, "timing", -1, OVERALL_TIMING_FORMAT, totalSeconds);
+    if (output) {
+        cJSON_AddNumberToObject(output, "fileCount", batch.fileCount);
+        cJSON_AddNumberToObject(output, "failureCount", failureCount);
+        cJSON_AddNumberToObject(output, "jobs", C->jobs);
+        cJSON_AddNumberToObject(output, "profileCacheHits", batch.cache->dstProfileHits);
+        cJSON_AddNumberToObject(output, "transformCacheHits", transformHits);
+        cJSON_AddNumberToObject(output, "transformCacheMisses", transformMisses);
+        cJSON_AddNumberToObject(output, "pixelBufferAllocations", poolAllocations);
+        cJSON_AddNumberToObject(output, "pixelBufferReuses", poolReuses);
+        cJSON_AddNumberToObject(output, "totalSeconds", totalSeconds);
+    }
+    if (failureCount > 0) {
+        returnCode = 1;
+    }
+
+batchCleanup:
+    for (int w = 0; w < batch.workerCount; ++w) {
+        clBatchWorker * worker = &batch.workers[w];
+        if (worker->context.taskPool) {
+            clTaskPoolDestroy(C, worker->context.taskPool);
+        }
+        if (worker->lines) {
+            clFree(worker->lines);
+        }
+    }
+    if (batch.workers) {
+        clFree(batch.workers);
+    }
+    if (batch.lock) {
+        clMutexDestroy(C, batch.lock);
+    }
+    if (batch.cache) {
+        clConvertCacheDestroy(C, batch.cache);
+    }
+    for (int i = 0; i < batch.fileCount; ++i) {
+        clFree(batch.files[i].inputFilename);
+        clFree(batch.files[i].outputFilename);
+    }
+    if (batch.files) {
+        clFree(batch.files);
+    }
+    return returnCode;
+}
@@ -8,10 +8,18 @@
 #include "colorist/context.h"
 
 #include "colorist/image.h"
+#include "colorist/lut.h"
+#include "colorist/pipeline.h"
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
+#include "colorist/strip.h"
 #include "colorist/task.h"
+#include "colorist/trace.h"
+#include "colorist/transform.h"
 
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define FAIL()               \
@@ -31,9 +39,686 @@ struct ImageInfo
     int luminance;
 };
 
+// Returns NULL if the conversion can be streamed (--stream), otherwise the reason it can't be
+static const char * streamBlocker(clContext * C, const char * inputFilename, clConversionParams * params)
+{
+    if ((params->resizeW > 0) || (params->resizeH > 0)) {
+        return "resize";
+    }
+    if (params->ladder) {
+        return "ladder";
+    }
+    if (params->rotate != 0) {
+        return "rotate";
+    }
+    if (params->autoGrade) {
+        return "autograde";
+    }
+    if (params->compositeFilename) {
+        return "composite";
+    }
+    if (params->stats) {
+        return "stats";
+    }
+    if (!strcmp(params->formatName, "icc")) {
+        return "icc output";
+    }
+
+    const char * srcFormatName = clFormatDetect(C, inputFilename);
+    clFormat * srcFormat = srcFormatName ? clContextFindFormat(C, srcFormatName) : NULL;
+    if (!srcFormat || !srcFormat->readStripsFunc) {
+        return "unsupported input format";
+    }
+    clFormat * dstFormat = clContextFindFormat(C, params->formatName);
+    if (!dstFormat || !dstFormat->writeStripsFunc) {
+        return "unsupported output format";
+    }
+    return NULL;
+}
+
+// Reads the next strip of at most rowsPerStrip rows inside of crop (reading past any rows above it). The strip is
+// as wide as the whole image; crop's columns are picked out by the pipeline. Returns NULL on failure.
+static clImage * readCroppedStrip(clContext * C, clStripReader * reader, int rowsPerStrip, const int crop[4])
+{
+    int cropEndY = crop[1] + crop[3];
+    for (;;) {
+        int y = reader->rowsRead;
+        int rowCount = CL_MIN(rowsPerStrip, cropEndY - y);
+        if (y < crop[1]) {
+            rowCount = CL_MIN(rowCount, crop[1] - y);
+        }
+
+        clImage * strip = clImageCreate(C, reader->image->width, rowCount, reader->image->depth, reader->image->profile);
+        if (!clStripReaderRead(C, reader, strip)) {
+            clImageDestroy(C, strip);
+            return NULL;
+        }
+        if (y < crop[1]) {
+            clImageDestroy(C, strip);
+            continue;
+        }
+        return strip;
+    }
+}
+
+// The streaming equivalent of clImageConvertPipeline() (with a Hald CLUT) + clContextWrite(). srcImage only describes
+// the (cropped) source image, the pixels come from reader. Adds to timings.
+static clBool convertStrips(clContext * C,
+                            const char * inputFilename,
+                            const char * outputFilename,
+                            clStripReader * reader,
+                            clImage * srcImage,
+                            const int crop[4],
+                            int depth,
+                            clProfile * dstProfile,
+                            clConversionParams * params,
+                            clConvertCache * cache,
+                            clConvertTimings * timings)
+{
+    Timer t;
+    clBool result = clFalse;
+    clStripReader * measureReader = NULL;
+    clStripWriter * writer = NULL;
+    clTransform * transform = NULL;
+    clPipeline * pipeline = NULL;
+    int cropEndY = crop[1] + crop[3];
+
+    // Size strips to fit every pixel buffer that is alive at once in the budget
+    clPixelFormat srcFormat = (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+    clPixelFormat dstFormat = (depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+    size_t rowBytes = (size_t)CL_BYTES_PER_PIXEL(srcFormat) * reader->image->width;
+    rowBytes += (size_t)CL_BYTES_PER_PIXEL(dstFormat) * crop[2];
+    size_t budgetRows = ((size_t)params->streamBudget * 1024 * 1024) / rowBytes;
+    int rowsPerStrip = (budgetRows < (size_t)crop[3]) ? (int)budgetRows : crop[3];
+    if (rowsPerStrip < 1) {
+        rowsPerStrip = 1;
+    }
+    clContextLog(C, "stream", 0, "Streaming %d rows per strip (%d MB budget)", rowsPerStrip, params->streamBudget);
+
+    clTonemap tonemap = params->tonemap;
+    if (tonemap == CL_TONEMAP_AUTO) {
+        // Only pay for an extra decoding pass to measure the source if its brightest possible pixel would be tonemapped
+        float largestChannel = 1.0f;
+        int potentialPeakLuminance = (int)clImageChannelLuminance(C, srcImage->profile, largestChannel);
+        if (clImageAutoTonemap(C, potentialPeakLuminance, depth, dstProfile, clFalse) == CL_TONEMAP_ON) {
+            clContextLog(C, "stream", 0, "Measuring source peak luminance (extra decoding pass)...");
+            timerStart(&t);
+            measureReader = clContextReadStrips(C, inputFilename, cache->srcOverrideProfile, NULL);
+            if (!measureReader) {
+                goto convertStripsCleanup;
+            }
+            largestChannel = 0.0f;
+            while (measureReader->rowsRead < cropEndY) {
+                clImage * strip = readCroppedStrip(C, measureReader, rowsPerStrip, crop);
+                if (!strip) {
+                    goto convertStripsCleanup;
+                }
+                int stripRect[4] = { crop[0], 0, crop[2], strip->height };
+                largestChannel = CL_MAX(largestChannel, clImageLargestChannelRect(C, strip, stripRect));
+                clImageDestroy(C, strip);
+            }
+            clStripReaderDestroy(C, measureReader);
+            measureReader = NULL;
+            timings->decodeSeconds += timerElapsedSeconds(&t);
+            clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+        }
+        tonemap = clImageAutoTonemap(C, (int)clImageChannelLuminance(C, srcImage->profile, largestChannel), depth, dstProfile, clTrue);
+    }
+
+    int srcDepth = (srcFormat == CL_PIXELFORMAT_U16) ? CL_CLAMP(srcImage->depth, 8, 16) : 8;
+    transform = clTransformCreate(C, srcImage->profile, CL_XF_RGBA, dstProfile, CL_XF_RGBA, tonemap);
+    memcpy(&transform->tonemapParams, &params->tonemapParams, sizeof(clTonemapParams));
+    if ((crop[2] * crop[3]) >= (1 << srcDepth)) {
+        clTransformSetSourceDepth(C, transform, srcDepth);
+    }
+    clTransformPrepare(C, transform);
+    clContextLog(C,
+                 "convert",
+                 0,
+                 "Converting (%s, lum scale %gx, %s)...",
+                 clTransformCMMName(C, transform),
+                 clTransformGetLuminanceScale(C, transform),
+                 transform->tonemapEnabled ? "tonemap" : "clip");
+
+    pipeline = clPipelineCreate(C);
+    if (cache->hald) {
+        clContextLog(C,
+                     "hald",
+                     0,
+                     "Performing Hald CLUT postprocessing (%s, fused with conversion)...",
+                     clLUTInterpolationToString(C, cache->hald->interpolation));
+        clPipelineAddLUT3D(C, pipeline, cache->hald);
+    }
+
+    clImage * dstHeader = clImageCreate(C, crop[2], crop[3], depth, dstProfile);
+    clContextLogWrite(C, outputFilename, params->formatName, &params->writeParams);
+    writer = clContextWriteStrips(C, dstHeader, outputFilename, params->formatName, &params->writeParams);
+    clImageDestroy(C, dstHeader);
+    if (!writer) {
+        goto convertStripsCleanup;
+    }
+
+    double decodeSeconds = 0.0;
+    double convertSeconds = 0.0;
+    double encodeSeconds = 0.0;
+    while (reader->rowsRead < cropEndY) {
+        clTraceSpan span;
+        clTraceBegin(C, &span, "decode strip");
+        timerStart(&t);
+        clImage * srcStrip = readCroppedStrip(C, reader, rowsPerStrip, crop);
+        decodeSeconds += timerElapsedSeconds(&t);
+        clTraceEnd(C, &span);
+        if (!srcStrip) {
+            goto convertStripsCleanup;
+        }
+
+        clTraceBegin(C, &span, "convert strip");
+        timerStart(&t);
+        int stripRect[4] = { crop[0], 0, crop[2], srcStrip->height };
+        clImage * dstStrip = clImageCreate(C, crop[2], srcStrip->height, depth, dstProfile);
+        clPipelineRun(C, pipeline, transform, srcStrip, stripRect, dstStrip);
+        clImageDestroy(C, srcStrip);
+        convertSeconds += timerElapsedSeconds(&t);
+        clTraceEnd(C, &span);
+
+        clTraceBegin(C, &span, "encode strip");
+        timerStart(&t);
+        clBool written = clStripWriterWrite(C, writer, dstStrip);
+        clImageDestroy(C, dstStrip);
+        encodeSeconds += timerElapsedSeconds(&t);
+        clTraceEnd(C, &span);
+        if (!written) {
+            goto convertStripsCleanup;
+        }
+    }
+
+    timerStart(&t);
+    if (!clStripWriterFinish(C, writer)) {
+        goto convertStripsCleanup;
+    }
+    encodeSeconds += timerElapsedSeconds(&t);
+
+    clContextLog(C, "encode", 1, "Wrote %d bytes.", clFileSize(outputFilename));
+    clContextLog(C, "stream", 0, "Decode: %.3f sec, convert: %.3f sec, encode: %.3f sec", decodeSeconds, convertSeconds, encodeSeconds);
+    timings->decodeSeconds += decodeSeconds;
+    timings->convertSeconds += convertSeconds;
+    timings->encodeSeconds += encodeSeconds;
+    result = clTrue;
+
+convertStripsCleanup:
+    if (writer)
+        clStripWriterDestroy(C, writer);
+    if (pipeline)
+        clPipelineDestroy(C, pipeline);
+    if (transform)
+        clTransformDestroy(C, transform);
+    if (measureReader)
+        clStripReaderDestroy(C, measureReader);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Thumbnail ladders (--ladder)
+
+#define LADDER_MAX_LEVELS 16
+
+typedef struct clLadderLevel
+{
+    int width;           // 0 derives it from height, keeping the aspect ratio
+    int height;          // 0 derives it from width, keeping the aspect ratio
+    char formatName[16]; // empty uses the output's format
+    int quality;         // -1 uses -q
+} clLadderLevel;
+
+typedef struct clLadder
+{
+    clLadderLevel levels[LADDER_MAX_LEVELS];
+    int levelCount;
+    clFilter filter;
+} clLadder;
+
+typedef struct clLadderRendition
+{
+    int width;
+    int height;
+    char * outputFilename;
+    const char * formatName;
+    clWriteParams writeParams;
+    clImage * resizedImage; // in the source's profile, NULL when the level is the source's size
+    clImage * dstImage;
+    clBool written;
+} clLadderRendition;
+
+typedef struct clLadderEncodeTask
+{
+    clContext * C;
+    clLadderRendition * renditions;
+} clLadderEncodeTask;
+
+// Fills in the size --resize / --ladder dimensions (either of which may be 0) turn srcWidth x srcHeight into
+static void calcResizeDimensions(int srcWidth, int srcHeight, int width, int height, int * outWidth, int * outHeight)
+{
+    if (width <= 0) {
+        *outWidth = (int)(((float)srcWidth / (float)srcHeight) * height);
+        *outHeight = height;
+    } else if (height <= 0) {
+        *outWidth = width;
+        *outHeight = (int)(((float)srcHeight / (float)srcWidth) * width);
+    } else {
+        *outWidth = width;
+        *outHeight = height;
+    }
+    if (*outWidth <= 0)
+        *outWidth = 1;
+    if (*outHeight <= 0)
+        *outHeight = 1;
+}
+
+// Decoding straight to (about) the size the source is resized to is far cheaper, for formats that can. Crops are in
+// source pixels and nearest neighbor wants source pixels, so neither allows it. Returns clFalse for a full decode.
+static clBool convertReadScale(const clConversionParams * params, const clLadder * ladder, clReadScale * scale)
+{
+    memset(scale, 0, sizeof(clReadScale));
+    if ((params->rect[0] >= 0) && (params->rect[1] >= 0) && (params->rect[2] > 0) && (params->rect[3] > 0)) {
+        return clFalse;
+    }
+    if (ladder) {
+        if (ladder->filter == CL_FILTER_NEAREST) {
+            return clFalse;
+        }
+        for (int i = 0; i < ladder->levelCount; ++i) {
+            scale->minWidth = CL_MAX(scale->minWidth, ladder->levels[i].width);
+            scale->minHeight = CL_MAX(scale->minHeight, ladder->levels[i].height);
+        }
+        return clTrue;
+    }
+    if (((params->resizeW > 0) || (params->resizeH > 0)) && (params->resizeFilter != CL_FILTER_NEAREST)) {
+        scale->minWidth = CL_MAX(params->resizeW, 0);
+        scale->minHeight = CL_MAX(params->resizeH, 0);
+        return clTrue;
+    }
+    return clFalse;
+}
+
+// Comma separated levels (WxH[:FORMAT[:QUALITY]], either of W or H may be 0 and xH may be left off), plus an
+// optional resize filter. Conversions can run concurrently (clContextBatch()), so no strtok() here.
+static clBool ladderParse(clContext * C, const char * spec, clLadder * ladder)
+{
+    clBool result = clTrue;
+    memset(ladder, 0, sizeof(clLadder));
+    ladder->filter = CL_FILTER_AUTO;
+
+    char * buffer = clContextStrdup(C, spec);
+    char * next;
+    for (char * token = buffer; token && result; token = next) {
+        next = strchr(token, ',');
+        if (next) {
+            *next = 0;
+            ++next;
+        }
+
+        if (!isdigit(token[0])) {
+            clFilter filter = clFilterFromString(C, token);
+            if (filter == CL_FILTER_INVALID) {
+                clContextLogError(C, "Unrecognized ladder level or resize filter: %s", token);
+                result = clFalse;
+            }
+            ladder->filter = filter;
+            continue;
+        }
+
+        if (ladder->levelCount == LADDER_MAX_LEVELS) {
+            clContextLogError(C, "Too many ladder levels (at most %d)", LADDER_MAX_LEVELS);
+            result = clFalse;
+            continue;
+        }
+        clLadderLevel * level = &ladder->levels[ladder->levelCount];
+        ++ladder->levelCount;
+        level->quality = -1;
+
+        char * end;
+        level->width = (int)strtol(token, &end, 10);
+        if (*end == 'x') {
+            level->height = (int)strtol(end + 1, &end, 10);
+        }
+        if (*end == ':') {
+            char * formatName = end + 1;
+            char * quality = strchr(formatName, ':');
+            if (quality) {
+                *quality = 0;
+                level->quality = (int)strtol(quality + 1, &end, 10);
+                if ((end == quality + 1) || *end || (level->quality < 0) || (level->quality > 100)) {
+                    clContextLogError(C, "Invalid ladder quality: %s", quality + 1);
+                    result = clFalse;
+                }
+            }
+            if ((strlen(formatName) >= sizeof(level->formatName)) || !clFormatExists(C, formatName)) {
+                clContextLogError(C, "Unknown ladder format: %s", formatName);
+                result = clFalse;
+            } else {
+                strcpy(level->formatName, formatName);
+            }
+        } else if (*end) {
+            clContextLogError(C, "Invalid ladder level: %s", token);
+            result = clFalse;
+        }
+        if (result && (level->width <= 0) && (level->height <= 0)) {
+            clContextLogError(C, "Ladder level missing at least one non-zero dimension: %s", token);
+            result = clFalse;
+        }
+    }
+    clFree(buffer);
+
+    if (result && (ladder->levelCount == 0)) {
+        clContextLogError(C, "Ladder has no levels: %s", spec);
+        result = clFalse;
+    }
+    return result;
+}
+
+// Expands template's %d with width, and replaces the extension after it (if any) with formatName (if any)
+static char * ladderOutputFilename(clContext * C, const char * template, int width, const char * formatName)
+{
+    char widthString[16];
+    snprintf(widthString, sizeof(widthString), "%d", width);
+    size_t widthLen = strlen(widthString);
+
+    const char * marker = strstr(template, "%d");
+    size_t prefixLen = (size_t)(marker - template);
+    size_t outputLen = strlen(template) - 2 + widthLen;
+    if (formatName) {
+        outputLen += strlen(formatName) + 1;
+    }
+    char * output = clAllocate(outputLen + 1);
+    memcpy(output, template, prefixLen);
+    memcpy(output + prefixLen, widthString, widthLen);
+    strcpy(output + prefixLen + widthLen, marker + 2);
+    if (formatName) {
+        char * name = output + prefixLen + widthLen;
+        for (char * p = name; *p; ++p) {
+            if ((*p == '/') || (*p == '\\')) {
+                name = p + 1;
+            }
+        }
+        char * ext = strrchr(name, '.');
+        if (ext) {
+            *ext = 0;
+        }
+        strcat(output, ".");
+        strcat(output, formatName);
+    }
+    return output;
+}
+
+static void ladderEncodeTaskFunc(void * userData, int start, int count)
+{
+    clLadderEncodeTask * task = (clLadderEncodeTask *)userData;
+    for (int i = start; i < (start + count); ++i) {
+        clLadderRendition * rendition = &task->renditions[i];
+        clTraceSpan span;
+        clTraceBegin(task->C, &span, "encode");
+        rendition->written = clContextWrite(task->C, rendition->dstImage, rendition->outputFilename, rendition->formatName, &rendition->writeParams);
+        clTraceEnd(task->C, &span);
+    }
+}
+
+// Resizes srcImage to every level of ladder (largest first, each from the smallest larger level it can be), converts
+// each one with the same dst profile, then encodes them all at once. Levels are sized relative to fullWidth x
+// fullHeight, which is larger than srcImage if it was decoded at a reduced size. Adds to timings.
+static clBool convertLadder(clContext * C,
+                            const char * outputFilename,
+                            const clLadder * ladder,
+                            clImage * srcImage,
+                            int fullWidth,
+                            int fullHeight,
+                            int depth,
+                            clProfile * dstProfile,
+                            clConversionParams * params,
+                            clConvertCache * cache,
+                            clConvertTimings * timings)
+{
+    Timer t;
+    clBool result = clTrue;
+    clLadderRendition renditions[LADDER_MAX_LEVELS];
+    int order[LADDER_MAX_LEVELS];
+    memset(renditions, 0, sizeof(renditions));
+
+    timerStart(&t);
+    for (int i = 0; i < ladder->levelCount; ++i) {
+        const clLadderLevel * level = &ladder->levels[i];
+        clLadderRendition * rendition = &renditions[i];
+        calcResizeDimensions(fullWidth, fullHeight, level->width, level->height, &rendition->width, &rendition->height);
+        rendition->formatName = level->formatName[0] ? level->formatName : params->formatName;
+        rendition->outputFilename = ladderOutputFilename(C, outputFilename, rendition->width, level->formatName[0] ? level->formatName : NULL);
+        memcpy(&rendition->writeParams, &params->writeParams, sizeof(clWriteParams));
+        if (level->quality >= 0) {
+            rendition->writeParams.quality = level->quality;
+        }
+
+        // Largest first (insertion sort, as there are only a handful)
+        int j = i;
+        for (; (j > 0) && (((int64_t)renditions[order[j - 1]].width * renditions[order[j - 1]].height) <
+                           ((int64_t)rendition->width * rendition->height));
+             --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    for (int i = 0; (i < ladder->levelCount) && result; ++i) {
+        clLadderRendition * rendition = &renditions[order[i]];
+
+        // A level at least twice as small (both ways) as a larger one is resized from it instead of from the source:
+        // it's far fewer pixels to filter, and each output pixel still covers a couple of them. Nearest neighbor
+        // only ever picks source pixels, so it always resizes the source.
+        clImage * resizeSrc = srcImage;
+        if (ladder->filter != CL_FILTER_NEAREST) {
+            for (int j = i - 1; j >= 0; --j) {
+                clLadderRendition * larger = &renditions[order[j]];
+                if (larger->resizedImage && (larger->width >= (rendition->width * 2)) && (larger->height >= (rendition->height * 2))) {
+                    resizeSrc = larger->resizedImage;
+                    break;
+                }
+            }
+        }
+
+        clImage * levelImage = srcImage;
+        if ((rendition->width != srcImage->width) || (rendition->height != srcImage->height)) {
+            clContextLog(C,
+                         "ladder",
+                         0,
+                         "Resizing %dx%d -> [filter:%s] -> %dx%d",
+                         resizeSrc->width,
+                         resizeSrc->height,
+                         clFilterToString(C, ladder->filter),
+                         rendition->width,
+                         rendition->height);
+            rendition->resizedImage = clImageResize(C, resizeSrc, rendition->width, rendition->height, ladder->filter);
+            if (!rendition->resizedImage) {
+                clContextLogError(C, "Failed to resize image");
+                result = clFalse;
+                break;
+            }
+            levelImage = rendition->resizedImage;
+        }
+
+        clPipeline * pipeline = clPipelineCreate(C);
+        if (cache->hald) {
+            clPipelineAddLUT3D(C, pipeline, cache->hald);
+        }
+        pipeline->rotate = params->rotate;
+        int levelDepth = clFormatBestDepth(C, rendition->formatName, depth);
+        rendition->dstImage = clImageConvertPipeline(C,
+                                                     levelImage,
+                                                     NULL,
+                                                     levelDepth,
+                                                     dstProfile,
+                                                     params->autoGrade ? CL_TONEMAP_OFF : params->tonemap,
+                                                     &params->tonemapParams,
+                                                     pipeline);
+        clPipelineDestroy(C, pipeline);
+    }
+    timings->convertSeconds += timerElapsedSeconds(&t);
+    clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+
+    if (result) {
+        for (int i = 0; i < ladder->levelCount; ++i) {
+            clContextLogWrite(C, renditions[i].outputFilename, renditions[i].formatName, &renditions[i].writeParams);
+        }
+        timerStart(&t);
+        clLadderEncodeTask task;
+        task.C = C;
+        task.renditions = renditions;
+        clTaskParallelFor(C, ladder->levelCount, 1, ladderEncodeTaskFunc, &task);
+        for (int i = 0; i < ladder->levelCount; ++i) {
+            if (renditions[i].written) {
+                clContextLog(C,
+                             "encode",
+                             1,
+                             "Wrote %s (%dx%d, %d bytes).",
+                             renditions[i].outputFilename,
+                             renditions[i].dstImage->width,
+                             renditions[i].dstImage->height,
+                             clFileSize(renditions[i].outputFilename));
+            } else {
+                result = clFalse;
+            }
+        }
+        timings->encodeSeconds += timerElapsedSeconds(&t);
+        clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+    }
+
+    for (int i = 0; i < ladder->levelCount; ++i) {
+        clFree(renditions[i].outputFilename);
+        if (renditions[i].resizedImage) {
+            clImageDestroy(C, renditions[i].resizedImage);
+        }
+        if (renditions[i].dstImage) {
+            clImageDestroy(C, renditions[i].dstImage);
+        }
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// clConvertCache
+
+#define MAX_CACHED_DST_PROFILES 16
+
+typedef struct clConvertCacheProfile
+{
+    clProfilePrimaries primaries;
+    clProfileCurve curve;
+    int luminance;
+    clProfile * profile;
+} clConvertCacheProfile;
+
+clConvertCache * clConvertCacheCreate(clContext * C, clConversionParams * params, const char * iccOverrideIn)
+{
+    clConvertCache * cache = clAllocateStruct(clConvertCache);
+    memset(cache, 0, sizeof(clConvertCache));
+    cache->dstProfiles = clAllocate(sizeof(clConvertCacheProfile) * MAX_CACHED_DST_PROFILES);
+    cache->lock = clMutexCreate(C);
+
+    if (iccOverrideIn) {
+        cache->srcOverrideProfile = clProfileRead(C, iccOverrideIn);
+        if (!cache->srcOverrideProfile) {
+            clContextLogError(C, "Bad ICC override file [-i]: %s", iccOverrideIn);
+            goto cacheFailed;
+        }
+        clContextLog(C, "profile", 1, "Overriding src profile with file: %s", iccOverrideIn);
+    }
+
+    if (params->iccOverrideOut) {
+        cache->dstOverrideProfile = clProfileRead(C, params->iccOverrideOut);
+        if (!cache->dstOverrideProfile) {
+            clContextLogError(C, "Invalid destination profile override: %s", params->iccOverrideOut);
+            goto cacheFailed;
+        }
+    }
+
+    // Load Hald CLUT / .cube 3D LUT, if any
+    if (params->hald) {
+        cache->hald = clLUT3DRead(C, params->hald);
+        if (!cache->hald) {
+            goto cacheFailed;
+        }
+        cache->hald->interpolation = params->haldInterp;
+    }
+    return cache;
+
+cacheFailed:
+    clConvertCacheDestroy(C, cache);
+    return NULL;
+}
+
+void clConvertCacheDestroy(clContext * C, clConvertCache * cache)
+{
+    for (int i = 0; i < cache->dstProfileCount; ++i) {
+        clProfileDestroy(C, cache->dstProfiles[i].profile);
+    }
+    clFree(cache->dstProfiles);
+    if (cache->srcOverrideProfile)
+        clProfileDestroy(C, cache->srcOverrideProfile);
+    if (cache->dstOverrideProfile)
+        clProfileDestroy(C, cache->dstOverrideProfile);
+    if (cache->hald)
+        clLUT3DDestroy(C, cache->hald);
+    clMutexDestroy(C, cache->lock);
+    clFree(cache);
+}
+
+// Returns a clone of the dst profile described by info, generating (and caching) it on first use. Holds the lock
+// while generating so that conversions running concurrently don't all build the same profile.
+static clProfile * convertCacheProfile(clContext * C, clConvertCache * cache, struct ImageInfo * info, const char * description, const char * copyright)
+{
+    clProfile * profile = NULL;
+    clMutexLock(cache->lock);
+    for (int i = 0; i < cache->dstProfileCount; ++i) {
+        clConvertCacheProfile * entry = &cache->dstProfiles[i];
+        if (!memcmp(&entry->primaries, &info->primaries, sizeof(entry->primaries)) && !memcmp(&entry->curve, &info->curve, sizeof(entry->curve)) &&
+            (entry->luminance == info->luminance)) {
+            clContextLog(C, "profile", 0, "Reusing destination ICC profile: \"%s\"", description);
+            profile = clProfileClone(C, entry->profile);
+            ++cache->dstProfileHits;
+            break;
+        }
+    }
+
+    if (!profile) {
+        clContextLog(C, "profile", 0, "Creating new destination ICC profile: \"%s\"", description);
+        profile = clProfileCreate(C, &info->primaries, &info->curve, info->luminance, description);
+
+        // Copyright
+        if (copyright) {
+            clContextLog(C, "profile", 1, "Setting copyright: \"%s\"", copyright);
+            clProfileSetMLU(C, profile, "cprt", "en", "US", copyright);
+        }
+
+        if (cache->dstProfileCount < MAX_CACHED_DST_PROFILES) {
+            clConvertCacheProfile * entry = &cache->dstProfiles[cache->dstProfileCount];
+            memcpy(&entry->primaries, &info->primaries, sizeof(entry->primaries));
+            memcpy(&entry->curve, &info->curve, sizeof(entry->curve));
+            entry->luminance = info->luminance;
+            entry->profile = clProfileClone(C, profile);
+            ++cache->dstProfileCount;
+        }
+    }
+    clMutexUnlock(cache->lock);
+    return profile;
+}
+
+// ---------------------------------------------------------------------------
+// Convert
+
 int clContextConvert(clContext * C)
 {
-    Timer overall, t;
+    return clContextConvertFile(C, C->inputFilename, C->outputFilename, NULL, NULL);
+}
+
+int clContextConvertFile(clContext * C, const char * inputFilename, const char * outputFilename, clConvertCache * cache, clConvertTimings * timings)
+{
+    Timer overall, t, stage;
     int returnCode = 0;
 
     // Goals
@@ -45,98 +730,173 @@ int clContextConvert(clContext * C)
     struct ImageInfo srcInfo;
     struct ImageInfo dstInfo;
 
-    // Hald CLUT
-    clImage * haldImage = NULL;
-    int haldDims = 0;
+    // Everything done to the pixels after the conversion, fused into it
+    clPipeline * pipeline = NULL;
+
+    // Only used when streaming (--stream)
+    clStripReader * stripReader = NULL;
+
+    // Only used when the caller didn't supply a cache
+    clConvertCache * ownedCache = NULL;
+
+    // Only used with --ladder
+    clLadder ladder;
+
+    // Only used when the source can be decoded at a reduced size
+    clReadScale readScale;
+    clBool reducedDecode = clFalse;
+
+    clConvertTimings ignoredTimings;
+    if (!timings) {
+        timings = &ignoredTimings;
+    }
+    memset(timings, 0, sizeof(clConvertTimings));
+    timerStart(&overall);
+
+    int poolAllocations, poolReuses;
+    clPixelPoolGetStats(C, &poolAllocations, &poolReuses);
 
     clConversionParams params;
     memcpy(&params, &C->params, sizeof(params));
 
     if (!params.formatName)
-        params.formatName = clFormatDetect(C, C->outputFilename);
+        params.formatName = clFormatDetect(C, outputFilename);
     if (!params.formatName) {
-        clContextLogError(C, "Unknown output file format: %s", C->outputFilename);
+        clContextLogError(C, "Unknown output file format: %s", outputFilename);
         FAIL();
     }
 
-    clContextLog(C, "action", 0, "Convert [%d max threads]: %s -> %s", C->jobs, C->inputFilename, C->outputFilename);
-    timerStart(&overall);
+    clContextLog(C, "action", 0, "Convert [%d max threads]: %s -> %s", C->jobs, inputFilename, outputFilename);
 
-    clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, clFileSize(C->inputFilename));
-    timerStart(&t);
-    srcImage = clContextRead(C, C->inputFilename, C->iccOverrideIn, NULL);
-    if (srcImage == NULL) {
-        return 1;
+    if (params.ladder) {
+        if (!ladderParse(C, params.ladder, &ladder)) {
+            FAIL();
+        }
+        const char * marker = strstr(outputFilename, "%d");
+        if (!marker || (strchr(outputFilename, '%') != marker) || strchr(marker + 2, '%')) {
+            clContextLogError(C, "Ladder output filename must contain exactly one %%d (and no other %%): %s", outputFilename);
+            FAIL();
+        }
+        const char * conflict = NULL;
+        if ((params.resizeW > 0) || (params.resizeH > 0)) {
+            conflict = "--resize";
+        } else if (params.compositeFilename) {
+            conflict = "--composite";
+        } else if (params.stats) {
+            conflict = "--stats";
+        } else if (!strcmp(params.formatName, "icc")) {
+            conflict = "icc output";
+        }
+        if (conflict) {
+            clContextLogError(C, "--ladder can't be combined with %s", conflict);
+            FAIL();
+        }
     }
-    clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
-
-    if (!strcmp(params.formatName, "icc")) {
-        // Just dump out the profile to disk and bail out
-
-        clContextLog(C, "encode", 0, "Writing ICC: %s", C->outputFilename);
-        clProfileDebugDump(C, srcImage->profile, C->verbose, 0);
 
-        if (!clProfileWrite(C, srcImage->profile, C->outputFilename)) {
+    if (!cache) {
+        ownedCache = clConvertCacheCreate(C, &params, C->iccOverrideIn);
+        if (!ownedCache) {
             FAIL();
         }
-        goto convertCleanup;
+        cache = ownedCache;
     }
 
-    // Load HALD, if any
-    if (params.hald) {
-        haldImage = clContextRead(C, params.hald, NULL, NULL);
-        if (!haldImage) {
-            clContextLogError(C, "Can't read Hald CLUT: %s", params.hald);
-            FAIL();
+    timerStart(&stage);
+    if (params.streamBudget > 0) {
+        const char * blocker = streamBlocker(C, inputFilename, &params);
+        if (blocker) {
+            clContextLog(C, "stream", 0, "Can't stream this conversion (%s), converting the whole image at once", blocker);
+        } else {
+            clContextLog(C, "decode", 0, "Streaming: %s (%d bytes)", inputFilename, clFileSize(inputFilename));
+            stripReader = clContextReadStrips(C, inputFilename, cache->srcOverrideProfile, NULL);
+            if (stripReader) {
+                // Only describes the source; the pixels are read a strip at a time during conversion
+                clImage * header = stripReader->image;
+                srcImage = clImageCreate(C, header->width, header->height, header->depth, header->profile);
+            } else {
+                clContextLog(C, "stream", 0, "Falling back to converting the whole image at once");
+            }
         }
-        if (haldImage->width != haldImage->height) {
-            clContextLogError(C, "Hald CLUT isn't square [%dx%d]: %s", haldImage->width, haldImage->height, params.hald);
+    }
+
+    if (!stripReader) {
+        clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", inputFilename, clFileSize(inputFilename));
+        timerStart(&t);
+        clBool scaled = convertReadScale(&params, params.ladder ? &ladder : NULL, &readScale);
+        srcImage = clContextReadScaled(C, inputFilename, cache->srcOverrideProfile, scaled ? &readScale : NULL, NULL);
+        if (srcImage == NULL) {
             FAIL();
         }
+        if (scaled && ((srcImage->width != readScale.fullWidth) || (srcImage->height != readScale.fullHeight))) {
+            clContextLog(C,
+                         "decode",
+                         0,
+                         "Decoded at reduced size: %dx%d -> %dx%d (for resize)",
+                         readScale.fullWidth,
+                         readScale.fullHeight,
+                         srcImage->width,
+                         srcImage->height);
+            reducedDecode = clTrue;
+        }
+        clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+    }
 
-        // Calc haldDims
-        {
-            int i;
-            for (i = 0; i < 32; ++i) {
-                if ((i * i * i) == haldImage->width) {
-                    haldDims = i * i;
-                    break;
-                }
-            }
+    if (!strcmp(params.formatName, "icc")) {
+        // Just dump out the profile to disk and bail out
 
-            if (haldDims == 0) {
-                clContextLogError(C, "Hald CLUT dimensions aren't cubic [%dx%d]: %s", haldImage->width, haldImage->height, params.hald);
-                FAIL();
-            }
+        clContextLog(C, "encode", 0, "Writing ICC: %s", outputFilename);
+        clProfileDebugDump(C, srcImage->profile, C->verbose, 0);
 
-            clContextLog(C, "hald", 0, "Loaded %dx%dx%d Hald CLUT: %s", haldDims, haldDims, haldDims, params.hald);
+        if (!clProfileWrite(C, srcImage->profile, outputFilename)) {
+            FAIL();
         }
+        goto convertCleanup;
     }
 
+    // The part of srcImage that is converted. Unless something needs the cropped pixels before the conversion
+    // (resize, autograde) or after it (stats), the crop is left to the conversion, which only reads these pixels.
     int crop[4];
-    memcpy(crop, C->params.rect, 4 * sizeof(int));
+    int srcRect[4] = { 0, 0, srcImage->width, srcImage->height };
+    memcpy(crop, params.rect, 4 * sizeof(int));
     if (clImageAdjustRect(C, srcImage, &crop[0], &crop[1], &crop[2], &crop[3])) {
-        timerStart(&t);
+        clBool fuseCrop = !stripReader && (params.resizeW <= 0) && (params.resizeH <= 0) && !params.ladder && !params.autoGrade && !params.stats;
         clContextLog(C,
                      "crop",
                      0,
-                     "Cropping source image from %dx%d to: +%d+%d %dx%d",
+                     "Cropping source image from %dx%d to: +%d+%d %dx%d%s",
                      srcImage->width,
                      srcImage->height,
                      crop[0],
                      crop[1],
                      crop[2],
-                     crop[3]);
-        srcImage = clImageCrop(C, srcImage, crop[0], crop[1], crop[2], crop[3], clFalse);
-        clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+                     crop[3],
+                     fuseCrop ? " (fused with conversion)" : "");
+        if (fuseCrop) {
+            memcpy(srcRect, crop, sizeof(srcRect));
+        } else {
+            timerStart(&t);
+            srcImage = clImageCrop(C, srcImage, crop[0], crop[1], crop[2], crop[3], clFalse);
+            srcRect[2] = srcImage->width;
+            srcRect[3] = srcImage->height;
+            clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+        }
+    } else {
+        crop[0] = 0;
+        crop[1] = 0;
+        crop[2] = srcImage->width;
+        crop[3] = srcImage->height;
     }
+    timings->decodeSeconds = timerElapsedSeconds(&stage);
+    timerStart(&stage);
+    clTraceSpan convertSpan;
+    clTraceBegin(C, &convertSpan, "convert");
 
     // -----------------------------------------------------------------------
     // Parse source image and conversion params, make decisions about dst
 
     // Populate srcInfo
-    srcInfo.width = srcImage->width;
-    srcInfo.height = srcImage->height;
+    srcInfo.width = srcRect[2];
+    srcInfo.height = srcRect[3];
     srcInfo.depth = srcImage->depth;
     clProfileQuery(C, srcImage->profile, &srcInfo.primaries, &srcInfo.curve, &srcInfo.luminance);
     if ((srcInfo.curve.type == CL_PCT_COMPLEX) && (srcInfo.curve.gamma > 0.0f)) {
@@ -146,6 +906,10 @@ int clContextConvert(clContext * C)
     // Start off dstInfo with srcInfo's values
     memcpy(&dstInfo, &srcInfo, sizeof(dstInfo));
 
+    // Resize targets are relative to the source's full size, even when it was decoded smaller
+    int fullWidth = reducedDecode ? readScale.fullWidth : srcInfo.width;
+    int fullHeight = reducedDecode ? readScale.fullHeight : srcInfo.height;
+
     // Forget starting gamma and luminance if we're autograding (conversion params can still force values)
     if (params.autoGrade) {
         dstInfo.curve.type = CL_PCT_GAMMA;
@@ -160,12 +924,7 @@ int clContextConvert(clContext * C)
             FAIL();
         }
 
-        dstProfile = clProfileRead(C, params.iccOverrideOut);
-        if (!dstProfile) {
-            clContextLogError(C, "Invalid destination profile override: %s", params.iccOverrideOut);
-            FAIL();
-        }
-
+        dstProfile = clProfileClone(C, cache->dstOverrideProfile);
         clProfileQuery(C, dstProfile, &dstInfo.primaries, &dstInfo.curve, &dstInfo.luminance);
         if ((dstInfo.curve.type == CL_PCT_COMPLEX) && (dstInfo.curve.gamma > 0.0f)) {
             clContextLog(C, "info", 0, "Estimated dst gamma: %g", dstInfo.curve.gamma);
@@ -201,26 +960,15 @@ int clContextConvert(clContext * C)
 
     // Override width and height
     if ((params.resizeW > 0) || (params.resizeH > 0)) {
-        if (params.resizeW <= 0) {
-            dstInfo.width = (int)(((float)srcInfo.width / (float)srcInfo.height) * params.resizeH);
-            dstInfo.height = params.resizeH;
-        } else if (params.resizeH <= 0) {
-            dstInfo.width = params.resizeW;
-            dstInfo.height = (int)(((float)srcInfo.height / (float)srcInfo.width) * params.resizeW);
-        } else {
-            dstInfo.width = params.resizeW;
-            dstInfo.height = params.resizeH;
-        }
-        if (dstInfo.width <= 0)
-            dstInfo.width = 1;
-        if (dstInfo.height <= 0)
-            dstInfo.height = 1;
+        calcResizeDimensions(fullWidth, fullHeight, params.resizeW, params.resizeH, &dstInfo.width, &dstInfo.height);
     }
 
-    // Override depth
+    // Override depth (each ladder level picks its own format's best depth from the requested one)
+    int requestedDepth = dstInfo.depth;
     {
         if (params.bpc > 0) {
             dstInfo.depth = params.bpc;
+            requestedDepth = params.bpc;
         }
 
         int bestDepth = clFormatBestDepth(C, params.formatName, dstInfo.depth);
@@ -253,6 +1001,8 @@ int clContextConvert(clContext * C)
 
         clImageDestroy(C, srcImage);
         srcImage = resizedImage;
+        srcRect[2] = srcImage->width; // the crop was never fused, see above
+        srcRect[3] = srcImage->height;
 
         clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
     }
@@ -315,15 +1065,9 @@ int clContextConvert(clContext * C)
                 dstDescription = clGenerateDescription(C, &dstInfo.primaries, &dstInfo.curve, dstInfo.luminance);
             }
 
-            clContextLog(C, "profile", 0, "Creating new destination ICC profile: \"%s\"", dstDescription);
-            dstProfile = clProfileCreate(C, &dstInfo.primaries, &dstInfo.curve, dstInfo.luminance, dstDescription);
+            // Description and copyright come from params, which are the same for every file sharing a cache
+            dstProfile = convertCacheProfile(C, cache, &dstInfo, dstDescription, params.copyright);
             clFree(dstDescription);
-
-            // Copyright
-            if (params.copyright) {
-                clContextLog(C, "profile", 1, "Setting copyright: \"%s\"", params.copyright);
-                clProfileSetMLU(C, dstProfile, "cprt", "en", "US", params.copyright);
-            }
         } else {
             // just clone the source one
             clContextLog(C, "profile", 0, "Using unmodified source ICC profile: \"%s\"", srcImage->profile->description);
@@ -331,11 +1075,28 @@ int clContextConvert(clContext * C)
         }
     }
 
-    dstImage = clImageConvert(C, srcImage, dstInfo.depth, dstProfile, params.autoGrade ? CL_TONEMAP_OFF : params.tonemap, &params.tonemapParams);
-    if (!dstImage) {
-        FAIL();
+    if (stripReader) {
+        // Strips are decoded, converted and encoded in turn, so the convert span covers all of it
+        clBool streamed = convertStrips(C, inputFilename, outputFilename, stripReader, srcImage, crop, dstInfo.depth, dstProfile, &params, cache, timings);
+        clTraceEnd(C, &convertSpan);
+        if (!streamed) {
+            FAIL();
+        }
+        goto convertCleanup;
     }
 
+    if (params.ladder) {
+        timings->convertSeconds = timerElapsedSeconds(&stage);
+        clTraceEnd(C, &convertSpan);
+        if (!convertLadder(C, outputFilename, &ladder, srcImage, fullWidth, fullHeight, requestedDepth, dstProfile, &params, cache, timings)) {
+            FAIL();
+        }
+        goto convertCleanup;
+    }
+
+    // Composite, Hald CLUT and rotation all happen during the conversion, a tile at a time
+    pipeline = clPipelineCreate(C);
+
     if (C->params.compositeFilename) {
         clContextLog(C,
                      "composite",
@@ -354,68 +1115,61 @@ int clContextConvert(clContext * C)
         clContextLog(C,
                      "composite",
                      0,
-                     "Blending composite on top (%.2g gamma, %s, offset %d,%d)...",
+                     "Blending composite on top (%.2g gamma, %s, offset %d,%d, fused with conversion)...",
                      params.compositeParams.gamma,
                      params.compositeParams.premultiplied ? "premultiplied" : "not premultiplied",
                      params.compositeParams.offsetX,
                      params.compositeParams.offsetY);
-        timerStart(&t);
         params.compositeParams.srcTonemap = params.tonemap;
         memcpy(&params.compositeParams.srcParams, &params.tonemapParams, sizeof(clTonemapParams));
-        clImage * blendedImage = clImageBlend(C, dstImage, compositeImage, &params.compositeParams);
-        if (!blendedImage) {
+        clBool blendAdded = clPipelineAddBlend(C, pipeline, dstProfile, compositeImage, &params.compositeParams);
+        clImageDestroy(C, compositeImage);
+        if (!blendAdded) {
             clContextLogError(C, "Image blend failed, bailing out");
-            clImageDestroy(C, blendedImage);
             FAIL();
         }
-        clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
-
-        clImageDestroy(C, dstImage);
-        dstImage = blendedImage;
     }
 
-    if (haldImage) {
-        clContextLog(C, "hald", 0, "Performing Hald CLUT postprocessing...");
-        timerStart(&t);
-
-        clImage * appliedImage = clImageApplyHALD(C, dstImage, haldImage, haldDims);
-        if (!appliedImage) {
-            clContextLogError(C, "Failed to apply HALD");
-            FAIL();
-        }
-
-        clImageDestroy(C, dstImage);
-        dstImage = appliedImage;
-
-        clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+    if (cache->hald) {
+        clContextLog(C,
+                     "hald",
+                     0,
+                     "Performing Hald CLUT postprocessing (%s, fused with conversion)...",
+                     clLUTInterpolationToString(C, cache->hald->interpolation));
+        clPipelineAddLUT3D(C, pipeline, cache->hald);
     }
 
     if (params.rotate != 0) {
-        clContextLog(C, "rotate", 0, "Rotating image clockwise %dx...", params.rotate);
-        timerStart(&t);
+        clContextLog(C, "rotate", 0, "Rotating image clockwise %dx (fused with conversion)...", params.rotate);
+        pipeline->rotate = params.rotate;
+    }
 
-        clImage * rotatedImage = clImageRotate(C, dstImage, params.rotate);
-        if (rotatedImage) {
-            clImageDestroy(C, dstImage);
-            dstImage = rotatedImage;
-        }
+    dstImage = clImageConvertPipeline(C,
+                                      srcImage,
+                                      srcRect,
+                                      dstInfo.depth,
+                                      dstProfile,
+                                      params.autoGrade ? CL_TONEMAP_OFF : params.tonemap,
+                                      &params.tonemapParams,
+                                      pipeline);
 
-        clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
-    }
+    timings->convertSeconds = timerElapsedSeconds(&stage);
+    clTraceEnd(C, &convertSpan);
 
     timerStart(&t);
-    clContextLogWrite(C, C->outputFilename, params.formatName, &params.writeParams);
-    if (!clContextWrite(C, dstImage, C->outputFilename, params.formatName, &params.writeParams)) {
+    clContextLogWrite(C, outputFilename, params.formatName, &params.writeParams);
+    if (!clContextWrite(C, dstImage, outputFilename, params.formatName, &params.writeParams)) {
         FAIL();
     }
-    clContextLog(C, "encode", 1, "Wrote %d bytes.", clFileSize(C->outputFilename));
+    clContextLog(C, "encode", 1, "Wrote %d bytes.", clFileSize(outputFilename));
+    timings->encodeSeconds = timerElapsedSeconds(&t);
     clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
 
     if (params.stats) {
         clContextLog(C, "stats", 0, "Calculating conversion stats...");
         timerStart(&t);
 
-        clImage * convertedImage = clContextRead(C, C->outputFilename, NULL, NULL);
+        clImage * convertedImage = clContextRead(C, outputFilename, NULL, NULL);
         if (convertedImage) {
             clImageSignals signals;
             if (clImageCalcSignals(C, srcImage, convertedImage, &signals)) {
@@ -433,17 +1187,33 @@ int clContextConvert(clContext * C)
     }
 
 convertCleanup:
+    if (stripReader)
+        clStripReaderDestroy(C, stripReader);
+    if (pipeline)
+        clPipelineDestroy(C, pipeline);
     if (dstProfile)
         clProfileDestroy(C, dstProfile);
     if (srcImage)
         clImageDestroy(C, srcImage);
     if (dstImage)
         clImageDestroy(C, dstImage);
-    if (haldImage)
-        clImageDestroy(C, haldImage);
+    if (ownedCache)
+        clConvertCacheDestroy(C, ownedCache);
 
+    timings->totalSeconds = timerElapsedSeconds(&overall);
     if (returnCode == 0) {
+        int allocations, reuses;
+        clPixelPoolGetStats(C, &allocations, &reuses);
+        allocations -= poolAllocations;
+        reuses -= poolReuses;
         clContextLog(C, "action", 0, "Conversion complete.");
+        clContextLog(C,
+                     "pool",
+                     0,
+                     "Pixel buffers: %d of %d reused (%d%%)",
+                     reuses,
+                     allocations,
+                     (allocations > 0) ? (100 * reuses) / allocations : 0);
         clContextLog(C, "timing", -1, OVERALL_TIMING_FORMAT, timerElapsedSeconds(&overall));
     }
     return returnCode;
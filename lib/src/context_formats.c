@@ -23,13 +23,35 @@ struct clImage * clFormatReadBMP(struct clContext * C, const char * formatName,
 clBool clFormatWriteBMP(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
 struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadScaledJPG(struct clContext * C,
+                                       const char * formatName,
+                                       struct clProfile * overrideProfile,
+                                       struct clRaw * input,
+                                       clReadScale * scale);
 clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
+struct clStripReader * clFormatReadStripsJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, const char * filename);
+struct clStripWriter * clFormatWriteStripsJPG(struct clContext * C,
+                                              struct clImage * image,
+                                              const char * formatName,
+                                              const char * filename,
+                                              struct clWriteParams * writeParams);
 
 struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadScaledJP2(struct clContext * C,
+                                       const char * formatName,
+                                       struct clProfile * overrideProfile,
+                                       struct clRaw * input,
+                                       clReadScale * scale);
 clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
 struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
 clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
+struct clStripReader * clFormatReadStripsPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, const char * filename);
+struct clStripWriter * clFormatWriteStripsPNG(struct clContext * C,
+                                              struct clImage * image,
+                                              const char * formatName,
+                                              const char * filename,
+                                              struct clWriteParams * writeParams);
 
 struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
 clBool clFormatWriteTIFF(struct clContext * C,
@@ -128,7 +150,10 @@ void clContextRegisterBuiltinFormats(struct clContext * C)
         format.usesYUVFormat = clFalse;
         format.detectFunc = detectFormatSignature;
         format.readFunc = clFormatReadJPG;
+        format.readScaledFunc = clFormatReadScaledJPG;
         format.writeFunc = clFormatWriteJPG;
+        format.readStripsFunc = clFormatReadStripsJPG;
+        format.writeStripsFunc = clFormatWriteStripsJPG;
         clContextRegisterFormat(C, &format);
     }
 
@@ -150,6 +175,7 @@ void clContextRegisterBuiltinFormats(struct clContext * C)
         format.usesYUVFormat = clFalse;
         format.detectFunc = detectFormatSignature;
         format.readFunc = clFormatReadJP2;
+        format.readScaledFunc = clFormatReadScaledJP2;
         format.writeFunc = clFormatWriteJP2;
         clContextRegisterFormat(C, &format);
     }
@@ -172,6 +198,7 @@ void clContextRegisterBuiltinFormats(struct clContext * C)
         format.usesYUVFormat = clFalse;
         format.detectFunc = detectFormatSignature;
         format.readFunc = clFormatReadJP2;
+        format.readScaledFunc = clFormatReadScaledJP2;
         format.writeFunc = clFormatWriteJP2;
         clContextRegisterFormat(C, &format);
     }
@@ -195,6 +222,8 @@ void clContextRegisterBuiltinFormats(struct clContext * C)
         format.detectFunc = detectFormatSignature;
         format.readFunc = clFormatReadPNG;
         format.writeFunc = clFormatWritePNG;
+        format.readStripsFunc = clFormatReadStripsPNG;
+        format.writeStripsFunc = clFormatWriteStripsPNG;
         clContextRegisterFormat(C, &format);
     }
 
@@ -9,25 +9,14 @@
 
 #include "colorist/image.h"
 #include "colorist/profile.h"
+#include "colorist/strip.h"
+#include "colorist/trace.h"
 
 #include <stdio.h>
 #include <string.h>
 
 struct clImage * clContextRead(clContext * C, const char * filename, const char * iccOverride, const char ** outFormatName)
 {
-    clImage * image = NULL;
-    clFormat * format;
-    const char * formatName = clFormatDetect(C, filename);
-    if (outFormatName)
-        *outFormatName = formatName;
-    if (!formatName) {
-        return NULL;
-    }
-    if (!strcmp(formatName, "icc")) {
-        // Someday, fix clFormatDetect() to not allow "icc" to return, and then this check can go away.
-        return NULL;
-    }
-
     clProfile * overrideProfile = NULL;
     if (iccOverride) {
         overrideProfile = clProfileRead(C, iccOverride);
@@ -39,9 +28,46 @@ struct clImage * clContextRead(clContext * C, const char * filename, const char
         }
     }
 
+    clImage * image = clContextReadWithProfile(C, filename, overrideProfile, outFormatName);
+    if (overrideProfile) {
+        clProfileDestroy(C, overrideProfile);
+    }
+    return image;
+}
+
+struct clImage * clContextReadWithProfile(clContext * C, const char * filename, struct clProfile * overrideProfile, const char ** outFormatName)
+{
+    return clContextReadScaled(C, filename, overrideProfile, NULL, outFormatName);
+}
+
+struct clImage * clContextReadScaled(clContext * C,
+                                     const char * filename,
+                                     struct clProfile * overrideProfile,
+                                     clReadScale * scale,
+                                     const char ** outFormatName)
+{
+    clImage * image = NULL;
+    clFormat * format;
+
+    // Format detection and the reader share one read-only mapping of the file
     clRaw input = CL_RAW_EMPTY;
-    if (!clRawReadFile(C, &input, filename)) {
-        return clFalse;
+    clTraceSpan span;
+    clTraceBegin(C, &span, "read");
+    if (!clRawMapFile(C, &input, filename)) {
+        if (outFormatName)
+            *outFormatName = NULL;
+        return NULL;
+    }
+    clTraceEnd(C, &span);
+    clTraceCount(C, CL_TRACE_BYTES_READ, input.size);
+
+    const char * formatName = clFormatDetectContents(C, filename, &input);
+    if (outFormatName)
+        *outFormatName = formatName;
+    if (!formatName || !strcmp(formatName, "icc")) {
+        // Someday, fix clFormatDetect() to not allow "icc" to return, and then this check can go away.
+        clRawFree(C, &input);
+        return NULL;
     }
 
     // Clear this out, only some of the format readers actually populate anything in here
@@ -49,29 +75,29 @@ struct clImage * clContextRead(clContext * C, const char * filename, const char
 
     format = clContextFindFormat(C, formatName);
     COLORIST_ASSERT(format);
-    if (format->readFunc) {
+    if (scale && format->readScaledFunc) {
+        clTraceBegin(C, &span, "decode");
+        image = format->readScaledFunc(C, formatName, overrideProfile, &input, scale);
+        clTraceEnd(C, &span);
+    } else if (format->readFunc) {
+        clTraceBegin(C, &span, "decode");
         image = format->readFunc(C, formatName, overrideProfile, &input);
+        clTraceEnd(C, &span);
+        if (image && scale) {
+            scale->fullWidth = image->width;
+            scale->fullHeight = image->height;
+        }
     } else {
         clContextLogError(C, "Unimplemented file reader '%s'", formatName);
     }
 
-    if (overrideProfile) {
-        // Just in case the read plugin is a bad citizen
-        if (image) {
-            if (image->profile == overrideProfile) {
-                // if the pointers match exactly, let it take ownership
-                overrideProfile = NULL;
-            } else if (!clProfileMatches(C, image->profile, overrideProfile)) {
-                clProfileDestroy(C, image->profile);
-                image->profile = overrideProfile; // take ownership
-                overrideProfile = NULL;
-            }
-        }
-
-        // There is a chance we lost ownership, so check if it is still here
-        if (overrideProfile) {
-            clProfileDestroy(C, overrideProfile);
-            overrideProfile = NULL;
+    // Just in case the read plugin is a bad citizen (overrideProfile still belongs to the caller)
+    if (image && overrideProfile) {
+        if (image->profile == overrideProfile) {
+            image->profile = clProfileClone(C, overrideProfile);
+        } else if (!clProfileMatches(C, image->profile, overrideProfile)) {
+            clProfileDestroy(C, image->profile);
+            image->profile = clProfileClone(C, overrideProfile);
         }
     }
     clRawFree(C, &input);
@@ -95,10 +121,17 @@ clBool clContextWrite(clContext * C, struct clImage * image, const char * filena
 
     if (format->writeFunc) {
         clRaw output = CL_RAW_EMPTY;
-        if (format->writeFunc(C, image, formatName, &output, writeParams)) {
+        clTraceSpan span;
+        clTraceBegin(C, &span, "encode");
+        clBool encoded = format->writeFunc(C, image, formatName, &output, writeParams);
+        clTraceEnd(C, &span);
+        if (encoded) {
+            clTraceBegin(C, &span, "write");
             if (clRawWriteFile(C, &output, filename)) {
+                clTraceCount(C, CL_TRACE_BYTES_WRITTEN, output.size);
                 result = clTrue;
             }
+            clTraceEnd(C, &span);
         }
         clRawFree(C, &output);
     } else {
@@ -107,6 +140,51 @@ clBool clContextWrite(clContext * C, struct clImage * image, const char * filena
     return result;
 }
 
+struct clStripReader * clContextReadStrips(clContext * C, const char * filename, struct clProfile * overrideProfile, const char ** outFormatName)
+{
+    const char * formatName = clFormatDetect(C, filename);
+    if (outFormatName)
+        *outFormatName = formatName;
+    if (!formatName) {
+        return NULL;
+    }
+
+    clFormat * format = clContextFindFormat(C, formatName);
+    if (!format || !format->readStripsFunc) {
+        clContextLogError(C, "Streaming unsupported for file reader '%s'", formatName);
+        return NULL;
+    }
+
+    memset(&C->readExtraInfo, 0, sizeof(C->readExtraInfo));
+
+    clStripReader * reader = format->readStripsFunc(C, formatName, overrideProfile, filename);
+
+    // Same as clContextReadWithProfile(), in case the read plugin ignored the override
+    if (reader && overrideProfile && !clProfileMatches(C, reader->image->profile, overrideProfile)) {
+        clProfileDestroy(C, reader->image->profile);
+        reader->image->profile = clProfileClone(C, overrideProfile);
+    }
+    return reader;
+}
+
+struct clStripWriter * clContextWriteStrips(clContext * C, struct clImage * image, const char * filename, const char * formatName, clWriteParams * writeParams)
+{
+    if (formatName == NULL) {
+        formatName = clFormatDetect(C, filename);
+        if (formatName == NULL) {
+            clContextLogError(C, "Unknown output file format '%s', please specify with -f", filename);
+            return NULL;
+        }
+    }
+
+    clFormat * format = clContextFindFormat(C, formatName);
+    if (!format || !format->writeStripsFunc) {
+        clContextLogError(C, "Streaming unsupported for file writer '%s'", formatName);
+        return NULL;
+    }
+    return format->writeStripsFunc(C, image, formatName, filename, writeParams);
+}
+
 char * clContextWriteURI(struct clContext * C, clImage * image, const char * formatName, clWriteParams * writeParams)
 {
     char * output = NULL;
@@ -220,7 +220,9 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
         }
     }
 
-    avifImageAllocatePlanes(avif, AVIF_PLANES_RGB | AVIF_PLANES_A);
+    // Opaque images don't need an alpha plane filled in, only for libavif to scan it and throw it away
+    clBool opaque = clImageGetTraits(C, image)->opaque;
+    avifImageAllocatePlanes(avif, opaque ? AVIF_PLANES_RGB : (AVIF_PLANES_RGB | AVIF_PLANES_A));
     avifRWData avifOutput = AVIF_DATA_EMPTY;
 
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
@@ -233,12 +235,16 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
                 *((uint16_t *)&avif->rgbPlanes[AVIF_CHAN_R][(i * 2) + (j * avif->rgbRowBytes[AVIF_CHAN_R])]) = pixel[0];
                 *((uint16_t *)&avif->rgbPlanes[AVIF_CHAN_G][(i * 2) + (j * avif->rgbRowBytes[AVIF_CHAN_G])]) = pixel[1];
                 *((uint16_t *)&avif->rgbPlanes[AVIF_CHAN_B][(i * 2) + (j * avif->rgbRowBytes[AVIF_CHAN_B])]) = pixel[2];
-                *((uint16_t *)&avif->alphaPlane[(i * 2) + (j * avif->alphaRowBytes)]) = pixel[3];
+                if (!opaque) {
+                    *((uint16_t *)&avif->alphaPlane[(i * 2) + (j * avif->alphaRowBytes)]) = pixel[3];
+                }
             } else {
                 avif->rgbPlanes[AVIF_CHAN_R][i + (j * avif->rgbRowBytes[AVIF_CHAN_R])] = (uint8_t)pixel[0];
                 avif->rgbPlanes[AVIF_CHAN_G][i + (j * avif->rgbRowBytes[AVIF_CHAN_G])] = (uint8_t)pixel[1];
                 avif->rgbPlanes[AVIF_CHAN_B][i + (j * avif->rgbRowBytes[AVIF_CHAN_B])] = (uint8_t)pixel[2];
-                avif->alphaPlane[i + (j * avif->alphaRowBytes)] = (uint8_t)pixel[3];
+                if (!opaque) {
+                    avif->alphaPlane[i + (j * avif->alphaRowBytes)] = (uint8_t)pixel[3];
+                }
             }
         }
     }
@@ -17,6 +17,11 @@
 #include <string.h>
 
 struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadScaledJP2(struct clContext * C,
+                                       const char * formatName,
+                                       struct clProfile * overrideProfile,
+                                       struct clRaw * input,
+                                       clReadScale * scale);
 clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
 static void error_callback(const char * msg, void * client_data)
@@ -120,6 +125,15 @@ static int limitedToFullUV(int depth, int v)
 }
 
 struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+{
+    return clFormatReadScaledJP2(C, formatName, overrideProfile, input, NULL);
+}
+
+struct clImage * clFormatReadScaledJP2(struct clContext * C,
+                                       const char * formatName,
+                                       struct clProfile * overrideProfile,
+                                       struct clRaw * input,
+                                       clReadScale * scale)
 {
     COLORIST_UNUSED(formatName);
 
@@ -183,6 +197,31 @@ struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName,
         return NULL;
     }
 
+    OPJ_UINT32 reduce = 0;
+    if (scale) {
+        scale->fullWidth = (int)(opjImage->x1 - opjImage->x0);
+        scale->fullHeight = (int)(opjImage->y1 - opjImage->y0);
+
+        // Each resolution level dropped halves the size and skips decoding that level's wavelet details
+        opj_codestream_info_v2_t * cstrInfo = opj_get_cstr_info(opjCodec);
+        if (cstrInfo) {
+            OPJ_UINT32 numResolutions = cstrInfo->m_default_tile_info.tccp_info ? cstrInfo->m_default_tile_info.tccp_info[0].numresolutions : 1;
+            while ((reduce + 1) < numResolutions) {
+                OPJ_UINT32 next = reduce + 1;
+                int width = (int)(((opjImage->x1 + (1U << next) - 1) >> next) - ((opjImage->x0 + (1U << next) - 1) >> next));
+                int height = (int)(((opjImage->y1 + (1U << next) - 1) >> next) - ((opjImage->y0 + (1U << next) - 1) >> next));
+                if ((width < scale->minWidth) || (height < scale->minHeight)) {
+                    break;
+                }
+                reduce = next;
+            }
+            opj_destroy_cstr_info(&cstrInfo);
+        }
+        if ((reduce > 0) && !opj_set_decoded_resolution_factor(opjCodec, reduce)) {
+            reduce = 0;
+        }
+    }
+
     if (!opj_decode(opjCodec, opjStream, opjImage)) {
         clContextLogError(C, "Failed to decode %s!", errorExtName);
         opj_destroy_codec(opjCodec);
@@ -243,8 +282,15 @@ struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName,
         clProfileQueryYUVCoefficients(C, profile, &yuv);
     }
 
-    clImageLogCreate(C, opjImage->x1, opjImage->y1, dstDepth, profile);
-    image = clImageCreate(C, opjImage->x1, opjImage->y1, dstDepth, profile);
+    // A reduced decode only shrinks the components (x1 / y1 stay in full size coordinates)
+    int width = (int)opjImage->x1;
+    int height = (int)opjImage->y1;
+    if (reduce > 0) {
+        width = (int)opjImage->comps[0].w;
+        height = (int)opjImage->comps[0].h;
+    }
+    clImageLogCreate(C, width, height, dstDepth, profile);
+    image = clImageCreate(C, width, height, dstDepth, profile);
     if (profile) {
         clProfileDestroy(C, profile);
     }
@@ -370,7 +416,8 @@ clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char
         }
     }
 
-    int numcomps = 4;
+    // Opaque images leave the alpha component out
+    int numcomps = clImageGetTraits(C, image)->opaque ? 3 : 4;
     opj_image_cmptparm_t cmptparm[4];
     unsigned int subsampling_dx = 1;
     unsigned int subsampling_dy = 1;
@@ -399,7 +446,9 @@ clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char
             opjImage->comps[0].data[dstOffset] = image->pixelsU16[srcOffset + 0];
             opjImage->comps[1].data[dstOffset] = image->pixelsU16[srcOffset + 1];
             opjImage->comps[2].data[dstOffset] = image->pixelsU16[srcOffset + 2];
-            opjImage->comps[3].data[dstOffset] = image->pixelsU16[srcOffset + 3];
+            if (numcomps == 4) {
+                opjImage->comps[3].data[dstOffset] = image->pixelsU16[srcOffset + 3];
+            }
         }
     }
 
@@ -407,7 +456,9 @@ clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char
     opjImage->y0 = 0;
     opjImage->x1 = image->width;
     opjImage->y1 = image->height;
-    opjImage->comps[3].alpha = 1;
+    if (numcomps == 4) {
+        opjImage->comps[3].alpha = 1;
+    }
 
     clRaw rawProfile = CL_RAW_EMPTY;
     if (writeParams->writeProfile) {
@@ -10,12 +10,14 @@
 #include "colorist/context.h"
 #include "colorist/profile.h"
 #include "colorist/raw.h"
+#include "colorist/strip.h"
 
 #include "lcms2.h"
 
 #include "jpeglib.h"
 
 #include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -37,19 +39,152 @@ static boolean read_icc_profile(struct clContext * C, j_decompress_ptr cinfo, JO
 static void write_icc_profile(j_compress_ptr cinfo, const JOCTET * icc_data_ptr, unsigned int icc_data_len);
 
 struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadScaledJPG(struct clContext * C,
+                                       const char * formatName,
+                                       struct clProfile * overrideProfile,
+                                       struct clRaw * input,
+                                       clReadScale * scale);
 clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
+struct clStripReader * clFormatReadStripsJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, const char * filename);
+struct clStripWriter * clFormatWriteStripsJPG(struct clContext * C,
+                                              struct clImage * image,
+                                              const char * formatName,
+                                              const char * filename,
+                                              struct clWriteParams * writeParams);
+
+// libjpeg-turbo reads and writes RGBA rows in place (ignoring or filling alpha); plain libjpeg only knows packed RGB
+#if defined(COLORIST_LIBJPEG_TURBO)
+#define JPEG_DIRECT_RGBA
+#define JPEG_RGB_OUT JCS_EXT_RGBA
+#define JPEG_RGB_IN JCS_EXT_RGBX
+#define JPEG_RGB_IN_COMPONENTS 4
+#else
+#define JPEG_RGB_OUT JCS_RGB
+#define JPEG_RGB_IN JCS_RGB
+#define JPEG_RGB_IN_COMPONENTS 3
+#endif
+
+// Scanlines handed to libjpeg per call, so it isn't called back for every row
+#define JPEG_ROWS_PER_CALL 16
+
+// Trades decoding quality for speed (see clConversionParams.readSpeed): from 5 up, chroma is upsampled by plain
+// replication instead of smoothly, and from 8 up the fast (less accurate) integer IDCT is used as well.
+static void jpegSetReadSpeed(struct clContext * C, j_decompress_ptr cinfo)
+{
+    int speed = C->params.readSpeed;
+    if (speed >= 5) {
+        cinfo->do_fancy_upsampling = FALSE;
+    }
+    if (speed >= 8) {
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->do_block_smoothing = FALSE;
+    }
+}
+
+// Trades encoding quality for speed (see clWriteParams.speed): up to 2, Huffman tables are optimized for the image (a
+// second pass, for smaller files), and from 8 up the fast (less accurate) integer DCT is used. Call after
+// jpeg_set_defaults().
+static void jpegSetWriteSpeed(j_compress_ptr cinfo, int speed)
+{
+    if ((speed >= 0) && (speed <= 2)) {
+        cinfo->optimize_coding = TRUE;
+    }
+    if (speed >= 8) {
+        cinfo->dct_method = JDCT_IFAST;
+    }
+}
+
+// Reads the next image->height rows (out_color_space JPEG_RGB_OUT) into image's U8 pixels. buffer holds
+// JPEG_ROWS_PER_CALL packed RGB rows, and isn't needed if libjpeg can fill the pixels directly.
+static void jpegReadRows(j_decompress_ptr cinfo, JSAMPARRAY buffer, clImage * image)
+{
+    COLORIST_UNUSED(buffer);
+
+    int y = 0;
+    while (y < image->height) {
+        JSAMPROW rows[JPEG_ROWS_PER_CALL];
+        int rowCount = CL_MIN(JPEG_ROWS_PER_CALL, image->height - y);
+        for (int r = 0; r < rowCount; ++r) {
+#if defined(JPEG_DIRECT_RGBA)
+            rows[r] = &image->pixelsU8[(size_t)(y + r) * image->width * CL_CHANNELS_PER_PIXEL];
+#else
+            rows[r] = buffer[r];
+#endif
+        }
+        rowCount = (int)jpeg_read_scanlines(cinfo, rows, (JDIMENSION)rowCount);
+#if !defined(JPEG_DIRECT_RGBA)
+        for (int r = 0; r < rowCount; ++r) {
+            uint8_t * pixelRow = &image->pixelsU8[(size_t)(y + r) * image->width * CL_CHANNELS_PER_PIXEL];
+            for (int i = 0; i < image->width; ++i) {
+                uint8_t * dst = &pixelRow[i * CL_CHANNELS_PER_PIXEL];
+                uint8_t * src = &buffer[r][i * 3];
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst[3] = 255;
+            }
+        }
+#endif
+        y += rowCount;
+    }
+}
+
+// Writes all of image's U8 pixels as the next image->height rows, with components channels (1 for in_color_space
+// JCS_GRAYSCALE, or 3 for JPEG_RGB_IN) per pixel. buffer holds JPEG_ROWS_PER_CALL packed rows of them, and isn't
+// needed if libjpeg can read the pixels directly. Gray rows are read through an indexed image's palette (see
+// clImageCopyRowChannel()).
+static void jpegWriteRows(struct clContext * C, j_compress_ptr cinfo, uint8_t * buffer, clImage * image, int components)
+{
+    int y = 0;
+    while (y < image->height) {
+        JSAMPROW rows[JPEG_ROWS_PER_CALL];
+        int rowCount = CL_MIN(JPEG_ROWS_PER_CALL, image->height - y);
+        for (int r = 0; r < rowCount; ++r) {
+            rows[r] = &buffer[(size_t)r * image->width * components];
+            if (components == 1) {
+                clImageCopyRowChannel(C, image, y + r, 0, CL_PIXELFORMAT_U8, rows[r]);
+                continue;
+            }
+            uint8_t * pixelRow = &image->pixelsU8[(size_t)(y + r) * image->width * CL_CHANNELS_PER_PIXEL];
+#if defined(JPEG_DIRECT_RGBA)
+            rows[r] = pixelRow;
+#else
+            for (int i = 0; i < image->width; ++i) {
+                for (int c = 0; c < components; ++c) {
+                    rows[r][(i * components) + c] = pixelRow[(i * CL_CHANNELS_PER_PIXEL) + c];
+                }
+            }
+#endif
+        }
+        y += (int)jpeg_write_scanlines(cinfo, rows, (JDIMENSION)rowCount);
+    }
+}
 
 struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+{
+    return clFormatReadScaledJPG(C, formatName, overrideProfile, input, NULL);
+}
+
+struct clImage * clFormatReadScaledJPG(struct clContext * C,
+                                       const char * formatName,
+                                       struct clProfile * overrideProfile,
+                                       struct clRaw * input,
+                                       clReadScale * scale)
 {
     COLORIST_UNUSED(formatName);
 
-    clImage * image = NULL;
+    // Both are set after the setjmp() below, so they have to be volatile to still be valid if it's returned to
+    clImage * volatile image = NULL;
+    uint8_t * volatile levels = NULL;
 
     struct my_error_mgr jerr;
     struct jpeg_decompress_struct cinfo;
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = my_error_exit;
     if (setjmp(jerr.setjmp_buffer)) {
+        if (levels) {
+            clFree(levels);
+        }
         if (image) {
             clImageDestroy(C, image);
         }
@@ -64,10 +199,26 @@ struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName,
     setup_read_icc_profile(&cinfo);
     jpeg_mem_src(&cinfo, input->ptr, (unsigned long)input->size);
     jpeg_read_header(&cinfo, TRUE);
+    // Grayscale JPEGs are read as gray levels, and kept as the image's palette (see clImageSetLevels())
+    clBool gray = (cinfo.jpeg_color_space == JCS_GRAYSCALE) ? clTrue : clFalse;
+    cinfo.out_color_space = gray ? JCS_GRAYSCALE : JPEG_RGB_OUT;
+    jpegSetReadSpeed(C, &cinfo);
+    if (scale) {
+        scale->fullWidth = (int)cinfo.image_width;
+        scale->fullHeight = (int)cinfo.image_height;
+
+        // The IDCT can produce M/8 scale output for about the cost of skipping the rest, pick the smallest M that fits
+        cinfo.scale_denom = 8;
+        for (cinfo.scale_num = 1; cinfo.scale_num < 8; ++cinfo.scale_num) {
+            jpeg_calc_output_dimensions(&cinfo);
+            if (((int)cinfo.output_width >= scale->minWidth) && ((int)cinfo.output_height >= scale->minHeight)) {
+                break;
+            }
+        }
+    }
     jpeg_start_decompress(&cinfo);
 
-    int row_stride = cinfo.output_width * cinfo.output_components;
-    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
+    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width * 3, JPEG_ROWS_PER_CALL);
 
     clProfile * profile = NULL;
     if (overrideProfile) {
@@ -88,30 +239,40 @@ struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName,
 
     clImageLogCreate(C, cinfo.output_width, cinfo.output_height, 8, profile);
     image = clImageCreate(C, cinfo.output_width, cinfo.output_height, 8, profile);
-    clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
 
     if (profile) {
         clProfileDestroy(C, profile);
     }
 
-    int row = 0;
-    while (cinfo.output_scanline < cinfo.output_height) {
-        jpeg_read_scanlines(&cinfo, buffer, 1);
-        uint8_t * pixelRow = &image->pixelsU8[row * image->width * CL_CHANNELS_PER_PIXEL];
-        for (unsigned int i = 0; i < cinfo.output_width; ++i) {
-            uint8_t * dst = &pixelRow[i * CL_CHANNELS_PER_PIXEL];
-            uint8_t * src = &buffer[0][i * 3];
-            dst[0] = src[0];
-            dst[1] = src[1];
-            dst[2] = src[2];
-            dst[3] = 255;
+    if (gray) {
+        levels = clAllocate((size_t)image->width * image->height);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            int y = (int)cinfo.output_scanline;
+            int rowCount = (int)jpeg_read_scanlines(&cinfo, buffer, JPEG_ROWS_PER_CALL);
+            for (int r = 0; r < rowCount; ++r) {
+                memcpy(&levels[(size_t)(y + r) * image->width], buffer[r], image->width);
+            }
         }
-        ++row;
+    } else {
+        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
+        jpegReadRows(&cinfo, buffer, image);
     }
 
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
 
+    if (gray) {
+        uint16_t levelColors[256 * CL_CHANNELS_PER_PIXEL];
+        for (int level = 0; level < 256; ++level) {
+            uint16_t * color = &levelColors[level * CL_CHANNELS_PER_PIXEL];
+            color[0] = (uint16_t)level;
+            color[1] = (uint16_t)level;
+            color[2] = (uint16_t)level;
+            color[3] = 255;
+        }
+        clImageSetLevels(C, image, levels, NULL, 256, levelColors);
+    }
+
     C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
     return image;
 }
@@ -123,8 +284,6 @@ clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
 
-    JSAMPROW row_pointer[1];
-    int row_stride;
     unsigned char * outbuffer = NULL;
     unsigned long outsize = 0;
 
@@ -137,36 +296,28 @@ clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char
     jpeg_create_compress(&cinfo);
     jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
 
-    clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
+    // Gray images skip both chroma planes entirely, unless they need to carry an (RGB) ICC profile, and only need an
+    // indexed image's colors
+    int components = (clImageGetTraits(C, image)->gray && !writeParams->writeProfile) ? 1 : 3;
+    clContextLog(C, "jpg", 1, "Color space: %s", (components == 1) ? "Grayscale" : "RGB");
+    clImagePrepareReadPixels(C, ((components == 1) && image->palette) ? image->palette->colors : image, CL_PIXELFORMAT_U8);
 
-    int pixelCount = image->width * image->height;
-    uint8_t * jpegPixels = clAllocate(3 * pixelCount);
-    for (int i = 0; i < pixelCount; ++i) {
-        uint8_t * imagePixel = &image->pixelsU8[i * CL_CHANNELS_PER_PIXEL];
-        uint8_t * jpegPixel = &jpegPixels[i * 3];
-        jpegPixel[0] = imagePixel[0];
-        jpegPixel[1] = imagePixel[1];
-        jpegPixel[2] = imagePixel[2];
-    }
+    uint8_t * buffer = clAllocate((size_t)JPEG_ROWS_PER_CALL * image->width * components);
 
     cinfo.image_width = image->width;
     cinfo.image_height = image->height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
+    cinfo.input_components = (components == 1) ? 1 : JPEG_RGB_IN_COMPONENTS;
+    cinfo.in_color_space = (components == 1) ? JCS_GRAYSCALE : JPEG_RGB_IN;
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, writeParams->quality, TRUE);
+    jpegSetWriteSpeed(&cinfo, writeParams->speed);
     jpeg_start_compress(&cinfo, TRUE);
 
     if (writeParams->writeProfile) {
         write_icc_profile(&cinfo, rawProfile.ptr, (unsigned int)rawProfile.size);
     }
 
-    row_stride = image->width * 3;
-    while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &jpegPixels[cinfo.next_scanline * row_stride];
-        (void)jpeg_write_scanlines(&cinfo, row_pointer, 1);
-    }
-
+    jpegWriteRows(C, &cinfo, buffer, image, components);
     jpeg_finish_compress(&cinfo);
 
     if (outbuffer && outsize) {
@@ -178,11 +329,209 @@ clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char
     free(outbuffer);
 
     jpeg_destroy_compress(&cinfo);
-    clFree(jpegPixels);
+    clFree(buffer);
     clRawFree(C, &rawProfile);
     return (output->size > 0) ? clTrue : clFalse;
 }
 
+// ----------------------------------------------------------------------------
+// Streaming
+
+typedef struct stripReaderInfo
+{
+    struct jpeg_decompress_struct cinfo;
+    struct my_error_mgr jerr;
+    FILE * f;
+    JSAMPARRAY buffer;
+} stripReaderInfo;
+
+static clBool stripRead(struct clContext * C, struct clStripReader * reader, struct clImage * strip)
+{
+    stripReaderInfo * sri = (stripReaderInfo *)reader->nativeData;
+    if (setjmp(sri->jerr.setjmp_buffer)) {
+        return clFalse;
+    }
+
+    clImagePrepareWritePixels(C, strip, CL_PIXELFORMAT_U8);
+    jpegReadRows(&sri->cinfo, sri->buffer, strip);
+    return clTrue;
+}
+
+static void stripReaderDestroy(struct clContext * C, struct clStripReader * reader)
+{
+    stripReaderInfo * sri = (stripReaderInfo *)reader->nativeData;
+    jpeg_destroy_decompress(&sri->cinfo);
+    fclose(sri->f);
+    clFree(sri);
+}
+
+struct clStripReader * clFormatReadStripsJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, const char * filename)
+{
+    COLORIST_UNUSED(formatName);
+
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        clContextLogError(C, "Failed to open file for read: %s", filename);
+        return NULL;
+    }
+
+    // libjpeg keeps pointers to both of these, so they live in the reader
+    stripReaderInfo * sri = clAllocateStruct(stripReaderInfo);
+    sri->f = f;
+    sri->cinfo.err = jpeg_std_error(&sri->jerr.pub);
+    sri->jerr.pub.error_exit = my_error_exit;
+    if (setjmp(sri->jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&sri->cinfo);
+        fclose(sri->f);
+        clFree(sri);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&sri->cinfo);
+    setup_read_icc_profile(&sri->cinfo);
+    jpeg_stdio_src(&sri->cinfo, f);
+    jpeg_read_header(&sri->cinfo, TRUE);
+    sri->cinfo.out_color_space = JPEG_RGB_OUT;
+    jpegSetReadSpeed(C, &sri->cinfo);
+    jpeg_start_decompress(&sri->cinfo);
+    sri->buffer = (*sri->cinfo.mem->alloc_sarray)((j_common_ptr)&sri->cinfo, JPOOL_IMAGE, sri->cinfo.output_width * 3, JPEG_ROWS_PER_CALL);
+
+    clProfile * profile = NULL;
+    if (overrideProfile) {
+        profile = clProfileClone(C, overrideProfile);
+    } else {
+        uint8_t * iccData = NULL;
+        unsigned int iccDataLen;
+        if (read_icc_profile(C, &sri->cinfo, &iccData, &iccDataLen)) {
+            profile = clProfileParse(C, iccData, iccDataLen, NULL);
+            clFree(iccData);
+            if (!profile) {
+                clContextLogError(C, "ERROR: can't parse JPEG embedded ICC profile");
+                jpeg_destroy_decompress(&sri->cinfo);
+                fclose(sri->f);
+                clFree(sri);
+                return NULL;
+            }
+        }
+    }
+
+    clImageLogCreate(C, sri->cinfo.output_width, sri->cinfo.output_height, 8, profile);
+    clStripReader * reader = clStripReaderCreate(C, clImageCreate(C, sri->cinfo.output_width, sri->cinfo.output_height, 8, profile));
+    if (profile) {
+        clProfileDestroy(C, profile);
+    }
+    reader->nativeData = sri;
+    reader->readFunc = stripRead;
+    reader->destroyFunc = stripReaderDestroy;
+    return reader;
+}
+
+typedef struct stripWriterInfo
+{
+    struct jpeg_compress_struct cinfo;
+    struct my_error_mgr jerr;
+    FILE * f;
+    uint8_t * buffer; // JPEG_ROWS_PER_CALL packed RGB rows
+} stripWriterInfo;
+
+static clBool stripWrite(struct clContext * C, struct clStripWriter * writer, struct clImage * strip)
+{
+    stripWriterInfo * swi = (stripWriterInfo *)writer->nativeData;
+    if (setjmp(swi->jerr.setjmp_buffer)) {
+        return clFalse;
+    }
+
+    clImagePrepareReadPixels(C, strip, CL_PIXELFORMAT_U8);
+    jpegWriteRows(C, &swi->cinfo, swi->buffer, strip, 3);
+    return clTrue;
+}
+
+static clBool stripWriterFinish(struct clContext * C, struct clStripWriter * writer)
+{
+    stripWriterInfo * swi = (stripWriterInfo *)writer->nativeData;
+    if (setjmp(swi->jerr.setjmp_buffer)) {
+        return clFalse;
+    }
+
+    jpeg_finish_compress(&swi->cinfo);
+    int closeResult = fclose(swi->f);
+    swi->f = NULL;
+    if (closeResult != 0) {
+        clContextLogError(C, "ERROR: JPG compression failed");
+        return clFalse;
+    }
+    return clTrue;
+}
+
+static void stripWriterDestroy(struct clContext * C, struct clStripWriter * writer)
+{
+    stripWriterInfo * swi = (stripWriterInfo *)writer->nativeData;
+    jpeg_destroy_compress(&swi->cinfo);
+    if (swi->f) {
+        fclose(swi->f);
+    }
+    clFree(swi->buffer);
+    clFree(swi);
+}
+
+struct clStripWriter * clFormatWriteStripsJPG(struct clContext * C,
+                                              struct clImage * image,
+                                              const char * formatName,
+                                              const char * filename,
+                                              struct clWriteParams * writeParams)
+{
+    COLORIST_UNUSED(formatName);
+
+    clRaw rawProfile = CL_RAW_EMPTY;
+    if (!clProfilePack(C, image->profile, &rawProfile)) {
+        return NULL;
+    }
+
+    FILE * f = fopen(filename, "wb");
+    if (!f) {
+        clContextLogError(C, "Failed to open file for write: %s", filename);
+        clRawFree(C, &rawProfile);
+        return NULL;
+    }
+
+    stripWriterInfo * swi = clAllocateStruct(stripWriterInfo);
+    swi->f = f;
+    swi->buffer = clAllocate((size_t)JPEG_ROWS_PER_CALL * 3 * image->width);
+    swi->cinfo.err = jpeg_std_error(&swi->jerr.pub);
+    swi->jerr.pub.error_exit = my_error_exit;
+    if (setjmp(swi->jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&swi->cinfo);
+        fclose(swi->f);
+        clFree(swi->buffer);
+        clFree(swi);
+        clRawFree(C, &rawProfile);
+        return NULL;
+    }
+
+    jpeg_create_compress(&swi->cinfo);
+    jpeg_stdio_dest(&swi->cinfo, f);
+    swi->cinfo.image_width = image->width;
+    swi->cinfo.image_height = image->height;
+    swi->cinfo.input_components = JPEG_RGB_IN_COMPONENTS;
+    swi->cinfo.in_color_space = JPEG_RGB_IN;
+    jpeg_set_defaults(&swi->cinfo);
+    jpeg_set_quality(&swi->cinfo, writeParams->quality, TRUE);
+    jpegSetWriteSpeed(&swi->cinfo, writeParams->speed);
+    jpeg_start_compress(&swi->cinfo, TRUE);
+
+    if (writeParams->writeProfile) {
+        write_icc_profile(&swi->cinfo, rawProfile.ptr, (unsigned int)rawProfile.size);
+    }
+    clRawFree(C, &rawProfile);
+
+    clStripWriter * writer = clStripWriterCreate(C, clImageCreate(C, image->width, image->height, 8, image->profile));
+    writer->nativeData = swi;
+    writer->writeFunc = stripWrite;
+    writer->finishFunc = stripWriterFinish;
+    writer->destroyFunc = stripWriterDestroy;
+    return writer;
+}
+
 // ----------------------------------------------------------------------------
 // Taken from http://www.littlecms.com/1/iccjpeg.c
 // Minor adaptations for compilation / formattingv
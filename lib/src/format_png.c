@@ -9,13 +9,24 @@
 
 #include "colorist/context.h"
 #include "colorist/profile.h"
+#include "colorist/strip.h"
+#include "colorist/task.h"
 
 #include "png.h"
+#include "zlib.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
 clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
+struct clStripReader * clFormatReadStripsPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, const char * filename);
+struct clStripWriter * clFormatWriteStripsPNG(struct clContext * C,
+                                              struct clImage * image,
+                                              const char * formatName,
+                                              const char * filename,
+                                              struct clWriteParams * writeParams);
 
 struct readInfo
 {
@@ -33,42 +44,12 @@ static void readCallback(png_structp png, png_bytep data, png_size_t length)
     ri->offset += length;
 }
 
-struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+// Reads everything up to the pixels and configures libpng to hand back RGBA rows (at 8 or 16 bits per channel, native
+// endian), returning an image without pixels to describe it. If levelBits isn't NULL, palette and gray images instead
+// hand back one level per pixel (a palette index or gray value, a byte each or a native endian uint16 if 16 bit), and
+// *levelBits is set to their bit depth (0 for RGBA rows). png must have its io set up, and a setjmp in place.
+static clImage * readImageHeader(struct clContext * C, png_structp png, png_infop info, struct clProfile * overrideProfile, int * levelBits)
 {
-    COLORIST_UNUSED(formatName);
-
-    clImage * image = NULL;
-    png_bytep * rowPointers = NULL;
-
-    if (png_sig_cmp(input->ptr, 0, 8)) {
-        clContextLogError(C, "not a PNG");
-        return NULL;
-    }
-
-    Timer t;
-    timerStart(&t);
-
-    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    png_infop info = png_create_info_struct(png);
-    COLORIST_ASSERT(png && info);
-
-    if (setjmp(png_jmpbuf(png))) {
-        if (rowPointers) {
-            clFree(rowPointers);
-        }
-        if (image) {
-            clImageDestroy(C, image);
-        }
-        png_destroy_read_struct(&png, &info, NULL);
-        return NULL;
-    }
-
-    struct readInfo ri;
-    ri.C = C;
-    ri.src = input;
-    ri.offset = 0;
-
-    png_set_read_fn(png, &ri, readCallback);
     png_read_info(png, info);
 
     clProfile * profile = NULL;
@@ -89,43 +70,165 @@ struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName,
     png_byte rawColorType = png_get_color_type(png, info);
     png_byte rawBitDepth = png_get_bit_depth(png, info);
 
-    if (rawColorType == PNG_COLOR_TYPE_PALETTE) {
-        png_set_palette_to_rgb(png);
+    clBool keepLevels = levelBits && ((rawColorType == PNG_COLOR_TYPE_PALETTE) || (rawColorType == PNG_COLOR_TYPE_GRAY));
+    if (levelBits) {
+        *levelBits = keepLevels ? rawBitDepth : 0;
     }
 
-    if ((rawColorType == PNG_COLOR_TYPE_GRAY) && (rawBitDepth < 8)) {
-        png_set_expand_gray_1_2_4_to_8(png);
-    }
+    if (keepLevels) {
+        if (rawBitDepth < 8) {
+            png_set_packing(png);
+        }
+    } else {
+        if (rawColorType == PNG_COLOR_TYPE_PALETTE) {
+            png_set_palette_to_rgb(png);
+        }
 
-    if (png_get_valid(png, info, PNG_INFO_tRNS)) {
-        png_set_tRNS_to_alpha(png);
-    }
+        if ((rawColorType == PNG_COLOR_TYPE_GRAY) && (rawBitDepth < 8)) {
+            png_set_expand_gray_1_2_4_to_8(png);
+        }
 
-    if ((rawColorType == PNG_COLOR_TYPE_RGB) || (rawColorType == PNG_COLOR_TYPE_GRAY) || (rawColorType == PNG_COLOR_TYPE_PALETTE)) {
-        png_set_filler(png, 0xFFFF, PNG_FILLER_AFTER);
-    }
+        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+            png_set_tRNS_to_alpha(png);
+        }
 
-    if ((rawColorType == PNG_COLOR_TYPE_GRAY) || (rawColorType == PNG_COLOR_TYPE_GRAY_ALPHA)) {
-        png_set_gray_to_rgb(png);
+        if ((rawColorType == PNG_COLOR_TYPE_RGB) || (rawColorType == PNG_COLOR_TYPE_GRAY) || (rawColorType == PNG_COLOR_TYPE_PALETTE)) {
+            png_set_filler(png, 0xFFFF, PNG_FILLER_AFTER);
+        }
+
+        if ((rawColorType == PNG_COLOR_TYPE_GRAY) || (rawColorType == PNG_COLOR_TYPE_GRAY_ALPHA)) {
+            png_set_gray_to_rgb(png);
+        }
     }
 
     int imgBitDepth = 8;
-    int imgBytesPerChannel = 1;
     if (rawBitDepth == 16) {
         png_set_swap(png);
         imgBitDepth = 16;
-        imgBytesPerChannel = 2;
     }
 
     png_read_update_info(png, info);
 
     clImageLogCreate(C, rawWidth, rawHeight, imgBitDepth, profile);
-    image = clImageCreate(C, rawWidth, rawHeight, imgBitDepth, profile);
+    clImage * image = clImageCreate(C, rawWidth, rawHeight, imgBitDepth, profile);
     if (profile) {
         clProfileDestroy(C, profile);
     }
+    return image;
+}
+
+// The RGBA color (at image's depth) of every possible level readImageHeader() hands back, the same as libpng would
+// have expanded it to. An index past the end of PLTE is opaque black.
+static uint16_t * readLevelColors(struct clContext * C, png_structp png, png_infop info, clImage * image, int levelBits, int * levelCount)
+{
+    *levelCount = 1 << levelBits;
+    uint16_t * levelColors = clAllocate(sizeof(uint16_t) * CL_CHANNELS_PER_PIXEL * *levelCount);
+    uint16_t maxChannel = (uint16_t)((1 << image->depth) - 1);
+
+    if (png_get_color_type(png, info) == PNG_COLOR_TYPE_PALETTE) {
+        png_colorp plte = NULL;
+        int plteCount = 0;
+        png_get_PLTE(png, info, &plte, &plteCount);
+        png_bytep trns = NULL;
+        int trnsCount = 0;
+        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+            png_get_tRNS(png, info, &trns, &trnsCount, NULL);
+        }
+        for (int level = 0; level < *levelCount; ++level) {
+            uint16_t * color = &levelColors[level * CL_CHANNELS_PER_PIXEL];
+            if (level < plteCount) {
+                color[0] = plte[level].red;
+                color[1] = plte[level].green;
+                color[2] = plte[level].blue;
+            }
+            color[3] = (level < trnsCount) ? trns[level] : maxChannel;
+        }
+    } else {
+        // Low bit depths scale up by repeating their bits, which is the same as scaling by the max
+        int transparentLevel = -1;
+        png_color_16p trnsColor = NULL;
+        if (png_get_valid(png, info, PNG_INFO_tRNS) && png_get_tRNS(png, info, NULL, NULL, &trnsColor)) {
+            transparentLevel = trnsColor->gray;
+        }
+        int maxLevel = *levelCount - 1;
+        for (int level = 0; level < *levelCount; ++level) {
+            uint16_t * color = &levelColors[level * CL_CHANNELS_PER_PIXEL];
+            uint16_t gray = (uint16_t)(((uint32_t)level * maxChannel) / maxLevel);
+            color[0] = gray;
+            color[1] = gray;
+            color[2] = gray;
+            color[3] = (level == transparentLevel) ? 0 : maxChannel;
+        }
+    }
+    return levelColors;
+}
+
+struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+{
+    COLORIST_UNUSED(formatName);
+
+    // All set after the setjmp() below, so they have to be volatile to still be valid if it's returned to
+    clImage * volatile image = NULL;
+    png_bytep * volatile rowPointers = NULL;
+    uint8_t * volatile levelsU8 = NULL;
+    uint16_t * volatile levelsU16 = NULL;
+
+    if (png_sig_cmp(input->ptr, 0, 8)) {
+        clContextLogError(C, "not a PNG");
+        return NULL;
+    }
+
+    Timer t;
+    timerStart(&t);
+
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    COLORIST_ASSERT(png && info);
+
+    if (setjmp(png_jmpbuf(png))) {
+        if (rowPointers) {
+            clFree(rowPointers);
+        }
+        if (levelsU8) {
+            clFree(levelsU8);
+        }
+        if (levelsU16) {
+            clFree(levelsU16);
+        }
+        if (image) {
+            clImageDestroy(C, image);
+        }
+        png_destroy_read_struct(&png, &info, NULL);
+        return NULL;
+    }
+
+    struct readInfo ri;
+    ri.C = C;
+    ri.src = input;
+    ri.offset = 0;
+
+    png_set_read_fn(png, &ri, readCallback);
+    int levelBits = 0;
+    image = readImageHeader(C, png, info, overrideProfile, &levelBits);
+    int rawWidth = image->width;
+    int rawHeight = image->height;
+    int imgBytesPerChannel = (image->depth == 16) ? 2 : 1;
+
     rowPointers = (png_bytep *)clAllocate(sizeof(png_bytep) * rawHeight);
-    if (imgBytesPerChannel == 1) {
+    if (levelBits > 0) {
+        // Palette indices and gray levels are kept as the image's palette (see clImageSetLevels())
+        if (levelBits == 16) {
+            levelsU16 = clAllocate(sizeof(uint16_t) * rawWidth * rawHeight);
+            for (int y = 0; y < rawHeight; ++y) {
+                rowPointers[y] = (png_bytep)&levelsU16[(size_t)y * rawWidth];
+            }
+        } else {
+            levelsU8 = clAllocate((size_t)rawWidth * rawHeight);
+            for (int y = 0; y < rawHeight; ++y) {
+                rowPointers[y] = &levelsU8[(size_t)y * rawWidth];
+            }
+        }
+    } else if (imgBytesPerChannel == 1) {
         clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
         for (int y = 0; y < rawHeight; ++y) {
             rowPointers[y] = &image->pixelsU8[CL_CHANNELS_PER_PIXEL * y * rawWidth];
@@ -137,6 +240,12 @@ struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName,
         }
     }
     png_read_image(png, rowPointers);
+    if (levelBits > 0) {
+        int levelCount;
+        uint16_t * levelColors = readLevelColors(C, png, info, image, levelBits, &levelCount);
+        clImageSetLevels(C, image, levelsU8, levelsU16, levelCount, levelColors);
+        clFree(levelColors);
+    }
     C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
 
     png_destroy_read_struct(&png, &info, NULL);
@@ -167,10 +276,538 @@ static void writeCallback(png_structp png, png_bytep data, png_size_t length)
     wi->offset += length;
 }
 
+// ---------------------------------------------------------------------------
+// Encoding effort
+
+// What each --speed (0-10) costs: zlib's level and strategy, and which row filters are tried (libpng's PNG_FILTER_*
+// masks; with more than one, each row keeps whichever has the smallest sum of absolute differences).
+typedef struct pngEffort
+{
+    int zlibLevel;
+    int zlibStrategy;
+    int filters;
+} pngEffort;
+
+static const pngEffort pngEfforts[11] = {
+    { 9, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },  // 0
+    { 9, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },  // 1
+    { 8, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },  // 2
+    { 7, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },  // 3
+    { 6, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },  // 4
+    { 6, Z_FILTERED, PNG_ALL_FILTERS },          // 5, also the default (what libpng does on its own)
+    { 5, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS },  // 6
+    { 4, Z_DEFAULT_STRATEGY, PNG_FILTER_PAETH }, // 7
+    { 3, Z_DEFAULT_STRATEGY, PNG_FILTER_PAETH }, // 8
+    { 1, Z_DEFAULT_STRATEGY, PNG_FILTER_SUB },   // 9
+    { 1, Z_RLE, PNG_FILTER_SUB },                // 10
+};
+#define PNG_DEFAULT_SPEED 5
+
+static const pngEffort * pngEffortForSpeed(int speed)
+{
+    if (speed < 0) {
+        speed = PNG_DEFAULT_SPEED;
+    }
+    return &pngEfforts[CL_MIN(speed, 10)];
+}
+
+// ---------------------------------------------------------------------------
+// Pixel layout
+
+// Which of the image's channels are stored per pixel, or a palette index instead
+typedef struct pngLayout
+{
+    int colorType;
+    int channelCount;                             // 1 for palette indices
+    int channels[CL_CHANNELS_PER_PIXEL];          // image channel for each stored one
+    const clImageTraits * traits;                 // palette only
+    uint8_t paletteIndices[CL_TRAITS_MAX_COLORS]; // traits->colors[i] is stored as paletteIndices[i]
+    int translucentCount;                         // palette entries with alpha (they come first, for tRNS)
+    const clImagePalette * palette;               // image->palette, if it has few enough colors to write from directly
+    uint8_t entryIndices[CL_TRAITS_MAX_COLORS];   // image->palette's color i is stored as entryIndices[i]
+} pngLayout;
+
+// Index of color in traits->colors, which must hold it
+static int pngFindColor(const clImageTraits * traits, uint32_t color)
+{
+    int lo = 0;
+    int hi = traits->colorCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (traits->colors[mid] < color) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// The smallest layout that still holds every pixel exactly, unless reduce is false (RGBA, which needs no scan). Gray
+// layouts can't carry an RGB ICC profile, so they're only used without one; 8 bit gray still gets a palette then.
+static void pngChooseLayout(struct clContext * C, clImage * image, clBool reduce, clBool writeProfile, pngLayout * layout)
+{
+    memset(layout, 0, sizeof(pngLayout));
+    const clImageTraits * traits = reduce ? clImageGetTraits(C, image) : NULL;
+    clBool opaque = traits && traits->opaque;
+    clBool gray = traits && traits->gray && !writeProfile;
+
+    if (gray && opaque) {
+        layout->colorType = PNG_COLOR_TYPE_GRAY;
+    } else if (traits && (traits->colorCount > 0)) {
+        // One byte per pixel beats gray + alpha, and anything with color
+        layout->colorType = PNG_COLOR_TYPE_PALETTE;
+        layout->traits = traits;
+        for (int i = 0; i < traits->colorCount; ++i) {
+            if ((traits->colors[i] >> 24) != 255) {
+                layout->paletteIndices[i] = (uint8_t)layout->translucentCount++;
+            }
+        }
+        int nextIndex = layout->translucentCount;
+        for (int i = 0; i < traits->colorCount; ++i) {
+            if ((traits->colors[i] >> 24) == 255) {
+                layout->paletteIndices[i] = (uint8_t)nextIndex++;
+            }
+        }
+        if (image->palette && (image->palette->colors->width <= CL_TRAITS_MAX_COLORS)) {
+            // Already indexed, so only its colors need looking up rather than every pixel
+            const clImage * colors = image->palette->colors;
+            layout->palette = image->palette;
+            for (int i = 0; i < colors->width; ++i) {
+                uint32_t color = CL_TRAITS_PACK_COLOR(&colors->pixelsU8[i * CL_CHANNELS_PER_PIXEL]);
+                layout->entryIndices[i] = layout->paletteIndices[pngFindColor(traits, color)];
+            }
+        }
+    } else if (gray) {
+        layout->colorType = PNG_COLOR_TYPE_GRAY_ALPHA;
+    } else if (opaque) {
+        layout->colorType = PNG_COLOR_TYPE_RGB;
+    } else {
+        layout->colorType = PNG_COLOR_TYPE_RGBA;
+    }
+
+    switch (layout->colorType) {
+        case PNG_COLOR_TYPE_GRAY:
+        case PNG_COLOR_TYPE_PALETTE:
+            layout->channelCount = 1;
+            break;
+        case PNG_COLOR_TYPE_GRAY_ALPHA:
+            layout->channelCount = 2;
+            layout->channels[1] = 3;
+            break;
+        default:
+            layout->channelCount = (layout->colorType == PNG_COLOR_TYPE_RGB) ? 3 : 4;
+            for (int i = 0; i < layout->channelCount; ++i) {
+                layout->channels[i] = i;
+            }
+            break;
+    }
+}
+
+static const char * pngColorTypeName(int colorType)
+{
+    switch (colorType) {
+        case PNG_COLOR_TYPE_GRAY:
+            return "Gray";
+        case PNG_COLOR_TYPE_GRAY_ALPHA:
+            return "GrayAlpha";
+        case PNG_COLOR_TYPE_PALETTE:
+            return "Palette";
+        case PNG_COLOR_TYPE_RGB:
+            return "RGB";
+    }
+    return "RGBA";
+}
+
+static void writeImageHeader(png_structp png, png_infop info, clImage * image, const pngLayout * layout, clRaw * rawProfile, struct clWriteParams * writeParams)
+{
+    const pngEffort * effort = pngEffortForSpeed(writeParams->speed);
+    png_set_compression_level(png, effort->zlibLevel);
+    png_set_compression_strategy(png, effort->zlibStrategy);
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, (layout->colorType == PNG_COLOR_TYPE_PALETTE) ? PNG_FILTER_NONE : effort->filters);
+
+    int bitDepth = (layout->colorType == PNG_COLOR_TYPE_PALETTE) ? 8 : image->depth;
+    png_set_IHDR(png, info, image->width, image->height, bitDepth, layout->colorType, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    if (layout->colorType == PNG_COLOR_TYPE_PALETTE) {
+        png_color palette[CL_TRAITS_MAX_COLORS];
+        png_byte paletteAlpha[CL_TRAITS_MAX_COLORS];
+        for (int i = 0; i < layout->traits->colorCount; ++i) {
+            uint32_t color = layout->traits->colors[i];
+            int index = layout->paletteIndices[i];
+            palette[index].red = (png_byte)(color & 0xff);
+            palette[index].green = (png_byte)((color >> 8) & 0xff);
+            palette[index].blue = (png_byte)((color >> 16) & 0xff);
+            paletteAlpha[index] = (png_byte)(color >> 24);
+        }
+        png_set_PLTE(png, info, palette, layout->traits->colorCount);
+        if (layout->translucentCount > 0) {
+            png_set_tRNS(png, info, paletteAlpha, layout->translucentCount, NULL);
+        }
+    }
+    if (writeParams->writeProfile) {
+        png_set_iCCP(png, info, image->profile->description, 0, rawProfile->ptr, (png_uint_32)rawProfile->size);
+    }
+    png_write_info(png, info);
+}
+
+// ---------------------------------------------------------------------------
+// Banded IDAT encoding
+//
+// The image is cut into bands of whole rows which are filtered and deflated independently, then stitched into a
+// single zlib stream: each band ends on a sync flush (byte aligned, not final) so the raw deflate data can simply be
+// concatenated, and starts with the last 32K of the rows before it as its dictionary so matches can still reach
+// back across the seam. The Adler-32s are combined at the end. Bands are sized by bytes alone, so the output is the
+// same no matter how many jobs encode it.
+
+#define PNG_BAND_BYTES (1024 * 1024)
+#define PNG_WINDOW_BYTES 32768
+#define PNG_MAX_IDAT_BYTES (1024 * 1024)
+
+typedef struct pngBand
+{
+    int firstRow;
+    int rowCount;
+    clRaw compressed; // raw deflate data (no zlib header or trailer)
+    size_t compressedSize;
+    uLong adler;          // Adler-32 of this band's filtered rows alone
+    size_t filteredBytes; // ... and how many bytes that covers
+    clBool failed;
+} pngBand;
+
+typedef struct pngEncodeInfo
+{
+    struct clContext * C;
+    clImage * image;
+    const pngEffort * effort;
+    const pngLayout * layout;
+    int filters;     // effort->filters, unless the layout calls for something else
+    size_t rowBytes; // one unfiltered row, without its filter type byte
+    int bytesPerPixel;
+    pngBand * bands;
+    int bandCount;
+} pngEncodeInfo;
+
+// Copies row y into dst as PNG lays it out (16 bit channels are big endian)
+static void pngPrepareRow(pngEncodeInfo * info, int y, uint8_t * dst)
+{
+    clImage * image = info->image;
+    const pngLayout * layout = info->layout;
+    int channelCount = layout->channelCount;
+    if (layout->palette) {
+        size_t rowStart = (size_t)y * image->width;
+        for (int x = 0; x < image->width; ++x) {
+            dst[x] = layout->entryIndices[CL_PALETTE_INDEX(layout->palette, rowStart + x)];
+        }
+    } else if (layout->colorType == PNG_COLOR_TYPE_GRAY) {
+        // Gray images are often still indexed, and this reads those through their palette
+        if (image->depth == 16) {
+            uint16_t * dst16 = (uint16_t *)dst;
+            clImageCopyRowChannel(info->C, image, y, 0, CL_PIXELFORMAT_U16, dst16);
+            for (int x = 0; x < image->width; ++x) {
+                dst16[x] = (uint16_t)((dst16[x] >> 8) | (dst16[x] << 8));
+            }
+        } else {
+            clImageCopyRowChannel(info->C, image, y, 0, CL_PIXELFORMAT_U8, dst);
+        }
+    } else if (layout->colorType == PNG_COLOR_TYPE_PALETTE) {
+        // Neighbors are usually the same color, so check the last one first
+        const uint8_t * src = &image->pixelsU8[(size_t)CL_CHANNELS_PER_PIXEL * y * image->width];
+        int colorIndex = 0;
+        for (int x = 0; x < image->width; ++x) {
+            uint32_t color = CL_TRAITS_PACK_COLOR(&src[x * CL_CHANNELS_PER_PIXEL]);
+            if (layout->traits->colors[colorIndex] != color) {
+                colorIndex = pngFindColor(layout->traits, color);
+            }
+            dst[x] = layout->paletteIndices[colorIndex];
+        }
+    } else if (image->depth == 16) {
+        const uint16_t * src = &image->pixelsU16[(size_t)CL_CHANNELS_PER_PIXEL * y * image->width];
+        for (int x = 0; x < image->width; ++x) {
+            for (int c = 0; c < channelCount; ++c) {
+                uint16_t v = src[(x * CL_CHANNELS_PER_PIXEL) + layout->channels[c]];
+                *dst++ = (uint8_t)(v >> 8);
+                *dst++ = (uint8_t)(v & 0xff);
+            }
+        }
+    } else if (channelCount == CL_CHANNELS_PER_PIXEL) {
+        memcpy(dst, &image->pixelsU8[(size_t)CL_CHANNELS_PER_PIXEL * y * image->width], info->rowBytes);
+    } else {
+        const uint8_t * src = &image->pixelsU8[(size_t)CL_CHANNELS_PER_PIXEL * y * image->width];
+        for (int x = 0; x < image->width; ++x) {
+            for (int c = 0; c < channelCount; ++c) {
+                *dst++ = src[(x * CL_CHANNELS_PER_PIXEL) + layout->channels[c]];
+            }
+        }
+    }
+}
+
+static uint8_t pngPaeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if ((pa <= pb) && (pa <= pc)) {
+        return (uint8_t)a;
+    }
+    if (pb <= pc) {
+        return (uint8_t)b;
+    }
+    return (uint8_t)c;
+}
+
+// Writes the filter type byte and the filtered row to out, returning the sum of the filtered bytes' magnitudes as
+// signed values (libpng's heuristic for picking a filter).
+static size_t pngFilterRow(int filterType, const uint8_t * row, const uint8_t * prev, size_t rowBytes, int bpp, uint8_t * out)
+{
+    uint8_t * dst = out + 1;
+    out[0] = (uint8_t)filterType;
+    switch (filterType) {
+        case PNG_FILTER_VALUE_NONE:
+            memcpy(dst, row, rowBytes);
+            break;
+        case PNG_FILTER_VALUE_SUB:
+            memcpy(dst, row, bpp);
+            for (size_t i = bpp; i < rowBytes; ++i) {
+                dst[i] = (uint8_t)(row[i] - row[i - bpp]);
+            }
+            break;
+        case PNG_FILTER_VALUE_UP:
+            for (size_t i = 0; i < rowBytes; ++i) {
+                dst[i] = (uint8_t)(row[i] - prev[i]);
+            }
+            break;
+        case PNG_FILTER_VALUE_AVG:
+            for (int i = 0; i < bpp; ++i) {
+                dst[i] = (uint8_t)(row[i] - (prev[i] >> 1));
+            }
+            for (size_t i = bpp; i < rowBytes; ++i) {
+                dst[i] = (uint8_t)(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+            }
+            break;
+        case PNG_FILTER_VALUE_PAETH:
+            for (int i = 0; i < bpp; ++i) {
+                dst[i] = (uint8_t)(row[i] - prev[i]);
+            }
+            for (size_t i = bpp; i < rowBytes; ++i) {
+                dst[i] = (uint8_t)(row[i] - pngPaeth(row[i - bpp], prev[i], prev[i - bpp]));
+            }
+            break;
+    }
+
+    size_t sum = 0;
+    for (size_t i = 0; i < rowBytes; ++i) {
+        sum += (dst[i] < 128) ? dst[i] : (256 - dst[i]);
+    }
+    return sum;
+}
+
+// Filters row into best (rowBytes + 1 bytes), using candidate as scratch
+static void pngFilterRowBest(pngEncodeInfo * info, const uint8_t * row, const uint8_t * prev, uint8_t ** best, uint8_t ** candidate)
+{
+    static const int filterMasks[PNG_FILTER_VALUE_LAST] = { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH };
+
+    size_t bestSum = (size_t)-1;
+    for (int filterType = 0; filterType < PNG_FILTER_VALUE_LAST; ++filterType) {
+        if (!(info->filters & filterMasks[filterType])) {
+            continue;
+        }
+        size_t sum = pngFilterRow(filterType, row, prev, info->rowBytes, info->bytesPerPixel, *candidate);
+        if (sum < bestSum) {
+            uint8_t * swap = *best;
+            *best = *candidate;
+            *candidate = swap;
+            bestSum = sum;
+        }
+    }
+}
+
+// Feeds strm's input into band->compressed (growing it as needed) until it is consumed and, for a flush, done
+static clBool pngBandDeflate(struct clContext * C, z_stream * strm, pngBand * band, int flush)
+{
+    for (;;) {
+        if (band->compressedSize == band->compressed.size) {
+            clRawRealloc(C, &band->compressed, band->compressed.size * 2);
+        }
+        strm->next_out = band->compressed.ptr + band->compressedSize;
+        strm->avail_out = (uInt)(band->compressed.size - band->compressedSize);
+        int ret = deflate(strm, flush);
+        band->compressedSize = band->compressed.size - strm->avail_out;
+        if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR)) {
+            return clFalse;
+        }
+        if (flush == Z_FINISH) {
+            if (ret == Z_STREAM_END) {
+                return clTrue;
+            }
+        } else if ((strm->avail_in == 0) && (strm->avail_out > 0)) {
+            return clTrue;
+        }
+    }
+}
+
+static void pngEncodeBand(pngEncodeInfo * info, pngBand * band)
+{
+    struct clContext * C = info->C;
+    size_t rowBytes = info->rowBytes;
+    size_t filteredRowBytes = rowBytes + 1;
+
+    // Enough of the rows before this band to fill the window, which are filtered again here (exactly as the band
+    // that owns them filters them) to become the dictionary
+    int dictionaryRows = CL_MIN(band->firstRow, (int)((PNG_WINDOW_BYTES + filteredRowBytes - 1) / filteredRowBytes));
+    int startRow = band->firstRow - dictionaryRows;
+    int endRow = band->firstRow + band->rowCount;
+    size_t dictionaryBytes = (size_t)dictionaryRows * filteredRowBytes;
+
+    uint8_t * row = clAllocate(rowBytes);
+    uint8_t * prev = clAllocate(rowBytes); // zeros above the first row
+    uint8_t * best = clAllocate(filteredRowBytes);
+    uint8_t * candidate = clAllocate(filteredRowBytes);
+    uint8_t * dictionary = (dictionaryBytes > 0) ? clAllocate(dictionaryBytes) : NULL;
+    if (startRow > 0) {
+        pngPrepareRow(info, startRow - 1, prev);
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, info->effort->zlibLevel, Z_DEFLATED, -15, 8, info->effort->zlibStrategy) != Z_OK) {
+        band->failed = clTrue;
+    } else {
+        clRawRealloc(C, &band->compressed, deflateBound(&strm, (uLong)(band->rowCount * filteredRowBytes)) + 64);
+        band->adler = adler32(0L, Z_NULL, 0);
+        band->filteredBytes = 0;
+
+        for (int y = startRow; (y < endRow) && !band->failed; ++y) {
+            pngPrepareRow(info, y, row);
+            if (y < band->firstRow) {
+                uint8_t * filtered = &dictionary[(size_t)(y - startRow) * filteredRowBytes];
+                pngFilterRowBest(info, row, prev, &best, &candidate);
+                memcpy(filtered, best, filteredRowBytes);
+                if ((y + 1) == band->firstRow) {
+                    size_t windowBytes = CL_MIN(dictionaryBytes, PNG_WINDOW_BYTES);
+                    if (deflateSetDictionary(&strm, dictionary + dictionaryBytes - windowBytes, (uInt)windowBytes) != Z_OK) {
+                        band->failed = clTrue;
+                    }
+                }
+            } else {
+                pngFilterRowBest(info, row, prev, &best, &candidate);
+                band->adler = adler32(band->adler, best, (uInt)filteredRowBytes);
+                band->filteredBytes += filteredRowBytes;
+                strm.next_in = best;
+                strm.avail_in = (uInt)filteredRowBytes;
+                if (!pngBandDeflate(C, &strm, band, Z_NO_FLUSH)) {
+                    band->failed = clTrue;
+                }
+            }
+            uint8_t * swap = prev;
+            prev = row;
+            row = swap;
+        }
+
+        if (!band->failed) {
+            int flush = (endRow == info->image->height) ? Z_FINISH : Z_SYNC_FLUSH;
+            strm.next_in = Z_NULL;
+            strm.avail_in = 0;
+            if (!pngBandDeflate(C, &strm, band, flush)) {
+                band->failed = clTrue;
+            }
+        }
+        deflateEnd(&strm);
+    }
+
+    clFree(row);
+    clFree(prev);
+    clFree(best);
+    clFree(candidate);
+    if (dictionary) {
+        clFree(dictionary);
+    }
+}
+
+static void pngEncodeBandsTask(void * userData, int start, int count)
+{
+    pngEncodeInfo * info = (pngEncodeInfo *)userData;
+    for (int i = start; i < (start + count); ++i) {
+        pngEncodeBand(info, &info->bands[i]);
+    }
+}
+
+// Writes the image's pixels as IDAT chunks. png must have written everything before them already.
+static clBool pngWriteBandedIDAT(struct clContext * C, png_structp png, clImage * image, const pngLayout * layout, const pngEffort * effort)
+{
+    pngEncodeInfo info;
+    info.C = C;
+    info.image = image;
+    info.effort = effort;
+    info.layout = layout;
+    info.filters = (layout->colorType == PNG_COLOR_TYPE_PALETTE) ? PNG_FILTER_NONE : effort->filters; // as libpng does
+    info.bytesPerPixel = layout->channelCount * (((image->depth == 16) && (layout->colorType != PNG_COLOR_TYPE_PALETTE)) ? 2 : 1);
+    info.rowBytes = (size_t)info.bytesPerPixel * image->width;
+
+    int rowsPerBand = (int)CL_MAX(1, PNG_BAND_BYTES / (info.rowBytes + 1));
+    info.bandCount = (image->height + rowsPerBand - 1) / rowsPerBand;
+    info.bands = clAllocate(sizeof(pngBand) * info.bandCount);
+    for (int i = 0; i < info.bandCount; ++i) {
+        info.bands[i].firstRow = i * rowsPerBand;
+        info.bands[i].rowCount = CL_MIN(rowsPerBand, image->height - info.bands[i].firstRow);
+    }
+
+    clTaskParallelFor(C, info.bandCount, 1, pngEncodeBandsTask, &info);
+
+    clBool result = clTrue;
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int i = 0; i < info.bandCount; ++i) {
+        if (info.bands[i].failed) {
+            result = clFalse;
+        } else {
+            adler = adler32_combine(adler, info.bands[i].adler, (z_off_t)info.bands[i].filteredBytes);
+        }
+    }
+
+    if (result) {
+        // zlib header (32K window, FLEVEL as zlib itself would report it) and trailer around the bands
+        int level = effort->zlibLevel;
+        int flevel = ((level < 2) || (effort->zlibStrategy >= Z_HUFFMAN_ONLY)) ? 0 : ((level < 6) ? 1 : ((level == 6) ? 2 : 3));
+        uint8_t header[2];
+        header[0] = 0x78;
+        header[1] = (uint8_t)(flevel << 6);
+        header[1] = (uint8_t)(header[1] + (31 - (((header[0] << 8) + header[1]) % 31)));
+        uint8_t trailer[4] = { (uint8_t)(adler >> 24), (uint8_t)(adler >> 16), (uint8_t)(adler >> 8), (uint8_t)adler };
+
+        // IDAT boundaries don't mean anything, so each band (split up if huge) gets its own
+        for (int i = 0; i < info.bandCount; ++i) {
+            pngBand * band = &info.bands[i];
+            size_t offset = 0;
+            do {
+                size_t bytes = CL_MIN(band->compressedSize - offset, PNG_MAX_IDAT_BYTES);
+                size_t headerBytes = ((i == 0) && (offset == 0)) ? sizeof(header) : 0;
+                size_t trailerBytes = (((i + 1) == info.bandCount) && ((offset + bytes) == band->compressedSize)) ? sizeof(trailer) : 0;
+                png_write_chunk_start(png, (png_const_bytep) "IDAT", (png_uint_32)(headerBytes + bytes + trailerBytes));
+                if (headerBytes) {
+                    png_write_chunk_data(png, header, headerBytes);
+                }
+                png_write_chunk_data(png, band->compressed.ptr + offset, bytes);
+                if (trailerBytes) {
+                    png_write_chunk_data(png, trailer, trailerBytes);
+                }
+                png_write_chunk_end(png);
+                offset += bytes;
+            } while (offset < band->compressedSize);
+        }
+    } else {
+        clContextLogError(C, "Failed to compress PNG pixels");
+    }
+
+    for (int i = 0; i < info.bandCount; ++i) {
+        clRawFree(C, &info.bands[i].compressed);
+    }
+    clFree(info.bands);
+    return result;
+}
+
 clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams)
 {
     COLORIST_UNUSED(formatName);
-    COLORIST_UNUSED(writeParams);
 
     png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     png_infop info = png_create_info_struct(png);
@@ -181,12 +818,7 @@ clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char
         return clFalse;
     }
 
-    png_bytep * rowPointers = NULL;
-
     if (setjmp(png_jmpbuf(png))) {
-        if (rowPointers) {
-            clFree(rowPointers);
-        }
         clRawFree(C, &rawProfile);
         png_destroy_write_struct(&png, &info);
         return clFalse;
@@ -198,33 +830,224 @@ clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char
     wi.dst = output;
     png_set_write_fn(png, &wi, writeCallback, NULL);
 
-    png_set_IHDR(png, info, image->width, image->height, image->depth, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    if (writeParams->writeProfile) {
-        png_set_iCCP(png, info, image->profile->description, 0, rawProfile.ptr, (png_uint_32)rawProfile.size);
+    const pngEffort * effort = pngEffortForSpeed(writeParams->speed);
+    if (writeParams->speed == -1) {
+        clContextLog(C, "png", 1, "Encoding speed (0=BestCompression, 10=Fastest): default (%d)", PNG_DEFAULT_SPEED);
+    } else {
+        clContextLog(C, "png", 1, "Encoding speed (0=BestCompression, 10=Fastest): %d", writeParams->speed);
     }
-    png_write_info(png, info);
 
-    rowPointers = (png_bytep *)clAllocate(sizeof(png_bytep) * image->height);
-    int imgBytesPerChannel = (image->depth == 16) ? 2 : 1;
-    if (imgBytesPerChannel == 1) {
-        clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
-        for (int y = 0; y < image->height; ++y) {
-            rowPointers[y] = &image->pixelsU8[CL_CHANNELS_PER_PIXEL * y * image->width];
-        }
+    pngLayout layout;
+    pngChooseLayout(C, image, clTrue, writeParams->writeProfile, &layout);
+    if (!layout.palette) {
+        // Gray layouts only need an indexed image's colors
+        clImage * source = ((layout.colorType == PNG_COLOR_TYPE_GRAY) && image->palette) ? image->palette->colors : image;
+        clImagePrepareReadPixels(C, source, (image->depth == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    }
+    if (layout.colorType == PNG_COLOR_TYPE_PALETTE) {
+        clContextLog(C, "png", 1, "Color type: %s (%d colors)", pngColorTypeName(layout.colorType), layout.traits->colorCount);
     } else {
-        clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
-        for (int y = 0; y < image->height; ++y) {
-            rowPointers[y] = (png_byte *)&image->pixelsU16[CL_CHANNELS_PER_PIXEL * y * image->width];
-        }
-        png_set_swap(png);
+        clContextLog(C, "png", 1, "Color type: %s", pngColorTypeName(layout.colorType));
     }
 
-    png_write_image(png, rowPointers);
-    png_write_end(png, NULL);
+    writeImageHeader(png, info, image, &layout, &rawProfile, writeParams);
+    if (!pngWriteBandedIDAT(C, png, image, &layout, effort)) {
+        clRawFree(C, &rawProfile);
+        png_destroy_write_struct(&png, &info);
+        return clFalse;
+    }
+    // The IDATs didn't go through libpng's own row writer, so png_write_end() would refuse; IEND is empty anyway
+    png_write_chunk(png, (png_const_bytep) "IEND", NULL, 0);
     png_destroy_write_struct(&png, &info);
 
-    clFree(rowPointers);
     clRawFree(C, &rawProfile);
     output->size = wi.offset;
     return clTrue;
 }
+
+// ---------------------------------------------------------------------------
+// Streaming
+
+typedef struct stripReaderInfo
+{
+    FILE * f;
+    png_structp png;
+    png_infop info;
+} stripReaderInfo;
+
+static clBool stripRead(struct clContext * C, struct clStripReader * reader, struct clImage * strip)
+{
+    stripReaderInfo * sri = (stripReaderInfo *)reader->nativeData;
+    if (setjmp(png_jmpbuf(sri->png))) {
+        return clFalse;
+    }
+
+    clPixelFormat pixelFormat = (reader->image->depth == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+    clImagePrepareWritePixels(C, strip, pixelFormat);
+    uint8_t * pixels = (pixelFormat == CL_PIXELFORMAT_U16) ? (uint8_t *)strip->pixelsU16 : strip->pixelsU8;
+    size_t rowBytes = (size_t)CL_BYTES_PER_PIXEL(pixelFormat) * strip->width;
+    for (int y = 0; y < strip->height; ++y) {
+        png_read_row(sri->png, &pixels[rowBytes * y], NULL);
+    }
+    return clTrue;
+}
+
+static void stripReaderDestroy(struct clContext * C, struct clStripReader * reader)
+{
+    stripReaderInfo * sri = (stripReaderInfo *)reader->nativeData;
+    png_destroy_read_struct(&sri->png, &sri->info, NULL);
+    fclose(sri->f);
+    clFree(sri);
+}
+
+struct clStripReader * clFormatReadStripsPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, const char * filename)
+{
+    COLORIST_UNUSED(formatName);
+
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        clContextLogError(C, "Failed to open file for read: %s", filename);
+        return NULL;
+    }
+
+    clImage * image = NULL;
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    COLORIST_ASSERT(png && info);
+
+    if (setjmp(png_jmpbuf(png))) {
+        if (image) {
+            clImageDestroy(C, image);
+        }
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(f);
+        return NULL;
+    }
+
+    png_init_io(png, f);
+    image = readImageHeader(C, png, info, overrideProfile, NULL);
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+        // Every row of an interlaced PNG depends on the final pass
+        clContextLogError(C, "Can't stream an interlaced PNG");
+        clImageDestroy(C, image);
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(f);
+        return NULL;
+    }
+
+    stripReaderInfo * sri = clAllocateStruct(stripReaderInfo);
+    sri->f = f;
+    sri->png = png;
+    sri->info = info;
+
+    clStripReader * reader = clStripReaderCreate(C, image);
+    reader->nativeData = sri;
+    reader->readFunc = stripRead;
+    reader->destroyFunc = stripReaderDestroy;
+    return reader;
+}
+
+typedef struct stripWriterInfo
+{
+    FILE * f;
+    png_structp png;
+    png_infop info;
+} stripWriterInfo;
+
+static clBool stripWrite(struct clContext * C, struct clStripWriter * writer, struct clImage * strip)
+{
+    stripWriterInfo * swi = (stripWriterInfo *)writer->nativeData;
+    if (setjmp(png_jmpbuf(swi->png))) {
+        return clFalse;
+    }
+
+    clPixelFormat pixelFormat = (writer->image->depth == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+    clImagePrepareReadPixels(C, strip, pixelFormat);
+    uint8_t * pixels = (pixelFormat == CL_PIXELFORMAT_U16) ? (uint8_t *)strip->pixelsU16 : strip->pixelsU8;
+    size_t rowBytes = (size_t)CL_BYTES_PER_PIXEL(pixelFormat) * strip->width;
+    for (int y = 0; y < strip->height; ++y) {
+        png_write_row(swi->png, &pixels[rowBytes * y]);
+    }
+    return clTrue;
+}
+
+static clBool stripWriterFinish(struct clContext * C, struct clStripWriter * writer)
+{
+    stripWriterInfo * swi = (stripWriterInfo *)writer->nativeData;
+    if (setjmp(png_jmpbuf(swi->png))) {
+        return clFalse;
+    }
+
+    png_write_end(swi->png, NULL);
+    int closeResult = fclose(swi->f);
+    swi->f = NULL;
+    if (closeResult != 0) {
+        clContextLogError(C, "Failed to write PNG");
+        return clFalse;
+    }
+    return clTrue;
+}
+
+static void stripWriterDestroy(struct clContext * C, struct clStripWriter * writer)
+{
+    stripWriterInfo * swi = (stripWriterInfo *)writer->nativeData;
+    png_destroy_write_struct(&swi->png, &swi->info);
+    if (swi->f) {
+        fclose(swi->f);
+    }
+    clFree(swi);
+}
+
+struct clStripWriter * clFormatWriteStripsPNG(struct clContext * C,
+                                              struct clImage * image,
+                                              const char * formatName,
+                                              const char * filename,
+                                              struct clWriteParams * writeParams)
+{
+    COLORIST_UNUSED(formatName);
+
+    clRaw rawProfile = CL_RAW_EMPTY;
+    if (!clProfilePack(C, image->profile, &rawProfile)) {
+        return NULL;
+    }
+
+    FILE * f = fopen(filename, "wb");
+    if (!f) {
+        clContextLogError(C, "Failed to open file for write: %s", filename);
+        clRawFree(C, &rawProfile);
+        return NULL;
+    }
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    COLORIST_ASSERT(png && info);
+
+    if (setjmp(png_jmpbuf(png))) {
+        clRawFree(C, &rawProfile);
+        png_destroy_write_struct(&png, &info);
+        fclose(f);
+        return NULL;
+    }
+
+    // Strips arrive one at a time, so there's nothing to scan ahead of the header
+    pngLayout layout;
+    pngChooseLayout(C, image, clFalse, writeParams->writeProfile, &layout);
+    png_init_io(png, f);
+    writeImageHeader(png, info, image, &layout, &rawProfile, writeParams);
+    if (image->depth == 16) {
+        png_set_swap(png);
+    }
+    clRawFree(C, &rawProfile);
+
+    stripWriterInfo * swi = clAllocateStruct(stripWriterInfo);
+    swi->f = f;
+    swi->png = png;
+    swi->info = info;
+
+    clStripWriter * writer = clStripWriterCreate(C, clImageCreate(C, image->width, image->height, image->depth, image->profile));
+    writer->nativeData = swi;
+    writer->writeFunc = stripWrite;
+    writer->finishFunc = stripWriterFinish;
+    writer->destroyFunc = stripWriterDestroy;
+    return writer;
+}
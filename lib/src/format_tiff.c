@@ -136,10 +136,13 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
     int orientation = ORIENTATION_TOPLEFT;
     int sampleFormat = SAMPLEFORMAT_UINT;
     uint8_t * iccBuf = NULL;
-    int rowIndex, rowBytes;
+    int rowIndex, rowBytes = 0;
     tiffCallbackInfo ci;
     uint8_t * pixels = NULL;
     clBool fp32 = clFalse;
+    uint16_t photometric = PHOTOMETRIC_RGB;
+    uint8_t * levelsU8 = NULL;
+    uint16_t * levelsU16 = NULL;
 
     ci.C = C;
     ci.raw = input;
@@ -176,7 +179,7 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
     }
 
     TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &channelCount);
-    if ((channelCount != 3) && (channelCount != 4)) {
+    if ((channelCount != 1) && (channelCount != 3) && (channelCount != 4)) {
         clContextLogError(C, "unsupported channelCount(%d) from TIFF", channelCount);
         goto readCleanup;
     }
@@ -203,6 +206,13 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
             goto readCleanup;
         }
     }
+    if (channelCount == 1) {
+        TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+        if (fp32 || ((photometric != PHOTOMETRIC_MINISBLACK) && (photometric != PHOTOMETRIC_MINISWHITE))) {
+            clContextLogError(C, "unsupported single channel TIFF (photometric %d, depth %d)", photometric, depth);
+            goto readCleanup;
+        }
+    }
 
     if (overrideProfile) {
         profile = clProfileClone(C, overrideProfile);
@@ -228,7 +238,14 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
     clImageLogCreate(C, width, height, depth, profile);
     image = clImageCreate(C, width, height, depth, profile);
 
-    if (fp32) {
+    if (channelCount == 1) {
+        // Gray levels are kept as the image's palette (see clImageSetLevels())
+        if (depth == 8) {
+            levelsU8 = clAllocate((size_t)image->width * image->height);
+        } else {
+            levelsU16 = clAllocate(sizeof(uint16_t) * image->width * image->height);
+        }
+    } else if (fp32) {
         clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_F32);
         pixels = (uint8_t *)image->pixelsF32;
         rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
@@ -242,6 +259,19 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
         rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U16);
     }
     for (rowIndex = 0; rowIndex < image->height; ++rowIndex) {
+        if (channelCount == 1) {
+            int levelRowIndex = (orientation == ORIENTATION_TOPLEFT) ? rowIndex : (image->height - 1 - rowIndex);
+            size_t levelRowStart = (size_t)levelRowIndex * image->width;
+            void * levelRow = levelsU8 ? (void *)&levelsU8[levelRowStart] : (void *)&levelsU16[levelRowStart];
+            if (TIFFReadScanline(tiff, levelRow, rowIndex, 0) < 0) {
+                clContextLogError(C, "Failed to read TIFF scanline row %d", rowIndex);
+                clImageDestroy(C, image);
+                image = NULL;
+                goto readCleanup;
+            }
+            continue;
+        }
+
         uint8_t * pixelRow;
         if (orientation == ORIENTATION_TOPLEFT) {
             pixelRow = &pixels[rowIndex * rowBytes];
@@ -289,9 +319,33 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
         }
     }
 
+    if (channelCount == 1) {
+        int levelCount = 1 << depth;
+        uint16_t maxChannel = (uint16_t)(levelCount - 1);
+        uint16_t * levelColors = clAllocate(sizeof(uint16_t) * CL_CHANNELS_PER_PIXEL * levelCount);
+        for (int level = 0; level < levelCount; ++level) {
+            uint16_t * color = &levelColors[level * CL_CHANNELS_PER_PIXEL];
+            uint16_t gray = (photometric == PHOTOMETRIC_MINISWHITE) ? (uint16_t)(maxChannel - level) : (uint16_t)level;
+            color[0] = gray;
+            color[1] = gray;
+            color[2] = gray;
+            color[3] = maxChannel;
+        }
+        clImageSetLevels(C, image, levelsU8, levelsU16, levelCount, levelColors);
+        levelsU8 = NULL;
+        levelsU16 = NULL;
+        clFree(levelColors);
+    }
+
     C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
 
 readCleanup:
+    if (levelsU8) {
+        clFree(levelsU8);
+    }
+    if (levelsU16) {
+        clFree(levelsU16);
+    }
     if (tiff) {
         TIFFClose(tiff);
     }
@@ -311,6 +365,7 @@ clBool clFormatWriteTIFF(struct clContext * C, struct clImage * image, const cha
     int rowIndex, rowBytes;
     tiffCallbackInfo ci;
     uint8_t * pixels = NULL;
+    uint8_t * grayRow = NULL;
 
     clRaw rawProfile = CL_RAW_EMPTY;
     if (!clProfilePack(C, image->profile, &rawProfile)) {
@@ -343,7 +398,15 @@ clBool clFormatWriteTIFF(struct clContext * C, struct clImage * image, const cha
         goto writeCleanup;
     }
 
+    // Opaque gray images only need one channel, but that can't carry an RGB ICC profile
     clBool fp32 = (image->depth == 32) ? clTrue : clFalse;
+    clBool gray = !fp32 && !writeParams->writeProfile;
+    if (gray) {
+        const clImageTraits * traits = clImageGetTraits(C, image);
+        gray = traits->gray && traits->opaque;
+    }
+
+    clPixelFormat pixelFormat = (image->depth == 8) ? CL_PIXELFORMAT_U8 : CL_PIXELFORMAT_U16;
     if (fp32) {
         TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 32);
         TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
@@ -351,26 +414,29 @@ clBool clFormatWriteTIFF(struct clContext * C, struct clImage * image, const cha
         clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_F32);
         pixels = (uint8_t *)image->pixelsF32;
         rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
+    } else if (gray) {
+        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, image->depth);
+        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+
+        // Gray rows only need an indexed image's colors (see clImageCopyRowChannel())
+        clImagePrepareReadPixels(C, image->palette ? image->palette->colors : image, pixelFormat);
+        rowBytes = image->width * CL_BYTES_PER_CHANNEL[pixelFormat];
+        grayRow = clAllocate(rowBytes);
     } else {
         TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, image->depth);
         TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-        if (image->depth == 8) {
-            clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
-            pixels = image->pixelsU8;
-            rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
-        } else {
-            clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
-            pixels = (uint8_t *)image->pixelsU16;
-            rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U16);
-        }
+
+        clImagePrepareReadPixels(C, image, pixelFormat);
+        pixels = (pixelFormat == CL_PIXELFORMAT_U8) ? image->pixelsU8 : (uint8_t *)image->pixelsU16;
+        rowBytes = image->width * CL_BYTES_PER_PIXEL(pixelFormat);
     }
 
     TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, image->width);
     TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, image->height);
-    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 4);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, gray ? 1 : 4);
     TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
     TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, gray ? PHOTOMETRIC_MINISBLACK : PHOTOMETRIC_RGB);
     TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, rowBytes));
 
     if (writeParams->writeProfile) {
@@ -378,7 +444,12 @@ clBool clFormatWriteTIFF(struct clContext * C, struct clImage * image, const cha
     }
 
     for (rowIndex = 0; rowIndex < image->height; ++rowIndex) {
-        uint8_t * pixelRow = &pixels[rowIndex * rowBytes];
+        uint8_t * pixelRow = grayRow;
+        if (gray) {
+            clImageCopyRowChannel(C, image, rowIndex, 0, pixelFormat, grayRow);
+        } else {
+            pixelRow = &pixels[rowIndex * rowBytes];
+        }
         if (TIFFWriteScanline(tiff, pixelRow, rowIndex, 0) < 0) {
             clContextLogError(C, "Failed to write TIFF scanline row %d", rowIndex);
             writeResult = clFalse;
@@ -387,6 +458,9 @@ clBool clFormatWriteTIFF(struct clContext * C, struct clImage * image, const cha
     }
 
 writeCleanup:
+    if (grayRow) {
+        clFree(grayRow);
+    }
     if (tiff) {
         TIFFClose(tiff);
     }
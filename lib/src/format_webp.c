@@ -133,7 +133,12 @@ clBool clFormatWriteWebP(struct clContext * C, struct clImage * image, const cha
     picture.height = image->height;
 
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
-    WebPPictureImportRGBA(&picture, image->pixelsU8, CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8) * image->width);
+    if (clImageGetTraits(C, image)->opaque) {
+        // No alpha plane to encode (or for libwebp to scan for)
+        WebPPictureImportRGBX(&picture, image->pixelsU8, CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8) * image->width);
+    } else {
+        WebPPictureImportRGBA(&picture, image->pixelsU8, CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8) * image->width);
+    }
 
     if (!WebPEncode(&config, &picture)) {
         clContextLogError(C, "Failed to encode WebP");
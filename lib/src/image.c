@@ -8,8 +8,12 @@
 #include "colorist/image.h"
 
 #include "colorist/context.h"
+#include "colorist/lut.h"
+#include "colorist/pipeline.h"
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
+#include "colorist/task.h"
+#include "colorist/trace.h"
 #include "colorist/transform.h"
 
 #include <string.h>
@@ -31,22 +35,24 @@ static uint8_t * clImagePixelPtr(clContext * C, clImage * image, clPixelFormat p
     return NULL;
 }
 
-static void clImageAllocatePixels(struct clContext * C, clImage * image, clPixelFormat pixelFormat)
+// Pass zero unless the caller is about to overwrite every pixel
+static void clImageAllocatePixels(struct clContext * C, clImage * image, clPixelFormat pixelFormat, clBool zero)
 {
+    size_t bytes = (size_t)image->width * image->height * CL_BYTES_PER_PIXEL(pixelFormat);
     switch (pixelFormat) {
         case CL_PIXELFORMAT_U8:
             if (!image->pixelsU8) {
-                image->pixelsU8 = clAllocate(image->width * image->height * CL_BYTES_PER_PIXEL(pixelFormat));
+                image->pixelsU8 = clPixelPoolAllocate(C, bytes, zero);
             }
             break;
         case CL_PIXELFORMAT_U16:
             if (!image->pixelsU16) {
-                image->pixelsU16 = clAllocate(image->width * image->height * CL_BYTES_PER_PIXEL(pixelFormat));
+                image->pixelsU16 = clPixelPoolAllocate(C, bytes, zero);
             }
             break;
         case CL_PIXELFORMAT_F32:
             if (!image->pixelsF32) {
-                image->pixelsF32 = clAllocate(image->width * image->height * CL_BYTES_PER_PIXEL(pixelFormat));
+                image->pixelsF32 = clPixelPoolAllocate(C, bytes, zero);
             }
             break;
         case CL_PIXELFORMAT_COUNT:
@@ -81,134 +87,215 @@ clImage * clImageCreate(clContext * C, int width, int height, int depth, clProfi
     image->pixelsU8 = NULL;
     image->pixelsU16 = NULL;
     image->pixelsF32 = NULL;
+    image->traits = NULL;
+    image->palette = NULL;
     return image;
 }
 
-void clImagePrepareReadPixels(struct clContext * C, clImage * image, clPixelFormat pixelFormat)
+static void imageDropPalette(struct clContext * C, clImage * image)
 {
-    static const uint32_t maxChannelU8 = 255;
-    static const float maxChannelU8f = 255.0f;
-    uint32_t depthU16 = CL_CLAMP(image->depth, 8, 16);
-    uint32_t maxChannelU16 = (1 << depthU16) - 1;
-    float maxChannelU16f = (float)maxChannelU16;
+    if (image->palette) {
+        clImageDestroy(C, image->palette->colors);
+        if (image->palette->indicesU8) {
+            clFree(image->palette->indicesU8);
+        }
+        if (image->palette->indicesU16) {
+            clFree(image->palette->indicesU16);
+        }
+        clFree(image->palette);
+        image->palette = NULL;
+    }
+}
 
-    switch (pixelFormat) {
-        case CL_PIXELFORMAT_U8:
-            if (!image->pixelsU8) {
-                clImageAllocatePixels(C, image, pixelFormat);
+void clImageSetPalette(struct clContext * C, clImage * image, clImage * colors, uint8_t * indicesU8, uint16_t * indicesU16)
+{
+    COLORIST_ASSERT((indicesU8 != NULL) != (indicesU16 != NULL));
 
-                if (image->pixelsF32) {
-                    // F32 -> U8
-                    for (int j = 0; j < image->height; ++j) {
-                        for (int i = 0; i < image->width; ++i) {
-                            float * srcPixel = &image->pixelsF32[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            uint8_t * dstPixel = &image->pixelsU8[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            float largestChannel = 1.0f;
-                            largestChannel = CL_MAX(largestChannel, srcPixel[0]);
-                            largestChannel = CL_MAX(largestChannel, srcPixel[1]);
-                            largestChannel = CL_MAX(largestChannel, srcPixel[2]);
-                            dstPixel[0] = (uint8_t)clPixelMathRoundUNorm(srcPixel[0] / largestChannel, maxChannelU8);
-                            dstPixel[1] = (uint8_t)clPixelMathRoundUNorm(srcPixel[1] / largestChannel, maxChannelU8);
-                            dstPixel[2] = (uint8_t)clPixelMathRoundUNorm(srcPixel[2] / largestChannel, maxChannelU8);
-                            dstPixel[3] = (uint8_t)clPixelMathRoundUNorm(srcPixel[3], maxChannelU8);
-                        }
-                    }
-                } else if (image->pixelsU16) {
-                    // U16 -> U8
-                    for (int j = 0; j < image->height; ++j) {
-                        for (int i = 0; i < image->width; ++i) {
-                            uint16_t * srcPixel = &image->pixelsU16[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            uint8_t * dstPixel = &image->pixelsU8[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            dstPixel[0] = (uint8_t)clPixelMathRoundUNorm(srcPixel[0] / maxChannelU16f, maxChannelU8);
-                            dstPixel[1] = (uint8_t)clPixelMathRoundUNorm(srcPixel[1] / maxChannelU16f, maxChannelU8);
-                            dstPixel[2] = (uint8_t)clPixelMathRoundUNorm(srcPixel[2] / maxChannelU16f, maxChannelU8);
-                            dstPixel[3] = (uint8_t)clPixelMathRoundUNorm(srcPixel[3] / maxChannelU16f, maxChannelU8);
-                        }
-                    }
+    // The palette is all there is to this image now; pixels are expanded from it whenever they're prepared again
+    imageDropPalette(C, image);
+    if (image->traits) {
+        clFree(image->traits);
+        image->traits = NULL;
+    }
+    clPixelPoolFree(C, image->pixelsU8);
+    clPixelPoolFree(C, image->pixelsU16);
+    clPixelPoolFree(C, image->pixelsF32);
+    image->pixelsU8 = NULL;
+    image->pixelsU16 = NULL;
+    image->pixelsF32 = NULL;
+
+    image->palette = clAllocateStruct(clImagePalette);
+    image->palette->colors = colors;
+    image->palette->indicesU8 = indicesU8;
+    image->palette->indicesU16 = indicesU16;
+}
+
+void clImageSetLevels(struct clContext * C, clImage * image, uint8_t * levelsU8, uint16_t * levelsU16, int levelCount, const uint16_t * levelColors)
+{
+    size_t pixelCount = (size_t)image->width * image->height;
+    uint16_t * remap = clAllocate(sizeof(uint16_t) * levelCount);
+    uint8_t * used = clAllocate(levelCount);
+    for (size_t i = 0; i < pixelCount; ++i) {
+        used[levelsU8 ? levelsU8[i] : levelsU16[i]] = 1;
+    }
+    int colorCount = 0;
+    for (int level = 0; level < levelCount; ++level) {
+        if (used[level]) {
+            remap[level] = (uint16_t)colorCount++;
+        }
+    }
+
+    clPixelFormat pixelFormat = (image->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+    clImage * colors = clImageCreate(C, colorCount, 1, image->depth, image->profile);
+    clImagePrepareWritePixels(C, colors, pixelFormat);
+    for (int level = 0; level < levelCount; ++level) {
+        if (used[level]) {
+            for (int c = 0; c < CL_CHANNELS_PER_PIXEL; ++c) {
+                int channelIndex = (remap[level] * CL_CHANNELS_PER_PIXEL) + c;
+                uint16_t channel = levelColors[(level * CL_CHANNELS_PER_PIXEL) + c];
+                if (pixelFormat == CL_PIXELFORMAT_U16) {
+                    colors->pixelsU16[channelIndex] = channel;
                 } else {
-                    // U8 White
-                    memset(image->pixelsU8, 0xff, image->width * image->height * sizeof(uint8_t));
+                    colors->pixelsU8[channelIndex] = (uint8_t)channel;
                 }
             }
-            break;
+        }
+    }
 
-        case CL_PIXELFORMAT_U16:
-            if (!image->pixelsU16) {
-                clImageAllocatePixels(C, image, pixelFormat);
+    if (levelsU8) {
+        for (size_t i = 0; i < pixelCount; ++i) {
+            levelsU8[i] = (uint8_t)remap[levelsU8[i]];
+        }
+    } else if (colorCount <= 256) {
+        // Few enough of the levels are used for a byte per pixel
+        levelsU8 = clAllocate(pixelCount);
+        for (size_t i = 0; i < pixelCount; ++i) {
+            levelsU8[i] = (uint8_t)remap[levelsU16[i]];
+        }
+        clFree(levelsU16);
+        levelsU16 = NULL;
+    } else {
+        for (size_t i = 0; i < pixelCount; ++i) {
+            levelsU16[i] = remap[levelsU16[i]];
+        }
+    }
+    clImageSetPalette(C, image, colors, levelsU8, levelsU16);
 
-                if (image->pixelsF32) {
-                    // F32 -> U16
-                    for (int j = 0; j < image->height; ++j) {
-                        for (int i = 0; i < image->width; ++i) {
-                            float * srcPixel = &image->pixelsF32[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            uint16_t * dstPixel = &image->pixelsU16[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            float largestChannel = 1.0f;
-                            largestChannel = CL_MAX(largestChannel, srcPixel[0]);
-                            largestChannel = CL_MAX(largestChannel, srcPixel[1]);
-                            largestChannel = CL_MAX(largestChannel, srcPixel[2]);
-                            dstPixel[0] = (uint16_t)clPixelMathRoundUNorm(srcPixel[0] / largestChannel, maxChannelU16);
-                            dstPixel[1] = (uint16_t)clPixelMathRoundUNorm(srcPixel[1] / largestChannel, maxChannelU16);
-                            dstPixel[2] = (uint16_t)clPixelMathRoundUNorm(srcPixel[2] / largestChannel, maxChannelU16);
-                            dstPixel[3] = (uint16_t)clPixelMathRoundUNorm(srcPixel[3], maxChannelU16);
-                        }
-                    }
-                } else if (image->pixelsU8) {
-                    // U8 -> U16
-                    for (int j = 0; j < image->height; ++j) {
-                        for (int i = 0; i < image->width; ++i) {
-                            uint8_t * srcPixel = &image->pixelsU8[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            uint16_t * dstPixel = &image->pixelsU16[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            dstPixel[0] = (uint16_t)clPixelMathRoundUNorm(srcPixel[0] / maxChannelU8f, maxChannelU16);
-                            dstPixel[1] = (uint16_t)clPixelMathRoundUNorm(srcPixel[1] / maxChannelU8f, maxChannelU16);
-                            dstPixel[2] = (uint16_t)clPixelMathRoundUNorm(srcPixel[2] / maxChannelU8f, maxChannelU16);
-                            dstPixel[3] = (uint16_t)clPixelMathRoundUNorm(srcPixel[3] / maxChannelU8f, maxChannelU16);
-                        }
-                    }
-                } else {
-                    // U16 White
-                    memset(image->pixelsU16, 0xff, image->width * image->height * sizeof(uint16_t));
-                }
+    clFree(used);
+    clFree(remap);
+}
+
+// Fills image's pixelFormat pixels from its palette, converting just the palette's colors to pixelFormat
+static void imageExpandPalette(struct clContext * C, clImage * image, clPixelFormat pixelFormat)
+{
+    clImagePalette * palette = image->palette;
+    clImagePrepareReadPixels(C, palette->colors, pixelFormat);
+    clImageAllocatePixels(C, image, pixelFormat, clFalse);
+
+    size_t bytesPerPixel = CL_BYTES_PER_PIXEL(pixelFormat);
+    const uint8_t * srcPixels = clImagePixelPtr(C, palette->colors, pixelFormat);
+    uint8_t * dstPixels = clImagePixelPtr(C, image, pixelFormat);
+    size_t pixelCount = (size_t)image->width * image->height;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        memcpy(&dstPixels[i * bytesPerPixel], &srcPixels[CL_PALETTE_INDEX(palette, i) * bytesPerPixel], bytesPerPixel);
+    }
+}
+
+void clImageExpandPalette(struct clContext * C, clImage * image)
+{
+    if (!image->palette || image->pixelsU8 || image->pixelsU16 || image->pixelsF32) {
+        return;
+    }
+
+    clImage * colors = image->palette->colors;
+    clPixelFormat pixelFormat = CL_PIXELFORMAT_U8;
+    if (colors->pixelsF32) {
+        pixelFormat = CL_PIXELFORMAT_F32;
+    } else if (colors->pixelsU16) {
+        pixelFormat = CL_PIXELFORMAT_U16;
+    }
+    imageExpandPalette(C, image, pixelFormat);
+}
+
+void clImageCopyRowChannel(struct clContext * C, clImage * image, int y, int c, clPixelFormat pixelFormat, void * dst)
+{
+    COLORIST_ASSERT((pixelFormat == CL_PIXELFORMAT_U8) || (pixelFormat == CL_PIXELFORMAT_U16));
+
+    size_t rowStart = (size_t)y * image->width;
+    if (!clImagePixelPtr(C, image, pixelFormat) && image->palette) {
+        clImagePalette * palette = image->palette;
+        if (pixelFormat == CL_PIXELFORMAT_U16) {
+            const uint16_t * src = palette->colors->pixelsU16;
+            uint16_t * dstRow = (uint16_t *)dst;
+            for (int x = 0; x < image->width; ++x) {
+                dstRow[x] = src[(CL_PALETTE_INDEX(palette, rowStart + x) * CL_CHANNELS_PER_PIXEL) + c];
             }
-            break;
+        } else {
+            const uint8_t * src = palette->colors->pixelsU8;
+            uint8_t * dstRow = (uint8_t *)dst;
+            for (int x = 0; x < image->width; ++x) {
+                dstRow[x] = src[(CL_PALETTE_INDEX(palette, rowStart + x) * CL_CHANNELS_PER_PIXEL) + c];
+            }
+        }
+    } else if (pixelFormat == CL_PIXELFORMAT_U16) {
+        const uint16_t * src = &image->pixelsU16[rowStart * CL_CHANNELS_PER_PIXEL];
+        uint16_t * dstRow = (uint16_t *)dst;
+        for (int x = 0; x < image->width; ++x) {
+            dstRow[x] = src[(x * CL_CHANNELS_PER_PIXEL) + c];
+        }
+    } else {
+        const uint8_t * src = &image->pixelsU8[rowStart * CL_CHANNELS_PER_PIXEL];
+        uint8_t * dstRow = (uint8_t *)dst;
+        for (int x = 0; x < image->width; ++x) {
+            dstRow[x] = src[(x * CL_CHANNELS_PER_PIXEL) + c];
+        }
+    }
+}
 
-        case CL_PIXELFORMAT_F32:
-            if (!image->pixelsF32) {
-                clImageAllocatePixels(C, image, pixelFormat);
+void clImagePrepareReadPixels(struct clContext * C, clImage * image, clPixelFormat pixelFormat)
+{
+    uint32_t depthU16 = CL_CLAMP(image->depth, 8, 16);
+    uint32_t maxChannelU16 = (1 << depthU16) - 1;
+    int pixelCount = image->width * image->height;
 
-                if (image->pixelsU16) {
-                    // U16 -> F32
-                    for (int j = 0; j < image->height; ++j) {
-                        for (int i = 0; i < image->width; ++i) {
-                            uint16_t * srcPixel = &image->pixelsU16[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            float * dstPixel = &image->pixelsF32[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            dstPixel[0] = srcPixel[0] / maxChannelU16f;
-                            dstPixel[1] = srcPixel[1] / maxChannelU16f;
-                            dstPixel[2] = srcPixel[2] / maxChannelU16f;
-                            dstPixel[3] = srcPixel[3] / maxChannelU16f;
-                        }
-                    }
-                } else if (image->pixelsU8) {
-                    // U8 -> F32
-                    for (int j = 0; j < image->height; ++j) {
-                        for (int i = 0; i < image->width; ++i) {
-                            uint8_t * srcPixel = &image->pixelsU8[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            float * dstPixel = &image->pixelsF32[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
-                            dstPixel[0] = srcPixel[0] / maxChannelU8f;
-                            dstPixel[1] = srcPixel[1] / maxChannelU8f;
-                            dstPixel[2] = srcPixel[2] / maxChannelU8f;
-                            dstPixel[3] = srcPixel[3] / maxChannelU8f;
-                        }
-                    }
-                } else {
-                    // F32 White
-                    uint32_t channelCount = image->width * image->height * CL_CHANNELS_PER_PIXEL;
-                    for (uint32_t i = 0; i < channelCount; ++i) {
-                        image->pixelsF32[i] = 1.0f;
-                    }
-                }
+    if (clImagePixelPtr(C, image, pixelFormat)) {
+        return;
+    }
+
+    // Indexed images only need their colors converted
+    if (image->palette) {
+        imageExpandPalette(C, image, pixelFormat);
+        return;
+    }
+
+    // Convert from the most precise format available
+    static const clPixelFormat srcPreference[] = { CL_PIXELFORMAT_F32, CL_PIXELFORMAT_U16, CL_PIXELFORMAT_U8 };
+    for (int i = 0; i < CL_PIXELFORMAT_COUNT; ++i) {
+        clPixelFormat srcFormat = srcPreference[i];
+        uint8_t * srcPixels = (srcFormat != pixelFormat) ? clImagePixelPtr(C, image, srcFormat) : NULL;
+        if (srcPixels) {
+            clImageAllocatePixels(C, image, pixelFormat, clFalse);
+            clPixelMathConvertPixels(C, srcFormat, srcPixels, pixelFormat, clImagePixelPtr(C, image, pixelFormat), maxChannelU16, pixelCount);
+            return;
+        }
+    }
+
+    // Nothing to convert from, so start out white (the F32 fill covers every channel)
+    clImageAllocatePixels(C, image, pixelFormat, pixelFormat != CL_PIXELFORMAT_F32);
+    switch (pixelFormat) {
+        case CL_PIXELFORMAT_U8:
+            memset(image->pixelsU8, 0xff, image->width * image->height * sizeof(uint8_t));
+            break;
+        case CL_PIXELFORMAT_U16:
+            memset(image->pixelsU16, 0xff, image->width * image->height * sizeof(uint16_t));
+            break;
+        case CL_PIXELFORMAT_F32: {
+            uint32_t channelCount = image->width * image->height * CL_CHANNELS_PER_PIXEL;
+            for (uint32_t i = 0; i < channelCount; ++i) {
+                image->pixelsF32[i] = 1.0f;
             }
             break;
-
+        }
         case CL_PIXELFORMAT_COUNT:
             COLORIST_ASSERT(0);
             break;
@@ -219,18 +306,25 @@ void clImagePrepareWritePixels(struct clContext * C, clImage * image, clPixelFor
 {
     clImagePrepareReadPixels(C, image, pixelFormat);
 
+    // Whatever is written next may not share the old pixels' traits, or be made of the old palette's colors
+    if (image->traits) {
+        clFree(image->traits);
+        image->traits = NULL;
+    }
+    imageDropPalette(C, image);
+
     // Throw away anything that isn't about to be written to; it will be stale and can be repopulated
     // lazily by a future call to clImagePrepareReadPixels().
     if (image->pixelsU8 && (pixelFormat != CL_PIXELFORMAT_U8)) {
-        clFree(image->pixelsU8);
+        clPixelPoolFree(C, image->pixelsU8);
         image->pixelsU8 = NULL;
     }
     if (image->pixelsU16 && (pixelFormat != CL_PIXELFORMAT_U16)) {
-        clFree(image->pixelsU16);
+        clPixelPoolFree(C, image->pixelsU16);
         image->pixelsU16 = NULL;
     }
     if (image->pixelsF32 && (pixelFormat != CL_PIXELFORMAT_F32)) {
-        clFree(image->pixelsF32);
+        clPixelPoolFree(C, image->pixelsF32);
         image->pixelsF32 = NULL;
     }
 }
@@ -244,13 +338,14 @@ clImage * clImageCrop(struct clContext * C, clImage * srcImage, int x, int y, in
         return NULL;
     }
 
+    clImageExpandPalette(C, srcImage);
     clImage * dstImage = clImageCreate(C, w, h, srcImage->depth, srcImage->profile);
     for (clPixelFormat pixelFormat = CL_PIXELFORMAT_FIRST; pixelFormat != CL_PIXELFORMAT_COUNT; ++pixelFormat) {
         uint8_t * srcPixels = clImagePixelPtr(C, srcImage, pixelFormat);
         if (!srcPixels) {
             continue;
         }
-        clImageAllocatePixels(C, dstImage, pixelFormat);
+        clImageAllocatePixels(C, dstImage, pixelFormat, clFalse);
         uint8_t * dstPixels = clImagePixelPtr(C, dstImage, pixelFormat);
         for (int j = 0; j < h; ++j) {
             for (int i = 0; i < w; ++i) {
@@ -267,28 +362,45 @@ clImage * clImageCrop(struct clContext * C, clImage * srcImage, int x, int y, in
     return dstImage;
 }
 
-clImage * clImageApplyHALD(struct clContext * C, clImage * image, clImage * hald, int haldDims)
+typedef struct clLUT3DTask
+{
+    clContext * C;
+    const clLUT3D * lut;
+    float * srcPixels;
+    float * dstPixels;
+} clLUT3DTask;
+
+static void lut3DTaskFunc(void * userData, int start, int count)
+{
+    clLUT3DTask * info = (clLUT3DTask *)userData;
+    int offset = start * CL_CHANNELS_PER_PIXEL;
+    clTraceSpan span;
+    clTraceBegin(info->C, &span, "hald");
+    clLUT3DApply(info->C, info->lut, &info->srcPixels[offset], &info->dstPixels[offset], count);
+    clTraceEnd(info->C, &span);
+}
+
+clImage * clImageApplyLUT3D(struct clContext * C, clImage * image, const struct clLUT3D * lut)
 {
+    clLUT3DTask info;
     clImage * appliedImage = clImageCreate(C, image->width, image->height, image->depth, image->profile);
 
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_F32);
-    clImagePrepareReadPixels(C, hald, CL_PIXELFORMAT_F32);
     clImagePrepareWritePixels(C, appliedImage, CL_PIXELFORMAT_F32);
 
-    int pixelCount = image->width * image->height;
-    for (int i = 0; i < pixelCount; ++i) {
-        clPixelMathHaldCLUTLookup(C,
-                                  hald->pixelsF32,
-                                  haldDims,
-                                  &image->pixelsF32[i * CL_CHANNELS_PER_PIXEL],
-                                  &appliedImage->pixelsF32[i * CL_CHANNELS_PER_PIXEL]);
-    }
+    info.C = C;
+    info.lut = lut;
+    info.srcPixels = image->pixelsF32;
+    info.dstPixels = appliedImage->pixelsF32;
+    clTaskParallelFor(C, image->width * image->height, 1024, lut3DTaskFunc, &info);
 
     return appliedImage;
 }
 
 clImage * clImageResize(struct clContext * C, clImage * image, int width, int height, clFilter resizeFilter)
 {
+    clTraceSpan span;
+    clTraceBegin(C, &span, "resize");
     clImage * resizedImage = clImageCreate(C, width, height, image->depth, image->profile);
 
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_F32);
@@ -300,6 +412,7 @@ clImage * clImageResize(struct clContext * C, clImage * image, int width, int he
         // catmullrom and mitchell sometimes give negative values. Protect against that
         resizedImage->pixelsF32[i] = CL_MAX(resizedImage->pixelsF32[i], 0.0f);
     }
+    clTraceEnd(C, &span);
     return resizedImage;
 }
 
@@ -317,13 +430,13 @@ void clBlendParamsSetDefaults(struct clContext * C, clBlendParams * blendParams)
     blendParams->offsetY = 0;
 }
 
-clImage * clImageBlend(struct clContext * C, clImage * image, clImage * compositeImage, clBlendParams * blendParams)
+clProfile * clImageBlendProfileCreate(struct clContext * C, clProfile * profile, float gamma)
 {
     // Query profile used for both src and dst image
     clProfilePrimaries primaries;
     clProfileCurve curve;
     int maxLuminance;
-    if (!clProfileQuery(C, image->profile, &primaries, &curve, &maxLuminance)) {
+    if (!clProfileQuery(C, profile, &primaries, &curve, &maxLuminance)) {
         clContextLogError(C, "clImageBlend: failed to query source profile");
         return NULL;
     }
@@ -332,8 +445,18 @@ clImage * clImageBlend(struct clContext * C, clImage * image, clImage * composit
     // Build a profile using the same color volume, but a blend-friendly gamma
     curve.type = CL_PCT_GAMMA;
     curve.implicitScale = 1.0f;
-    curve.gamma = blendParams->gamma;
-    clProfile * blendProfile = clProfileCreate(C, &primaries, &curve, maxLuminance, NULL);
+    curve.gamma = gamma;
+    return clProfileCreate(C, &primaries, &curve, maxLuminance, NULL);
+}
+
+clImage * clImageBlend(struct clContext * C, clImage * image, clImage * compositeImage, clBlendParams * blendParams)
+{
+    clProfile * blendProfile = clImageBlendProfileCreate(C, image->profile, blendParams->gamma);
+    if (!blendProfile) {
+        return NULL;
+    }
+    clTraceSpan span;
+    clTraceBegin(C, &span, "blend");
 
     // Build transforms that go [src -> blend], [cmp -> blend], [blend -> dst]
     clTransform * srcBlendTransform = clTransformCreate(C, image->profile, CL_XF_RGBA, blendProfile, CL_XF_RGBA, blendParams->srcTonemap);
@@ -347,9 +470,9 @@ clImage * clImageBlend(struct clContext * C, clImage * image, clImage * composit
     // Transform src and comp images into normalized blend space
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_F32);
     clImagePrepareReadPixels(C, compositeImage, CL_PIXELFORMAT_F32);
-    float * srcFloats = clAllocate(4 * sizeof(float) * image->width * image->height);
+    float * srcFloats = clPixelPoolAllocate(C, 4 * sizeof(float) * image->width * image->height, clFalse);
     clTransformRun(C, srcBlendTransform, image->pixelsF32, srcFloats, image->width * image->height);
-    float * cmpFloats = clAllocate(4 * sizeof(float) * compositeImage->width * compositeImage->height);
+    float * cmpFloats = clPixelPoolAllocate(C, 4 * sizeof(float) * compositeImage->width * compositeImage->height, clFalse);
     clTransformRun(C, cmpBlendTransform, compositeImage->pixelsF32, cmpFloats, compositeImage->width * compositeImage->height);
 
     // Find bounds and offset for composition
@@ -359,38 +482,15 @@ clImage * clImageBlend(struct clContext * C, clImage * image, clImage * composit
     int rangeY = CL_MIN(image->height - offsetY, compositeImage->height);
 
     // Perform SourceOver blend
-    float * dstFloats = clAllocate(4 * sizeof(float) * image->width * image->height);
+    float * dstFloats = clPixelPoolAllocate(C, 4 * sizeof(float) * image->width * image->height, clFalse);
     memcpy(dstFloats, srcFloats, 4 * sizeof(float) * image->width * image->height); // start with the original pixels
     if ((rangeX >= 1) && (rangeY >= 1)) {
-        if (blendParams->premultiplied) {
-            // Premultiplied alpha
-            for (int j = 0; j < rangeY; ++j) {
-                for (int i = 0; i < rangeX; ++i) {
-                    float * srcPixel = &srcFloats[CL_CHANNELS_PER_PIXEL * ((i + offsetX) + ((j + offsetY) * image->width))];
-                    float * cmpPixel = &cmpFloats[CL_CHANNELS_PER_PIXEL * (i + (j * compositeImage->width))];
-                    float * dstPixel = &dstFloats[CL_CHANNELS_PER_PIXEL * ((i + offsetX) + ((j + offsetY) * image->width))];
-
-                    // cmpPixel is the "Source" in a SourceOver Porter/Duff blend
-                    dstPixel[0] = cmpPixel[0] + (srcPixel[0] * (1 - cmpPixel[3]));
-                    dstPixel[1] = cmpPixel[1] + (srcPixel[1] * (1 - cmpPixel[3]));
-                    dstPixel[2] = cmpPixel[2] + (srcPixel[2] * (1 - cmpPixel[3]));
-                    dstPixel[3] = cmpPixel[3] + (srcPixel[3] * (1 - cmpPixel[3]));
-                }
-            }
-        } else {
-            // Not Premultiplied alpha, perform the multiply during the blend
-            for (int j = 0; j < rangeY; ++j) {
-                for (int i = 0; i < rangeX; ++i) {
-                    float * srcPixel = &srcFloats[CL_CHANNELS_PER_PIXEL * ((i + offsetX) + ((j + offsetY) * image->width))];
-                    float * cmpPixel = &cmpFloats[CL_CHANNELS_PER_PIXEL * (i + (j * compositeImage->width))];
-                    float * dstPixel = &dstFloats[CL_CHANNELS_PER_PIXEL * ((i + offsetX) + ((j + offsetY) * image->width))];
-
-                    // cmpPixel is the "Source" in a SourceOver Porter/Duff blend
-                    dstPixel[0] = (cmpPixel[0] * cmpPixel[3]) + (srcPixel[0] * srcPixel[3] * (1 - cmpPixel[3]));
-                    dstPixel[1] = (cmpPixel[1] * cmpPixel[3]) + (srcPixel[1] * srcPixel[3] * (1 - cmpPixel[3]));
-                    dstPixel[2] = (cmpPixel[2] * cmpPixel[3]) + (srcPixel[2] * srcPixel[3] * (1 - cmpPixel[3]));
-                    dstPixel[3] = cmpPixel[3] + (srcPixel[3] * (1 - cmpPixel[3]));
-                }
+        for (int j = 0; j < rangeY; ++j) {
+            for (int i = 0; i < rangeX; ++i) {
+                float * srcPixel = &srcFloats[CL_CHANNELS_PER_PIXEL * ((i + offsetX) + ((j + offsetY) * image->width))];
+                float * cmpPixel = &cmpFloats[CL_CHANNELS_PER_PIXEL * (i + (j * compositeImage->width))];
+                float * dstPixel = &dstFloats[CL_CHANNELS_PER_PIXEL * ((i + offsetX) + ((j + offsetY) * image->width))];
+                clPixelMathBlendSourceOver(srcPixel, cmpPixel, blendParams->premultiplied, dstPixel);
             }
         }
     }
@@ -405,9 +505,10 @@ clImage * clImageBlend(struct clContext * C, clImage * image, clImage * composit
     clTransformDestroy(C, cmpBlendTransform);
     clTransformDestroy(C, dstTransform);
     clProfileDestroy(C, blendProfile);
-    clFree(srcFloats);
-    clFree(cmpFloats);
-    clFree(dstFloats);
+    clPixelPoolFree(C, srcFloats);
+    clPixelPoolFree(C, cmpFloats);
+    clPixelPoolFree(C, dstFloats);
+    clTraceEnd(C, &span);
     return dstImage;
 }
 
@@ -435,6 +536,7 @@ clBool clImageAdjustRect(struct clContext * C, clImage * image, int * x, int * y
 clImage * clImageRotate(struct clContext * C, clImage * image, int cwTurns)
 {
     clImage * rotated = NULL;
+    clImageExpandPalette(C, image);
 
     switch (cwTurns) {
         case 0: // Not rotated
@@ -457,7 +559,7 @@ clImage * clImageRotate(struct clContext * C, clImage * image, int cwTurns)
             if (!srcPixels) {
                 continue;
             }
-            clImageAllocatePixels(C, rotated, pixelFormat);
+            clImageAllocatePixels(C, rotated, pixelFormat, clFalse);
             uint8_t * dstPixels = clImagePixelPtr(C, rotated, pixelFormat);
 
             switch (cwTurns) {
@@ -500,12 +602,94 @@ clImage * clImageRotate(struct clContext * C, clImage * image, int cwTurns)
     return rotated;
 }
 
+clTonemap clImageAutoTonemap(struct clContext * C, int srcPeakLuminance, int depth, struct clProfile * dstProfile, clBool verbose)
+{
+    int dstLuminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, dstProfile, NULL, NULL, &dstLuminance);
+    if (dstLuminance == CL_LUMINANCE_UNSPECIFIED) {
+        dstLuminance = C->defaultLuminance;
+    }
+
+    clTonemap tonemap = (srcPeakLuminance > dstLuminance) ? CL_TONEMAP_ON : CL_TONEMAP_OFF;
+    if (verbose) {
+        clContextLog(C,
+                     "tonemap",
+                     0,
+                     "Tonemap: %d nits (measured potential peak) -> %d nits normalized (%dbpc), auto-tonemap %s",
+                     srcPeakLuminance,
+                     dstLuminance,
+                     depth,
+                     (tonemap == CL_TONEMAP_ON) ? "enabled" : "disabled");
+    }
+    return tonemap;
+}
+
 clImage * clImageConvert(struct clContext * C, clImage * srcImage, int depth, struct clProfile * dstProfile, clTonemap tonemap, clTonemapParams * tonemapParams)
+{
+    return clImageConvertPipeline(C, srcImage, NULL, depth, dstProfile, tonemap, tonemapParams, NULL);
+}
+
+static clBool rectCoversImage(const clImage * image, const int rect[4])
+{
+    return (rect[0] == 0) && (rect[1] == 0) && (rect[2] == image->width) && (rect[3] == image->height);
+}
+
+// clPipelineRun() for all of a srcImage with a palette: runs just the palette's colors, and hands them to dstImage
+// with a copy of the indices, so it stays indexed (and can be written as an indexed image again).
+static void convertPalette(struct clContext * C, struct clPipeline * pipeline, clTransform * transform, clImage * srcImage, clImage * dstImage)
+{
+    clImagePalette * palette = srcImage->palette;
+    clImage * colors = clImageCreate(C, palette->colors->width, 1, dstImage->depth, dstImage->profile);
+    int colorsRect[4] = { 0, 0, palette->colors->width, 1 };
+    clPipelineRun(C, pipeline, transform, palette->colors, colorsRect, colors);
+
+    size_t pixelCount = (size_t)dstImage->width * dstImage->height;
+    uint8_t * indicesU8 = NULL;
+    uint16_t * indicesU16 = NULL;
+    if (palette->indicesU8) {
+        indicesU8 = clAllocate(pixelCount);
+        memcpy(indicesU8, palette->indicesU8, pixelCount);
+    } else {
+        indicesU16 = clAllocate(sizeof(uint16_t) * pixelCount);
+        memcpy(indicesU16, palette->indicesU16, sizeof(uint16_t) * pixelCount);
+    }
+    clImageSetPalette(C, dstImage, colors, indicesU8, indicesU16);
+}
+
+clImage * clImageConvertPipeline(struct clContext * C,
+                                 clImage * srcImage,
+                                 const int srcRect[4],
+                                 int depth,
+                                 struct clProfile * dstProfile,
+                                 clTonemap tonemap,
+                                 clTonemapParams * tonemapParams,
+                                 struct clPipeline * pipeline)
 {
     Timer t;
+    int srcIntegerDepth = 0;
+
+    int rect[4] = { 0, 0, srcImage->width, srcImage->height };
+    if (srcRect) {
+        memcpy(rect, srcRect, sizeof(rect));
+    }
+
+    // All of an indexed image, run through nothing but color stages, only needs its colors converted
+    clBool convertColors = srcImage->palette && rectCoversImage(srcImage, rect) && clPipelineIsColorOnly(C, pipeline);
+    if (!convertColors) {
+        clImageExpandPalette(C, srcImage);
+    }
+    clImage * srcPixelImage = convertColors ? srcImage->palette->colors : srcImage;
+    int srcPixelCount = convertColors ? srcPixelImage->width : (rect[2] * rect[3]);
+
+    if (!srcPixelImage->pixelsF32 && (srcPixelImage->pixelsU8 || srcPixelImage->pixelsU16)) {
+        // The source pixels are integers, so there's no need for an F32 copy of the image, and the
+        // transform can use curve LUTs (if there are enough pixels to be worth building them).
+        srcIntegerDepth = srcPixelImage->pixelsU16 ? CL_CLAMP(srcImage->depth, 8, 16) : 8;
+    }
 
     // Create destination image
-    clImage * dstImage = clImageCreate(C, srcImage->width, srcImage->height, depth, dstProfile);
+    int rotate = pipeline ? pipeline->rotate : 0;
+    clImage * dstImage = clImageCreate(C, (rotate & 1) ? rect[3] : rect[2], (rotate & 1) ? rect[2] : rect[3], depth, dstProfile);
 
     // Show image details
     clContextLog(C, "details", 0, "Source:");
@@ -519,27 +703,8 @@ clImage * clImageConvert(struct clContext * C, clImage * srcImage, int depth, st
             clContextLog(C, "tonemap", 0, "Tonemap: converting to FP32 (overranging), auto-tonemap disabled");
             tonemap = CL_TONEMAP_OFF;
         } else {
-            int srcPeakLuminance = (int)clImagePeakLuminance(C, srcImage);
-            int dstLuminance = CL_LUMINANCE_UNSPECIFIED;
-            clProfileQuery(C, dstProfile, NULL, NULL, &dstLuminance);
-            if (dstLuminance == CL_LUMINANCE_UNSPECIFIED) {
-                dstLuminance = C->defaultLuminance;
-            }
-
-            if (srcPeakLuminance > dstLuminance) {
-                tonemap = CL_TONEMAP_ON;
-            } else {
-                tonemap = CL_TONEMAP_OFF;
-            }
-
-            clContextLog(C,
-                         "tonemap",
-                         0,
-                         "Tonemap: %d nits (measured potential peak) -> %d nits normalized (%dbpc), auto-tonemap %s",
-                         srcPeakLuminance,
-                         dstLuminance,
-                         depth,
-                         (tonemap == CL_TONEMAP_ON) ? "enabled" : "disabled");
+            int peakLuminance = (int)clImageChannelLuminance(C, srcImage->profile, clImageLargestChannelRect(C, srcImage, rect));
+            tonemap = clImageAutoTonemap(C, peakLuminance, depth, dstProfile, clTrue);
         }
     }
 
@@ -548,12 +713,12 @@ clImage * clImageConvert(struct clContext * C, clImage * srcImage, int depth, st
     if (tonemapParams) {
         memcpy(&transform->tonemapParams, tonemapParams, sizeof(clTonemapParams));
     }
+    if ((srcIntegerDepth > 0) && (srcPixelCount >= (1 << srcIntegerDepth))) {
+        clTransformSetSourceDepth(C, transform, srcIntegerDepth);
+    }
     clTransformPrepare(C, transform);
     float luminanceScale = clTransformGetLuminanceScale(C, transform);
 
-    clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_F32);
-    clImagePrepareWritePixels(C, dstImage, CL_PIXELFORMAT_F32);
-
     const char * tonemapDescription = transform->tonemapEnabled ? "tonemap" : "clip";
     if ((tonemap == CL_TONEMAP_OFF) && (depth == 32)) {
         tonemapDescription = "overrange";
@@ -572,7 +737,12 @@ clImage * clImageConvert(struct clContext * C, clImage * srcImage, int depth, st
                      transform->tonemapParams.power);
     }
     timerStart(&t);
-    clTransformRun(C, transform, srcImage->pixelsF32, dstImage->pixelsF32, srcImage->width * srcImage->height);
+    if (convertColors) {
+        clContextLog(C, "convert", 0, "Converting %d palette colors instead of every pixel", srcImage->palette->colors->width);
+        convertPalette(C, pipeline, transform, srcImage, dstImage);
+    } else {
+        clPipelineRun(C, pipeline, transform, srcImage, rect, dstImage);
+    }
     clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
 
     // Cleanup
@@ -593,20 +763,72 @@ void clImageColorGrade(struct clContext * C, clImage * image, int dstColorDepth,
 
 float clImageLargestChannel(struct clContext * C, clImage * image)
 {
+    int rect[4] = { 0, 0, image->width, image->height };
+    return clImageLargestChannelRect(C, image, rect);
+}
+
+float clImageLargestChannelRect(struct clContext * C, clImage * image, const int rect[4])
+{
+    if (image->palette && rectCoversImage(image, rect)) {
+        // Every palette color is used by some pixel, so they're all that needs checking
+        return clImageLargestChannel(C, image->palette->colors);
+    }
+    clImageExpandPalette(C, image);
+    if (!image->pixelsF32 && (image->pixelsU8 || image->pixelsU16)) {
+        // Integer pixels can't overrange; find the largest one without making an F32 copy of the image
+        uint32_t largestChannel = 0;
+        float maxChannel;
+        if (image->pixelsU16) {
+            for (int j = rect[1]; j < (rect[1] + rect[3]); ++j) {
+                for (int i = rect[0]; i < (rect[0] + rect[2]); ++i) {
+                    uint16_t * pixel = &image->pixelsU16[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
+                    if (largestChannel < pixel[0]) {
+                        largestChannel = pixel[0];
+                    }
+                    if (largestChannel < pixel[1]) {
+                        largestChannel = pixel[1];
+                    }
+                    if (largestChannel < pixel[2]) {
+                        largestChannel = pixel[2];
+                    }
+                }
+            }
+            maxChannel = (float)((1 << CL_CLAMP(image->depth, 8, 16)) - 1);
+        } else {
+            for (int j = rect[1]; j < (rect[1] + rect[3]); ++j) {
+                for (int i = rect[0]; i < (rect[0] + rect[2]); ++i) {
+                    uint8_t * pixel = &image->pixelsU8[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
+                    if (largestChannel < pixel[0]) {
+                        largestChannel = pixel[0];
+                    }
+                    if (largestChannel < pixel[1]) {
+                        largestChannel = pixel[1];
+                    }
+                    if (largestChannel < pixel[2]) {
+                        largestChannel = pixel[2];
+                    }
+                }
+            }
+            maxChannel = 255.0f;
+        }
+        return (float)largestChannel / maxChannel;
+    }
+
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_F32);
 
     float largestChannel = 0.0f;
-    int pixelCount = image->width * image->height;
-    for (int i = 0; i < pixelCount; ++i) {
-        float * pixel = &image->pixelsF32[i * CL_CHANNELS_PER_PIXEL];
-        if (largestChannel < pixel[0]) {
-            largestChannel = pixel[0];
-        }
-        if (largestChannel < pixel[1]) {
-            largestChannel = pixel[1];
-        }
-        if (largestChannel < pixel[2]) {
-            largestChannel = pixel[2];
+    for (int j = rect[1]; j < (rect[1] + rect[3]); ++j) {
+        for (int i = rect[0]; i < (rect[0] + rect[2]); ++i) {
+            float * pixel = &image->pixelsF32[(i + (j * image->width)) * CL_CHANNELS_PER_PIXEL];
+            if (largestChannel < pixel[0]) {
+                largestChannel = pixel[0];
+            }
+            if (largestChannel < pixel[1]) {
+                largestChannel = pixel[1];
+            }
+            if (largestChannel < pixel[2]) {
+                largestChannel = pixel[2];
+            }
         }
     }
     return largestChannel;
@@ -614,8 +836,11 @@ float clImageLargestChannel(struct clContext * C, clImage * image)
 
 float clImagePeakLuminance(struct clContext * C, clImage * image)
 {
-    float largestChannel = clImageLargestChannel(C, image);
+    return clImageChannelLuminance(C, image->profile, clImageLargestChannel(C, image));
+}
 
+float clImageChannelLuminance(struct clContext * C, struct clProfile * profile, float largestChannel)
+{
     float peakPixel[4];
     peakPixel[0] = largestChannel;
     peakPixel[1] = largestChannel;
@@ -623,7 +848,7 @@ float clImagePeakLuminance(struct clContext * C, clImage * image)
     peakPixel[3] = 1.0f;
 
     float peakXYZ[3];
-    clTransform * toXYZ = clTransformCreate(C, image->profile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
+    clTransform * toXYZ = clTransformCreate(C, profile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
     clTransformRun(C, toXYZ, peakPixel, peakXYZ, 1);
     clTransformDestroy(C, toXYZ);
 
@@ -644,14 +869,12 @@ void clImageClear(struct clContext * C, clImage * image, float color[4])
 void clImageDestroy(clContext * C, clImage * image)
 {
     clProfileDestroy(C, image->profile);
-    if (image->pixelsU8) {
-        clFree(image->pixelsU8);
-    }
-    if (image->pixelsU16) {
-        clFree(image->pixelsU16);
-    }
-    if (image->pixelsF32) {
-        clFree(image->pixelsF32);
+    clPixelPoolFree(C, image->pixelsU8);
+    clPixelPoolFree(C, image->pixelsU16);
+    clPixelPoolFree(C, image->pixelsF32);
+    if (image->traits) {
+        clFree(image->traits);
     }
+    imageDropPalette(C, image);
     clFree(image);
 }
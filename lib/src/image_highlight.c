@@ -10,23 +10,238 @@
 #include "colorist/context.h"
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
+#include "colorist/task.h"
 #include "colorist/transform.h"
 
-#include <stdlib.h>
 #include <string.h>
 
-static int compareFloats(const void * p, const void * q)
+// clImageMeasureHDR() measures its pixels in blocks (in parallel), each with its own counts
+#define MEASURE_MIN_BLOCK_PIXELS (64 * 1024)
+#define MEASURE_MAX_BLOCKS 64
+
+static int measureBlockCount(int pixelCount)
+{
+    return CL_CLAMP(pixelCount / MEASURE_MIN_BLOCK_PIXELS, 1, MEASURE_MAX_BLOCKS);
+}
+
+// ---------------------------------------------------------------------------
+// Percentiles
+
+// clImageMeasureHDR's percentiles are exact order statistics, found without sorting every pixel. Each pixel's
+// value is recorded along with its quantization bucket (a bucket's values are all smaller than those of any
+// later bucket), and each block of pixels keeps its own bucket counts. The summed counts say
+// which bucket each percentile's rank lands in, so only the pixels of those buckets are gathered (each block
+// in parallel, at offsets known ahead of time) and selected from (each bucket in parallel).
+
+#define PERCENTILE_COUNT 101
+
+typedef struct clPercentileSelector
+{
+    int pixelCount;
+    int blockPixels;
+    int blockCount;
+    float * values;     // [pixelCount]
+    uint16_t * buckets; // [pixelCount]
+    int * blockCounts;  // [blockCount][CL_QUANTIZATION_BUCKET_COUNT]
+
+    // Set up by percentileSelect()
+    int slotOfBucket[CL_QUANTIZATION_BUCKET_COUNT]; // index into slot*, or -1 if no percentile lands in the bucket
+    int slotCount;
+    int slotStarts[PERCENTILE_COUNT + 1]; // where each slot's pixels are gathered to in candidates
+    int slotFirstRank[PERCENTILE_COUNT];
+    int slotRankCount[PERCENTILE_COUNT];
+    int * blockOffsets; // [blockCount][slotCount], advanced while gathering
+    float * candidates;
+    int ranks[PERCENTILE_COUNT]; // relative to the start of the rank's slot
+    float results[PERCENTILE_COUNT];
+} clPercentileSelector;
+
+static clPercentileSelector * percentileSelectorCreate(struct clContext * C, int pixelCount)
+{
+    clPercentileSelector * selector = clAllocateStruct(clPercentileSelector);
+    selector->pixelCount = pixelCount;
+    selector->blockCount = measureBlockCount(pixelCount);
+    selector->blockPixels = (pixelCount + selector->blockCount - 1) / selector->blockCount;
+    selector->values = clAllocate(sizeof(float) * pixelCount);
+    selector->buckets = clAllocate(sizeof(uint16_t) * pixelCount);
+    selector->blockCounts = clAllocate(sizeof(int) * selector->blockCount * CL_QUANTIZATION_BUCKET_COUNT);
+    selector->blockOffsets = NULL;
+    selector->candidates = NULL;
+    return selector;
+}
+
+static void percentileSelectorDestroy(struct clContext * C, clPercentileSelector * selector)
+{
+    clFree(selector->values);
+    clFree(selector->buckets);
+    clFree(selector->blockCounts);
+    if (selector->blockOffsets) {
+        clFree(selector->blockOffsets);
+    }
+    if (selector->candidates) {
+        clFree(selector->candidates);
+    }
+    clFree(selector);
+}
+
+static void percentileAdd(clPercentileSelector * selector, int pixelIndex, float value, int bucket)
+{
+    selector->values[pixelIndex] = value;
+    selector->buckets[pixelIndex] = (uint16_t)bucket;
+    ++selector->blockCounts[((pixelIndex / selector->blockPixels) * CL_QUANTIZATION_BUCKET_COUNT) + bucket];
+}
+
+// Writes the values of the (ascending) ranks of values[] to out, partially reordering values[] along the way.
+// ranks are offset by rankBase.
+static void selectRanks(float * values, int count, const int * ranks, int rankCount, int rankBase, float * out)
+{
+    while (rankCount > 0) {
+        if (count <= 16) {
+            for (int i = 1; i < count; ++i) {
+                float v = values[i];
+                int j = i;
+                for (; (j > 0) && (values[j - 1] > v); --j) {
+                    values[j] = values[j - 1];
+                }
+                values[j] = v;
+            }
+            for (int i = 0; i < rankCount; ++i) {
+                out[i] = values[ranks[i] - rankBase];
+            }
+            return;
+        }
+
+        // Median of three, then a three-way partition into [ < pivot | == pivot | > pivot ] so that runs of equal
+        // values (very common: black, clipped white) are settled in a single pass
+        float a = values[0];
+        float b = values[count / 2];
+        float c = values[count - 1];
+        float pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a)) : ((a < c) ? a : ((b < c) ? c : b));
+        int lt = 0;
+        int gt = count;
+        for (int i = 0; i < gt;) {
+            float v = values[i];
+            if (v < pivot) {
+                values[i++] = values[lt];
+                values[lt++] = v;
+            } else if (v > pivot) {
+                values[i] = values[--gt];
+                values[gt] = v;
+            } else {
+                ++i;
+            }
+        }
+
+        int below = 0;
+        while ((below < rankCount) && ((ranks[below] - rankBase) < lt)) {
+            ++below;
+        }
+        selectRanks(values, lt, ranks, below, rankBase, out);
+        int settled = below;
+        while ((settled < rankCount) && ((ranks[settled] - rankBase) < gt)) {
+            out[settled++] = pivot;
+        }
+
+        values += gt;
+        count -= gt;
+        rankBase += gt;
+        ranks += settled;
+        rankCount -= settled;
+        out += settled;
+    }
+}
+
+static void percentileGatherTaskFunc(void * userData, int start, int count)
 {
-    const float x = *(const float *)p;
-    const float y = *(const float *)q;
-    if (x < y) {
-        return -1;
-    } else if (x > y) {
-        return 1;
+    clPercentileSelector * selector = (clPercentileSelector *)userData;
+    for (int block = start; block < (start + count); ++block) {
+        int * offsets = &selector->blockOffsets[block * selector->slotCount];
+        int blockStart = block * selector->blockPixels;
+        int blockEnd = CL_MIN(blockStart + selector->blockPixels, selector->pixelCount);
+        for (int i = blockStart; i < blockEnd; ++i) {
+            int slot = selector->slotOfBucket[selector->buckets[i]];
+            if (slot >= 0) {
+                selector->candidates[offsets[slot]++] = selector->values[i];
+            }
+        }
+    }
+}
+
+static void percentileSelectTaskFunc(void * userData, int start, int count)
+{
+    clPercentileSelector * selector = (clPercentileSelector *)userData;
+    for (int slot = start; slot < (start + count); ++slot) {
+        int first = selector->slotFirstRank[slot];
+        selectRanks(&selector->candidates[selector->slotStarts[slot]],
+                    selector->slotStarts[slot + 1] - selector->slotStarts[slot],
+                    &selector->ranks[first],
+                    selector->slotRankCount[slot],
+                    0,
+                    &selector->results[first]);
+    }
+}
+
+// Finds the 0th-99th percentiles (the value at index (i * pixelCount / 100) if all values were sorted), and the
+// largest value as the 100th
+static void percentileSelect(struct clContext * C, clPercentileSelector * selector, float outValues[PERCENTILE_COUNT])
+{
+    int bucketCounts[CL_QUANTIZATION_BUCKET_COUNT];
+    memset(bucketCounts, 0, sizeof(bucketCounts));
+    for (int block = 0; block < selector->blockCount; ++block) {
+        const int * counts = &selector->blockCounts[block * CL_QUANTIZATION_BUCKET_COUNT];
+        for (int bucket = 0; bucket < CL_QUANTIZATION_BUCKET_COUNT; ++bucket) {
+            bucketCounts[bucket] += counts[bucket];
+        }
     }
-    return 0;
+
+    // Walk the ranks (ascending) through the buckets, giving each bucket that a rank lands in a slot
+    int slotBuckets[PERCENTILE_COUNT];
+    selector->slotCount = 0;
+    for (int bucket = 0; bucket < CL_QUANTIZATION_BUCKET_COUNT; ++bucket) {
+        selector->slotOfBucket[bucket] = -1;
+    }
+    int bucket = 0;
+    int bucketStart = 0; // rank of the first value in bucket
+    for (int i = 0; i < PERCENTILE_COUNT; ++i) {
+        int rank = (i < 100) ? (int)((float)i * (float)selector->pixelCount / 100.0f) : (selector->pixelCount - 1);
+        while ((rank - bucketStart) >= bucketCounts[bucket]) {
+            bucketStart += bucketCounts[bucket];
+            ++bucket;
+        }
+        if (selector->slotOfBucket[bucket] < 0) {
+            int slot = selector->slotCount++;
+            selector->slotOfBucket[bucket] = slot;
+            selector->slotFirstRank[slot] = i;
+            selector->slotRankCount[slot] = 0;
+            slotBuckets[slot] = bucket;
+        }
+        ++selector->slotRankCount[selector->slotOfBucket[bucket]];
+        selector->ranks[i] = rank - bucketStart;
+    }
+
+    // Each block gathers its pixels of a slot's bucket right after the previous block's
+    selector->slotStarts[0] = 0;
+    for (int slot = 0; slot < selector->slotCount; ++slot) {
+        selector->slotStarts[slot + 1] = selector->slotStarts[slot] + bucketCounts[slotBuckets[slot]];
+    }
+    selector->blockOffsets = clAllocate(sizeof(int) * selector->blockCount * selector->slotCount);
+    for (int slot = 0; slot < selector->slotCount; ++slot) {
+        int offset = selector->slotStarts[slot];
+        for (int block = 0; block < selector->blockCount; ++block) {
+            selector->blockOffsets[(block * selector->slotCount) + slot] = offset;
+            offset += selector->blockCounts[(block * CL_QUANTIZATION_BUCKET_COUNT) + slotBuckets[slot]];
+        }
+    }
+    selector->candidates = clAllocate(sizeof(float) * selector->slotStarts[selector->slotCount]);
+
+    clTaskParallelFor(C, selector->blockCount, 1, percentileGatherTaskFunc, selector);
+    clTaskParallelFor(C, selector->slotCount, 1, percentileSelectTaskFunc, selector);
+    memcpy(outValues, selector->results, sizeof(selector->results));
 }
 
+// ---------------------------------------------------------------------------
+// HDR measurement
+
 static float calcOverbright(float Y, float overbrightScale, float maxY)
 {
     // Even at 10,000 nits, this is only 1 nit difference. If its less than this, we're not over.
@@ -178,6 +393,144 @@ void clImageHDRPixelInfoDestroy(struct clContext * C, clImageHDRPixelInfo * pixe
     clFree(pixelInfo);
 }
 
+typedef struct clMeasureHDRBlock
+{
+    int brightestPixelIndex; // -1 if no pixel is brighter than 0 nits
+    float brightestPixelNits;
+    int overbrightPixelCount;
+    int outOfGamutPixelCount;
+    int bothPixelCount;
+    int pixelCountsNitsPQ[CL_QUANTIZATION_BUCKET_COUNT];
+    int pixelCountsSaturation[CL_QUANTIZATION_BUCKET_COUNT];
+} clMeasureHDRBlock;
+
+typedef struct clMeasureHDRTask
+{
+    int pixelCount;
+    int blockPixels;
+    clMeasureHDRBlock * blocks;
+    const float * xyzPixels;
+    clProfilePrimaries * srcPrimaries;
+    clTransformGamutCeiling ceiling;
+    int srgbLuminance;
+    float satLuminance;
+    float overbrightScale;
+    float pixelInfoScale; // nits -> clImageHDRPixel.Y
+    clImage * highlight;
+    clImageHDRPixelInfo * pixelInfo;
+    clPercentileSelector * saturationPercentiles;
+    clPercentileSelector * nitsPercentiles;
+} clMeasureHDRTask;
+
+static void measureHDRTaskFunc(void * userData, int start, int count)
+{
+    const float minHighlight = 0.4f;
+
+    clMeasureHDRTask * info = (clMeasureHDRTask *)userData;
+    for (int blockIndex = start; blockIndex < (start + count); ++blockIndex) {
+        clMeasureHDRBlock * block = &info->blocks[blockIndex];
+        memset(block, 0, sizeof(clMeasureHDRBlock));
+        block->brightestPixelIndex = -1;
+
+        int blockStart = blockIndex * info->blockPixels;
+        int blockEnd = CL_MIN(blockStart + info->blockPixels, info->pixelCount);
+        for (int i = blockStart; i < blockEnd; ++i) {
+            const float * srcXYZ = &info->xyzPixels[i * 3];
+            uint16_t * dstPixel = info->highlight ? &info->highlight->pixelsU16[i * CL_CHANNELS_PER_PIXEL] : NULL;
+
+            cmsCIEXYZ XYZ;
+            XYZ.X = srcXYZ[0];
+            XYZ.Y = srcXYZ[1];
+            XYZ.Z = srcXYZ[2];
+
+            cmsCIExyY xyY;
+            if (XYZ.Y > 0) {
+                cmsXYZ2xyY(&xyY, &XYZ);
+            } else {
+                xyY.x = info->srcPrimaries->white[0];
+                xyY.y = info->srcPrimaries->white[1];
+                xyY.Y = 0.0f;
+            }
+
+            float pixelNits = (float)xyY.Y;
+            if (block->brightestPixelNits < pixelNits) {
+                block->brightestPixelNits = pixelNits;
+                block->brightestPixelIndex = i;
+            }
+
+            float maxY = clTransformGamutCeilingMaxY(&info->ceiling, (float)xyY.x, (float)xyY.y) * (float)info->srgbLuminance;
+            float overbright = calcOverbright((float)xyY.Y, info->overbrightScale, maxY);
+            float saturation = calcSaturation((float)xyY.x, (float)xyY.y, info->srcPrimaries);
+
+            if (info->pixelInfo) {
+                clImageHDRPixel * pixelHighlightInfo = &info->pixelInfo->pixels[i];
+                pixelHighlightInfo->x = (float)xyY.x;
+                pixelHighlightInfo->y = (float)xyY.y;
+                pixelHighlightInfo->Y = (float)xyY.Y / info->pixelInfoScale;
+                pixelHighlightInfo->nits = pixelNits;
+                pixelHighlightInfo->maxNits = maxY;
+                pixelHighlightInfo->saturation = saturation;
+            }
+
+            if (info->nitsPercentiles) {
+                float clampedNits = CL_CLAMP(pixelNits, 0.0f, 10000.0f);
+                int pqBucket =
+                    (int)clPixelMathRoundf(clTransformOETF_PQ(clampedNits / 10000.0f) * (float)(CL_QUANTIZATION_BUCKET_COUNT - 1));
+                pqBucket = CL_CLAMP(pqBucket, 0, CL_QUANTIZATION_BUCKET_COUNT - 1);
+                ++block->pixelCountsNitsPQ[pqBucket];
+                percentileAdd(info->nitsPercentiles, i, pixelNits, pqBucket);
+
+                // Pixels too dim to count toward saturation still count as 0 in its percentiles
+                if (clampedNits >= info->satLuminance) {
+                    int saturationBucket = (int)clPixelMathRoundf(saturation * 0.5f * (float)(CL_QUANTIZATION_BUCKET_COUNT - 1));
+                    saturationBucket = CL_CLAMP(saturationBucket, 0, CL_QUANTIZATION_BUCKET_COUNT - 1);
+                    ++block->pixelCountsSaturation[saturationBucket];
+                    percentileAdd(info->saturationPercentiles, i, saturation, saturationBucket);
+                } else {
+                    percentileAdd(info->saturationPercentiles, i, 0.0f, 0);
+                }
+            }
+
+            if (dstPixel) {
+                float outOfSRGB = CL_CLAMP(saturation - 1.0f, 0.0f, 1.0f);
+                float baseIntensity = pixelNits / (float)info->srgbLuminance;
+                baseIntensity = CL_CLAMP(baseIntensity, 0.0f, 1.0f);
+                uint8_t intensity8 = intensityToU8(baseIntensity);
+
+                if ((overbright > 0.0f) && (outOfSRGB > 0.0f)) {
+                    float biggerHighlight = (overbright > outOfSRGB) ? overbright : outOfSRGB;
+                    float highlightIntensity = minHighlight + (biggerHighlight * (1.0f - minHighlight));
+                    // Yellow
+                    dstPixel[0] = intensity8;
+                    dstPixel[1] = intensity8;
+                    dstPixel[2] = intensityToU8(baseIntensity * (1.0f - highlightIntensity));
+                    ++block->bothPixelCount;
+                } else if (overbright > 0.0f) {
+                    float highlightIntensity = minHighlight + (overbright * (1.0f - minHighlight));
+                    // Magenta
+                    dstPixel[0] = intensity8;
+                    dstPixel[1] = intensityToU8(baseIntensity * (1.0f - highlightIntensity));
+                    dstPixel[2] = intensity8;
+                    ++block->overbrightPixelCount;
+                } else if (outOfSRGB > 0.0f) {
+                    float highlightIntensity = minHighlight + (outOfSRGB * (1.0f - minHighlight));
+                    // Cyan
+                    dstPixel[0] = intensityToU8(baseIntensity * (1.0f - highlightIntensity));
+                    dstPixel[1] = intensity8;
+                    dstPixel[2] = intensity8;
+                    ++block->outOfGamutPixelCount;
+                } else {
+                    // Gray
+                    dstPixel[0] = intensity8;
+                    dstPixel[1] = intensity8;
+                    dstPixel[2] = intensity8;
+                }
+                dstPixel[3] = 255;
+            }
+        }
+    }
+}
+
 void clImageMeasureHDR(clContext * C,
                        clImage * srcImage,
                        int srgbLuminance,
@@ -187,10 +540,7 @@ void clImageMeasureHDR(clContext * C,
                        clImageHDRPixelInfo * outPixelInfo,
                        clImageHDRQuantization * outQuantization)
 {
-    const float minHighlight = 0.4f;
-
     clTransform * toXYZ = clTransformCreate(C, srcImage->profile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
-    clTransform * fromXYZ = clTransformCreate(C, NULL, CL_XF_XYZ, srcImage->profile, CL_XF_RGB, CL_TONEMAP_OFF);
 
     clProfilePrimaries srcPrimaries;
     clProfileCurve srcCurve;
@@ -204,21 +554,12 @@ void clImageMeasureHDR(clContext * C,
         }
     }
 
-    // clTransformCalcMaxY assumes the RGB profile is linear with a 1 nit luminance
-    clProfileCurve gamma1;
-    gamma1.type = CL_PCT_GAMMA;
-    gamma1.gamma = 1.0f;
-    clProfile * linearProfile = clProfileCreate(C, &srcPrimaries, &gamma1, 1, NULL);
-    clTransform * linearToXYZ = clTransformCreate(C, linearProfile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
-    clTransform * linearFromXYZ = clTransformCreate(C, NULL, CL_XF_XYZ, linearProfile, CL_XF_RGB, CL_TONEMAP_OFF);
-
     memset(outStats, 0, sizeof(clImageHDRStats));
     int pixelCount = outStats->pixelCount = srcImage->width * srcImage->height;
 
     clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_F32);
 
     float measuredPeakLuminance = clImagePeakLuminance(C, srcImage);
-    float overbrightScale = measuredPeakLuminance * srcCurve.implicitScale / (float)srgbLuminance;
 
     float * xyzPixels = clAllocate(3 * sizeof(float) * pixelCount);
     clTransformRun(C, toXYZ, srcImage->pixelsF32, xyzPixels, pixelCount);
@@ -233,131 +574,65 @@ void clImageMeasureHDR(clContext * C,
         clImagePrepareWritePixels(C, highlight, CL_PIXELFORMAT_U16);
     }
 
-    float * saturationForPercentiles = NULL;
-    float * nitsForPercentiles = NULL;
+    clMeasureHDRTask info;
+    info.pixelCount = pixelCount;
+    int blockCount = measureBlockCount(pixelCount);
+    info.blockPixels = (pixelCount + blockCount - 1) / blockCount;
+    info.blocks = clAllocate(sizeof(clMeasureHDRBlock) * blockCount);
+    info.xyzPixels = xyzPixels;
+    info.srcPrimaries = &srcPrimaries;
+    clTransformGamutCeilingInit(C, &srcPrimaries, &info.ceiling);
+    info.srgbLuminance = srgbLuminance;
+    info.satLuminance = satLuminance;
+    info.overbrightScale = measuredPeakLuminance * srcCurve.implicitScale / (float)srgbLuminance;
+    info.pixelInfoScale = (float)srcLuminance * srcCurve.implicitScale;
+    info.highlight = highlight;
+    info.pixelInfo = outPixelInfo;
+    info.saturationPercentiles = NULL;
+    info.nitsPercentiles = NULL;
     if (outQuantization) {
         memset(outQuantization, 0, sizeof(clImageHDRQuantization));
-        saturationForPercentiles = clAllocate(sizeof(float) * pixelCount);
-        nitsForPercentiles = clAllocate(sizeof(float) * pixelCount);
+        info.saturationPercentiles = percentileSelectorCreate(C, pixelCount);
+        info.nitsPercentiles = percentileSelectorCreate(C, pixelCount);
     }
 
-    for (int i = 0; i < pixelCount; ++i) {
-        float * srcXYZ = &xyzPixels[i * 3];
-        uint16_t * dstPixel = highlight ? &highlight->pixelsU16[i * CL_CHANNELS_PER_PIXEL] : NULL;
-
-        cmsCIEXYZ XYZ;
-        XYZ.X = srcXYZ[0];
-        XYZ.Y = srcXYZ[1];
-        XYZ.Z = srcXYZ[2];
+    clTaskParallelFor(C, blockCount, 1, measureHDRTaskFunc, &info);
 
-        cmsCIExyY xyY;
-        if (XYZ.Y > 0) {
-            cmsXYZ2xyY(&xyY, &XYZ);
-        } else {
-            xyY.x = srcPrimaries.white[0];
-            xyY.y = srcPrimaries.white[1];
-            xyY.Y = 0.0f;
-        }
-
-        float pixelNits = (float)xyY.Y;
-        if (outStats->brightestPixelNits < pixelNits) {
-            outStats->brightestPixelNits = pixelNits;
-            outStats->brightestPixelX = i % srcImage->width;
-            outStats->brightestPixelY = i / srcImage->width;
+    // Blocks are merged in order, so the brightest pixel is still the first one found at that brightness
+    for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex) {
+        clMeasureHDRBlock * block = &info.blocks[blockIndex];
+        if (outStats->brightestPixelNits < block->brightestPixelNits) {
+            outStats->brightestPixelNits = block->brightestPixelNits;
+            outStats->brightestPixelX = block->brightestPixelIndex % srcImage->width;
+            outStats->brightestPixelY = block->brightestPixelIndex / srcImage->width;
         }
-
-        float maxY = clTransformCalcMaxY(C, linearFromXYZ, linearToXYZ, (float)xyY.x, (float)xyY.y) * (float)srgbLuminance;
-        float overbright = calcOverbright((float)xyY.Y, overbrightScale, maxY);
-        float saturation = calcSaturation((float)xyY.x, (float)xyY.y, &srcPrimaries);
-
-        if (outPixelInfo) {
-            clImageHDRPixel * pixelHighlightInfo = &outPixelInfo->pixels[i];
-            pixelHighlightInfo->x = (float)xyY.x;
-            pixelHighlightInfo->y = (float)xyY.y;
-            pixelHighlightInfo->Y = (float)xyY.Y / ((float)srcLuminance * srcCurve.implicitScale);
-            pixelHighlightInfo->nits = pixelNits;
-            pixelHighlightInfo->maxNits = maxY;
-            pixelHighlightInfo->saturation = saturation;
-        }
-
+        outStats->overbrightPixelCount += block->overbrightPixelCount;
+        outStats->outOfGamutPixelCount += block->outOfGamutPixelCount;
+        outStats->bothPixelCount += block->bothPixelCount;
         if (outQuantization) {
-            float clampedNits = CL_CLAMP(pixelNits, 0.0f, 10000.0f);
-            int pqBucket =
-                (int)clPixelMathRoundf(clTransformOETF_PQ(clampedNits / 10000.0f) * (float)(CL_QUANTIZATION_BUCKET_COUNT - 1));
-            pqBucket = CL_CLAMP(pqBucket, 0, CL_QUANTIZATION_BUCKET_COUNT - 1);
-            ++outQuantization->pixelCountsNitsPQ[pqBucket];
-            nitsForPercentiles[i] = pixelNits;
-
-            if (clampedNits >= satLuminance) {
-                int saturationBucket = (int)clPixelMathRoundf(saturation * 0.5f * (float)(CL_QUANTIZATION_BUCKET_COUNT - 1));
-                saturationBucket = CL_CLAMP(saturationBucket, 0, CL_QUANTIZATION_BUCKET_COUNT - 1);
-                ++outQuantization->pixelCountsSaturation[saturationBucket];
-                saturationForPercentiles[i] = saturation;
+            for (int bucket = 0; bucket < CL_QUANTIZATION_BUCKET_COUNT; ++bucket) {
+                outQuantization->pixelCountsNitsPQ[bucket] += block->pixelCountsNitsPQ[bucket];
+                outQuantization->pixelCountsSaturation[bucket] += block->pixelCountsSaturation[bucket];
             }
         }
-
-        if (dstPixel) {
-            float outOfSRGB = CL_CLAMP(saturation - 1.0f, 0.0f, 1.0f);
-            float baseIntensity = pixelNits / (float)srgbLuminance;
-            baseIntensity = CL_CLAMP(baseIntensity, 0.0f, 1.0f);
-            uint8_t intensity8 = intensityToU8(baseIntensity);
-
-            if ((overbright > 0.0f) && (outOfSRGB > 0.0f)) {
-                float biggerHighlight = (overbright > outOfSRGB) ? overbright : outOfSRGB;
-                float highlightIntensity = minHighlight + (biggerHighlight * (1.0f - minHighlight));
-                // Yellow
-                dstPixel[0] = intensity8;
-                dstPixel[1] = intensity8;
-                dstPixel[2] = intensityToU8(baseIntensity * (1.0f - highlightIntensity));
-                ++outStats->bothPixelCount;
-            } else if (overbright > 0.0f) {
-                float highlightIntensity = minHighlight + (overbright * (1.0f - minHighlight));
-                // Magenta
-                dstPixel[0] = intensity8;
-                dstPixel[1] = intensityToU8(baseIntensity * (1.0f - highlightIntensity));
-                dstPixel[2] = intensity8;
-                ++outStats->overbrightPixelCount;
-            } else if (outOfSRGB > 0.0f) {
-                float highlightIntensity = minHighlight + (outOfSRGB * (1.0f - minHighlight));
-                // Cyan
-                dstPixel[0] = intensityToU8(baseIntensity * (1.0f - highlightIntensity));
-                dstPixel[1] = intensity8;
-                dstPixel[2] = intensity8;
-                ++outStats->outOfGamutPixelCount;
-            } else {
-                // Gray
-                dstPixel[0] = intensity8;
-                dstPixel[1] = intensity8;
-                dstPixel[2] = intensity8;
-            }
-            dstPixel[3] = 255;
-        }
     }
     outStats->hdrPixelCount = outStats->bothPixelCount + outStats->overbrightPixelCount + outStats->outOfGamutPixelCount;
 
     if (outQuantization) {
-        qsort(saturationForPercentiles, pixelCount, sizeof(float), compareFloats);
-        qsort(nitsForPercentiles, pixelCount, sizeof(float), compareFloats);
-
-        for (int i = 0; i < 100; ++i) {
-            clImageHDRPercentile * percentile = &outQuantization->percentiles[i];
-            int percentileIndex = (int)((float)i * (float)pixelCount / 100.0f);
-            percentile->saturation = saturationForPercentiles[percentileIndex];
-            percentile->nits = nitsForPercentiles[percentileIndex];
+        float saturations[PERCENTILE_COUNT];
+        float nits[PERCENTILE_COUNT];
+        percentileSelect(C, info.saturationPercentiles, saturations);
+        percentileSelect(C, info.nitsPercentiles, nits);
+        for (int i = 0; i < PERCENTILE_COUNT; ++i) {
+            outQuantization->percentiles[i].saturation = saturations[i];
+            outQuantization->percentiles[i].nits = nits[i];
         }
-        clImageHDRPercentile * topPercentile = &outQuantization->percentiles[100];
-        topPercentile->saturation = saturationForPercentiles[pixelCount - 1];
-        topPercentile->nits = nitsForPercentiles[pixelCount - 1];
 
-        clFree(saturationForPercentiles);
-        clFree(nitsForPercentiles);
+        percentileSelectorDestroy(C, info.saturationPercentiles);
+        percentileSelectorDestroy(C, info.nitsPercentiles);
     }
 
-    clTransformDestroy(C, linearToXYZ);
-    clTransformDestroy(C, linearFromXYZ);
-    clProfileDestroy(C, linearProfile);
-
-    clTransformDestroy(C, fromXYZ);
+    clFree(info.blocks);
     clTransformDestroy(C, toXYZ);
     clFree(xyzPixels);
 }
@@ -0,0 +1,177 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/image.h"
+
+#include "colorist/context.h"
+#include "colorist/task.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Each buffer is preceded by a header, padded out to POOL_ALIGNMENT so that the pixels stay aligned.
+#define POOL_ALIGNMENT 64
+
+// Smaller buffers aren't worth recycling (the system allocator keeps those around anyway). Classes are
+// (2^e + k * 2^e / 8) bytes for k in [1, 8], for each e in [POOL_MIN_EXPONENT, POOL_MAX_EXPONENT).
+#define POOL_MIN_EXPONENT 16
+#define POOL_MAX_EXPONENT 40
+#define POOL_CLASSES_PER_EXPONENT 8
+#define POOL_CLASS_COUNT ((POOL_MAX_EXPONENT - POOL_MIN_EXPONENT) * POOL_CLASSES_PER_EXPONENT)
+
+typedef struct clPixelPoolBuffer
+{
+    void * allocation; // what C->system.alloc() returned
+    size_t capacity;   // usable bytes
+    int sizeClass;     // -1 if this buffer is never recycled
+    struct clPixelPoolBuffer * next;
+} clPixelPoolBuffer;
+
+static clPixelPoolBuffer * poolHeader(void * ptr)
+{
+    return (clPixelPoolBuffer *)((uint8_t *)ptr - POOL_ALIGNMENT);
+}
+
+static void * poolPixels(clPixelPoolBuffer * buffer)
+{
+    return (uint8_t *)buffer + POOL_ALIGNMENT;
+}
+
+// Returns the size class of bytes (or -1 if it has none), and how many bytes buffers of it hold
+static int poolSizeClass(size_t bytes, size_t * outCapacity)
+{
+    *outCapacity = bytes;
+    if (bytes <= ((size_t)1 << POOL_MIN_EXPONENT)) {
+        return -1;
+    }
+    for (int e = POOL_MIN_EXPONENT; e < POOL_MAX_EXPONENT; ++e) {
+        size_t base = (size_t)1 << e;
+        if (bytes <= (base << 1)) {
+            size_t step = base / POOL_CLASSES_PER_EXPONENT;
+            size_t k = (bytes - base + step - 1) / step; // [1, 8]
+            *outCapacity = base + (k * step);
+            return ((e - POOL_MIN_EXPONENT) * POOL_CLASSES_PER_EXPONENT) + (int)(k - 1);
+        }
+        if ((base << 1) < base) {
+            break; // size_t overflow (32-bit)
+        }
+    }
+    return -1;
+}
+
+static void poolRelease(struct clContext * C, clPixelPoolBuffer * buffer)
+{
+    clFree(buffer->allocation);
+}
+
+clPixelPool * clPixelPoolCreate(struct clContext * C, size_t budget)
+{
+    clPixelPool * pool = clAllocateStruct(clPixelPool);
+    pool->idle = clAllocate(sizeof(clPixelPoolBuffer *) * POOL_CLASS_COUNT);
+    pool->idleBytes = 0;
+    pool->budget = budget;
+    pool->allocations = 0;
+    pool->reuses = 0;
+    pool->lock = clMutexCreate(C);
+    return pool;
+}
+
+void clPixelPoolClear(struct clContext * C, clPixelPool * pool)
+{
+    clMutexLock(pool->lock);
+    for (int sizeClass = 0; sizeClass < POOL_CLASS_COUNT; ++sizeClass) {
+        while (pool->idle[sizeClass]) {
+            clPixelPoolBuffer * buffer = pool->idle[sizeClass];
+            pool->idle[sizeClass] = buffer->next;
+            poolRelease(C, buffer);
+        }
+    }
+    pool->idleBytes = 0;
+    pool->allocations = 0;
+    pool->reuses = 0;
+    clMutexUnlock(pool->lock);
+}
+
+void clPixelPoolDestroy(struct clContext * C, clPixelPool * pool)
+{
+    clPixelPoolClear(C, pool);
+    clFree(pool->idle);
+    clMutexDestroy(C, pool->lock);
+    clFree(pool);
+}
+
+void * clPixelPoolAllocate(struct clContext * C, size_t bytes, clBool zero)
+{
+    clPixelPool * pool = C->pixelPool;
+    size_t capacity;
+    int sizeClass = poolSizeClass(bytes, &capacity);
+
+    clPixelPoolBuffer * buffer = NULL;
+    clMutexLock(pool->lock);
+    ++pool->allocations;
+    if ((sizeClass >= 0) && pool->idle[sizeClass]) {
+        buffer = pool->idle[sizeClass];
+        pool->idle[sizeClass] = buffer->next;
+        pool->idleBytes -= buffer->capacity;
+        ++pool->reuses;
+    }
+    clMutexUnlock(pool->lock);
+
+    if (buffer) {
+        if (zero) {
+            memset(poolPixels(buffer), 0, bytes);
+        }
+    } else {
+        // Room for the header, plus slack to align the pixels after it
+        uint8_t * allocation = clAllocate(POOL_ALIGNMENT + capacity + (POOL_ALIGNMENT - 1));
+        uintptr_t pixels = ((uintptr_t)allocation + POOL_ALIGNMENT + (POOL_ALIGNMENT - 1)) & ~(uintptr_t)(POOL_ALIGNMENT - 1);
+        buffer = poolHeader((void *)pixels);
+        buffer->allocation = allocation;
+        buffer->capacity = capacity;
+        buffer->sizeClass = sizeClass;
+    }
+    buffer->next = NULL;
+    return poolPixels(buffer);
+}
+
+void clPixelPoolFree(struct clContext * C, void * ptr)
+{
+    clPixelPool * pool = C->pixelPool;
+    if (!ptr) {
+        return;
+    }
+
+    clPixelPoolBuffer * buffer = poolHeader(ptr);
+    if ((buffer->sizeClass < 0) || (buffer->capacity > pool->budget)) {
+        poolRelease(C, buffer);
+        return;
+    }
+
+    clMutexLock(pool->lock);
+    // Make room by dropping idle buffers, largest first; those are the costliest to keep around
+    for (int sizeClass = POOL_CLASS_COUNT - 1; (sizeClass >= 0) && ((pool->idleBytes + buffer->capacity) > pool->budget); --sizeClass) {
+        while (pool->idle[sizeClass] && ((pool->idleBytes + buffer->capacity) > pool->budget)) {
+            clPixelPoolBuffer * evicted = pool->idle[sizeClass];
+            pool->idle[sizeClass] = evicted->next;
+            pool->idleBytes -= evicted->capacity;
+            poolRelease(C, evicted);
+        }
+    }
+    buffer->next = pool->idle[buffer->sizeClass];
+    pool->idle[buffer->sizeClass] = buffer;
+    pool->idleBytes += buffer->capacity;
+    clMutexUnlock(pool->lock);
+}
+
+void clPixelPoolGetStats(struct clContext * C, int * outAllocations, int * outReuses)
+{
+    clPixelPool * pool = C->pixelPool;
+    clMutexLock(pool->lock);
+    *outAllocations = pool->allocations;
+    *outReuses = pool->reuses;
+    clMutexUnlock(pool->lock);
+}
@@ -0,0 +1,164 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/image.h"
+
+#include "colorist/context.h"
+#include "colorist/task.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Distinct colors are gathered in a small open addressing set; twice the palette limit keeps probes short
+#define TRAITS_SET_SIZE (CL_TRAITS_MAX_COLORS * 2)
+
+typedef struct clColorSet
+{
+    uint32_t keys[TRAITS_SET_SIZE];
+    uint8_t used[TRAITS_SET_SIZE];
+    int count;
+    clBool overflowed; // saw more than CL_TRAITS_MAX_COLORS
+} clColorSet;
+
+static void colorSetAdd(clColorSet * set, uint32_t key)
+{
+    uint32_t slot = (key * 2654435761u) >> 23; // 9 bits, TRAITS_SET_SIZE slots
+    while (set->used[slot]) {
+        if (set->keys[slot] == key) {
+            return;
+        }
+        slot = (slot + 1) & (TRAITS_SET_SIZE - 1);
+    }
+    if (set->count == CL_TRAITS_MAX_COLORS) {
+        set->overflowed = clTrue;
+        return;
+    }
+    set->used[slot] = 1;
+    set->keys[slot] = key;
+    ++set->count;
+}
+
+typedef struct clTraitsTask
+{
+    clContext * C;
+    clImage * image;
+    uint16_t maxChannel;
+    clMutex * lock;
+
+    // Guarded by lock, merged into by every range
+    clBool opaque;
+    clBool gray;
+    clColorSet colors;
+} clTraitsTask;
+
+static void traitsTaskFunc(void * userData, int start, int count)
+{
+    clTraitsTask * info = (clTraitsTask *)userData;
+    clContext * C = info->C;
+    clImage * image = info->image;
+
+    // Nothing left to learn once every trait is ruled out
+    clMutexLock(info->lock);
+    clBool opaque = info->opaque;
+    clBool gray = info->gray;
+    clBool countColors = (image->depth == 8) && !info->colors.overflowed;
+    clMutexUnlock(info->lock);
+    if (!opaque && !gray && !countColors) {
+        return;
+    }
+
+    clColorSet * colors = NULL;
+    if (countColors) {
+        colors = clAllocateStruct(clColorSet);
+    }
+
+    int pixelCount = count * image->width;
+    if (image->depth == 8) {
+        const uint8_t * pixels = &image->pixelsU8[(size_t)start * image->width * CL_CHANNELS_PER_PIXEL];
+        for (int i = 0; (i < pixelCount) && (opaque || gray || countColors); ++i) {
+            const uint8_t * pixel = &pixels[i * CL_CHANNELS_PER_PIXEL];
+            opaque = opaque && (pixel[3] == 255);
+            gray = gray && (pixel[0] == pixel[1]) && (pixel[1] == pixel[2]);
+            if (countColors) {
+                colorSetAdd(colors, CL_TRAITS_PACK_COLOR(pixel));
+                countColors = !colors->overflowed;
+            }
+        }
+    } else {
+        const uint16_t * pixels = &image->pixelsU16[(size_t)start * image->width * CL_CHANNELS_PER_PIXEL];
+        for (int i = 0; (i < pixelCount) && (opaque || gray); ++i) {
+            const uint16_t * pixel = &pixels[i * CL_CHANNELS_PER_PIXEL];
+            opaque = opaque && (pixel[3] == info->maxChannel);
+            gray = gray && (pixel[0] == pixel[1]) && (pixel[1] == pixel[2]);
+        }
+    }
+
+    clMutexLock(info->lock);
+    info->opaque = info->opaque && opaque;
+    info->gray = info->gray && gray;
+    if (colors) {
+        if (colors->overflowed) {
+            info->colors.overflowed = clTrue;
+        }
+        for (int slot = 0; (slot < TRAITS_SET_SIZE) && !info->colors.overflowed; ++slot) {
+            if (colors->used[slot]) {
+                colorSetAdd(&info->colors, colors->keys[slot]);
+            }
+        }
+    }
+    clMutexUnlock(info->lock);
+
+    if (colors) {
+        clFree(colors);
+    }
+}
+
+static int compareColors(const void * a, const void * b)
+{
+    uint32_t ca = *(const uint32_t *)a;
+    uint32_t cb = *(const uint32_t *)b;
+    return (ca < cb) ? -1 : ((ca > cb) ? 1 : 0);
+}
+
+const clImageTraits * clImageGetTraits(struct clContext * C, clImage * image)
+{
+    if (image->traits) {
+        return image->traits;
+    }
+
+    // Every palette color is used by some pixel, so scanning those is the same as scanning the pixels
+    clImage * scanned = image->palette ? image->palette->colors : image;
+
+    clTraitsTask info;
+    memset(&info, 0, sizeof(info));
+    info.C = C;
+    info.image = scanned;
+    info.maxChannel = (uint16_t)((1 << CL_CLAMP(image->depth, 8, 16)) - 1);
+    info.lock = clMutexCreate(C);
+    info.opaque = clTrue;
+    info.gray = clTrue;
+
+    clImagePrepareReadPixels(C, scanned, (scanned->depth == 8) ? CL_PIXELFORMAT_U8 : CL_PIXELFORMAT_U16);
+    int minRows = CL_MAX(1, 16384 / CL_MAX(scanned->width, 1));
+    clTaskParallelFor(C, scanned->height, minRows, traitsTaskFunc, &info);
+    clMutexDestroy(C, info.lock);
+
+    clImageTraits * traits = clAllocateStruct(clImageTraits);
+    traits->opaque = info.opaque;
+    traits->gray = info.gray;
+    traits->colorCount = 0;
+    if ((image->depth == 8) && !info.colors.overflowed) {
+        for (int slot = 0; slot < TRAITS_SET_SIZE; ++slot) {
+            if (info.colors.used[slot]) {
+                traits->colors[traits->colorCount++] = info.colors.keys[slot];
+            }
+        }
+        qsort(traits->colors, traits->colorCount, sizeof(uint32_t), compareColors);
+    }
+    image->traits = traits;
+    return traits;
+}
@@ -0,0 +1,503 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/lut.h"
+
+#include "colorist/context.h"
+#include "colorist/image.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COLORIST_LUT_SSE2
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <emmintrin.h>
+#endif
+
+// Floats per lattice point
+#define LUT_STRIDE 4
+
+// .cube files this large are already hundreds of MB of text
+#define CUBE_MAX_SIZE 256
+
+clLUT3D * clLUT3DCreate(struct clContext * C, int size)
+{
+    COLORIST_ASSERT(size >= 2);
+
+    clLUT3D * lut = clAllocateStruct(clLUT3D);
+    lut->size = size;
+    lut->lattice = clAllocate(sizeof(float) * LUT_STRIDE * size * size * size);
+    for (int i = 0; i < 3; ++i) {
+        lut->domainMin[i] = 0.0f;
+        lut->domainMax[i] = 1.0f;
+    }
+    lut->interpolation = CL_LUT_INTERPOLATION_TETRAHEDRAL;
+
+    float maxIndex = (float)(size - 1);
+    float * point = lut->lattice;
+    for (int b = 0; b < size; ++b) {
+        for (int g = 0; g < size; ++g) {
+            for (int r = 0; r < size; ++r) {
+                point[0] = (float)r / maxIndex;
+                point[1] = (float)g / maxIndex;
+                point[2] = (float)b / maxIndex;
+                point[3] = 0.0f;
+                point += LUT_STRIDE;
+            }
+        }
+    }
+    return lut;
+}
+
+void clLUT3DDestroy(struct clContext * C, clLUT3D * lut)
+{
+    clFree(lut->lattice);
+    clFree(lut);
+}
+
+clLUT3D * clLUT3DCreateHALD(struct clContext * C, struct clImage * hald, int haldDims)
+{
+    COLORIST_ASSERT((hald->width * hald->height) == (haldDims * haldDims * haldDims));
+
+    clImagePrepareReadPixels(C, hald, CL_PIXELFORMAT_F32);
+
+    clLUT3D * lut = clLUT3DCreate(C, haldDims);
+    int pointCount = haldDims * haldDims * haldDims;
+    for (int i = 0; i < pointCount; ++i) {
+        memcpy(&lut->lattice[i * LUT_STRIDE], &hald->pixelsF32[i * CL_CHANNELS_PER_PIXEL], sizeof(float) * 3);
+    }
+    return lut;
+}
+
+static clBool filenameEndsWith(const char * filename, const char * extension)
+{
+    size_t filenameLen = strlen(filename);
+    size_t extensionLen = strlen(extension);
+    if (filenameLen < extensionLen) {
+        return clFalse;
+    }
+    const char * s = filename + filenameLen - extensionLen;
+    for (size_t i = 0; i < extensionLen; ++i) {
+        if (tolower((unsigned char)s[i]) != extension[i]) {
+            return clFalse;
+        }
+    }
+    return clTrue;
+}
+
+clLUT3D * clLUT3DRead(struct clContext * C, const char * filename)
+{
+    if (filenameEndsWith(filename, ".cube")) {
+        return clLUT3DReadCube(C, filename);
+    }
+
+    clImage * hald = clContextRead(C, filename, NULL, NULL);
+    if (!hald) {
+        clContextLogError(C, "Can't read Hald CLUT: %s", filename);
+        return NULL;
+    }
+    if (hald->width != hald->height) {
+        clContextLogError(C, "Hald CLUT isn't square [%dx%d]: %s", hald->width, hald->height, filename);
+        clImageDestroy(C, hald);
+        return NULL;
+    }
+
+    // A level L Hald CLUT is L^3 pixels wide and holds an L^2 lattice
+    int haldDims = 0;
+    for (int i = 2; i < 32; ++i) {
+        if ((i * i * i) == hald->width) {
+            haldDims = i * i;
+            break;
+        }
+    }
+    if (haldDims == 0) {
+        clContextLogError(C, "Hald CLUT dimensions aren't cubic [%dx%d]: %s", hald->width, hald->height, filename);
+        clImageDestroy(C, hald);
+        return NULL;
+    }
+
+    clLUT3D * lut = clLUT3DCreateHALD(C, hald, haldDims);
+    clImageDestroy(C, hald);
+    clContextLog(C, "hald", 0, "Loaded %dx%dx%d Hald CLUT: %s", haldDims, haldDims, haldDims, filename);
+    return lut;
+}
+
+static clBool cubeKeyword(char ** s, const char * keyword)
+{
+    size_t len = strlen(keyword);
+    if (strncmp(*s, keyword, len) || !isspace((unsigned char)(*s)[len])) {
+        return clFalse;
+    }
+    *s += len;
+    return clTrue;
+}
+
+// See the "Cube LUT Specification" (Adobe, v1.0). Keywords colorist doesn't need (TITLE, LUT_IN_VIDEO_RANGE, etc) are skipped.
+clLUT3D * clLUT3DReadCube(struct clContext * C, const char * filename)
+{
+    char line[1024];
+    clLUT3D * lut = NULL;
+    float domainMin[3] = { 0.0f, 0.0f, 0.0f };
+    float domainMax[3] = { 1.0f, 1.0f, 1.0f };
+    int pointCount = 0;
+    int pointsRead = 0;
+    clBool failed = clFalse;
+
+    FILE * f = fopen(filename, "r");
+    if (!f) {
+        clContextLogError(C, "Can't open 3D LUT: %s", filename);
+        return NULL;
+    }
+
+    int lineNumber = 0;
+    while (!failed && fgets(line, sizeof(line), f)) {
+        ++lineNumber;
+
+        char * s = line;
+        while (isspace((unsigned char)*s)) {
+            ++s;
+        }
+        if ((*s == 0) || (*s == '#')) {
+            continue;
+        }
+
+        if (cubeKeyword(&s, "LUT_3D_SIZE")) {
+            int size = atoi(s);
+            if (lut || (size < 2) || (size > CUBE_MAX_SIZE)) {
+                clContextLogError(C, "%s:%d: invalid LUT_3D_SIZE", filename, lineNumber);
+                failed = clTrue;
+                continue;
+            }
+            lut = clLUT3DCreate(C, size);
+            pointCount = size * size * size;
+        } else if (cubeKeyword(&s, "LUT_1D_SIZE")) {
+            clContextLogError(C, "%s:%d: 1D LUTs are unsupported", filename, lineNumber);
+            failed = clTrue;
+        } else if (cubeKeyword(&s, "DOMAIN_MIN")) {
+            if (sscanf(s, "%f %f %f", &domainMin[0], &domainMin[1], &domainMin[2]) != 3) {
+                clContextLogError(C, "%s:%d: invalid DOMAIN_MIN", filename, lineNumber);
+                failed = clTrue;
+            }
+        } else if (cubeKeyword(&s, "DOMAIN_MAX")) {
+            if (sscanf(s, "%f %f %f", &domainMax[0], &domainMax[1], &domainMax[2]) != 3) {
+                clContextLogError(C, "%s:%d: invalid DOMAIN_MAX", filename, lineNumber);
+                failed = clTrue;
+            }
+        } else if (cubeKeyword(&s, "LUT_3D_INPUT_RANGE")) {
+            // Resolve's older spelling of DOMAIN_MIN / DOMAIN_MAX
+            float rangeMin, rangeMax;
+            if (sscanf(s, "%f %f", &rangeMin, &rangeMax) == 2) {
+                for (int i = 0; i < 3; ++i) {
+                    domainMin[i] = rangeMin;
+                    domainMax[i] = rangeMax;
+                }
+            } else {
+                clContextLogError(C, "%s:%d: invalid LUT_3D_INPUT_RANGE", filename, lineNumber);
+                failed = clTrue;
+            }
+        } else if (isalpha((unsigned char)*s)) {
+            continue;
+        } else {
+            if (!lut) {
+                clContextLogError(C, "%s:%d: LUT data before LUT_3D_SIZE", filename, lineNumber);
+                failed = clTrue;
+            } else if (pointsRead >= pointCount) {
+                clContextLogError(C, "%s:%d: too many LUT entries (expected %d)", filename, lineNumber, pointCount);
+                failed = clTrue;
+            } else {
+                float * point = &lut->lattice[pointsRead * LUT_STRIDE];
+                if (sscanf(s, "%f %f %f", &point[0], &point[1], &point[2]) != 3) {
+                    clContextLogError(C, "%s:%d: invalid LUT entry", filename, lineNumber);
+                    failed = clTrue;
+                }
+                ++pointsRead;
+            }
+        }
+    }
+    fclose(f);
+
+    if (!failed) {
+        if (!lut) {
+            clContextLogError(C, "%s: missing LUT_3D_SIZE", filename);
+            failed = clTrue;
+        } else if (pointsRead != pointCount) {
+            clContextLogError(C, "%s: expected %d LUT entries, found %d", filename, pointCount, pointsRead);
+            failed = clTrue;
+        }
+    }
+    for (int i = 0; !failed && (i < 3); ++i) {
+        if (!(domainMax[i] > domainMin[i])) {
+            clContextLogError(C, "%s: DOMAIN_MAX must be greater than DOMAIN_MIN", filename);
+            failed = clTrue;
+        }
+    }
+    if (failed) {
+        if (lut) {
+            clLUT3DDestroy(C, lut);
+        }
+        return NULL;
+    }
+
+    memcpy(lut->domainMin, domainMin, sizeof(domainMin));
+    memcpy(lut->domainMax, domainMax, sizeof(domainMax));
+    clContextLog(C, "hald", 0, "Loaded %dx%dx%d 3D LUT: %s", lut->size, lut->size, lut->size, filename);
+    return lut;
+}
+
+// ---------------------------------------------------------------------------
+// Lookup
+//
+// Both interpolations start by finding the lattice cell holding the color and its fractional position in it.
+// Trilinear blends all 8 corners of the cell. Tetrahedral splits the cell into 6 tetrahedra sharing the
+// black-white diagonal, picks the one holding the color by sorting the fractions, and blends its 4 corners
+// (black corner, one edge, one face diagonal, white corner) with weights that are differences of the sorted fractions.
+
+typedef struct clLUTLookup
+{
+    const float * lattice;
+    float scale[3];   // Lattice units per input unit
+    float offset[3];  // -domainMin * scale
+    float maxCoord;   // size - 1
+    int maxCell;      // size - 2, the last cell with a corner past it
+    int strides[3];   // Floats between neighbors along R, G and B
+} clLUTLookup;
+
+static void lutLookupInit(const clLUT3D * lut, clLUTLookup * lookup)
+{
+    lookup->lattice = lut->lattice;
+    lookup->maxCoord = (float)(lut->size - 1);
+    lookup->maxCell = lut->size - 2;
+    for (int i = 0; i < 3; ++i) {
+        lookup->scale[i] = lookup->maxCoord / (lut->domainMax[i] - lut->domainMin[i]);
+        lookup->offset[i] = -lut->domainMin[i] * lookup->scale[i];
+    }
+    lookup->strides[0] = LUT_STRIDE;
+    lookup->strides[1] = LUT_STRIDE * lut->size;
+    lookup->strides[2] = LUT_STRIDE * lut->size * lut->size;
+}
+
+// Returns the offset of the cell's black corner in the lattice, and writes the color's position inside of it
+static inline int lutLocate(const clLUTLookup * lookup, const float * src, float frac[3])
+{
+    int cornerOffset = 0;
+    for (int i = 0; i < 3; ++i) {
+        float coord = (src[i] * lookup->scale[i]) + lookup->offset[i];
+        if (!(coord > 0.0f)) { // also catches NaN
+            coord = 0.0f;
+        } else if (coord > lookup->maxCoord) {
+            coord = lookup->maxCoord;
+        }
+        int cell = (int)coord;
+        if (cell > lookup->maxCell) {
+            cell = lookup->maxCell;
+        }
+        frac[i] = coord - (float)cell;
+        cornerOffset += cell * lookup->strides[i];
+    }
+    return cornerOffset;
+}
+
+// Picks the tetrahedron holding frac: the offsets (from the black corner) of its edge and face diagonal
+// corners, and the weights of all 4 corners (black, edge, face diagonal, white)
+static inline void lutTetrahedron(const clLUTLookup * lookup,
+                                  const float frac[3],
+                                  int * edgeOffset,
+                                  int * faceOffset,
+                                  float weights[4])
+{
+    const int r = lookup->strides[0];
+    const int g = lookup->strides[1];
+    const int b = lookup->strides[2];
+    float fr = frac[0];
+    float fg = frac[1];
+    float fb = frac[2];
+    float w1, w2, w3; // Sorted fractions, largest first
+
+    if (fr >= fg) {
+        if (fg >= fb) {
+            *edgeOffset = r;
+            *faceOffset = r + g;
+            w1 = fr;
+            w2 = fg;
+            w3 = fb;
+        } else if (fr >= fb) {
+            *edgeOffset = r;
+            *faceOffset = r + b;
+            w1 = fr;
+            w2 = fb;
+            w3 = fg;
+        } else {
+            *edgeOffset = b;
+            *faceOffset = r + b;
+            w1 = fb;
+            w2 = fr;
+            w3 = fg;
+        }
+    } else {
+        if (fb >= fg) {
+            *edgeOffset = b;
+            *faceOffset = g + b;
+            w1 = fb;
+            w2 = fg;
+            w3 = fr;
+        } else if (fb >= fr) {
+            *edgeOffset = g;
+            *faceOffset = g + b;
+            w1 = fg;
+            w2 = fb;
+            w3 = fr;
+        } else {
+            *edgeOffset = g;
+            *faceOffset = r + g;
+            w1 = fg;
+            w2 = fr;
+            w3 = fb;
+        }
+    }
+    weights[0] = 1.0f - w1;
+    weights[1] = w1 - w2;
+    weights[2] = w2 - w3;
+    weights[3] = w3;
+}
+
+static void lutApplyTetrahedral(const clLUTLookup * lookup, const float * srcPixels, float * dstPixels, int pixelCount)
+{
+    const int whiteOffset = lookup->strides[0] + lookup->strides[1] + lookup->strides[2];
+    for (int i = 0; i < pixelCount; ++i) {
+        const float * src = &srcPixels[i * CL_CHANNELS_PER_PIXEL];
+        float * dst = &dstPixels[i * CL_CHANNELS_PER_PIXEL];
+        float frac[3];
+        float weights[4];
+        int edgeOffset, faceOffset;
+
+        const float * c0 = &lookup->lattice[lutLocate(lookup, src, frac)];
+        lutTetrahedron(lookup, frac, &edgeOffset, &faceOffset, weights);
+        const float * c1 = c0 + edgeOffset;
+        const float * c2 = c0 + faceOffset;
+        const float * c3 = c0 + whiteOffset;
+        float alpha = src[3];
+        for (int j = 0; j < 3; ++j) {
+            dst[j] = (c0[j] * weights[0]) + (c1[j] * weights[1]) + (c2[j] * weights[2]) + (c3[j] * weights[3]);
+        }
+        dst[3] = alpha;
+    }
+}
+
+static void lutApplyTrilinear(const clLUTLookup * lookup, const float * srcPixels, float * dstPixels, int pixelCount)
+{
+    const int r = lookup->strides[0];
+    const int g = lookup->strides[1];
+    const int b = lookup->strides[2];
+    for (int i = 0; i < pixelCount; ++i) {
+        const float * src = &srcPixels[i * CL_CHANNELS_PER_PIXEL];
+        float * dst = &dstPixels[i * CL_CHANNELS_PER_PIXEL];
+        float frac[3];
+
+        const float * c = &lookup->lattice[lutLocate(lookup, src, frac)];
+        float alpha = src[3];
+        for (int j = 0; j < 3; ++j) {
+            float c00 = c[j] + ((c[r + j] - c[j]) * frac[0]);
+            float c10 = c[g + j] + ((c[r + g + j] - c[g + j]) * frac[0]);
+            float c01 = c[b + j] + ((c[r + b + j] - c[b + j]) * frac[0]);
+            float c11 = c[g + b + j] + ((c[r + g + b + j] - c[g + b + j]) * frac[0]);
+            float c0 = c00 + ((c10 - c00) * frac[1]);
+            float c1 = c01 + ((c11 - c01) * frac[1]);
+            dst[j] = c0 + ((c1 - c0) * frac[2]);
+        }
+        dst[3] = alpha;
+    }
+}
+
+#if defined(COLORIST_LUT_SSE2)
+
+// The same math, with each lattice point's RGB (+ padding) in one SSE register, so a corner is one load
+// and a blend is one multiply-add for all three channels.
+
+static inline __m128 lutLerpSSE2(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+static void lutApplyTetrahedralSSE2(const clLUTLookup * lookup, const float * srcPixels, float * dstPixels, int pixelCount)
+{
+    const int whiteOffset = lookup->strides[0] + lookup->strides[1] + lookup->strides[2];
+    for (int i = 0; i < pixelCount; ++i) {
+        const float * src = &srcPixels[i * CL_CHANNELS_PER_PIXEL];
+        float * dst = &dstPixels[i * CL_CHANNELS_PER_PIXEL];
+        float frac[3];
+        float weights[4];
+        int edgeOffset, faceOffset;
+
+        const float * c0 = &lookup->lattice[lutLocate(lookup, src, frac)];
+        lutTetrahedron(lookup, frac, &edgeOffset, &faceOffset, weights);
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(c0), _mm_set1_ps(weights[0]));
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c0 + edgeOffset), _mm_set1_ps(weights[1])));
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c0 + faceOffset), _mm_set1_ps(weights[2])));
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c0 + whiteOffset), _mm_set1_ps(weights[3])));
+        float alpha = src[3];
+        _mm_storeu_ps(dst, v);
+        dst[3] = alpha;
+    }
+}
+
+static void lutApplyTrilinearSSE2(const clLUTLookup * lookup, const float * srcPixels, float * dstPixels, int pixelCount)
+{
+    const int r = lookup->strides[0];
+    const int g = lookup->strides[1];
+    const int b = lookup->strides[2];
+    for (int i = 0; i < pixelCount; ++i) {
+        const float * src = &srcPixels[i * CL_CHANNELS_PER_PIXEL];
+        float * dst = &dstPixels[i * CL_CHANNELS_PER_PIXEL];
+        float frac[3];
+
+        const float * c = &lookup->lattice[lutLocate(lookup, src, frac)];
+        __m128 fr = _mm_set1_ps(frac[0]);
+        __m128 fg = _mm_set1_ps(frac[1]);
+        __m128 c00 = lutLerpSSE2(_mm_loadu_ps(c), _mm_loadu_ps(c + r), fr);
+        __m128 c10 = lutLerpSSE2(_mm_loadu_ps(c + g), _mm_loadu_ps(c + r + g), fr);
+        __m128 c01 = lutLerpSSE2(_mm_loadu_ps(c + b), _mm_loadu_ps(c + r + b), fr);
+        __m128 c11 = lutLerpSSE2(_mm_loadu_ps(c + g + b), _mm_loadu_ps(c + r + g + b), fr);
+        __m128 c0 = lutLerpSSE2(c00, c10, fg);
+        __m128 c1 = lutLerpSSE2(c01, c11, fg);
+        float alpha = src[3];
+        _mm_storeu_ps(dst, lutLerpSSE2(c0, c1, _mm_set1_ps(frac[2])));
+        dst[3] = alpha;
+    }
+}
+
+#endif /* if defined(COLORIST_LUT_SSE2) */
+
+void clLUT3DApply(struct clContext * C, const clLUT3D * lut, const float * srcPixels, float * dstPixels, int pixelCount)
+{
+    clLUTLookup lookup;
+    lutLookupInit(lut, &lookup);
+
+#if defined(COLORIST_LUT_SSE2)
+    // SSE2 is always present on x86-64, so only --simd off needs checking
+    if (C->simdAllowed) {
+        if (lut->interpolation == CL_LUT_INTERPOLATION_TRILINEAR) {
+            lutApplyTrilinearSSE2(&lookup, srcPixels, dstPixels, pixelCount);
+        } else {
+            lutApplyTetrahedralSSE2(&lookup, srcPixels, dstPixels, pixelCount);
+        }
+        return;
+    }
+#else
+    COLORIST_UNUSED(C);
+#endif
+
+    if (lut->interpolation == CL_LUT_INTERPOLATION_TRILINEAR) {
+        lutApplyTrilinear(&lookup, srcPixels, dstPixels, pixelCount);
+    } else {
+        lutApplyTetrahedral(&lookup, srcPixels, dstPixels, pixelCount);
+    }
+}
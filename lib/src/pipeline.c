@@ -0,0 +1,396 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/pipeline.h"
+
+#include "colorist/context.h"
+#include "colorist/image.h"
+#include "colorist/lut.h"
+#include "colorist/pixelmath.h"
+#include "colorist/profile.h"
+#include "colorist/task.h"
+#include "colorist/trace.h"
+#include "colorist/transform.h"
+
+#include <string.h>
+
+// Below this many pixels, handing work to other threads costs more than it saves
+#define MIN_PIXELS_PER_TASK 1024
+
+clPipeline * clPipelineCreate(struct clContext * C)
+{
+    COLORIST_UNUSED(C);
+
+    clPipeline * pipeline = clAllocateStruct(clPipeline);
+    memset(pipeline, 0, sizeof(clPipeline));
+    return pipeline;
+}
+
+void clPipelineDestroy(struct clContext * C, clPipeline * pipeline)
+{
+    for (int i = 0; i < pipeline->stageCount; ++i) {
+        clPipelineStage * stage = &pipeline->stages[i];
+        if (stage->destroyFunc) {
+            stage->destroyFunc(C, stage->stageData);
+        }
+    }
+    clFree(pipeline);
+}
+
+void clPipelineAddStage(struct clContext * C,
+                        clPipeline * pipeline,
+                        const char * name,
+                        clPipelineStageFunc func,
+                        clPipelineStageDestroyFunc destroyFunc,
+                        void * stageData)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_ASSERT(pipeline->stageCount < CL_PIPELINE_MAX_STAGES);
+
+    clPipelineStage * stage = &pipeline->stages[pipeline->stageCount];
+    stage->name = name;
+    stage->func = func;
+    stage->destroyFunc = destroyFunc;
+    stage->stageData = stageData;
+    stage->colorOnly = clFalse;
+    ++pipeline->stageCount;
+}
+
+clBool clPipelineIsColorOnly(struct clContext * C, clPipeline * pipeline)
+{
+    COLORIST_UNUSED(C);
+
+    if (!pipeline) {
+        return clTrue;
+    }
+    if (pipeline->rotate != 0) {
+        return clFalse;
+    }
+    for (int i = 0; i < pipeline->stageCount; ++i) {
+        if (!pipeline->stages[i].colorOnly) {
+            return clFalse;
+        }
+    }
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Blend stage
+
+typedef struct clPipelineBlend
+{
+    struct clProfile * blendProfile;
+    clTransform * toBlend;
+    clTransform * fromBlend;
+    float * cmpPixels; // compositeImage, transformed into blendProfile
+    int cmpWidth;
+    int cmpHeight;
+    int offsetX;
+    int offsetY;
+    clBool premultiplied;
+} clPipelineBlend;
+
+// Composites onto the converted tile before it is packed, so the blend sees the same unquantized floats the
+// standalone clImageConvert() -> clImageBlend() steps always did; low-depth dsts are rounded once, at write time.
+static void blendStageFunc(struct clContext * C, void * stageData, float * pixels, int x, int y, int pixelCount)
+{
+    clPipelineBlend * blend = (clPipelineBlend *)stageData;
+    float blendPixels[CL_PIPELINE_TILE_PIXELS * CL_CHANNELS_PER_PIXEL];
+
+    clTransformRunSerial(C, blend->toBlend, pixels, blendPixels, pixelCount);
+
+    int cmpY = y - blend->offsetY;
+    if ((cmpY >= 0) && (cmpY < blend->cmpHeight)) {
+        int firstPixel = CL_MAX(0, blend->offsetX - x);
+        int lastPixel = CL_MIN(pixelCount, blend->offsetX + blend->cmpWidth - x);
+        for (int i = firstPixel; i < lastPixel; ++i) {
+            float * blendPixel = &blendPixels[i * CL_CHANNELS_PER_PIXEL];
+            float * cmpPixel = &blend->cmpPixels[CL_CHANNELS_PER_PIXEL * ((x + i - blend->offsetX) + (cmpY * blend->cmpWidth))];
+            clPixelMathBlendSourceOver(blendPixel, cmpPixel, blend->premultiplied, blendPixel);
+        }
+    }
+
+    clTransformRunSerial(C, blend->fromBlend, blendPixels, pixels, pixelCount);
+}
+
+static void blendStageDestroy(struct clContext * C, void * stageData)
+{
+    clPipelineBlend * blend = (clPipelineBlend *)stageData;
+    clTransformDestroy(C, blend->toBlend);
+    clTransformDestroy(C, blend->fromBlend);
+    clProfileDestroy(C, blend->blendProfile);
+    clPixelPoolFree(C, blend->cmpPixels);
+    clFree(blend);
+}
+
+clBool clPipelineAddBlend(struct clContext * C,
+                          clPipeline * pipeline,
+                          struct clProfile * profile,
+                          struct clImage * compositeImage,
+                          clBlendParams * blendParams)
+{
+    struct clProfile * blendProfile = clImageBlendProfileCreate(C, profile, blendParams->gamma);
+    if (!blendProfile) {
+        return clFalse;
+    }
+
+    clPipelineBlend * blend = clAllocateStruct(clPipelineBlend);
+    blend->blendProfile = blendProfile;
+    blend->cmpWidth = compositeImage->width;
+    blend->cmpHeight = compositeImage->height;
+    blend->offsetX = blendParams->offsetX;
+    blend->offsetY = blendParams->offsetY;
+    blend->premultiplied = blendParams->premultiplied;
+
+    // Same transforms as clImageBlend(): [pixels -> blend], [cmp -> blend], [blend -> pixels]
+    blend->toBlend = clTransformCreate(C, profile, CL_XF_RGBA, blendProfile, CL_XF_RGBA, blendParams->srcTonemap);
+    memcpy(&blend->toBlend->tonemapParams, &blendParams->srcParams, sizeof(clTonemapParams));
+    clTransformPrepare(C, blend->toBlend);
+    blend->fromBlend =
+        clTransformCreate(C, blendProfile, CL_XF_RGBA, profile, CL_XF_RGBA, CL_TONEMAP_OFF); // maxLuminance should match, no need to tonemap
+    clTransformPrepare(C, blend->fromBlend);
+
+    clTransform * cmpBlendTransform =
+        clTransformCreate(C, compositeImage->profile, CL_XF_RGBA, blendProfile, CL_XF_RGBA, blendParams->cmpTonemap);
+    memcpy(&cmpBlendTransform->tonemapParams, &blendParams->cmpParams, sizeof(clTonemapParams));
+    clImagePrepareReadPixels(C, compositeImage, CL_PIXELFORMAT_F32);
+    blend->cmpPixels = clPixelPoolAllocate(C, CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32) * blend->cmpWidth * blend->cmpHeight, clFalse);
+    clTransformRun(C, cmpBlendTransform, compositeImage->pixelsF32, blend->cmpPixels, blend->cmpWidth * blend->cmpHeight);
+    clTransformDestroy(C, cmpBlendTransform);
+
+    clPipelineAddStage(C, pipeline, "blend", blendStageFunc, blendStageDestroy, blend);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// 3D LUT stage
+
+static void lut3DStageFunc(struct clContext * C, void * stageData, float * pixels, int x, int y, int pixelCount)
+{
+    COLORIST_UNUSED(x);
+    COLORIST_UNUSED(y);
+
+    clLUT3DApply(C, (const clLUT3D *)stageData, pixels, pixels, pixelCount);
+}
+
+void clPipelineAddLUT3D(struct clContext * C, clPipeline * pipeline, struct clLUT3D * lut)
+{
+    clPipelineAddStage(C, pipeline, "hald", lut3DStageFunc, NULL, lut);
+    pipeline->stages[pipeline->stageCount - 1].colorOnly = clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Run
+
+typedef struct clPipelineTask
+{
+    clContext * C;
+    clPipeline * pipeline;
+    clTransform * transform;
+
+    // Read addressing
+    clPixelFormat srcFormat;
+    const uint8_t * srcPixels;
+    int srcStride; // in pixels
+    int srcX;
+    int srcY;
+    float srcMaxChannel;
+    int width; // of the rect, and the unrotated dst
+    int height;
+
+    // Write addressing
+    clPixelFormat dstFormat;
+    uint8_t * dstPixels;
+    uint32_t dstMaxChannel;
+    int rotate;
+} clPipelineTask;
+
+static void pipelineReadTile(clPipelineTask * info, int x, int y, int pixelCount, float * tile)
+{
+    int channelCount = pixelCount * CL_CHANNELS_PER_PIXEL;
+    int srcOffset = ((info->srcX + x) + ((info->srcY + y) * info->srcStride)) * CL_CHANNELS_PER_PIXEL;
+    switch (info->srcFormat) {
+        case CL_PIXELFORMAT_F32:
+            memcpy(tile, &((const float *)info->srcPixels)[srcOffset], sizeof(float) * channelCount);
+            break;
+        case CL_PIXELFORMAT_U16: {
+            const uint16_t * srcChannels = &((const uint16_t *)info->srcPixels)[srcOffset];
+            for (int i = 0; i < channelCount; ++i) {
+                tile[i] = srcChannels[i] / info->srcMaxChannel;
+            }
+            break;
+        }
+        case CL_PIXELFORMAT_U8: {
+            const uint8_t * srcChannels = &info->srcPixels[srcOffset];
+            for (int i = 0; i < channelCount; ++i) {
+                tile[i] = srcChannels[i] / info->srcMaxChannel;
+            }
+            break;
+        }
+        case CL_PIXELFORMAT_COUNT:
+            COLORIST_ASSERT(0);
+            break;
+    }
+}
+
+static void pipelineWriteTile(clPipelineTask * info, int x, int y, int pixelCount, const float * tile)
+{
+    // The dst pixel index of unrotated (x + i, y) is firstIndex + (i * step)
+    int w = info->width;
+    int h = info->height;
+    int firstIndex = 0;
+    int step = 1;
+    switch (info->rotate) {
+        case 0:
+            firstIndex = x + (y * w);
+            step = 1;
+            break;
+        case 1: // 90 degrees clockwise, dst is h x w
+            firstIndex = (h - 1 - y) + (x * h);
+            step = h;
+            break;
+        case 2: // 180 degrees clockwise
+            firstIndex = (w - 1 - x) + ((h - 1 - y) * w);
+            step = -1;
+            break;
+        case 3: // 270 degrees clockwise, dst is h x w
+            firstIndex = y + ((w - 1 - x) * h);
+            step = -h;
+            break;
+    }
+
+    for (int i = 0; i < pixelCount; ++i) {
+        const float * srcPixel = &tile[i * CL_CHANNELS_PER_PIXEL];
+        int dstOffset = (firstIndex + (i * step)) * CL_CHANNELS_PER_PIXEL;
+        if (info->dstFormat == CL_PIXELFORMAT_F32) {
+            memcpy(&((float *)info->dstPixels)[dstOffset], srcPixel, sizeof(float) * CL_CHANNELS_PER_PIXEL);
+            continue;
+        }
+
+        // Quantize, scaling down overranged colors (same as clImagePrepareReadPixels())
+        float largestChannel = 1.0f;
+        uint32_t dstPixel[4];
+        largestChannel = CL_MAX(largestChannel, srcPixel[0]);
+        largestChannel = CL_MAX(largestChannel, srcPixel[1]);
+        largestChannel = CL_MAX(largestChannel, srcPixel[2]);
+        dstPixel[0] = clPixelMathRoundUNorm(srcPixel[0] / largestChannel, info->dstMaxChannel);
+        dstPixel[1] = clPixelMathRoundUNorm(srcPixel[1] / largestChannel, info->dstMaxChannel);
+        dstPixel[2] = clPixelMathRoundUNorm(srcPixel[2] / largestChannel, info->dstMaxChannel);
+        dstPixel[3] = clPixelMathRoundUNorm(srcPixel[3], info->dstMaxChannel);
+        if (info->dstFormat == CL_PIXELFORMAT_U16) {
+            uint16_t * dstChannels = &((uint16_t *)info->dstPixels)[dstOffset];
+            dstChannels[0] = (uint16_t)dstPixel[0];
+            dstChannels[1] = (uint16_t)dstPixel[1];
+            dstChannels[2] = (uint16_t)dstPixel[2];
+            dstChannels[3] = (uint16_t)dstPixel[3];
+        } else {
+            uint8_t * dstChannels = &info->dstPixels[dstOffset];
+            dstChannels[0] = (uint8_t)dstPixel[0];
+            dstChannels[1] = (uint8_t)dstPixel[1];
+            dstChannels[2] = (uint8_t)dstPixel[2];
+            dstChannels[3] = (uint8_t)dstPixel[3];
+        }
+    }
+}
+
+static void pipelineTaskFunc(void * userData, int start, int count)
+{
+    clPipelineTask * info = (clPipelineTask *)userData;
+    clPipeline * pipeline = info->pipeline;
+    float srcTile[CL_PIPELINE_TILE_PIXELS * CL_CHANNELS_PER_PIXEL];
+    float dstTile[CL_PIPELINE_TILE_PIXELS * CL_CHANNELS_PER_PIXEL];
+    clTraceSpan span;
+    clTraceBegin(info->C, &span, "pipeline");
+
+    for (int y = start; y < (start + count); ++y) {
+        for (int x = 0; x < info->width; x += CL_PIPELINE_TILE_PIXELS) {
+            int tileCount = CL_MIN(CL_PIPELINE_TILE_PIXELS, info->width - x);
+            pipelineReadTile(info, x, y, tileCount, srcTile);
+            clTransformRunSerial(info->C, info->transform, srcTile, dstTile, tileCount);
+            if (pipeline) {
+                for (int i = 0; i < pipeline->stageCount; ++i) {
+                    clPipelineStage * stage = &pipeline->stages[i];
+                    stage->func(info->C, stage->stageData, dstTile, x, y, tileCount);
+                }
+            }
+            pipelineWriteTile(info, x, y, tileCount, dstTile);
+        }
+    }
+    clTraceEnd(info->C, &span);
+    clTraceCount(info->C, CL_TRACE_PIXELS_TRANSFORMED, (uint64_t)count * info->width);
+}
+
+void clPipelineRun(struct clContext * C,
+                   clPipeline * pipeline,
+                   struct clTransform * transform,
+                   struct clImage * srcImage,
+                   const int rect[4],
+                   struct clImage * dstImage)
+{
+    clPipelineTask info;
+    if ((rect[2] <= 0) || (rect[3] <= 0)) {
+        return;
+    }
+
+    info.C = C;
+    info.pipeline = pipeline;
+    info.transform = transform;
+    info.rotate = pipeline ? pipeline->rotate : 0;
+    info.srcX = rect[0];
+    info.srcY = rect[1];
+    info.width = rect[2];
+    info.height = rect[3];
+    info.srcStride = srcImage->width;
+
+    COLORIST_ASSERT((transform->srcFormat == CL_XF_RGBA) && (transform->dstFormat == CL_XF_RGBA));
+    COLORIST_ASSERT((rect[0] >= 0) && (rect[1] >= 0));
+    COLORIST_ASSERT(((rect[0] + rect[2]) <= srcImage->width) && ((rect[1] + rect[3]) <= srcImage->height));
+    COLORIST_ASSERT(dstImage->width == ((info.rotate & 1) ? info.height : info.width));
+
+    clImageExpandPalette(C, srcImage);
+    if (srcImage->pixelsF32) {
+        info.srcFormat = CL_PIXELFORMAT_F32;
+        info.srcPixels = (const uint8_t *)srcImage->pixelsF32;
+        info.srcMaxChannel = 1.0f;
+    } else if (srcImage->pixelsU16) {
+        info.srcFormat = CL_PIXELFORMAT_U16;
+        info.srcPixels = (const uint8_t *)srcImage->pixelsU16;
+        info.srcMaxChannel = (float)((1 << CL_CLAMP(srcImage->depth, 8, 16)) - 1);
+    } else {
+        clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_U8);
+        info.srcFormat = CL_PIXELFORMAT_U8;
+        info.srcPixels = srcImage->pixelsU8;
+        info.srcMaxChannel = 255.0f;
+    }
+
+    if (dstImage->depth == 32) {
+        info.dstFormat = CL_PIXELFORMAT_F32;
+        info.dstMaxChannel = 0;
+    } else if (dstImage->depth > 8) {
+        info.dstFormat = CL_PIXELFORMAT_U16;
+        info.dstMaxChannel = (uint32_t)((1 << CL_CLAMP(dstImage->depth, 8, 16)) - 1);
+    } else {
+        info.dstFormat = CL_PIXELFORMAT_U8;
+        info.dstMaxChannel = 255;
+    }
+    clImagePrepareWritePixels(C, dstImage, info.dstFormat);
+    switch (info.dstFormat) {
+        case CL_PIXELFORMAT_U8:
+            info.dstPixels = dstImage->pixelsU8;
+            break;
+        case CL_PIXELFORMAT_U16:
+            info.dstPixels = (uint8_t *)dstImage->pixelsU16;
+            break;
+        case CL_PIXELFORMAT_F32:
+        case CL_PIXELFORMAT_COUNT:
+            info.dstPixels = (uint8_t *)dstImage->pixelsF32;
+            break;
+    }
+
+    clTransformPrepare(C, transform);
+    clTaskParallelFor(C, info.height, CL_MAX(1, MIN_PIXELS_PER_TASK / info.width), pipelineTaskFunc, &info);
+}
@@ -0,0 +1,371 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/pixelmath.h"
+
+#include "colorist/context.h"
+#include "colorist/image.h"
+#include "colorist/task.h"
+#include "colorist/trace.h"
+#include "colorist/transform.h"
+
+#include <string.h>
+
+typedef void (*clPixelConvertFunc)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16);
+
+// ----------------------------------------------------------------------------
+// Scalar conversions
+//
+// These define the results; the SIMD kernels below must match them bit for bit.
+
+// Overranged colors are scaled down by their largest channel (keeping their hue) instead of clipped
+static inline void quantizePixel(const float * srcPixel, uint32_t maxChannel, uint32_t dstPixel[4])
+{
+    float largestChannel = 1.0f;
+    largestChannel = CL_MAX(largestChannel, srcPixel[0]);
+    largestChannel = CL_MAX(largestChannel, srcPixel[1]);
+    largestChannel = CL_MAX(largestChannel, srcPixel[2]);
+    dstPixel[0] = clPixelMathRoundUNorm(srcPixel[0] / largestChannel, maxChannel);
+    dstPixel[1] = clPixelMathRoundUNorm(srcPixel[1] / largestChannel, maxChannel);
+    dstPixel[2] = clPixelMathRoundUNorm(srcPixel[2] / largestChannel, maxChannel);
+    dstPixel[3] = clPixelMathRoundUNorm(srcPixel[3], maxChannel);
+}
+
+static void convertF32ToU8(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    COLORIST_UNUSED(maxChannelU16);
+
+    const float * src = (const float *)srcPixels;
+    uint8_t * dst = (uint8_t *)dstPixels;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; i += CL_CHANNELS_PER_PIXEL) {
+        uint32_t quantized[4];
+        quantizePixel(&src[i], 255, quantized);
+        dst[i + 0] = (uint8_t)quantized[0];
+        dst[i + 1] = (uint8_t)quantized[1];
+        dst[i + 2] = (uint8_t)quantized[2];
+        dst[i + 3] = (uint8_t)quantized[3];
+    }
+}
+
+static void convertF32ToU16(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const float * src = (const float *)srcPixels;
+    uint16_t * dst = (uint16_t *)dstPixels;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; i += CL_CHANNELS_PER_PIXEL) {
+        uint32_t quantized[4];
+        quantizePixel(&src[i], maxChannelU16, quantized);
+        dst[i + 0] = (uint16_t)quantized[0];
+        dst[i + 1] = (uint16_t)quantized[1];
+        dst[i + 2] = (uint16_t)quantized[2];
+        dst[i + 3] = (uint16_t)quantized[3];
+    }
+}
+
+static void convertU16ToU8(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint16_t * src = (const uint16_t *)srcPixels;
+    uint8_t * dst = (uint8_t *)dstPixels;
+    float maxChannelU16f = (float)maxChannelU16;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; ++i) {
+        dst[i] = (uint8_t)clPixelMathRoundUNorm(src[i] / maxChannelU16f, 255);
+    }
+}
+
+static void convertU8ToU16(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint8_t * src = (const uint8_t *)srcPixels;
+    uint16_t * dst = (uint16_t *)dstPixels;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; ++i) {
+        dst[i] = (uint16_t)clPixelMathRoundUNorm(src[i] / 255.0f, maxChannelU16);
+    }
+}
+
+static void convertU8ToF32(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    COLORIST_UNUSED(maxChannelU16);
+
+    const uint8_t * src = (const uint8_t *)srcPixels;
+    float * dst = (float *)dstPixels;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; ++i) {
+        dst[i] = src[i] / 255.0f;
+    }
+}
+
+static void convertU16ToF32(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint16_t * src = (const uint16_t *)srcPixels;
+    float * dst = (float *)dstPixels;
+    float maxChannelU16f = (float)maxChannelU16;
+    for (int i = 0; i < pixelCount * CL_CHANNELS_PER_PIXEL; ++i) {
+        dst[i] = src[i] / maxChannelU16f;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// SIMD conversions
+//
+// Unlike the CCMM kernels in transform_simd.c these must be exact, so they stick to IEEE ops that round the same
+// as the scalar code (the divisions stay divisions), and the AVX2 kernels are built without FMA so the compiler
+// can't fuse a multiply and add that the scalar code rounds separately.
+
+#define CL_SIMD_CONCAT2(A, B) A##B
+#define CL_SIMD_CONCAT(A, B) CL_SIMD_CONCAT2(A, B)
+#define CL_SIMD_NAME(N) CL_SIMD_CONCAT(N, CL_SIMD_SUFFIX)
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COLORIST_SIMD_X64
+#endif
+
+#if defined(COLORIST_SIMD_X64)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+// ----------------------------------------------------------------------------
+// SSE2 (4 lanes, 1 pixel)
+
+static inline __m128i loadU8SSE2(const uint8_t * p)
+{
+    int bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+}
+
+static inline __m128i loadU16SSE2(const uint16_t * p)
+{
+    return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128());
+}
+
+static inline void storeU8SSE2(uint8_t * p, __m128i v)
+{
+    __m128i packed = _mm_packs_epi32(v, v);
+    int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+    memcpy(p, &bytes, sizeof(bytes));
+}
+
+static inline void storeU16SSE2(uint16_t * p, __m128i v)
+{
+    // SSE2 can only pack with signed saturation, so shift [0, 65535] into int16 range and back
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(v, _mm_set1_epi32(32768)), _mm_setzero_si128());
+    _mm_storel_epi64((__m128i *)p, _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+}
+
+static inline __m128 pixelMaxSSE2(__m128 v)
+{
+    __m128 m = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+#define CL_SIMD_SUFFIX SSE2
+#define CL_SIMD_TARGET
+#define CL_SIMD_WIDTH 4
+#define VF __m128
+#define VI __m128i
+#define VF_SET1(X) _mm_set1_ps(X)
+#define VF_LOADU(P) _mm_loadu_ps(P)
+#define VF_STOREU(P, V) _mm_storeu_ps(P, V)
+#define VF_ADD(A, B) _mm_add_ps(A, B)
+#define VF_MUL(A, B) _mm_mul_ps(A, B)
+#define VF_DIV(A, B) _mm_div_ps(A, B)
+#define VF_AND(A, B) _mm_and_ps(A, B)
+#define VF_GE(A, B) _mm_cmpge_ps(A, B)
+#define VF_LT(A, B) _mm_cmplt_ps(A, B)
+#define VF_SELECT(M, A, B) _mm_or_ps(_mm_and_ps(M, A), _mm_andnot_ps(M, B))
+#define VF_MOVEMASK(A) _mm_movemask_ps(A)
+#define VF_MOVEMASK_ALL 0xf
+#define VF_ALPHA_MASK() _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0))
+#define VF_PIXEL_MAX(A) pixelMaxSSE2(A)
+#define VF_TRUNC_TO_VI(A) _mm_cvttps_epi32(A)
+#define VI_TO_VF(A) _mm_cvtepi32_ps(A)
+#define VI_SET1(X) _mm_set1_epi32(X)
+#define VI_GT(A, B) _mm_cmpgt_epi32(A, B)
+#define VI_SELECT(M, A, B) _mm_or_si128(_mm_and_si128(M, A), _mm_andnot_si128(M, B))
+#define VI_LOAD_U8(P) loadU8SSE2(P)
+#define VI_LOAD_U16(P) loadU16SSE2(P)
+#define VI_STORE_U8(P, V) storeU8SSE2(P, V)
+#define VI_STORE_U16(P, V) storeU16SSE2(P, V)
+#include "pixelmath_convert_kernel.h"
+#undef CL_SIMD_SUFFIX
+#undef CL_SIMD_TARGET
+#undef CL_SIMD_WIDTH
+#undef VF
+#undef VI
+#undef VF_SET1
+#undef VF_LOADU
+#undef VF_STOREU
+#undef VF_ADD
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_AND
+#undef VF_GE
+#undef VF_LT
+#undef VF_SELECT
+#undef VF_MOVEMASK
+#undef VF_MOVEMASK_ALL
+#undef VF_ALPHA_MASK
+#undef VF_PIXEL_MAX
+#undef VF_TRUNC_TO_VI
+#undef VI_TO_VF
+#undef VI_SET1
+#undef VI_GT
+#undef VI_SELECT
+#undef VI_LOAD_U8
+#undef VI_LOAD_U16
+#undef VI_STORE_U8
+#undef VI_STORE_U16
+
+// ----------------------------------------------------------------------------
+// AVX2 (8 lanes, 2 pixels)
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CL_SIMD_TARGET
+#else
+#define CL_SIMD_TARGET __attribute__((target("avx2")))
+#endif
+
+static CL_SIMD_TARGET inline __m256i loadU8AVX2(const uint8_t * p)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p));
+}
+
+static CL_SIMD_TARGET inline __m256i loadU16AVX2(const uint16_t * p)
+{
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+
+static CL_SIMD_TARGET inline void storeU8AVX2(uint8_t * p, __m256i v)
+{
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(packed, packed));
+}
+
+static CL_SIMD_TARGET inline void storeU16AVX2(uint16_t * p, __m256i v)
+{
+    _mm_storeu_si128((__m128i *)p, _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+// Shuffles stay inside of 128-bit lanes, which is exactly one pixel each
+static CL_SIMD_TARGET inline __m256 pixelMaxAVX2(__m256 v)
+{
+    __m256 m = _mm256_max_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm256_max_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+#define CL_SIMD_SUFFIX AVX2
+#define CL_SIMD_WIDTH 8
+#define VF __m256
+#define VI __m256i
+#define VF_SET1(X) _mm256_set1_ps(X)
+#define VF_LOADU(P) _mm256_loadu_ps(P)
+#define VF_STOREU(P, V) _mm256_storeu_ps(P, V)
+#define VF_ADD(A, B) _mm256_add_ps(A, B)
+#define VF_MUL(A, B) _mm256_mul_ps(A, B)
+#define VF_DIV(A, B) _mm256_div_ps(A, B)
+#define VF_AND(A, B) _mm256_and_ps(A, B)
+#define VF_GE(A, B) _mm256_cmp_ps(A, B, _CMP_GE_OQ)
+#define VF_LT(A, B) _mm256_cmp_ps(A, B, _CMP_LT_OQ)
+#define VF_SELECT(M, A, B) _mm256_blendv_ps(B, A, M)
+#define VF_MOVEMASK(A) _mm256_movemask_ps(A)
+#define VF_MOVEMASK_ALL 0xff
+#define VF_ALPHA_MASK() _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0))
+#define VF_PIXEL_MAX(A) pixelMaxAVX2(A)
+#define VF_TRUNC_TO_VI(A) _mm256_cvttps_epi32(A)
+#define VI_TO_VF(A) _mm256_cvtepi32_ps(A)
+#define VI_SET1(X) _mm256_set1_epi32(X)
+#define VI_GT(A, B) _mm256_cmpgt_epi32(A, B)
+#define VI_SELECT(M, A, B) _mm256_blendv_epi8(B, A, M)
+#define VI_LOAD_U8(P) loadU8AVX2(P)
+#define VI_LOAD_U16(P) loadU16AVX2(P)
+#define VI_STORE_U8(P, V) storeU8AVX2(P, V)
+#define VI_STORE_U16(P, V) storeU16AVX2(P, V)
+#include "pixelmath_convert_kernel.h"
+
+#endif /* if defined(COLORIST_SIMD_X64) */
+
+// ----------------------------------------------------------------------------
+// Dispatch
+
+// Indexed by [srcFormat][dstFormat]
+static const clPixelConvertFunc scalarConvertFuncs[CL_PIXELFORMAT_COUNT][CL_PIXELFORMAT_COUNT] = {
+    { NULL, convertU8ToU16, convertU8ToF32 },
+    { convertU16ToU8, NULL, convertU16ToF32 },
+    { convertF32ToU8, convertF32ToU16, NULL },
+};
+#if defined(COLORIST_SIMD_X64)
+static const clPixelConvertFunc sse2ConvertFuncs[CL_PIXELFORMAT_COUNT][CL_PIXELFORMAT_COUNT] = {
+    { NULL, convertU8ToU16SSE2, convertU8ToF32SSE2 },
+    { convertU16ToU8SSE2, NULL, convertU16ToF32SSE2 },
+    { convertF32ToU8SSE2, convertF32ToU16SSE2, NULL },
+};
+static const clPixelConvertFunc avx2ConvertFuncs[CL_PIXELFORMAT_COUNT][CL_PIXELFORMAT_COUNT] = {
+    { NULL, convertU8ToU16AVX2, convertU8ToF32AVX2 },
+    { convertU16ToU8AVX2, NULL, convertU16ToF32AVX2 },
+    { convertF32ToU8AVX2, convertF32ToU16AVX2, NULL },
+};
+#endif
+
+static clPixelConvertFunc findConvertFunc(struct clContext * C, clPixelFormat srcFormat, clPixelFormat dstFormat)
+{
+#if defined(COLORIST_SIMD_X64)
+    if (C->simdAllowed) {
+        // clTransformSIMDName() does the CPU detection
+        if (!strcmp(clTransformSIMDName(C), "avx2")) {
+            return avx2ConvertFuncs[srcFormat][dstFormat];
+        }
+        return sse2ConvertFuncs[srcFormat][dstFormat];
+    }
+#else
+    COLORIST_UNUSED(C);
+#endif
+    return scalarConvertFuncs[srcFormat][dstFormat];
+}
+
+typedef struct clPixelConvertTask
+{
+    struct clContext * C;
+    clPixelConvertFunc func;
+    const uint8_t * srcPixels;
+    uint8_t * dstPixels;
+    size_t srcPixelBytes;
+    size_t dstPixelBytes;
+    uint32_t maxChannelU16;
+} clPixelConvertTask;
+
+static void pixelConvertTaskFunc(void * userData, int start, int count)
+{
+    clPixelConvertTask * info = (clPixelConvertTask *)userData;
+    clTraceSpan span;
+    clTraceBegin(info->C, &span, "pixel convert");
+    info->func(info->srcPixels + (start * info->srcPixelBytes), info->dstPixels + (start * info->dstPixelBytes), count, info->maxChannelU16);
+    clTraceEnd(info->C, &span);
+}
+
+void clPixelMathConvertPixels(struct clContext * C,
+                              clPixelFormat srcFormat,
+                              const void * srcPixels,
+                              clPixelFormat dstFormat,
+                              void * dstPixels,
+                              uint32_t maxChannelU16,
+                              int pixelCount)
+{
+    COLORIST_ASSERT(srcFormat != dstFormat);
+
+    clPixelConvertTask info;
+    info.C = C;
+    info.func = findConvertFunc(C, srcFormat, dstFormat);
+    info.srcPixels = (const uint8_t *)srcPixels;
+    info.dstPixels = (uint8_t *)dstPixels;
+    info.srcPixelBytes = CL_BYTES_PER_PIXEL(srcFormat);
+    info.dstPixelBytes = CL_BYTES_PER_PIXEL(dstFormat);
+    info.maxChannelU16 = maxChannelU16;
+
+    // Conversions are memory bound, so only split them up once there's a decent amount of work per thread
+    clTaskParallelFor(C, pixelCount, 16 * 1024, pixelConvertTaskFunc, &info);
+}
@@ -0,0 +1,131 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+// Included by pixelmath_convert.c once per instruction set, after defining CL_SIMD_NAME(), CL_SIMD_TARGET,
+// CL_SIMD_WIDTH (floats per vector, a multiple of 4) and the VF_* / VI_* vector macros. Every kernel works
+// on whole vectors of channels and hands any leftover pixels to the scalar version it mirrors.
+
+// Quantizes CL_SIMD_WIDTH / 4 F32 pixels like quantizePixel(). Returns clFalse (leaving out alone) if any
+// channel rounds outside of [0, 2^31), as only the scalar code reproduces clPixelMathRoundUNorm()'s
+// behavior there (NaN, negative and huge values); the caller then uses quantizePixel() instead.
+static CL_SIMD_TARGET inline clBool CL_SIMD_NAME(quantizeF32)(const float * src, VF maxChannel, VI maxChannelI, VI * out)
+{
+    VF v = VF_LOADU(src);
+    VF one = VF_SET1(1.0f);
+    VF alphaMask = VF_ALPHA_MASK();
+
+    // largestChannel = max(1, R, G, B), and alpha is divided by 1 (left alone)
+    VF largestChannel = VF_PIXEL_MAX(VF_SELECT(alphaMask, one, v));
+    VF divisor = VF_SELECT(alphaMask, one, largestChannel);
+
+    VF rounded = VF_ADD(VF_MUL(VF_DIV(v, divisor), maxChannel), VF_SET1(0.5f));
+    VF inRange = VF_AND(VF_GE(rounded, VF_SET1(0.0f)), VF_LT(rounded, VF_SET1(2147483648.0f)));
+    if (VF_MOVEMASK(inRange) != VF_MOVEMASK_ALL) {
+        return clFalse;
+    }
+    VI quantized = VF_TRUNC_TO_VI(rounded); // floorf() for non-negative values
+    *out = VI_SELECT(VI_GT(quantized, maxChannelI), maxChannelI, quantized);
+    return clTrue;
+}
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(convertF32ToU8)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const float * src = (const float *)srcPixels;
+    uint8_t * dst = (uint8_t *)dstPixels;
+    VF maxChannel = VF_SET1(255.0f);
+    VI maxChannelI = VI_SET1(255);
+    int vectorPixels = (pixelCount / (CL_SIMD_WIDTH / 4)) * (CL_SIMD_WIDTH / 4);
+    for (int i = 0; i < vectorPixels; i += CL_SIMD_WIDTH / 4) {
+        VI quantized;
+        int offset = i * CL_CHANNELS_PER_PIXEL;
+        if (CL_SIMD_NAME(quantizeF32)(&src[offset], maxChannel, maxChannelI, &quantized)) {
+            VI_STORE_U8(&dst[offset], quantized);
+        } else {
+            convertF32ToU8(&src[offset], &dst[offset], CL_SIMD_WIDTH / 4, maxChannelU16);
+        }
+    }
+    convertF32ToU8(&src[vectorPixels * CL_CHANNELS_PER_PIXEL], &dst[vectorPixels * CL_CHANNELS_PER_PIXEL], pixelCount - vectorPixels, maxChannelU16);
+}
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(convertF32ToU16)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const float * src = (const float *)srcPixels;
+    uint16_t * dst = (uint16_t *)dstPixels;
+    VF maxChannel = VF_SET1((float)maxChannelU16);
+    VI maxChannelI = VI_SET1((int)maxChannelU16);
+    int vectorPixels = (pixelCount / (CL_SIMD_WIDTH / 4)) * (CL_SIMD_WIDTH / 4);
+    for (int i = 0; i < vectorPixels; i += CL_SIMD_WIDTH / 4) {
+        VI quantized;
+        int offset = i * CL_CHANNELS_PER_PIXEL;
+        if (CL_SIMD_NAME(quantizeF32)(&src[offset], maxChannel, maxChannelI, &quantized)) {
+            VI_STORE_U16(&dst[offset], quantized);
+        } else {
+            convertF32ToU16(&src[offset], &dst[offset], CL_SIMD_WIDTH / 4, maxChannelU16);
+        }
+    }
+    convertF32ToU16(&src[vectorPixels * CL_CHANNELS_PER_PIXEL], &dst[vectorPixels * CL_CHANNELS_PER_PIXEL], pixelCount - vectorPixels, maxChannelU16);
+}
+
+// Integer -> integer channels never round outside of [0, 2^31), so they only need clamping
+static CL_SIMD_TARGET inline VI CL_SIMD_NAME(requantize)(VI v, VF srcMaxChannel, VF dstMaxChannel, VI dstMaxChannelI)
+{
+    VF rounded = VF_ADD(VF_MUL(VF_DIV(VI_TO_VF(v), srcMaxChannel), dstMaxChannel), VF_SET1(0.5f));
+    VI quantized = VF_TRUNC_TO_VI(rounded);
+    return VI_SELECT(VI_GT(quantized, dstMaxChannelI), dstMaxChannelI, quantized);
+}
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(convertU16ToU8)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint16_t * src = (const uint16_t *)srcPixels;
+    uint8_t * dst = (uint8_t *)dstPixels;
+    VF srcMaxChannel = VF_SET1((float)maxChannelU16);
+    VF dstMaxChannel = VF_SET1(255.0f);
+    VI dstMaxChannelI = VI_SET1(255);
+    int vectorPixels = (pixelCount / (CL_SIMD_WIDTH / 4)) * (CL_SIMD_WIDTH / 4);
+    for (int i = 0; i < vectorPixels * CL_CHANNELS_PER_PIXEL; i += CL_SIMD_WIDTH) {
+        VI_STORE_U8(&dst[i], CL_SIMD_NAME(requantize)(VI_LOAD_U16(&src[i]), srcMaxChannel, dstMaxChannel, dstMaxChannelI));
+    }
+    convertU16ToU8(&src[vectorPixels * CL_CHANNELS_PER_PIXEL], &dst[vectorPixels * CL_CHANNELS_PER_PIXEL], pixelCount - vectorPixels, maxChannelU16);
+}
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(convertU8ToU16)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint8_t * src = (const uint8_t *)srcPixels;
+    uint16_t * dst = (uint16_t *)dstPixels;
+    VF srcMaxChannel = VF_SET1(255.0f);
+    VF dstMaxChannel = VF_SET1((float)maxChannelU16);
+    VI dstMaxChannelI = VI_SET1((int)maxChannelU16);
+    int vectorPixels = (pixelCount / (CL_SIMD_WIDTH / 4)) * (CL_SIMD_WIDTH / 4);
+    for (int i = 0; i < vectorPixels * CL_CHANNELS_PER_PIXEL; i += CL_SIMD_WIDTH) {
+        VI_STORE_U16(&dst[i], CL_SIMD_NAME(requantize)(VI_LOAD_U8(&src[i]), srcMaxChannel, dstMaxChannel, dstMaxChannelI));
+    }
+    convertU8ToU16(&src[vectorPixels * CL_CHANNELS_PER_PIXEL], &dst[vectorPixels * CL_CHANNELS_PER_PIXEL], pixelCount - vectorPixels, maxChannelU16);
+}
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(convertU8ToF32)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint8_t * src = (const uint8_t *)srcPixels;
+    float * dst = (float *)dstPixels;
+    VF maxChannel = VF_SET1(255.0f);
+    int vectorPixels = (pixelCount / (CL_SIMD_WIDTH / 4)) * (CL_SIMD_WIDTH / 4);
+    for (int i = 0; i < vectorPixels * CL_CHANNELS_PER_PIXEL; i += CL_SIMD_WIDTH) {
+        VF_STOREU(&dst[i], VF_DIV(VI_TO_VF(VI_LOAD_U8(&src[i])), maxChannel));
+    }
+    convertU8ToF32(&src[vectorPixels * CL_CHANNELS_PER_PIXEL], &dst[vectorPixels * CL_CHANNELS_PER_PIXEL], pixelCount - vectorPixels, maxChannelU16);
+}
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(convertU16ToF32)(const void * srcPixels, void * dstPixels, int pixelCount, uint32_t maxChannelU16)
+{
+    const uint16_t * src = (const uint16_t *)srcPixels;
+    float * dst = (float *)dstPixels;
+    VF maxChannel = VF_SET1((float)maxChannelU16);
+    int vectorPixels = (pixelCount / (CL_SIMD_WIDTH / 4)) * (CL_SIMD_WIDTH / 4);
+    for (int i = 0; i < vectorPixels * CL_CHANNELS_PER_PIXEL; i += CL_SIMD_WIDTH) {
+        VF_STOREU(&dst[i], VF_DIV(VI_TO_VF(VI_LOAD_U16(&src[i])), maxChannel));
+    }
+    convertU16ToF32(&src[vectorPixels * CL_CHANNELS_PER_PIXEL], &dst[vectorPixels * CL_CHANNELS_PER_PIXEL], pixelCount - vectorPixels, maxChannelU16);
+}
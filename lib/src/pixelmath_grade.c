@@ -84,18 +84,20 @@ static float gammaErrorTerm(float gamma, float * pixels, int pixelCount, float m
 
 typedef struct clGammaErrorTermTask
 {
-    int gammaInt;
-    float gamma;
     float * pixels;
     int pixelCount;
     float maxChannel;
     float luminanceScale;
-    float outErrorTerm;
+    float * outErrorTerms; // one per gamma attempt, indexed from GAMMA_RANGE_START
 } clGammaErrorTermTask;
 
-static void gammaErrorTermTaskFunc(clGammaErrorTermTask * info)
+static void gammaErrorTermTaskFunc(void * userData, int start, int count)
 {
-    info->outErrorTerm = gammaErrorTerm(info->gamma, info->pixels, info->pixelCount, info->maxChannel, info->luminanceScale);
+    clGammaErrorTermTask * info = (clGammaErrorTermTask *)userData;
+    for (int i = start; i < (start + count); ++i) {
+        float gamma = (float)(GAMMA_RANGE_START + i) / GAMMA_INT_DIVISOR;
+        info->outErrorTerms[i] = gammaErrorTerm(gamma, info->pixels, info->pixelCount, info->maxChannel, info->luminanceScale);
+    }
 }
 
 void clPixelMathColorGrade(struct clContext * C,
@@ -176,56 +178,37 @@ void clPixelMathColorGrade(struct clContext * C,
         int minGammaInt = 0;
         float minErrorTerm = -1.0f;
         float maxChannel = (float)((1 << dstColorDepth) - 1);
-        clTask ** tasks;
-        clGammaErrorTermTask * infos;
-        int tasksInFlight = 0;
-        int taskCount = C->jobs;
+        clGammaErrorTermTask info;
+        int attemptCount = GAMMA_RANGE_END - GAMMA_RANGE_START + 1;
+
+        clContextLog(C, "grading", 1, "Using %d thread%s to find best gamma.", C->jobs, (C->jobs == 1) ? "" : "s");
 
-        clContextLog(C, "grading", 1, "Using %d thread%s to find best gamma.", taskCount, (taskCount == 1) ? "" : "s");
+        info.pixels = pixels;
+        info.pixelCount = pixelCount;
+        info.maxChannel = maxChannel;
+        info.luminanceScale = luminanceScale;
+        info.outErrorTerms = clAllocate(attemptCount * sizeof(float));
+        clTaskParallelFor(C, attemptCount, 1, gammaErrorTermTaskFunc, &info);
 
-        tasks = clAllocate(taskCount * sizeof(clTask *));
-        infos = clAllocate(taskCount * sizeof(clGammaErrorTermTask));
         for (gammaInt = GAMMA_RANGE_START; gammaInt <= GAMMA_RANGE_END; ++gammaInt) {
-            float gammaAttempt = (float)gammaInt / GAMMA_INT_DIVISOR;
-
-            infos[tasksInFlight].gammaInt = gammaInt;
-            infos[tasksInFlight].gamma = gammaAttempt;
-            infos[tasksInFlight].pixels = pixels;
-            infos[tasksInFlight].pixelCount = pixelCount;
-            infos[tasksInFlight].maxChannel = maxChannel;
-            infos[tasksInFlight].luminanceScale = luminanceScale;
-            infos[tasksInFlight].outErrorTerm = 0;
-            tasks[tasksInFlight] = clTaskCreate(C, (clTaskFunc)gammaErrorTermTaskFunc, &infos[tasksInFlight]);
-            ++tasksInFlight;
-
-            if ((tasksInFlight == taskCount) || (gammaInt == GAMMA_RANGE_END)) {
-                for (int i = 0; i < tasksInFlight; ++i) {
-                    clTaskJoin(C, tasks[i]);
-                    if (minErrorTerm < 0.0f) {
-                        minErrorTerm = infos[i].outErrorTerm;
-                        minGammaInt = infos[i].gammaInt;
-                    } else if (minErrorTerm > infos[i].outErrorTerm) {
-                        minErrorTerm = infos[i].outErrorTerm;
-                        minGammaInt = infos[i].gammaInt;
-                    }
-                    if (verbose)
-                        clContextLog(C,
-                                     "grading",
-                                     2,
-                                     "attempt: gamma %.3g, err: %g     best -> gamma: %g, err: %g",
-                                     infos[i].gamma,
-                                     infos[i].outErrorTerm,
-                                     (float)minGammaInt / GAMMA_INT_DIVISOR,
-                                     minErrorTerm);
-                    clTaskDestroy(C, tasks[i]);
-                }
-                tasksInFlight = 0;
+            float errorTerm = info.outErrorTerms[gammaInt - GAMMA_RANGE_START];
+            if ((minErrorTerm < 0.0f) || (minErrorTerm > errorTerm)) {
+                minErrorTerm = errorTerm;
+                minGammaInt = gammaInt;
             }
+            if (verbose)
+                clContextLog(C,
+                             "grading",
+                             2,
+                             "attempt: gamma %.3g, err: %g     best -> gamma: %g, err: %g",
+                             (float)gammaInt / GAMMA_INT_DIVISOR,
+                             errorTerm,
+                             (float)minGammaInt / GAMMA_INT_DIVISOR,
+                             minErrorTerm);
         }
         bestGamma = (float)minGammaInt / GAMMA_INT_DIVISOR;
         clContextLog(C, "grading", 1, "Found best gamma: %g", bestGamma);
-        clFree(tasks);
-        clFree(infos);
+        clFree(info.outErrorTerms);
     } else {
         bestGamma = *outGamma;
         clContextLog(C, "grading", 1, "Using requested gamma: %g", bestGamma);
@@ -1,48 +1,559 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
 #include "colorist/pixelmath.h"
 
 #include "colorist/context.h"
+#include "colorist/image.h"
+#include "colorist/task.h"
 
-#include "stb_image_resize.h"
-
+#include <math.h>
 #include <string.h>
 
-void clPixelMathResize(struct clContext * C, int srcW, int srcH, float * srcPixels, int dstW, int dstH, float * dstPixels, clFilter filter)
+#if defined(__x86_64__) || defined(_M_X64)
+#define COLORIST_SIMD_X64
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <emmintrin.h>
+#endif
+
+// Resizing is separable: a horizontal pass turns each source row into a dstW-wide row, then a vertical pass
+// combines those rows into each destination row. Both passes are split across the task pool (by source rows,
+// then by destination rows), and each output pixel is a weighted sum of a handful of input pixels ("taps"),
+// listed per axis in a clResizeAxis table that is built once and kept in C->resizeCache.
+//
+// The filters, tap placement, weights, alpha weighting and summation order all match stb_image_resize (which
+// colorist used to hand every resize to) exactly, so its results are unchanged.
+
+// ----------------------------------------------------------------------------
+// Filters (from stb_image_resize)
+
+static float filterTrapezoid(float x, float scale)
+{
+    float halfscale = scale / 2;
+    float t = 0.5f + halfscale;
+
+    x = fabsf(x);
+    if (x >= t) {
+        return 0;
+    }
+    float r = 0.5f - halfscale;
+    if (x <= r) {
+        return 1;
+    }
+    return (t - x) / scale;
+}
+
+static float filterTriangle(float x, float scale)
+{
+    COLORIST_UNUSED(scale);
+
+    x = fabsf(x);
+    if (x <= 1.0f) {
+        return 1 - x;
+    }
+    return 0;
+}
+
+static float filterCubic(float x, float scale)
+{
+    COLORIST_UNUSED(scale);
+
+    x = fabsf(x);
+    if (x < 1.0f) {
+        return (4 + x * x * (3 * x - 6)) / 6;
+    } else if (x < 2.0f) {
+        return (8 + x * (-12 + x * (6 - x))) / 6;
+    }
+    return 0.0f;
+}
+
+static float filterCatmullRom(float x, float scale)
+{
+    COLORIST_UNUSED(scale);
+
+    x = fabsf(x);
+    if (x < 1.0f) {
+        return 1 - x * x * (2.5f - 1.5f * x);
+    } else if (x < 2.0f) {
+        return 2 - x * (4 + x * (0.5f * x - 2.5f));
+    }
+    return 0.0f;
+}
+
+static float filterMitchell(float x, float scale)
+{
+    COLORIST_UNUSED(scale);
+
+    x = fabsf(x);
+    if (x < 1.0f) {
+        return (16 + x * x * (21 * x - 36)) / 18;
+    } else if (x < 2.0f) {
+        return (32 + x * (-60 + x * (36 - 7 * x))) / 18;
+    }
+    return 0.0f;
+}
+
+static float supportTrapezoid(float scale)
+{
+    return 0.5f + scale / 2;
+}
+
+static float supportOne(float scale)
+{
+    COLORIST_UNUSED(scale);
+    return 1;
+}
+
+static float supportTwo(float scale)
+{
+    COLORIST_UNUSED(scale);
+    return 2;
+}
+
+typedef struct clResizeFilterInfo
+{
+    float (*kernel)(float x, float scale);
+    float (*support)(float scale);
+} clResizeFilterInfo;
+
+// Indexed by clFilter (AUTO and NEAREST have no kernel)
+static const clResizeFilterInfo filterInfo[] = {
+    { NULL, NULL },
+    { filterTrapezoid, supportTrapezoid },
+    { filterTriangle, supportOne },
+    { filterCubic, supportTwo },
+    { filterCatmullRom, supportTwo },
+    { filterMitchell, supportTwo },
+};
+
+// ----------------------------------------------------------------------------
+// Axis tables
+
+typedef struct clResizeAxis
+{
+    int srcSize;
+    int dstSize;
+    clFilter filter;  // as requested, part of the cache key
+    int * tapStarts;  // [dstSize + 1], index of each output pixel's first tap
+    int * tapIndices; // source pixel of each tap, already clamped to the edges
+    float * tapWeights;
+    int refs;         // callers using this table, only changed with the cache's lock held
+    clBool cached;    // clResizeAxisRelease() frees uncached tables once unused
+} clResizeAxis;
+
+static void resizeAxisFree(struct clContext * C, clResizeAxis * axis)
+{
+    clFree(axis->tapStarts);
+    clFree(axis->tapIndices);
+    clFree(axis->tapWeights);
+    clFree(axis);
+}
+
+static void resizeAxisAllocateTaps(struct clContext * C, clResizeAxis * axis, int tapCount)
+{
+    axis->tapIndices = clAllocate(sizeof(int) * CL_MAX(tapCount, 1));
+    axis->tapWeights = clAllocate(sizeof(float) * CL_MAX(tapCount, 1));
+}
+
+static void buildNearest(struct clContext * C, clResizeAxis * axis)
+{
+    // colorist's very own super-obvious nearest neighbor implementation
+    float scale = (float)axis->srcSize / (float)axis->dstSize;
+    resizeAxisAllocateTaps(C, axis, axis->dstSize);
+    for (int i = 0; i < axis->dstSize; ++i) {
+        int src = (int)(((float)i + 0.5f) * scale);
+        axis->tapStarts[i] = i;
+        axis->tapIndices[i] = CL_CLAMP(src, 0, axis->srcSize - 1);
+        axis->tapWeights[i] = 1.0f;
+    }
+    axis->tapStarts[axis->dstSize] = axis->dstSize;
+}
+
+// Output pixel n gathers from the input pixels around its center, with weights normalized to sum to 1
+static void buildUpsample(struct clContext * C, clResizeAxis * axis, const clResizeFilterInfo * info, float scale)
 {
-    COLORIST_UNUSED(C);
+    float outRadius = info->support(1 / scale) * scale;
+    int maxTaps = (int)ceil(info->support(1 / scale) * 2) + 1;
+    float * weights = clAllocate(sizeof(float) * maxTaps);
+    resizeAxisAllocateTaps(C, axis, axis->dstSize * maxTaps);
 
+    int tapCount = 0;
+    for (int n = 0; n < axis->dstSize; ++n) {
+        float outCenter = (float)n + 0.5f;
+        float inCenter = outCenter / scale;
+        int first = (int)(floor((outCenter - outRadius) / scale + 0.5));
+        int last = (int)(floor((outCenter + outRadius) / scale - 0.5));
+        float total = 0;
+
+        int i;
+        for (i = 0; i <= last - first; i++) {
+            float inPixelCenter = (float)(i + first) + 0.5f;
+            weights[i] = info->kernel(inCenter - inPixelCenter, 1 / scale);
+            if ((i == 0) && !weights[i]) {
+                // Leading zero, start one pixel later
+                ++first;
+                --i;
+                continue;
+            }
+            total += weights[i];
+        }
+
+        float filterScale = 1 / total;
+        axis->tapStarts[n] = tapCount;
+        for (i = 0; i <= last - first; i++) {
+            float weight = weights[i] * filterScale;
+            if (weight != 0.0f) {
+                axis->tapIndices[tapCount] = CL_CLAMP(first + i, 0, axis->srcSize - 1);
+                axis->tapWeights[tapCount] = weight;
+                ++tapCount;
+            }
+        }
+    }
+    axis->tapStarts[axis->dstSize] = tapCount;
+    clFree(weights);
+}
+
+// Which output pixels input pixel n (which may be past either edge, see margin) contributes to, and how much
+static int downsampleRange(const clResizeFilterInfo * info, float scale, float inRadius, int n, float * weights, int * outFirst)
+{
+    float inCenter = (float)n + 0.5f;
+    float outCenter = inCenter * scale;
+    int first = (int)(floor((inCenter - inRadius) * scale + 0.5));
+    int last = (int)(floor((inCenter + inRadius) * scale - 0.5));
+    for (int i = 0; i <= last - first; i++) {
+        float outPixelCenter = (float)(i + first) + 0.5f;
+        weights[i] = info->kernel(outPixelCenter - outCenter, scale) * scale;
+    }
+    *outFirst = first;
+    return last - first + 1;
+}
+
+// Each input pixel scatters into the output pixels around its center; the output pixels' weights are then
+// normalized to sum to 1. Taps are listed in input order, which is the order stb_image_resize sums them in.
+static void buildDownsample(struct clContext * C, clResizeAxis * axis, const clResizeFilterInfo * info, float scale)
+{
+    float inRadius = info->support(scale) / scale;
+    int margin = (int)ceil(info->support(scale) * 2 / scale) / 2;
+    int maxRange = (int)ceil(info->support(scale) * 2) + 2;
+    float * weights = clAllocate(sizeof(float) * maxRange);
+    int * counts = clAllocate(sizeof(int) * axis->dstSize);
+
+    // Count each output pixel's taps, then fill them in
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            int tapCount = 0;
+            for (int o = 0; o < axis->dstSize; ++o) {
+                axis->tapStarts[o] = tapCount;
+                tapCount += counts[o];
+                counts[o] = 0;
+            }
+            axis->tapStarts[axis->dstSize] = tapCount;
+            resizeAxisAllocateTaps(C, axis, tapCount);
+        }
+
+        for (int n = -margin; n < axis->srcSize + margin; ++n) {
+            int first;
+            int range = downsampleRange(info, scale, inRadius, n, weights, &first);
+            for (int i = 0; i < range; ++i) {
+                int o = first + i;
+                if ((o < 0) || (o >= axis->dstSize) || (weights[i] == 0.0f)) {
+                    continue;
+                }
+                if (pass == 1) {
+                    int tap = axis->tapStarts[o] + counts[o];
+                    axis->tapIndices[tap] = CL_CLAMP(n, 0, axis->srcSize - 1);
+                    axis->tapWeights[tap] = weights[i];
+                }
+                ++counts[o];
+            }
+        }
+    }
+
+    for (int o = 0; o < axis->dstSize; ++o) {
+        float total = 0;
+        for (int tap = axis->tapStarts[o]; tap < axis->tapStarts[o + 1]; ++tap) {
+            total += axis->tapWeights[tap];
+        }
+        float filterScale = 1 / total;
+        for (int tap = axis->tapStarts[o]; tap < axis->tapStarts[o + 1]; ++tap) {
+            axis->tapWeights[tap] *= filterScale;
+        }
+    }
+
+    clFree(counts);
+    clFree(weights);
+}
+
+static clResizeAxis * resizeAxisCreate(struct clContext * C, int srcSize, int dstSize, clFilter filter)
+{
+    clResizeAxis * axis = clAllocateStruct(clResizeAxis);
+    axis->srcSize = srcSize;
+    axis->dstSize = dstSize;
+    axis->filter = filter;
+    axis->tapStarts = clAllocate(sizeof(int) * (dstSize + 1));
+    axis->refs = 0;
+    axis->cached = clFalse;
+
+    float scale = (float)dstSize / (float)srcSize;
+    if (filter == CL_FILTER_AUTO) {
+        filter = (scale > 1) ? CL_FILTER_CATMULLROM : CL_FILTER_MITCHELL;
+    }
     if (filter == CL_FILTER_NEAREST) {
-        // colorist's very own super-obvious nearest neighbor implementation
-        float scaleW = (float)srcW / (float)dstW;
-        float scaleH = (float)srcH / (float)dstH;
-        for (int j = 0; j < dstH; ++j) {
-            for (int i = 0; i < dstW; ++i) {
-                float * srcPixel;
-                float * dstPixel;
-                int srcX = (int)(((float)i + 0.5f) * scaleW);
-                int srcY = (int)(((float)j + 0.5f) * scaleH);
-                srcX = CL_CLAMP(srcX, 0, srcW - 1);
-                srcY = CL_CLAMP(srcY, 0, srcH - 1);
-                srcPixel = &srcPixels[4 * (srcX + (srcY * srcW))];
-                dstPixel = &dstPixels[4 * (i + (j * dstW))];
-                memcpy(dstPixel, srcPixel, 4 * sizeof(float));
+        buildNearest(C, axis);
+    } else if (scale > 1) {
+        buildUpsample(C, axis, &filterInfo[filter], scale);
+    } else {
+        buildDownsample(C, axis, &filterInfo[filter], scale);
+    }
+    return axis;
+}
+
+// ----------------------------------------------------------------------------
+// clResizeCache
+
+clResizeCache * clResizeCacheCreate(struct clContext * C, int capacity)
+{
+    clResizeCache * cache = clAllocateStruct(clResizeCache);
+    cache->axes = (capacity > 0) ? clAllocate(sizeof(clResizeAxis *) * capacity) : NULL;
+    cache->count = 0;
+    cache->capacity = CL_MAX(capacity, 0);
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->lock = clMutexCreate(C);
+    return cache;
+}
+
+void clResizeCacheClear(struct clContext * C, clResizeCache * cache)
+{
+    clMutexLock(cache->lock);
+    for (int i = 0; i < cache->count; ++i) {
+        clResizeAxis * axis = cache->axes[i];
+        axis->cached = clFalse;
+        if (axis->refs == 0) {
+            resizeAxisFree(C, axis);
+        }
+    }
+    cache->count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    clMutexUnlock(cache->lock);
+}
+
+void clResizeCacheDestroy(struct clContext * C, clResizeCache * cache)
+{
+    clResizeCacheClear(C, cache);
+    if (cache->axes) {
+        clFree(cache->axes);
+    }
+    clMutexDestroy(C, cache->lock);
+    clFree(cache);
+}
+
+static clResizeAxis * resizeAxisAcquire(struct clContext * C, int srcSize, int dstSize, clFilter filter)
+{
+    clResizeCache * cache = C->resizeCache;
+
+    clMutexLock(cache->lock);
+    for (int i = 0; i < cache->count; ++i) {
+        clResizeAxis * axis = cache->axes[i];
+        if ((axis->srcSize == srcSize) && (axis->dstSize == dstSize) && (axis->filter == filter)) {
+            // Move to the front (most recently used)
+            memmove(&cache->axes[1], &cache->axes[0], sizeof(clResizeAxis *) * i);
+            cache->axes[0] = axis;
+            ++axis->refs;
+            ++cache->hits;
+            clMutexUnlock(cache->lock);
+            return axis;
+        }
+    }
+    ++cache->misses;
+    clMutexUnlock(cache->lock);
+
+    clResizeAxis * axis = resizeAxisCreate(C, srcSize, dstSize, filter);
+    axis->refs = 1;
+
+    clMutexLock(cache->lock);
+    if (cache->count == cache->capacity) {
+        // Make room by dropping the least recently used table nobody is using
+        for (int i = cache->count - 1; i >= 0; --i) {
+            if (cache->axes[i]->refs == 0) {
+                resizeAxisFree(C, cache->axes[i]);
+                memmove(&cache->axes[i], &cache->axes[i + 1], sizeof(clResizeAxis *) * (cache->count - i - 1));
+                --cache->count;
+                break;
             }
         }
+    }
+    if (cache->count < cache->capacity) {
+        memmove(&cache->axes[1], &cache->axes[0], sizeof(clResizeAxis *) * cache->count);
+        cache->axes[0] = axis;
+        ++cache->count;
+        axis->cached = clTrue;
+    }
+    clMutexUnlock(cache->lock);
+    return axis;
+}
+
+static void resizeAxisRelease(struct clContext * C, clResizeAxis * axis)
+{
+    clResizeCache * cache = C->resizeCache;
+
+    clMutexLock(cache->lock);
+    --axis->refs;
+    clBool unused = (axis->refs == 0) && !axis->cached;
+    clMutexUnlock(cache->lock);
+    if (unused) {
+        resizeAxisFree(C, axis);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Resampling
+
+typedef struct clResizeTask
+{
+    struct clContext * C;
+    const clResizeAxis * xAxis;
+    const clResizeAxis * yAxis;
+    int srcW;
+    const float * srcPixels;
+    float * tmpPixels; // dstW x srcH, alpha-weighted (premultiplied)
+    float * dstPixels;
+    clBool simd;
+} clResizeTask;
+
+// Sums a tap list of 4 channel pixels, each pixels[indices[i] * stride]
+static inline void sumTaps(const float * pixels, int stride, const int * indices, const float * weights, int tapCount, clBool simd, float * out)
+{
+#if defined(COLORIST_SIMD_X64)
+    if (simd) {
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < tapCount; ++i) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&pixels[indices[i] * stride]), _mm_set1_ps(weights[i])));
+        }
+        _mm_storeu_ps(out, sum);
+        return;
+    }
+#else
+    COLORIST_UNUSED(simd);
+#endif
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < tapCount; ++i) {
+        const float * pixel = &pixels[indices[i] * stride];
+        float weight = weights[i];
+        sum[0] += pixel[0] * weight;
+        sum[1] += pixel[1] * weight;
+        sum[2] += pixel[2] * weight;
+        sum[3] += pixel[3] * weight;
+    }
+    memcpy(out, sum, sizeof(sum));
+}
+
+// Source rows -> alpha-weighted, dstW-wide rows of tmpPixels
+static void resizeHorizontalTaskFunc(void * userData, int start, int count)
+{
+    clResizeTask * info = (clResizeTask *)userData;
+    struct clContext * C = info->C;
+    const clResizeAxis * xAxis = info->xAxis;
+    int dstW = xAxis->dstSize;
+
+    float * row = clAllocate(sizeof(float) * CL_CHANNELS_PER_PIXEL * info->srcW);
+    for (int y = start; y < (start + count); ++y) {
+        const float * srcRow = &info->srcPixels[(size_t)y * info->srcW * CL_CHANNELS_PER_PIXEL];
+        for (int x = 0; x < info->srcW; ++x) {
+            const float * srcPixel = &srcRow[x * CL_CHANNELS_PER_PIXEL];
+            float * pixel = &row[x * CL_CHANNELS_PER_PIXEL];
+            float alpha = srcPixel[3];
+            pixel[0] = srcPixel[0] * alpha;
+            pixel[1] = srcPixel[1] * alpha;
+            pixel[2] = srcPixel[2] * alpha;
+            pixel[3] = alpha;
+        }
+
+        float * tmpRow = &info->tmpPixels[(size_t)y * dstW * CL_CHANNELS_PER_PIXEL];
+        for (int x = 0; x < dstW; ++x) {
+            int firstTap = xAxis->tapStarts[x];
+            sumTaps(row,
+                    CL_CHANNELS_PER_PIXEL,
+                    &xAxis->tapIndices[firstTap],
+                    &xAxis->tapWeights[firstTap],
+                    xAxis->tapStarts[x + 1] - firstTap,
+                    info->simd,
+                    &tmpRow[x * CL_CHANNELS_PER_PIXEL]);
+        }
+    }
+    clFree(row);
+}
+
+// tmpPixels rows -> destination rows (with the alpha weighting removed)
+static void resizeVerticalTaskFunc(void * userData, int start, int count)
+{
+    clResizeTask * info = (clResizeTask *)userData;
+    const clResizeAxis * yAxis = info->yAxis;
+    int rowChannels = info->xAxis->dstSize * CL_CHANNELS_PER_PIXEL;
+
+    for (int y = start; y < (start + count); ++y) {
+        int firstTap = yAxis->tapStarts[y];
+        const int * indices = &yAxis->tapIndices[firstTap];
+        const float * weights = &yAxis->tapWeights[firstTap];
+        int tapCount = yAxis->tapStarts[y + 1] - firstTap;
+
+        float * dstRow = &info->dstPixels[(size_t)y * rowChannels];
+        for (int i = 0; i < rowChannels; i += CL_CHANNELS_PER_PIXEL) {
+            // Each pixel of a tmpPixels row is rowChannels floats from the same pixel in the next row
+            float * pixel = &dstRow[i];
+            sumTaps(&info->tmpPixels[i], rowChannels, indices, weights, tapCount, info->simd, pixel);
+
+            float reciprocalAlpha = pixel[3] ? 1.0f / pixel[3] : 0;
+            pixel[0] *= reciprocalAlpha;
+            pixel[1] *= reciprocalAlpha;
+            pixel[2] *= reciprocalAlpha;
+        }
+    }
+}
+
+static void resizeNearestTaskFunc(void * userData, int start, int count)
+{
+    clResizeTask * info = (clResizeTask *)userData;
+    int dstW = info->xAxis->dstSize;
+    for (int y = start; y < (start + count); ++y) {
+        const float * srcRow = &info->srcPixels[(size_t)info->yAxis->tapIndices[y] * info->srcW * CL_CHANNELS_PER_PIXEL];
+        float * dstRow = &info->dstPixels[(size_t)y * dstW * CL_CHANNELS_PER_PIXEL];
+        for (int x = 0; x < dstW; ++x) {
+            memcpy(&dstRow[x * CL_CHANNELS_PER_PIXEL], &srcRow[info->xAxis->tapIndices[x] * CL_CHANNELS_PER_PIXEL], sizeof(float) * CL_CHANNELS_PER_PIXEL);
+        }
+    }
+}
+
+void clPixelMathResize(struct clContext * C, int srcW, int srcH, float * srcPixels, int dstW, int dstH, float * dstPixels, clFilter filter)
+{
+    clResizeTask info;
+    info.C = C;
+    info.xAxis = resizeAxisAcquire(C, srcW, dstW, filter);
+    info.yAxis = resizeAxisAcquire(C, srcH, dstH, filter);
+    info.srcW = srcW;
+    info.srcPixels = srcPixels;
+    info.tmpPixels = NULL;
+    info.dstPixels = dstPixels;
+    info.simd = C->simdAllowed;
+
+    // Rows are cheap on their own; make sure each task gets enough of them to be worth handing out
+    int minRows = CL_MAX(1, 16384 / CL_MAX(dstW, 1));
+    if (filter == CL_FILTER_NEAREST) {
+        clTaskParallelFor(C, dstH, minRows, resizeNearestTaskFunc, &info);
     } else {
-        // use STB!
-        stbir_resize_float_generic(srcPixels,
-                                   srcW,
-                                   srcH,
-                                   srcW * 4 * sizeof(float),
-                                   dstPixels,
-                                   dstW,
-                                   dstH,
-                                   dstW * 4 * sizeof(float),
-                                   4,
-                                   3,
-                                   0,
-                                   STBIR_EDGE_CLAMP,
-                                   (stbir_filter)filter,
-                                   STBIR_COLORSPACE_LINEAR,
-                                   NULL);
+        info.tmpPixels = clPixelPoolAllocate(C, sizeof(float) * CL_CHANNELS_PER_PIXEL * dstW * srcH, clFalse);
+        clTaskParallelFor(C, srcH, minRows, resizeHorizontalTaskFunc, &info);
+        clTaskParallelFor(C, dstH, minRows, resizeVerticalTaskFunc, &info);
+        clPixelPoolFree(C, info.tmpPixels);
     }
+
+    resizeAxisRelease(C, (clResizeAxis *)info.xAxis);
+    resizeAxisRelease(C, (clResizeAxis *)info.yAxis);
 }
@@ -11,6 +11,7 @@
 #include "colorist/embedded.h"
 #include "colorist/pixelmath.h"
 #include "colorist/raw.h"
+#include "colorist/trace.h"
 #include "colorist/transform.h"
 
 #include "lcms2_plugin.h"
@@ -103,7 +104,7 @@ clProfile * clProfileClone(struct clContext * C, clProfile * profile)
     return clone;
 }
 
-clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t iccLen, const char * description)
+static clProfile * profileParse(struct clContext * C, const uint8_t * icc, size_t iccLen, const char * description)
 {
     clProfile * profile = clAllocateStruct(clProfile);
     profile->handle = cmsOpenProfileFromMemTHR(C->lcms, icc, (cmsUInt32Number)iccLen);
@@ -153,6 +154,15 @@ clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t icc
     return profile;
 }
 
+clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t iccLen, const char * description)
+{
+    clTraceSpan span;
+    clTraceBegin(C, &span, "profile parse");
+    clProfile * profile = profileParse(C, icc, iccLen, description);
+    clTraceEnd(C, &span);
+    return profile;
+}
+
 clProfile * clProfileCreate(struct clContext * C, clProfilePrimaries * primaries, clProfileCurve * curve, int maxLuminance, const char * description)
 {
     clProfile * profile = clAllocateStruct(clProfile);
@@ -15,17 +15,28 @@
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#pragma warning(disable : 5031)
+#pragma warning(disable : 5032)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 void clRawRealloc(struct clContext * C, clRaw * raw, size_t newSize)
 {
-    if (raw->size != newSize) {
-        uint8_t * old = raw->ptr;
-        size_t oldSize = raw->size;
+    if ((raw->size != newSize) || raw->mapped) {
+        clRaw old = *raw;
         raw->ptr = clAllocate(newSize);
         raw->size = newSize;
-        if (oldSize) {
-            size_t bytesToCopy = (oldSize < raw->size) ? oldSize : raw->size;
-            memcpy(raw->ptr, old, bytesToCopy);
-            clFree(old);
+        raw->mapped = clFalse;
+        if (old.size) {
+            size_t bytesToCopy = (old.size < raw->size) ? old.size : raw->size;
+            memcpy(raw->ptr, old.ptr, bytesToCopy);
+            clRawFree(C, &old);
         }
     }
 }
@@ -148,9 +159,39 @@ void clRawSet(struct clContext * C, clRaw * raw, const uint8_t * data, size_t le
 
 void clRawFree(struct clContext * C, clRaw * raw)
 {
-    clFree(raw->ptr);
+    if (raw->mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(raw->ptr);
+#else
+        munmap(raw->ptr, raw->size);
+#endif
+    } else {
+        clFree(raw->ptr);
+    }
     raw->ptr = NULL;
     raw->size = 0;
+    raw->mapped = clFalse;
+}
+
+// For files that can't report their size up front (pipes)
+static clBool rawReadStream(struct clContext * C, clRaw * raw, FILE * f, const char * filename)
+{
+    size_t bytesRead = 0;
+    clRawRealloc(C, raw, 64 * 1024);
+    for (;;) {
+        bytesRead += fread(raw->ptr + bytesRead, 1, raw->size - bytesRead, f);
+        if (bytesRead < raw->size) {
+            break;
+        }
+        clRawRealloc(C, raw, raw->size * 2);
+    }
+    if (ferror(f) || (bytesRead == 0)) {
+        clContextLogError(C, "Failed to read file: %s", filename);
+        clRawFree(C, raw);
+        return clFalse;
+    }
+    raw->size = bytesRead;
+    return clTrue;
 }
 
 clBool clRawReadFile(struct clContext * C, clRaw * raw, const char * filename)
@@ -163,8 +204,11 @@ clBool clRawReadFile(struct clContext * C, clRaw * raw, const char * filename)
         clContextLogError(C, "Failed to open file for read: %s", filename);
         return clFalse;
     }
-    fseek(f, 0, SEEK_END);
-    bytes = ftell(f);
+    if (fseek(f, 0, SEEK_END) || ((bytes = ftell(f)) <= 0)) {
+        clBool result = rawReadStream(C, raw, f, filename);
+        fclose(f);
+        return result;
+    }
     fseek(f, 0, SEEK_SET);
 
     clRawRealloc(C, raw, bytes);
@@ -178,6 +222,52 @@ clBool clRawReadFile(struct clContext * C, clRaw * raw, const char * filename)
     return clTrue;
 }
 
+clBool clRawMapFile(struct clContext * C, clRaw * raw, const char * filename)
+{
+    clRawFree(C, raw);
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER fileSize;
+        if ((GetFileType(file) == FILE_TYPE_DISK) && GetFileSizeEx(file, &fileSize) && (fileSize.QuadPart > 0)) {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) {
+                // The view keeps the mapping (and file) alive after their handles are closed
+                void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (view) {
+                    raw->ptr = (uint8_t *)view;
+                    raw->size = (size_t)fileSize.QuadPart;
+                    raw->mapped = clTrue;
+                }
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (!fstat(fd, &st) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+            // The mapping keeps the file alive after fd is closed
+            void * view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                raw->ptr = (uint8_t *)view;
+                raw->size = (size_t)st.st_size;
+                raw->mapped = clTrue;
+            }
+        }
+        close(fd);
+    }
+#endif
+
+    if (raw->mapped) {
+        return clTrue;
+    }
+    return clRawReadFile(C, raw, filename);
+}
+
 clBool clRawReadFileHeader(struct clContext * C, clRaw * raw, const char * filename, size_t bytes)
 {
     FILE * f;
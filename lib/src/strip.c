@@ -0,0 +1,90 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/strip.h"
+
+#include "colorist/context.h"
+#include "colorist/image.h"
+
+clStripReader * clStripReaderCreate(struct clContext * C, struct clImage * image)
+{
+    clStripReader * reader = clAllocateStruct(clStripReader);
+    reader->image = image;
+    reader->rowsRead = 0;
+    reader->nativeData = NULL;
+    reader->readFunc = NULL;
+    reader->destroyFunc = NULL;
+    return reader;
+}
+
+clBool clStripReaderRead(struct clContext * C, clStripReader * reader, struct clImage * strip)
+{
+    if ((strip->width != reader->image->width) || ((reader->rowsRead + strip->height) > reader->image->height)) {
+        clContextLogError(C, "Strip [%dx%d] doesn't fit in the rows left to read", strip->width, strip->height);
+        return clFalse;
+    }
+    if (!reader->readFunc(C, reader, strip)) {
+        return clFalse;
+    }
+    reader->rowsRead += strip->height;
+    return clTrue;
+}
+
+void clStripReaderDestroy(struct clContext * C, clStripReader * reader)
+{
+    if (reader->destroyFunc) {
+        reader->destroyFunc(C, reader);
+    }
+    clImageDestroy(C, reader->image);
+    clFree(reader);
+}
+
+clStripWriter * clStripWriterCreate(struct clContext * C, struct clImage * image)
+{
+    clStripWriter * writer = clAllocateStruct(clStripWriter);
+    writer->image = image;
+    writer->rowsWritten = 0;
+    writer->nativeData = NULL;
+    writer->writeFunc = NULL;
+    writer->finishFunc = NULL;
+    writer->destroyFunc = NULL;
+    return writer;
+}
+
+clBool clStripWriterWrite(struct clContext * C, clStripWriter * writer, struct clImage * strip)
+{
+    if ((strip->width != writer->image->width) || ((writer->rowsWritten + strip->height) > writer->image->height)) {
+        clContextLogError(C, "Strip [%dx%d] doesn't fit in the rows left to write", strip->width, strip->height);
+        return clFalse;
+    }
+    if (!writer->writeFunc(C, writer, strip)) {
+        return clFalse;
+    }
+    writer->rowsWritten += strip->height;
+    return clTrue;
+}
+
+clBool clStripWriterFinish(struct clContext * C, clStripWriter * writer)
+{
+    if (writer->rowsWritten != writer->image->height) {
+        clContextLogError(C, "Only %d of %d rows were written", writer->rowsWritten, writer->image->height);
+        return clFalse;
+    }
+    if (writer->finishFunc) {
+        return writer->finishFunc(C, writer);
+    }
+    return clTrue;
+}
+
+void clStripWriterDestroy(struct clContext * C, clStripWriter * writer)
+{
+    if (writer->destroyFunc) {
+        writer->destroyFunc(C, writer);
+    }
+    clImageDestroy(C, writer->image);
+    clFree(writer);
+}
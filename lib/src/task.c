@@ -11,6 +11,16 @@
 
 static void nativeTaskStart(clContext * C, clTask * task);
 static void nativeTaskJoin(clContext * C, clTask * task);
+static void nativeMutexCreate(clContext * C, clMutex * mutex);
+static void nativeMutexDestroy(clContext * C, clMutex * mutex);
+static void nativePoolCreate(clContext * C, clTaskPool * pool);
+static void nativePoolDestroy(clContext * C, clTaskPool * pool);
+static void nativePoolLock(clTaskPool * pool);
+static void nativePoolUnlock(clTaskPool * pool);
+static void nativePoolWaitForWork(clTaskPool * pool);
+static void nativePoolSignalWork(clTaskPool * pool);
+static void nativePoolWaitForDone(clTaskPool * pool);
+static void nativePoolSignalDone(clTaskPool * pool);
 
 clTask * clTaskCreate(struct clContext * C, clTaskFunc func, void * userData)
 {
@@ -39,6 +49,179 @@ void clTaskDestroy(struct clContext * C, clTask * task)
     clFree(task);
 }
 
+// ---------------------------------------------------------------------------
+// clMutex
+
+clMutex * clMutexCreate(struct clContext * C)
+{
+    clMutex * mutex = clAllocateStruct(clMutex);
+    mutex->nativeData = NULL;
+    nativeMutexCreate(C, mutex);
+    return mutex;
+}
+
+void clMutexDestroy(struct clContext * C, clMutex * mutex)
+{
+    nativeMutexDestroy(C, mutex);
+    clFree(mutex);
+}
+
+// ---------------------------------------------------------------------------
+// clTaskPool
+
+// Hands out chunks of the current job until there are none left. Must be called with the pool locked.
+static void taskPoolDrain(clTaskPool * pool)
+{
+    while (pool->nextItem < pool->itemCount) {
+        int start = pool->nextItem;
+        int count = CL_MIN(pool->chunkSize, pool->itemCount - start);
+        pool->nextItem += count;
+
+        nativePoolUnlock(pool);
+        pool->func(pool->userData, start, count);
+        nativePoolLock(pool);
+
+        pool->itemsRemaining -= count;
+        if (pool->itemsRemaining == 0) {
+            nativePoolSignalDone(pool);
+        }
+    }
+}
+
+static void taskPoolWorker(void * userData)
+{
+    clTaskPool * pool = (clTaskPool *)userData;
+    unsigned int seenGeneration = 0;
+
+    nativePoolLock(pool);
+    for (;;) {
+        while (!pool->shutdown && (pool->generation == seenGeneration)) {
+            nativePoolWaitForWork(pool);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seenGeneration = pool->generation;
+        taskPoolDrain(pool);
+    }
+    nativePoolUnlock(pool);
+}
+
+clTaskPool * clTaskPoolCreate(struct clContext * C, int workerCount)
+{
+    clTaskPool * pool = clAllocateStruct(clTaskPool);
+    pool->workerCount = workerCount;
+    pool->workers = NULL;
+    pool->nativeData = NULL;
+    pool->func = NULL;
+    pool->userData = NULL;
+    pool->itemCount = 0;
+    pool->chunkSize = 1;
+    pool->nextItem = 0;
+    pool->itemsRemaining = 0;
+    pool->generation = 0;
+    pool->busy = clFalse;
+    pool->shutdown = clFalse;
+    nativePoolCreate(C, pool);
+
+    if (workerCount > 0) {
+        pool->workers = clAllocate(workerCount * sizeof(clTask *));
+        for (int i = 0; i < workerCount; ++i) {
+            pool->workers[i] = clTaskCreate(C, taskPoolWorker, pool);
+        }
+    }
+    return pool;
+}
+
+void clTaskPoolDestroy(struct clContext * C, clTaskPool * pool)
+{
+    nativePoolLock(pool);
+    pool->shutdown = clTrue;
+    nativePoolSignalWork(pool);
+    nativePoolUnlock(pool);
+
+    for (int i = 0; i < pool->workerCount; ++i) {
+        clTaskDestroy(C, pool->workers[i]);
+    }
+    if (pool->workers) {
+        clFree(pool->workers);
+    }
+    nativePoolDestroy(C, pool);
+    clFree(pool);
+}
+
+void clTaskPoolRun(struct clContext * C, clTaskPool * pool, int itemCount, int chunkSize, clTaskRangeFunc func, void * userData)
+{
+    COLORIST_UNUSED(C);
+
+    if (itemCount <= 0) {
+        return;
+    }
+
+    nativePoolLock(pool);
+    if (pool->busy) {
+        // Someone else (or an enclosing job on this very thread) owns the workers right now; just
+        // do the work here instead of waiting for them.
+        nativePoolUnlock(pool);
+        func(userData, 0, itemCount);
+        return;
+    }
+
+    pool->busy = clTrue;
+    pool->func = func;
+    pool->userData = userData;
+    pool->itemCount = itemCount;
+    pool->chunkSize = (chunkSize > 0) ? chunkSize : 1;
+    pool->nextItem = 0;
+    pool->itemsRemaining = itemCount;
+    ++pool->generation;
+    nativePoolSignalWork(pool);
+
+    taskPoolDrain(pool);
+    while (pool->itemsRemaining > 0) {
+        nativePoolWaitForDone(pool);
+    }
+
+    pool->func = NULL;
+    pool->userData = NULL;
+    pool->busy = clFalse;
+    nativePoolUnlock(pool);
+}
+
+void clTaskParallelFor(struct clContext * C, int itemCount, int minChunkSize, clTaskRangeFunc func, void * userData)
+{
+    int chunkCount;
+    int chunkSize;
+
+    if (itemCount <= 0) {
+        return;
+    }
+    if (minChunkSize < 1) {
+        minChunkSize = 1;
+    }
+    if ((C->jobs <= 1) || (itemCount <= minChunkSize)) {
+        func(userData, 0, itemCount);
+        return;
+    }
+
+    if (C->taskPool && (C->taskPool->workerCount != (C->jobs - 1))) {
+        // -j changed since the pool was made
+        clTaskPoolDestroy(C, C->taskPool);
+        C->taskPool = NULL;
+    }
+    if (!C->taskPool) {
+        C->taskPool = clTaskPoolCreate(C, C->jobs - 1);
+    }
+
+    // A few chunks per thread keeps everyone busy when chunks take uneven amounts of time
+    chunkCount = C->jobs * 4;
+    chunkSize = (itemCount + chunkCount - 1) / chunkCount;
+    if (chunkSize < minChunkSize) {
+        chunkSize = minChunkSize;
+    }
+    clTaskPoolRun(C, C->taskPool, itemCount, chunkSize, func, userData);
+}
+
 #ifdef _WIN32
 
 #pragma warning(disable : 5031)
@@ -54,6 +237,11 @@ int clTaskLimit(void)
     return numCPU;
 }
 
+uint64_t clTaskCurrentThreadID(void)
+{
+    return (uint64_t)GetCurrentThreadId();
+}
+
 typedef struct clNativeTask
 {
     HANDLE hThread;
@@ -83,6 +271,86 @@ static void nativeTaskJoin(clContext * C, clTask * task)
     task->nativeData = NULL;
 }
 
+static void nativeMutexCreate(clContext * C, clMutex * mutex)
+{
+    CRITICAL_SECTION * lock = clAllocateStruct(CRITICAL_SECTION);
+    InitializeCriticalSection(lock);
+    mutex->nativeData = lock;
+}
+
+static void nativeMutexDestroy(clContext * C, clMutex * mutex)
+{
+    DeleteCriticalSection((CRITICAL_SECTION *)mutex->nativeData);
+    clFree(mutex->nativeData);
+    mutex->nativeData = NULL;
+}
+
+void clMutexLock(clMutex * mutex)
+{
+    EnterCriticalSection((CRITICAL_SECTION *)mutex->nativeData);
+}
+
+void clMutexUnlock(clMutex * mutex)
+{
+    LeaveCriticalSection((CRITICAL_SECTION *)mutex->nativeData);
+}
+
+typedef struct clNativePool
+{
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE workCond;
+    CONDITION_VARIABLE doneCond;
+} clNativePool;
+
+static void nativePoolCreate(clContext * C, clTaskPool * pool)
+{
+    clNativePool * nativePool = clAllocateStruct(clNativePool);
+    InitializeCriticalSection(&nativePool->lock);
+    InitializeConditionVariable(&nativePool->workCond);
+    InitializeConditionVariable(&nativePool->doneCond);
+    pool->nativeData = nativePool;
+}
+
+static void nativePoolDestroy(clContext * C, clTaskPool * pool)
+{
+    clNativePool * nativePool = (clNativePool *)pool->nativeData;
+    DeleteCriticalSection(&nativePool->lock);
+    clFree(pool->nativeData);
+    pool->nativeData = NULL;
+}
+
+static void nativePoolLock(clTaskPool * pool)
+{
+    EnterCriticalSection(&((clNativePool *)pool->nativeData)->lock);
+}
+
+static void nativePoolUnlock(clTaskPool * pool)
+{
+    LeaveCriticalSection(&((clNativePool *)pool->nativeData)->lock);
+}
+
+static void nativePoolWaitForWork(clTaskPool * pool)
+{
+    clNativePool * nativePool = (clNativePool *)pool->nativeData;
+    SleepConditionVariableCS(&nativePool->workCond, &nativePool->lock, INFINITE);
+}
+
+static void nativePoolSignalWork(clTaskPool * pool)
+{
+    WakeAllConditionVariable(&((clNativePool *)pool->nativeData)->workCond);
+}
+
+static void nativePoolWaitForDone(clTaskPool * pool)
+{
+    clNativePool * nativePool = (clNativePool *)pool->nativeData;
+    SleepConditionVariableCS(&nativePool->doneCond, &nativePool->lock, INFINITE);
+}
+
+static void nativePoolSignalDone(clTaskPool * pool)
+{
+    WakeAllConditionVariable(&((clNativePool *)pool->nativeData)->doneCond);
+}
+
 #else /* ifdef _WIN32 */
 
 #ifdef __APPLE__
@@ -127,6 +395,11 @@ int clTaskLimit()
 
 #include <pthread.h>
 
+uint64_t clTaskCurrentThreadID(void)
+{
+    return (uint64_t)(uintptr_t)pthread_self();
+}
+
 typedef struct clNativeTask
 {
     pthread_t pthread;
@@ -154,4 +427,86 @@ static void nativeTaskJoin(clContext * C, clTask * task)
     task->nativeData = NULL;
 }
 
+static void nativeMutexCreate(clContext * C, clMutex * mutex)
+{
+    pthread_mutex_t * lock = clAllocateStruct(pthread_mutex_t);
+    pthread_mutex_init(lock, NULL);
+    mutex->nativeData = lock;
+}
+
+static void nativeMutexDestroy(clContext * C, clMutex * mutex)
+{
+    pthread_mutex_destroy((pthread_mutex_t *)mutex->nativeData);
+    clFree(mutex->nativeData);
+    mutex->nativeData = NULL;
+}
+
+void clMutexLock(clMutex * mutex)
+{
+    pthread_mutex_lock((pthread_mutex_t *)mutex->nativeData);
+}
+
+void clMutexUnlock(clMutex * mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mutex->nativeData);
+}
+
+typedef struct clNativePool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+} clNativePool;
+
+static void nativePoolCreate(clContext * C, clTaskPool * pool)
+{
+    clNativePool * nativePool = clAllocateStruct(clNativePool);
+    pthread_mutex_init(&nativePool->lock, NULL);
+    pthread_cond_init(&nativePool->workCond, NULL);
+    pthread_cond_init(&nativePool->doneCond, NULL);
+    pool->nativeData = nativePool;
+}
+
+static void nativePoolDestroy(clContext * C, clTaskPool * pool)
+{
+    clNativePool * nativePool = (clNativePool *)pool->nativeData;
+    pthread_cond_destroy(&nativePool->doneCond);
+    pthread_cond_destroy(&nativePool->workCond);
+    pthread_mutex_destroy(&nativePool->lock);
+    clFree(pool->nativeData);
+    pool->nativeData = NULL;
+}
+
+static void nativePoolLock(clTaskPool * pool)
+{
+    pthread_mutex_lock(&((clNativePool *)pool->nativeData)->lock);
+}
+
+static void nativePoolUnlock(clTaskPool * pool)
+{
+    pthread_mutex_unlock(&((clNativePool *)pool->nativeData)->lock);
+}
+
+static void nativePoolWaitForWork(clTaskPool * pool)
+{
+    clNativePool * nativePool = (clNativePool *)pool->nativeData;
+    pthread_cond_wait(&nativePool->workCond, &nativePool->lock);
+}
+
+static void nativePoolSignalWork(clTaskPool * pool)
+{
+    pthread_cond_broadcast(&((clNativePool *)pool->nativeData)->workCond);
+}
+
+static void nativePoolWaitForDone(clTaskPool * pool)
+{
+    clNativePool * nativePool = (clNativePool *)pool->nativeData;
+    pthread_cond_wait(&nativePool->doneCond, &nativePool->lock);
+}
+
+static void nativePoolSignalDone(clTaskPool * pool)
+{
+    pthread_cond_broadcast(&((clNativePool *)pool->nativeData)->doneCond);
+}
+
 #endif /* ifdef _WIN32 */
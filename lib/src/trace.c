@@ -0,0 +1,267 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/trace.h"
+
+#include "colorist/context.h"
+#include "colorist/image.h"
+#include "colorist/task.h"
+
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char * counterNames[CL_TRACE_COUNTER_COUNT] = { "bytesRead", "bytesWritten", "pixelsTransformed" };
+
+clTrace * clTraceCreate(struct clContext * C)
+{
+    clTrace * trace = clAllocateStruct(clTrace);
+    timerStart(&trace->epoch);
+    trace->events = NULL;
+    trace->eventCount = 0;
+    trace->eventCapacity = 0;
+    trace->threadCount = 0;
+    memset(trace->counters, 0, sizeof(trace->counters));
+    trace->lock = clMutexCreate(C);
+    return trace;
+}
+
+void clTraceDestroy(struct clContext * C, clTrace * trace)
+{
+    if (trace->events) {
+        clFree(trace->events);
+    }
+    clMutexDestroy(C, trace->lock);
+    clFree(trace);
+}
+
+void clTraceBegin(struct clContext * C, clTraceSpan * span, const char * name)
+{
+    span->name = name;
+    span->start = C->trace ? timerElapsedSeconds(&C->trace->epoch) : 0.0;
+}
+
+// Call with trace->lock held
+static int traceThreadIndex(clTrace * trace)
+{
+    uint64_t threadID = clTaskCurrentThreadID();
+    for (int i = 0; i < trace->threadCount; ++i) {
+        if (trace->threadIDs[i] == threadID) {
+            return i;
+        }
+    }
+    if (trace->threadCount < CL_TRACE_MAX_THREADS) {
+        trace->threadIDs[trace->threadCount] = threadID;
+        return trace->threadCount++;
+    }
+    return CL_TRACE_MAX_THREADS - 1;
+}
+
+void clTraceEnd(struct clContext * C, clTraceSpan * span)
+{
+    clTrace * trace = C->trace;
+    if (!trace) {
+        return;
+    }
+
+    double end = timerElapsedSeconds(&trace->epoch);
+    clMutexLock(trace->lock);
+    if (trace->eventCount == trace->eventCapacity) {
+        int newCapacity = (trace->eventCapacity > 0) ? trace->eventCapacity * 2 : 256;
+        clTraceEvent * newEvents = clAllocate(sizeof(clTraceEvent) * newCapacity);
+        if (trace->events) {
+            memcpy(newEvents, trace->events, sizeof(clTraceEvent) * trace->eventCount);
+            clFree(trace->events);
+        }
+        trace->events = newEvents;
+        trace->eventCapacity = newCapacity;
+    }
+    clTraceEvent * event = &trace->events[trace->eventCount++];
+    event->name = span->name;
+    event->start = span->start;
+    event->duration = end - span->start;
+    event->thread = traceThreadIndex(trace);
+    clMutexUnlock(trace->lock);
+}
+
+void clTraceCount(struct clContext * C, clTraceCounter counter, uint64_t amount)
+{
+    clTrace * trace = C->trace;
+    if (!trace) {
+        return;
+    }
+
+    clMutexLock(trace->lock);
+    trace->counters[counter] += amount;
+    clMutexUnlock(trace->lock);
+}
+
+static void addCounters(struct clContext * C, clTrace * trace, cJSON * counters)
+{
+    for (int i = 0; i < CL_TRACE_COUNTER_COUNT; ++i) {
+        cJSON_AddNumberToObject(counters, counterNames[i], (double)trace->counters[i]);
+    }
+    int allocations, reuses;
+    clPixelPoolGetStats(C, &allocations, &reuses);
+    cJSON_AddNumberToObject(counters, "pixelBufferAllocations", allocations);
+    cJSON_AddNumberToObject(counters, "pixelBufferReuses", reuses);
+}
+
+clBool clTraceWriteChrome(struct clContext * C, const char * filename)
+{
+    clTrace * trace = C->trace;
+    if (!trace) {
+        clContextLogError(C, "Tracing isn't enabled");
+        return clFalse;
+    }
+
+    cJSON * json = cJSON_CreateObject();
+    cJSON * traceEvents = cJSON_CreateArray();
+    cJSON_AddItemToObject(json, "traceEvents", traceEvents);
+    cJSON_AddStringToObject(json, "displayTimeUnit", "ms");
+
+    clMutexLock(trace->lock);
+    double end = timerElapsedSeconds(&trace->epoch);
+    for (int i = 0; i < trace->threadCount; ++i) {
+        char threadName[32];
+        if (i == 0) {
+            strcpy(threadName, "main");
+        } else {
+            snprintf(threadName, sizeof(threadName), "worker %d", i);
+        }
+        cJSON * metadata = cJSON_CreateObject();
+        cJSON_AddStringToObject(metadata, "name", "thread_name");
+        cJSON_AddStringToObject(metadata, "ph", "M");
+        cJSON_AddNumberToObject(metadata, "pid", 1);
+        cJSON_AddNumberToObject(metadata, "tid", i);
+        cJSON * args = cJSON_CreateObject();
+        cJSON_AddStringToObject(args, "name", threadName);
+        cJSON_AddItemToObject(metadata, "args", args);
+        cJSON_AddItemToArray(traceEvents, metadata);
+    }
+    for (int i = 0; i < trace->eventCount; ++i) {
+        clTraceEvent * event = &trace->events[i];
+        cJSON * jsonEvent = cJSON_CreateObject();
+        cJSON_AddStringToObject(jsonEvent, "name", event->name);
+        cJSON_AddStringToObject(jsonEvent, "ph", "X");
+        cJSON_AddNumberToObject(jsonEvent, "ts", event->start * 1000000.0);
+        cJSON_AddNumberToObject(jsonEvent, "dur", event->duration * 1000000.0);
+        cJSON_AddNumberToObject(jsonEvent, "pid", 1);
+        cJSON_AddNumberToObject(jsonEvent, "tid", event->thread);
+        cJSON_AddItemToArray(traceEvents, jsonEvent);
+    }
+    cJSON * counterEvent = cJSON_CreateObject();
+    cJSON_AddStringToObject(counterEvent, "name", "counters");
+    cJSON_AddStringToObject(counterEvent, "ph", "C");
+    cJSON_AddNumberToObject(counterEvent, "ts", end * 1000000.0);
+    cJSON_AddNumberToObject(counterEvent, "pid", 1);
+    cJSON_AddNumberToObject(counterEvent, "tid", 0);
+    cJSON * counters = cJSON_CreateObject();
+    addCounters(C, trace, counters);
+    cJSON_AddItemToObject(counterEvent, "args", counters);
+    cJSON_AddItemToArray(traceEvents, counterEvent);
+    clMutexUnlock(trace->lock);
+
+    clBool result = clFalse;
+    char * text = cJSON_PrintUnformatted(json);
+    FILE * f = fopen(filename, "wb");
+    if (f) {
+        result = (fwrite(text, strlen(text), 1, f) == 1) ? clTrue : clFalse;
+        fclose(f);
+    }
+    if (!result) {
+        clContextLogError(C, "Failed to write trace: %s", filename);
+    }
+    free(text);
+    cJSON_Delete(json);
+    return result;
+}
+
+static int compareEventsByThreadThenStart(const void * a, const void * b)
+{
+    const clTraceEvent * ea = (const clTraceEvent *)a;
+    const clTraceEvent * eb = (const clTraceEvent *)b;
+    if (ea->thread != eb->thread) {
+        return ea->thread - eb->thread;
+    }
+    return (ea->start < eb->start) ? -1 : ((ea->start > eb->start) ? 1 : 0);
+}
+
+void clTraceSummarize(struct clContext * C, struct cJSON * output)
+{
+    clTrace * trace = C->trace;
+    if (!trace) {
+        return;
+    }
+
+    cJSON * summary = cJSON_CreateObject();
+    cJSON * spans = cJSON_CreateObject();
+    cJSON * threads = cJSON_CreateArray();
+    cJSON * counters = cJSON_CreateObject();
+
+    clMutexLock(trace->lock);
+    double wallSeconds = timerElapsedSeconds(&trace->epoch);
+    cJSON_AddNumberToObject(summary, "wallSeconds", wallSeconds);
+
+    // Totals per span name (nested spans count toward both)
+    for (int i = 0; i < trace->eventCount; ++i) {
+        clTraceEvent * event = &trace->events[i];
+        cJSON * span = cJSON_GetObjectItemCaseSensitive(spans, event->name);
+        if (!span) {
+            span = cJSON_CreateObject();
+            cJSON_AddNumberToObject(span, "count", 0);
+            cJSON_AddNumberToObject(span, "totalSeconds", 0);
+            cJSON_AddNumberToObject(span, "maxSeconds", 0);
+            cJSON_AddItemToObject(spans, event->name, span);
+        }
+        cJSON * count = cJSON_GetObjectItemCaseSensitive(span, "count");
+        cJSON * total = cJSON_GetObjectItemCaseSensitive(span, "totalSeconds");
+        cJSON * max = cJSON_GetObjectItemCaseSensitive(span, "maxSeconds");
+        cJSON_SetNumberValue(count, count->valuedouble + 1.0);
+        cJSON_SetNumberValue(total, total->valuedouble + event->duration);
+        if (max->valuedouble < event->duration) {
+            cJSON_SetNumberValue(max, event->duration);
+        }
+    }
+
+    // Busy time per thread is the union of its spans, so nesting doesn't count twice
+    if (trace->eventCount > 0) {
+        clTraceEvent * sorted = clAllocate(sizeof(clTraceEvent) * trace->eventCount);
+        memcpy(sorted, trace->events, sizeof(clTraceEvent) * trace->eventCount);
+        qsort(sorted, trace->eventCount, sizeof(clTraceEvent), compareEventsByThreadThenStart);
+        int eventIndex = 0;
+        while (eventIndex < trace->eventCount) {
+            int thread = sorted[eventIndex].thread;
+            double busySeconds = 0.0;
+            double coveredUntil = 0.0;
+            for (; (eventIndex < trace->eventCount) && (sorted[eventIndex].thread == thread); ++eventIndex) {
+                double start = CL_MAX(sorted[eventIndex].start, coveredUntil);
+                double end = sorted[eventIndex].start + sorted[eventIndex].duration;
+                if (end > start) {
+                    busySeconds += end - start;
+                    coveredUntil = end;
+                }
+            }
+            cJSON * jsonThread = cJSON_CreateObject();
+            cJSON_AddNumberToObject(jsonThread, "thread", thread);
+            cJSON_AddNumberToObject(jsonThread, "busySeconds", busySeconds);
+            cJSON_AddNumberToObject(jsonThread, "utilization", (wallSeconds > 0.0) ? busySeconds / wallSeconds : 0.0);
+            cJSON_AddItemToArray(threads, jsonThread);
+        }
+        clFree(sorted);
+    }
+
+    addCounters(C, trace, counters);
+    clMutexUnlock(trace->lock);
+
+    cJSON_AddItemToObject(summary, "spans", spans);
+    cJSON_AddItemToObject(summary, "threads", threads);
+    cJSON_AddItemToObject(summary, "counters", counters);
+    cJSON_AddItemToObject(output, "trace", summary);
+}
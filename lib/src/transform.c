@@ -4,6 +4,7 @@
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
 #include "colorist/task.h"
+#include "colorist/trace.h"
 
 #include "gb_math.h"
 
@@ -15,11 +16,22 @@
 // this close.)
 #define AUTO_TONEMAP_LUMINANCE_SCALE_THRESHOLD (1.001f)
 
+// The dst OETF LUT covers [2^-OETF_LUT_OCTAVES, 1), with 2^OETF_LUT_MANTISSA_BITS linearly
+// interpolated segments per octave. Spacing the entries by octave keeps them dense where every
+// OETF is steepest (near 0), where evenly spaced entries would need millions of entries to be accurate.
+#define OETF_LUT_OCTAVES 32
+#define OETF_LUT_MANTISSA_BITS 8
+#define OETF_LUT_SIZE ((OETF_LUT_OCTAVES << OETF_LUT_MANTISSA_BITS) + 1)
+#define OETF_LUT_FRACTION_BITS (23 - OETF_LUT_MANTISSA_BITS)
+#define OETF_LUT_FIRST_INDEX ((uint32_t)(127 - OETF_LUT_OCTAVES) << OETF_LUT_MANTISSA_BITS)
+
 #define SRC_FLOAT_HAS_ALPHA() (srcChannelCount > 3)
 #define DST_FLOAT_HAS_ALPHA() (dstChannelCount > 3)
 
 static cmsUInt32Number clTransformFormatToLCMSFormat(struct clContext * C, clTransformFormat format);
 static int clTransformFormatToChannelCount(struct clContext * C, clTransformFormat format);
+static clBool transformCacheTake(struct clContext * C, clTransform * transform);
+static clBool transformCachePut(struct clContext * C, clTransform * transform);
 
 // ----------------------------------------------------------------------------
 // Debug Helpers
@@ -54,15 +66,20 @@ static const float PQ_C3 = 18.6875;         // 2392.0 / 4096.0 * 32.0
 static const float PQ_M1 = 0.1593017578125; // 2610.0 / 4096.0 / 4.0
 static const float PQ_M2 = 78.84375;        // 2523.0 / 4096.0 * 128.0
 
+// Both PQ equations below lean on c2 - c3 == 1 - c1. N^(1/m2) and the Equation 5.2 base both live
+// near 1, and subtracting c1 from (or raising ~1 to the m2) a float that close to 1 throws away most
+// of its precision (almost 1 LSB at 16-bit). Working with their distance from 1 instead (via expm1
+// and log1p) keeps the curves accurate to a small fraction of an LSB.
+
 // SMPTE ST.2084: Equation 4.1
 // L = ( (max(N^(1/m2) - c1, 0)) / (c2 - c3*N^(1/m2)) )^(1/m1)
 float clTransformEOTF_PQ(float N)
 {
-    float N1m2 = powf(N, 1 / PQ_M2);
-    float N1m2c1 = N1m2 - PQ_C1;
+    float N1m2Minus1 = expm1f(logf(N) / PQ_M2); // N^(1/m2) - 1
+    float N1m2c1 = N1m2Minus1 + (1.0f - PQ_C1);
     if (N1m2c1 < 0.0f)
         N1m2c1 = 0.0f;
-    float c2c3N1m2 = PQ_C2 - (PQ_C3 * N1m2);
+    float c2c3N1m2 = (PQ_C2 - PQ_C3) - (PQ_C3 * N1m2Minus1);
     return powf(N1m2c1 / c2c3N1m2, 1 / PQ_M1);
 }
 
@@ -71,9 +88,8 @@ float clTransformEOTF_PQ(float N)
 float clTransformOETF_PQ(float L)
 {
     float Lm1 = powf(L, PQ_M1);
-    float c2Lm1 = PQ_C2 * Lm1;
-    float c3Lm1 = PQ_C3 * Lm1;
-    return powf((PQ_C1 + c2Lm1) / (1 + c3Lm1), PQ_M2);
+    float baseMinus1 = ((PQ_C1 - 1.0f) * (1.0f - Lm1)) / (1 + (PQ_C3 * Lm1));
+    return expf(PQ_M2 * log1pf(baseMinus1));
 }
 
 static const float HLG_A = 0.17883277f;
@@ -107,6 +123,125 @@ static float HLG_OETF(float L, float maxLuminance)
     return HLG_A * logf((12.0f * N) - HLG_B) + HLG_C;
 }
 
+static float exactSrcEOTF(const clTransform * transform, float N)
+{
+    N = (N >= 0.0f) ? N : 0.0f;
+    switch (transform->ccmmSrcEOTF) {
+        case CL_XTF_GAMMA:
+            return powf(N, transform->ccmmSrcGamma);
+        case CL_XTF_HLG:
+            return HLG_EOTF(N, transform->ccmmHLGLuminance);
+        case CL_XTF_PQ:
+            return clTransformEOTF_PQ(N);
+        case CL_XTF_NONE:
+            break;
+    }
+    return N;
+}
+
+static float exactDstOETF(const clTransform * transform, float L)
+{
+    L = (L >= 0.0f) ? L : 0.0f;
+    switch (transform->ccmmDstOETF) {
+        case CL_XTF_GAMMA:
+            return powf(L, transform->ccmmDstInvGamma);
+        case CL_XTF_HLG:
+            return HLG_OETF(L, transform->ccmmHLGLuminance);
+        case CL_XTF_PQ:
+            return clTransformOETF_PQ(L);
+        case CL_XTF_NONE:
+            break;
+    }
+    return L;
+}
+
+static float lookupSrcEOTF(const clTransform * transform, float N)
+{
+    int maxIndex = (1 << transform->lutSrcDepth) - 1;
+    int index = (int)((N * (float)maxIndex) + 0.5f);
+    index = CL_CLAMP(index, 0, maxIndex);
+    return transform->lutSrcEOTF[index];
+}
+
+static float lookupDstOETF(const clTransform * transform, float L)
+{
+    uint32_t bits;
+    uint32_t index;
+    float fraction;
+
+    if (L <= 0.0f) {
+        return transform->lutDstOETFZero;
+    }
+    memcpy(&bits, &L, sizeof(bits));
+    index = bits >> OETF_LUT_FRACTION_BITS;
+    if (!(L < 1.0f) || (index < OETF_LUT_FIRST_INDEX)) {
+        // Overranged (or tiny enough to not be worth a table entry)
+        return exactDstOETF(transform, L);
+    }
+    index -= OETF_LUT_FIRST_INDEX;
+    fraction = (float)(bits & ((1 << OETF_LUT_FRACTION_BITS) - 1)) * (1.0f / (float)(1 << OETF_LUT_FRACTION_BITS));
+    return transform->lutDstOETF[index] + ((transform->lutDstOETF[index + 1] - transform->lutDstOETF[index]) * fraction);
+}
+
+static void prepareLUTs(struct clContext * C, struct clTransform * transform)
+{
+    if (transform->ccmmSrcEOTF != CL_XTF_NONE) {
+        int count = 1 << transform->lutSrcDepth;
+        float maxChannel = (float)(count - 1);
+        transform->lutSrcEOTF = clAllocate(sizeof(float) * count);
+        for (int i = 0; i < count; ++i) {
+            // Matches how clImagePrepareReadPixels() builds F32 pixels from U8/U16
+            transform->lutSrcEOTF[i] = exactSrcEOTF(transform, (float)i / maxChannel);
+        }
+    }
+
+    transform->lutDstOETFMaxError = 0.0f;
+    if (transform->ccmmDstOETF != CL_XTF_NONE) {
+        transform->lutDstOETF = clAllocate(sizeof(float) * OETF_LUT_SIZE);
+        for (uint32_t i = 0; i < OETF_LUT_SIZE; ++i) {
+            uint32_t bits = (OETF_LUT_FIRST_INDEX + i) << OETF_LUT_FRACTION_BITS;
+            float L;
+            memcpy(&L, &bits, sizeof(L));
+            transform->lutDstOETF[i] = exactDstOETF(transform, L);
+        }
+        transform->lutDstOETFZero = exactDstOETF(transform, 0.0f);
+
+        // Interpolation error peaks somewhere in the middle of each segment
+        for (uint32_t i = 0; i < (OETF_LUT_SIZE - 1); ++i) {
+            uint32_t bits = ((OETF_LUT_FIRST_INDEX + i) << OETF_LUT_FRACTION_BITS) | (1 << (OETF_LUT_FRACTION_BITS - 1));
+            float L;
+            float error;
+            memcpy(&L, &bits, sizeof(L));
+            error = fabsf(lookupDstOETF(transform, L) - exactDstOETF(transform, L));
+            if (transform->lutDstOETFMaxError < error) {
+                transform->lutDstOETFMaxError = error;
+            }
+        }
+    }
+    transform->lutReady = clTrue;
+
+    clContextLog(C,
+                 "lut",
+                 1,
+                 "CCMM LUTs: %d src EOTF entries, %d dst OETF entries (max error: %.4f 16-bit codes)",
+                 transform->lutSrcEOTF ? (1 << transform->lutSrcDepth) : 0,
+                 transform->lutDstOETF ? OETF_LUT_SIZE : 0,
+                 transform->lutDstOETFMaxError * 65535.0f);
+}
+
+static void freeLUTs(struct clContext * C, struct clTransform * transform)
+{
+    if (transform->lutSrcEOTF) {
+        clFree(transform->lutSrcEOTF);
+        transform->lutSrcEOTF = NULL;
+    }
+    if (transform->lutDstOETF) {
+        clFree(transform->lutDstOETF);
+        transform->lutDstOETF = NULL;
+    }
+    transform->lutReady = clFalse;
+}
+
 static float hlgDiffuseWhite(float peakWhite)
 {
     float base = (expf((0.75f - HLG_C) / HLG_A) + HLG_B) / 12.0f;
@@ -215,8 +350,17 @@ static clBool derivePrimariesAndXTF(struct clContext * C,
 
 void clTransformPrepare(struct clContext * C, struct clTransform * transform)
 {
+    if (!transform->ccmmReady && !transform->lcmsReady) {
+        if (transformCacheTake(C, transform)) {
+            return;
+        }
+    }
+
     clBool useCCMM = clTransformUsesCCMM(C, transform);
-    if ((useCCMM && !transform->ccmmReady) || (!useCCMM && !transform->lcmsReady)) {
+    clBool preparing = (useCCMM && !transform->ccmmReady) || (!useCCMM && !transform->lcmsReady);
+    clTraceSpan span;
+    clTraceBegin(C, &span, "transform prepare");
+    if (preparing) {
         // Calculate luminance scaling
 
         // Default to D65, allow either profile to override it, with the priority: dst > src > D65
@@ -299,9 +443,10 @@ void clTransformPrepare(struct clContext * C, struct clTransform * transform)
                 break;
         }
 
-        if (!useCCMM || !transform->srcProfile || !transform->dstProfile || transform->tonemapEnabled ||
-            (fabsf((transform->srcLuminanceScale * transform->srcCurveScale) -
-                   (transform->dstLuminanceScale * transform->dstCurveScale)) > 0.00001f)) {
+        // LittleCMS applies both curve scales itself, so only the luminances need to match there
+        float srcScale = transform->srcLuminanceScale * (useCCMM ? transform->srcCurveScale : 1.0f);
+        float dstScale = transform->dstLuminanceScale * (useCCMM ? transform->dstCurveScale : 1.0f);
+        if (!transform->srcProfile || !transform->dstProfile || transform->tonemapEnabled || (fabsf(srcScale - dstScale) > 0.00001f)) {
             transform->luminanceScaleEnabled = clTrue;
         } else {
             transform->luminanceScaleEnabled = clFalse;
@@ -348,6 +493,10 @@ void clTransformPrepare(struct clContext * C, struct clTransform * transform)
 
             transform->ccmmReady = clTrue;
         }
+
+        if ((transform->lutSrcDepth > 0) && !transform->lutReady) {
+            prepareLUTs(C, transform);
+        }
     } else {
         // Prepare LittleCMS
         if (!transform->lcmsReady) {
@@ -399,6 +548,112 @@ void clTransformPrepare(struct clContext * C, struct clTransform * transform)
             transform->lcmsReady = clTrue;
         }
     }
+    if (preparing) {
+        clTraceEnd(C, &span);
+    }
+}
+
+// Luminance scales (and tonemaps, if enabled) a single XYZ value in place
+static void scaleLuminance(struct clContext * C, struct clTransform * transform, clBool useCCMM, float XYZ[3])
+{
+    float xyY[3];
+
+    // if tonemapping is necessary, luminance scale MUST be enabled
+    COLORIST_ASSERT(!transform->tonemapEnabled || transform->luminanceScaleEnabled);
+
+    // Convert to xyY
+    clTransformXYZToXYY(C, xyY, XYZ, transform->whitePointX, transform->whitePointY);
+
+    // Apply srcCurveScale as CCMM, if any (LCMS implicitly does this)
+    if (useCCMM) {
+        xyY[2] *= transform->srcCurveScale;
+    }
+
+    // Luminance scale
+    xyY[2] *= transform->srcLuminanceScale;
+    xyY[2] /= transform->dstLuminanceScale;
+
+    // Apply inverse dstCurveScale prior to tonemapping to ensure tonemap gets [0-1] range
+    xyY[2] /= transform->dstCurveScale;
+
+    // Tonemap
+    if (transform->tonemapEnabled) {
+        // reinhard tonemap, with additional tuning (see context.h for attribution)
+        float z = powf(xyY[2] > 0.0f ? xyY[2] : 0.0f, transform->tonemapParams.contrast);
+        xyY[2] = z / ((powf(z, transform->tonemapParams.power) * transform->tonemapParams.clipPoint) + transform->tonemapParams.speed);
+    }
+
+    if (!useCCMM) {
+        // Re-apply dst scale for LCMS as it expects the XYZ->Dst input to be overranged
+        xyY[2] *= transform->dstCurveScale;
+    }
+
+    // Convert to XYZ
+    clTransformXYYToXYZ(C, XYZ, xyY);
+}
+
+// Each cmsDoTransform() call has a fair amount of fixed overhead, so LittleCMS is handed this many pixels at a time
+// (packed into 3 channel tiles, as the LittleCMS side of every transform format is 3 floats)
+#define LCMS_TILE_PIXELS 1024
+
+static void lcmsConvert(struct clContext * C,
+                        struct clTransform * transform,
+                        float * srcPixels,
+                        int srcChannelCount,
+                        float * dstPixels,
+                        int dstChannelCount,
+                        int pixelCount)
+{
+    float srcTile[LCMS_TILE_PIXELS * 3];
+    float xyzTile[LCMS_TILE_PIXELS * 3];
+    float dstTile[LCMS_TILE_PIXELS * 3];
+
+    for (int tileStart = 0; tileStart < pixelCount; tileStart += LCMS_TILE_PIXELS) {
+        int tileCount = CL_MIN(LCMS_TILE_PIXELS, pixelCount - tileStart);
+        const float * tileSrcPixels = &srcPixels[tileStart * srcChannelCount];
+        float * tileDstPixels = &dstPixels[tileStart * dstChannelCount];
+
+        const float * lcmsSrc = tileSrcPixels;
+        if (srcChannelCount != 3) {
+            for (int i = 0; i < tileCount; ++i) {
+                memcpy(&srcTile[i * 3], &tileSrcPixels[i * srcChannelCount], sizeof(float) * 3);
+            }
+            lcmsSrc = srcTile;
+        }
+
+        if (transform->luminanceScaleEnabled) {
+            cmsDoTransform(transform->lcmsSrcToXYZ, lcmsSrc, xyzTile, (cmsUInt32Number)tileCount);
+            for (int i = 0; i < tileCount; ++i) {
+                scaleLuminance(C, transform, clFalse, &xyzTile[i * 3]);
+            }
+            cmsDoTransform(transform->lcmsXYZToDst, xyzTile, dstTile, (cmsUInt32Number)tileCount);
+        } else {
+            cmsDoTransform(transform->lcmsCombined, lcmsSrc, dstTile, (cmsUInt32Number)tileCount);
+        }
+
+        for (int i = 0; i < tileCount; ++i) {
+            const float * srcPixel = &tileSrcPixels[i * srcChannelCount];
+            float * dstPixel = &tileDstPixels[i * dstChannelCount];
+            const float * lcmsPixel = &dstTile[i * 3];
+            if (transform->dstProfile) {                 // don't clamp XYZ
+                dstPixel[0] = CL_MAX(lcmsPixel[0], 0.0f); // clamp (allow overranging)
+                dstPixel[1] = CL_MAX(lcmsPixel[1], 0.0f); // clamp (allow overranging)
+                dstPixel[2] = CL_MAX(lcmsPixel[2], 0.0f); // clamp (allow overranging)
+            } else {
+                memcpy(dstPixel, lcmsPixel, sizeof(float) * 3);
+            }
+
+            if (DST_FLOAT_HAS_ALPHA()) {
+                if (SRC_FLOAT_HAS_ALPHA()) {
+                    // Copy alpha
+                    dstPixel[3] = srcPixel[3];
+                } else {
+                    // Full alpha
+                    dstPixel[3] = 1.0f;
+                }
+            }
+        }
+    }
 }
 
 // The real color conversion function
@@ -411,13 +666,25 @@ static void colorConvert(struct clContext * C,
                          int dstChannelCount,
                          int pixelCount)
 {
+    if (!useCCMM) {
+        lcmsConvert(C, transform, srcPixels, srcChannelCount, dstPixels, dstChannelCount, pixelCount);
+        return;
+    }
+    if (clTransformSIMDConvert(C, transform, srcPixels, srcChannelCount, dstPixels, dstChannelCount, pixelCount)) {
+        return;
+    }
+
     for (int i = 0; i < pixelCount; ++i) {
         float * srcPixel = &srcPixels[i * srcChannelCount];
         float * dstPixel = &dstPixels[i * dstChannelCount];
         gbVec3 src;
         float XYZ[3];
 
-        if (useCCMM) {
+        if (transform->lutSrcEOTF) {
+            src.x = lookupSrcEOTF(transform, srcPixel[0]);
+            src.y = lookupSrcEOTF(transform, srcPixel[1]);
+            src.z = lookupSrcEOTF(transform, srcPixel[2]);
+        } else {
             switch (transform->ccmmSrcEOTF) {
                 default:
                 case CL_XTF_NONE:
@@ -439,106 +706,77 @@ static void colorConvert(struct clContext * C,
                     src.z = clTransformEOTF_PQ((srcPixel[2] >= 0.0f) ? srcPixel[2] : 0.0f);
                     break;
             }
-
-            gb_mat3_mul_vec3((gbVec3 *)XYZ, &transform->ccmmSrcToXYZ, src);
-        } else {
-            // Use LCMS
-            cmsDoTransform(transform->lcmsSrcToXYZ, srcPixel, XYZ, 1);
         }
 
-        // if tonemapping is necessary, luminance scale MUST be enabled
-        COLORIST_ASSERT(!transform->tonemapEnabled || transform->luminanceScaleEnabled);
+        gb_mat3_mul_vec3((gbVec3 *)XYZ, &transform->ccmmSrcToXYZ, src);
 
         if (transform->luminanceScaleEnabled) {
-            float xyY[3];
-
-            // Convert to xyY
-            clTransformXYZToXYY(C, xyY, XYZ, transform->whitePointX, transform->whitePointY);
-
-            // Apply srcCurveScale as CCMM, if any (LCMS implicitly does this)
-            if (useCCMM) {
-                xyY[2] *= transform->srcCurveScale;
-            }
-
-            // Luminance scale
-            xyY[2] *= transform->srcLuminanceScale;
-            xyY[2] /= transform->dstLuminanceScale;
-
-            // Apply inverse dstCurveScale prior to tonemapping to ensure tonemap gets [0-1] range
-            xyY[2] /= transform->dstCurveScale;
-
-            // Tonemap
-            if (transform->tonemapEnabled) {
-                // reinhard tonemap, with additional tuning (see context.h for attribution)
-                float z = powf(xyY[2] > 0.0f ? xyY[2] : 0.0f, transform->tonemapParams.contrast);
-                xyY[2] = z / ((powf(z, transform->tonemapParams.power) * transform->tonemapParams.clipPoint) +
-                              transform->tonemapParams.speed);
-            }
-
-            if (!useCCMM) {
-                // Re-apply dst scale for LCMS as it expects the XYZ->Dst input to be overranged
-                xyY[2] *= transform->dstCurveScale;
-            }
-
-            // Convert to XYZ
-            clTransformXYYToXYZ(C, XYZ, xyY);
+            scaleLuminance(C, transform, clTrue, XYZ);
         }
 
-        if (useCCMM) {
-            float tmp[3];
-            memcpy(&src, XYZ, sizeof(src));
+        float tmp[3];
+        memcpy(&src, XYZ, sizeof(src));
 
-            switch (transform->ccmmDstOETF) {
-                case CL_XTF_NONE:
-                    gb_mat3_mul_vec3((gbVec3 *)dstPixel, &transform->ccmmXYZToDst, src);
-                    if (transform->dstProfile) {                 // don't clamp XYZ
-                        dstPixel[0] = CL_MAX(dstPixel[0], 0.0f); // clamp (allow overranging)
-                        dstPixel[1] = CL_MAX(dstPixel[1], 0.0f); // clamp (allow overranging)
-                        dstPixel[2] = CL_MAX(dstPixel[2], 0.0f); // clamp (allow overranging)
-                    }
-                    break;
-                case CL_XTF_GAMMA:
-                    gb_mat3_mul_vec3((gbVec3 *)tmp, &transform->ccmmXYZToDst, src);
-                    if (transform->dstProfile) {       // don't clamp XYZ
-                        tmp[0] = CL_MAX(tmp[0], 0.0f); // clamp (allow overranging)
-                        tmp[1] = CL_MAX(tmp[1], 0.0f); // clamp (allow overranging)
-                        tmp[2] = CL_MAX(tmp[2], 0.0f); // clamp (allow overranging)
-                    }
-                    dstPixel[0] = powf((tmp[0] >= 0.0f) ? tmp[0] : 0.0f, transform->ccmmDstInvGamma);
-                    dstPixel[1] = powf((tmp[1] >= 0.0f) ? tmp[1] : 0.0f, transform->ccmmDstInvGamma);
-                    dstPixel[2] = powf((tmp[2] >= 0.0f) ? tmp[2] : 0.0f, transform->ccmmDstInvGamma);
+        switch (transform->ccmmDstOETF) {
+            case CL_XTF_NONE:
+                gb_mat3_mul_vec3((gbVec3 *)dstPixel, &transform->ccmmXYZToDst, src);
+                if (transform->dstProfile) {                 // don't clamp XYZ
+                    dstPixel[0] = CL_MAX(dstPixel[0], 0.0f); // clamp (allow overranging)
+                    dstPixel[1] = CL_MAX(dstPixel[1], 0.0f); // clamp (allow overranging)
+                    dstPixel[2] = CL_MAX(dstPixel[2], 0.0f); // clamp (allow overranging)
+                }
+                break;
+            case CL_XTF_GAMMA:
+                gb_mat3_mul_vec3((gbVec3 *)tmp, &transform->ccmmXYZToDst, src);
+                if (transform->dstProfile) {       // don't clamp XYZ
+                    tmp[0] = CL_MAX(tmp[0], 0.0f); // clamp (allow overranging)
+                    tmp[1] = CL_MAX(tmp[1], 0.0f); // clamp (allow overranging)
+                    tmp[2] = CL_MAX(tmp[2], 0.0f); // clamp (allow overranging)
+                }
+                if (transform->lutDstOETF) {
+                    dstPixel[0] = lookupDstOETF(transform, tmp[0]);
+                    dstPixel[1] = lookupDstOETF(transform, tmp[1]);
+                    dstPixel[2] = lookupDstOETF(transform, tmp[2]);
                     break;
-                case CL_XTF_HLG:
-                    gb_mat3_mul_vec3((gbVec3 *)tmp, &transform->ccmmXYZToDst, src);
-                    if (transform->dstProfile) {               // don't clamp XYZ
-                        tmp[0] = CL_CLAMP(tmp[0], 0.0f, 1.0f); // clamp
-                        tmp[1] = CL_CLAMP(tmp[1], 0.0f, 1.0f); // clamp
-                        tmp[2] = CL_CLAMP(tmp[2], 0.0f, 1.0f); // clamp
-                    }
-                    dstPixel[0] = HLG_OETF((tmp[0] >= 0.0f) ? tmp[0] : 0.0f, transform->ccmmHLGLuminance);
-                    dstPixel[1] = HLG_OETF((tmp[1] >= 0.0f) ? tmp[1] : 0.0f, transform->ccmmHLGLuminance);
-                    dstPixel[2] = HLG_OETF((tmp[2] >= 0.0f) ? tmp[2] : 0.0f, transform->ccmmHLGLuminance);
+                }
+                dstPixel[0] = powf((tmp[0] >= 0.0f) ? tmp[0] : 0.0f, transform->ccmmDstInvGamma);
+                dstPixel[1] = powf((tmp[1] >= 0.0f) ? tmp[1] : 0.0f, transform->ccmmDstInvGamma);
+                dstPixel[2] = powf((tmp[2] >= 0.0f) ? tmp[2] : 0.0f, transform->ccmmDstInvGamma);
+                break;
+            case CL_XTF_HLG:
+                gb_mat3_mul_vec3((gbVec3 *)tmp, &transform->ccmmXYZToDst, src);
+                if (transform->dstProfile) {               // don't clamp XYZ
+                    tmp[0] = CL_CLAMP(tmp[0], 0.0f, 1.0f); // clamp
+                    tmp[1] = CL_CLAMP(tmp[1], 0.0f, 1.0f); // clamp
+                    tmp[2] = CL_CLAMP(tmp[2], 0.0f, 1.0f); // clamp
+                }
+                if (transform->lutDstOETF) {
+                    dstPixel[0] = lookupDstOETF(transform, tmp[0]);
+                    dstPixel[1] = lookupDstOETF(transform, tmp[1]);
+                    dstPixel[2] = lookupDstOETF(transform, tmp[2]);
                     break;
-                case CL_XTF_PQ:
-                    gb_mat3_mul_vec3((gbVec3 *)tmp, &transform->ccmmXYZToDst, src);
-                    if (transform->dstProfile) {               // don't clamp XYZ
-                        tmp[0] = CL_CLAMP(tmp[0], 0.0f, 1.0f); // clamp
-                        tmp[1] = CL_CLAMP(tmp[1], 0.0f, 1.0f); // clamp
-                        tmp[2] = CL_CLAMP(tmp[2], 0.0f, 1.0f); // clamp
-                    }
-                    dstPixel[0] = clTransformOETF_PQ((tmp[0] >= 0.0f) ? tmp[0] : 0.0f);
-                    dstPixel[1] = clTransformOETF_PQ((tmp[1] >= 0.0f) ? tmp[1] : 0.0f);
-                    dstPixel[2] = clTransformOETF_PQ((tmp[2] >= 0.0f) ? tmp[2] : 0.0f);
+                }
+                dstPixel[0] = HLG_OETF((tmp[0] >= 0.0f) ? tmp[0] : 0.0f, transform->ccmmHLGLuminance);
+                dstPixel[1] = HLG_OETF((tmp[1] >= 0.0f) ? tmp[1] : 0.0f, transform->ccmmHLGLuminance);
+                dstPixel[2] = HLG_OETF((tmp[2] >= 0.0f) ? tmp[2] : 0.0f, transform->ccmmHLGLuminance);
+                break;
+            case CL_XTF_PQ:
+                gb_mat3_mul_vec3((gbVec3 *)tmp, &transform->ccmmXYZToDst, src);
+                if (transform->dstProfile) {               // don't clamp XYZ
+                    tmp[0] = CL_CLAMP(tmp[0], 0.0f, 1.0f); // clamp
+                    tmp[1] = CL_CLAMP(tmp[1], 0.0f, 1.0f); // clamp
+                    tmp[2] = CL_CLAMP(tmp[2], 0.0f, 1.0f); // clamp
+                }
+                if (transform->lutDstOETF) {
+                    dstPixel[0] = lookupDstOETF(transform, tmp[0]);
+                    dstPixel[1] = lookupDstOETF(transform, tmp[1]);
+                    dstPixel[2] = lookupDstOETF(transform, tmp[2]);
                     break;
-            }
-        } else {
-            // LittleCMS
-            cmsDoTransform(transform->lcmsXYZToDst, XYZ, dstPixel, 1);
-            if (transform->dstProfile) {                 // don't clamp XYZ
-                dstPixel[0] = CL_MAX(dstPixel[0], 0.0f); // clamp (allow overranging)
-                dstPixel[1] = CL_MAX(dstPixel[1], 0.0f); // clamp (allow overranging)
-                dstPixel[2] = CL_MAX(dstPixel[2], 0.0f); // clamp (allow overranging)
-            }
+                }
+                dstPixel[0] = clTransformOETF_PQ((tmp[0] >= 0.0f) ? tmp[0] : 0.0f);
+                dstPixel[1] = clTransformOETF_PQ((tmp[1] >= 0.0f) ? tmp[1] : 0.0f);
+                dstPixel[2] = clTransformOETF_PQ((tmp[2] >= 0.0f) ? tmp[2] : 0.0f);
+                break;
         }
 
         if (DST_FLOAT_HAS_ALPHA()) {
@@ -648,6 +886,36 @@ float clTransformCalcMaxY(clContext * C, clTransform * linearFromXYZ, clTransfor
     return floatXYZ[1];
 }
 
+void clTransformGamutCeilingInit(struct clContext * C, struct clProfilePrimaries * primaries, clTransformGamutCeiling * ceiling)
+{
+    // Built the same way clTransformPrepare() builds the CCMM's matrices
+    clTransformDeriveXYZMatrix(C, primaries, &ceiling->rgbToXYZ);
+    gb_mat3_inverse(&ceiling->xyzToRGB, &ceiling->rgbToXYZ);
+    gb_mat3_transpose(&ceiling->xyzToRGB);
+}
+
+float clTransformGamutCeilingMaxY(const clTransformGamutCeiling * ceiling, float x, float y)
+{
+    gbVec3 XYZ;
+    gbVec3 RGB;
+    float maxChannel;
+
+    // xyY -> XYZ at max luminance
+    XYZ.x = x / y;
+    XYZ.y = 1.0f;
+    XYZ.z = (1.0f - x - y) / y;
+    gb_mat3_mul_vec3(&RGB, (gbMat3 *)&ceiling->xyzToRGB, XYZ);
+    RGB.x = CL_MAX(RGB.x, 0.0f);
+    RGB.y = CL_MAX(RGB.y, 0.0f);
+    RGB.z = CL_MAX(RGB.z, 0.0f);
+    maxChannel = CL_MAX(CL_MAX(RGB.x, RGB.y), RGB.z);
+    RGB.x /= maxChannel;
+    RGB.y /= maxChannel;
+    RGB.z /= maxChannel;
+    gb_mat3_mul_vec3(&XYZ, (gbMat3 *)&ceiling->rgbToXYZ, RGB);
+    return XYZ.y;
+}
+
 clTransform * clTransformCreate(struct clContext * C,
                                 struct clProfile * srcProfile,
                                 clTransformFormat srcFormat,
@@ -665,6 +933,13 @@ clTransform * clTransformCreate(struct clContext * C,
 
     transform->ccmmReady = clFalse;
 
+    transform->lutSrcDepth = 0;
+    transform->lutSrcEOTF = NULL;
+    transform->lutDstOETF = NULL;
+    transform->lutDstOETFZero = 0.0f;
+    transform->lutDstOETFMaxError = 0.0f;
+    transform->lutReady = clFalse;
+
     transform->lcmsXYZProfile = NULL;
     transform->lcmsSrcToXYZ = NULL;
     transform->lcmsXYZToDst = NULL;
@@ -673,8 +948,9 @@ clTransform * clTransformCreate(struct clContext * C,
     return transform;
 }
 
-void clTransformDestroy(struct clContext * C, clTransform * transform)
+static void transformFree(struct clContext * C, clTransform * transform)
 {
+    freeLUTs(C, transform);
     if (transform->lcmsSrcToXYZ) {
         cmsDeleteTransform(transform->lcmsSrcToXYZ);
     }
@@ -690,6 +966,171 @@ void clTransformDestroy(struct clContext * C, clTransform * transform)
     clFree(transform);
 }
 
+void clTransformDestroy(struct clContext * C, clTransform * transform)
+{
+    if (!transformCachePut(C, transform)) {
+        transformFree(C, transform);
+    }
+}
+
+void clTransformSetSourceDepth(struct clContext * C, clTransform * transform, int depth)
+{
+    depth = CL_CLAMP(depth, 0, 16);
+    if (transform->lutSrcDepth != depth) {
+        freeLUTs(C, transform);
+        transform->lutSrcDepth = depth;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// clTransformCache
+
+// Everything clTransformPrepare()'s results depend on. Always memset before filling, as it is compared with memcmp().
+typedef struct clTransformCacheKey
+{
+    uint8_t srcSignature[16]; // all zeros for XYZ
+    uint8_t dstSignature[16]; // all zeros for XYZ
+    clTransformFormat srcFormat;
+    clTransformFormat dstFormat;
+    clTonemap tonemap;
+    clTonemapParams tonemapParams;
+    int lutSrcDepth;
+    int defaultLuminance;
+    clBool useCCMM;
+} clTransformCacheKey;
+
+typedef struct clTransformCacheEntry
+{
+    clTransformCacheKey key;
+    clTransform * transform; // prepared, profile pointers cleared
+} clTransformCacheEntry;
+
+clTransformCache * clTransformCacheCreate(struct clContext * C, int capacity)
+{
+    clTransformCache * cache = clAllocateStruct(clTransformCache);
+    cache->entries = (capacity > 0) ? clAllocate(sizeof(clTransformCacheEntry) * capacity) : NULL;
+    cache->count = 0;
+    cache->capacity = CL_MAX(capacity, 0);
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->lock = clMutexCreate(C);
+    return cache;
+}
+
+void clTransformCacheClear(struct clContext * C, clTransformCache * cache)
+{
+    clMutexLock(cache->lock);
+    for (int i = 0; i < cache->count; ++i) {
+        transformFree(C, cache->entries[i].transform);
+    }
+    cache->count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    clMutexUnlock(cache->lock);
+}
+
+void clTransformCacheDestroy(struct clContext * C, clTransformCache * cache)
+{
+    clTransformCacheClear(C, cache);
+    if (cache->entries) {
+        clFree(cache->entries);
+    }
+    clMutexDestroy(C, cache->lock);
+    clFree(cache);
+}
+
+static void transformCacheMakeKey(struct clContext * C, clTransform * transform, clTransformCacheKey * key)
+{
+    memset(key, 0, sizeof(clTransformCacheKey));
+    if (transform->srcProfile) {
+        memcpy(key->srcSignature, transform->srcProfile->signature, sizeof(key->srcSignature));
+    }
+    if (transform->dstProfile) {
+        memcpy(key->dstSignature, transform->dstProfile->signature, sizeof(key->dstSignature));
+    }
+    key->srcFormat = transform->srcFormat;
+    key->dstFormat = transform->dstFormat;
+    key->tonemap = transform->requestedTonemap;
+    memcpy(&key->tonemapParams, &transform->tonemapParams, sizeof(key->tonemapParams));
+    key->lutSrcDepth = transform->lutSrcDepth;
+    key->defaultLuminance = C->defaultLuminance;
+    key->useCCMM = clTransformUsesCCMM(C, transform);
+}
+
+// If the cache has a prepared transform identical to this (unprepared) one, moves its prepared state into transform
+static clBool transformCacheTake(struct clContext * C, clTransform * transform)
+{
+    clTransformCache * cache = C->transformCache;
+    clTransform * cached = NULL;
+    clTransformCacheKey key;
+
+    if (!cache || (cache->capacity == 0)) {
+        return clFalse;
+    }
+
+    transformCacheMakeKey(C, transform, &key);
+    clMutexLock(cache->lock);
+    for (int i = 0; i < cache->count; ++i) {
+        if (!memcmp(&cache->entries[i].key, &key, sizeof(key))) {
+            cached = cache->entries[i].transform;
+            memmove(&cache->entries[i], &cache->entries[i + 1], sizeof(clTransformCacheEntry) * (cache->count - i - 1));
+            --cache->count;
+            break;
+        }
+    }
+    if (cached) {
+        ++cache->hits;
+    } else {
+        ++cache->misses;
+    }
+    clMutexUnlock(cache->lock);
+
+    if (!cached) {
+        return clFalse;
+    }
+
+    // The signatures match, so the caller's profiles are interchangeable with the ones this was prepared with
+    clProfile * srcProfile = transform->srcProfile;
+    clProfile * dstProfile = transform->dstProfile;
+    memcpy(transform, cached, sizeof(clTransform));
+    transform->srcProfile = srcProfile;
+    transform->dstProfile = dstProfile;
+    clFree(cached);
+    return clTrue;
+}
+
+// Takes ownership of transform if it is worth caching
+static clBool transformCachePut(struct clContext * C, clTransform * transform)
+{
+    clTransformCache * cache = C->transformCache;
+    clTransform * evicted = NULL;
+    clTransformCacheKey key;
+
+    if (!cache || (cache->capacity == 0) || (!transform->ccmmReady && !transform->lcmsReady)) {
+        return clFalse;
+    }
+
+    transformCacheMakeKey(C, transform, &key);
+    transform->srcProfile = NULL;
+    transform->dstProfile = NULL;
+
+    clMutexLock(cache->lock);
+    if (cache->count == cache->capacity) {
+        evicted = cache->entries[cache->count - 1].transform;
+        --cache->count;
+    }
+    memmove(&cache->entries[1], &cache->entries[0], sizeof(clTransformCacheEntry) * cache->count);
+    memcpy(&cache->entries[0].key, &key, sizeof(key));
+    cache->entries[0].transform = transform;
+    ++cache->count;
+    clMutexUnlock(cache->lock);
+
+    if (evicted) {
+        transformFree(C, evicted);
+    }
+    return clTrue;
+}
+
 static cmsUInt32Number clTransformFormatToLCMSFormat(struct clContext * C, clTransformFormat format)
 {
     COLORIST_UNUSED(C);
@@ -753,63 +1194,152 @@ typedef struct clTransformTask
     clTransform * transform;
     float * inPixels;
     float * outPixels;
-    int pixelCount;
+    int srcChannelCount;
+    int dstChannelCount;
     clBool useCCMM;
 } clTransformTask;
 
-static void transformTaskFunc(clTransformTask * info)
+static void transformTaskFunc(void * userData, int start, int count)
 {
-    clCCMMTransform(info->C, info->transform, info->useCCMM, info->inPixels, info->outPixels, info->pixelCount);
+    clTransformTask * info = (clTransformTask *)userData;
+    clTraceSpan span;
+    clTraceBegin(info->C, &span, "transform");
+    clCCMMTransform(info->C,
+                    info->transform,
+                    info->useCCMM,
+                    &info->inPixels[start * info->srcChannelCount],
+                    &info->outPixels[start * info->dstChannelCount],
+                    count);
+    clTraceEnd(info->C, &span);
+    clTraceCount(info->C, CL_TRACE_PIXELS_TRANSFORMED, count);
 }
 
+// Below this many pixels, handing work to other threads costs more than it saves
+#define MIN_PIXELS_PER_TASK 1024
+
 void clTransformRun(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount)
 {
-    int srcChannelCount = clTransformFormatToChannelCount(C, transform->srcFormat);
-    int dstChannelCount = clTransformFormatToChannelCount(C, transform->dstFormat);
-    clBool useCCMM = clTransformUsesCCMM(C, transform);
-    int taskCount = C->jobs;
+    clTransformTask info;
 
     clTransformPrepare(C, transform);
 
-    if (taskCount > pixelCount) {
-        // This is a dumb corner case I'm not too worried about.
-        taskCount = pixelCount;
-    }
-
-    if (taskCount == 1) {
-        // Don't bother making any new threads
-        clTransformTask info;
-        info.C = C;
-        info.transform = transform;
-        info.inPixels = srcPixels;
-        info.outPixels = dstPixels;
-        info.pixelCount = pixelCount;
-        info.useCCMM = useCCMM;
-        transformTaskFunc(&info);
-    } else {
-        int pixelsPerTask = pixelCount / taskCount;
-        int lastTaskPixelCount = pixelCount - (pixelsPerTask * (taskCount - 1));
-        clTask ** tasks;
-        clTransformTask * infos;
-        int i;
-
-        tasks = clAllocate(taskCount * sizeof(clTask *));
-        infos = clAllocate(taskCount * sizeof(clTransformTask));
-        for (i = 0; i < taskCount; ++i) {
-            infos[i].C = C;
-            infos[i].transform = transform;
-            infos[i].inPixels = &srcPixels[i * pixelsPerTask * srcChannelCount];
-            infos[i].outPixels = &dstPixels[i * pixelsPerTask * dstChannelCount];
-            infos[i].pixelCount = (i == (taskCount - 1)) ? lastTaskPixelCount : pixelsPerTask;
-            infos[i].useCCMM = useCCMM;
-            tasks[i] = clTaskCreate(C, (clTaskFunc)transformTaskFunc, &infos[i]);
-        }
+    info.C = C;
+    info.transform = transform;
+    info.inPixels = srcPixels;
+    info.outPixels = dstPixels;
+    info.srcChannelCount = clTransformFormatToChannelCount(C, transform->srcFormat);
+    info.dstChannelCount = clTransformFormatToChannelCount(C, transform->dstFormat);
+    info.useCCMM = clTransformUsesCCMM(C, transform);
+    clTaskParallelFor(C, pixelCount, MIN_PIXELS_PER_TASK, transformTaskFunc, &info);
+}
+
+void clTransformRunSerial(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount)
+{
+    COLORIST_ASSERT(transform->ccmmReady || transform->lcmsReady);
+    clCCMMTransform(C, transform, clTransformUsesCCMM(C, transform), srcPixels, dstPixels, pixelCount);
+}
 
-        for (i = 0; i < taskCount; ++i) {
-            clTaskDestroy(C, tasks[i]);
+typedef struct clTransformIntegerTask
+{
+    clContext * C;
+    clTransform * transform;
+    clPixelFormat srcFormat;
+    const void * srcPixels;
+    float srcMaxChannel;
+    clPixelFormat dstFormat;
+    void * dstPixels;
+    uint32_t dstMaxChannel;
+    clBool useCCMM;
+} clTransformIntegerTask;
+
+// 1024 RGBA pixels in and out is 32KB of floats, which stays in cache between the three passes
+#define INTEGER_TILE_PIXELS 1024
+
+static void transformIntegerTaskFunc(void * userData, int start, int count)
+{
+    clTransformIntegerTask * info = (clTransformIntegerTask *)userData;
+    float srcTile[INTEGER_TILE_PIXELS * 4];
+    float dstTile[INTEGER_TILE_PIXELS * 4];
+    clTraceSpan span;
+    clTraceBegin(info->C, &span, "transform");
+
+    for (int tileStart = start; tileStart < (start + count); tileStart += INTEGER_TILE_PIXELS) {
+        int tileCount = CL_MIN(INTEGER_TILE_PIXELS, (start + count) - tileStart);
+        int channelCount = tileCount * 4;
+
+        // Normalize
+        if (info->srcFormat == CL_PIXELFORMAT_U16) {
+            const uint16_t * srcChannels = &((const uint16_t *)info->srcPixels)[tileStart * 4];
+            for (int i = 0; i < channelCount; ++i) {
+                srcTile[i] = srcChannels[i] / info->srcMaxChannel;
+            }
+        } else {
+            const uint8_t * srcChannels = &((const uint8_t *)info->srcPixels)[tileStart * 4];
+            for (int i = 0; i < channelCount; ++i) {
+                srcTile[i] = srcChannels[i] / info->srcMaxChannel;
+            }
         }
 
-        clFree(tasks);
-        clFree(infos);
+        clCCMMTransform(info->C, info->transform, info->useCCMM, srcTile, dstTile, tileCount);
+
+        // Quantize, scaling down overranged colors (same as clImagePrepareReadPixels())
+        for (int i = 0; i < tileCount; ++i) {
+            float * srcPixel = &dstTile[i * 4];
+            float largestChannel = 1.0f;
+            uint32_t dstPixel[4];
+            largestChannel = CL_MAX(largestChannel, srcPixel[0]);
+            largestChannel = CL_MAX(largestChannel, srcPixel[1]);
+            largestChannel = CL_MAX(largestChannel, srcPixel[2]);
+            dstPixel[0] = clPixelMathRoundUNorm(srcPixel[0] / largestChannel, info->dstMaxChannel);
+            dstPixel[1] = clPixelMathRoundUNorm(srcPixel[1] / largestChannel, info->dstMaxChannel);
+            dstPixel[2] = clPixelMathRoundUNorm(srcPixel[2] / largestChannel, info->dstMaxChannel);
+            dstPixel[3] = clPixelMathRoundUNorm(srcPixel[3], info->dstMaxChannel);
+
+            if (info->dstFormat == CL_PIXELFORMAT_U16) {
+                uint16_t * dstChannels = &((uint16_t *)info->dstPixels)[(tileStart + i) * 4];
+                dstChannels[0] = (uint16_t)dstPixel[0];
+                dstChannels[1] = (uint16_t)dstPixel[1];
+                dstChannels[2] = (uint16_t)dstPixel[2];
+                dstChannels[3] = (uint16_t)dstPixel[3];
+            } else {
+                uint8_t * dstChannels = &((uint8_t *)info->dstPixels)[(tileStart + i) * 4];
+                dstChannels[0] = (uint8_t)dstPixel[0];
+                dstChannels[1] = (uint8_t)dstPixel[1];
+                dstChannels[2] = (uint8_t)dstPixel[2];
+                dstChannels[3] = (uint8_t)dstPixel[3];
+            }
+        }
     }
+    clTraceEnd(info->C, &span);
+    clTraceCount(info->C, CL_TRACE_PIXELS_TRANSFORMED, count);
+}
+
+void clTransformRunInteger(struct clContext * C,
+                           clTransform * transform,
+                           clPixelFormat srcFormat,
+                           int srcDepth,
+                           const void * srcPixels,
+                           clPixelFormat dstFormat,
+                           int dstDepth,
+                           void * dstPixels,
+                           int pixelCount)
+{
+    clTransformIntegerTask info;
+
+    COLORIST_ASSERT((transform->srcFormat == CL_XF_RGBA) && (transform->dstFormat == CL_XF_RGBA));
+    COLORIST_ASSERT((srcFormat == CL_PIXELFORMAT_U8) || (srcFormat == CL_PIXELFORMAT_U16));
+    COLORIST_ASSERT((dstFormat == CL_PIXELFORMAT_U8) || (dstFormat == CL_PIXELFORMAT_U16));
+
+    clTransformPrepare(C, transform);
+
+    info.C = C;
+    info.transform = transform;
+    info.srcFormat = srcFormat;
+    info.srcPixels = srcPixels;
+    info.srcMaxChannel = (srcFormat == CL_PIXELFORMAT_U16) ? (float)((1 << CL_CLAMP(srcDepth, 8, 16)) - 1) : 255.0f;
+    info.dstFormat = dstFormat;
+    info.dstPixels = dstPixels;
+    info.dstMaxChannel = (dstFormat == CL_PIXELFORMAT_U16) ? (uint32_t)((1 << CL_CLAMP(dstDepth, 8, 16)) - 1) : 255;
+    info.useCCMM = clTransformUsesCCMM(C, transform);
+    clTaskParallelFor(C, pixelCount, MIN_PIXELS_PER_TASK, transformIntegerTaskFunc, &info);
 }
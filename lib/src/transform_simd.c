@@ -0,0 +1,301 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/transform.h"
+
+#include "colorist/context.h"
+#include "colorist/profile.h"
+
+#include <math.h>
+#include <string.h>
+
+// ----------------------------------------------------------------------------
+// SIMD CCMM kernels
+//
+// These mirror colorConvert() in transform.c for the CCMM path, but work on a handful of pixels at
+// once. pow/exp/log are replaced with polynomial approximations (see transform_simd_kernel.h) which
+// stay within a few float ULPs of libm, comfortably under 1 LSB at 16-bit.
+//
+// The kernel is written once against a small set of vector macros and instantiated per instruction
+// set below. SSE2 is always present on x86-64, AVX2+FMA is chosen at runtime when the CPU has it.
+// Porting to another vector unit (NEON, etc) only requires another block of macros.
+
+typedef struct clSIMDParams
+{
+    clTransformTransferFunction srcEOTF; // CL_XTF_NONE when srcEOTFLUT is used instead
+    clTransformTransferFunction dstOETF;
+    const float * srcEOTFLUT;            // see clTransformSetSourceDepth()
+    int srcEOTFLUTMaxIndex;
+    float srcGamma;
+    float dstInvGamma;
+    float hlgExponent; // HLG OOTF exponent derived from ccmmHLGLuminance
+    float srcToXYZ[9]; // same layout gb_mat3_mul_vec3() reads
+    float xyzToDst[9];
+    clBool clampDst;   // false when the dst is XYZ
+    clBool luminanceScaleEnabled;
+    clBool tonemapEnabled;
+    float srcCurveScale;
+    float srcLuminanceScale;
+    float dstLuminanceScale;
+    float dstCurveScale;
+    float whitePointX;
+    float whitePointY;
+    clTonemapParams tonemapParams;
+} clSIMDParams;
+
+typedef void (*clSIMDConvertFunc)(const clSIMDParams * params,
+                                  const float * srcPixels,
+                                  int srcChannelCount,
+                                  float * dstPixels,
+                                  int dstChannelCount,
+                                  int pixelCount);
+
+// See transform.c
+#define SIMD_PQ_C1 0.8359375f
+#define SIMD_PQ_C2 18.8515625f
+#define SIMD_PQ_C3 18.6875f
+#define SIMD_PQ_M1 0.1593017578125f
+#define SIMD_PQ_M2 78.84375f
+#define SIMD_HLG_A 0.17883277f
+#define SIMD_HLG_B 0.28466892f
+#define SIMD_HLG_C 0.55991072953f
+
+// The src EOTF LUT is applied while deinterleaving, as gathers don't buy anything over scalar loads
+static inline int simdLUTIndex(const clSIMDParams * params, float N)
+{
+    int index = (int)((N * (float)params->srcEOTFLUTMaxIndex) + 0.5f);
+    return CL_CLAMP(index, 0, params->srcEOTFLUTMaxIndex);
+}
+
+#define CL_SIMD_CONCAT2(A, B) A##B
+#define CL_SIMD_CONCAT(A, B) CL_SIMD_CONCAT2(A, B)
+#define CL_SIMD_NAME(N) CL_SIMD_CONCAT(N, CL_SIMD_SUFFIX)
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COLORIST_SIMD_X64
+#endif
+
+#if defined(COLORIST_SIMD_X64)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+// ----------------------------------------------------------------------------
+// SSE2 (4 lanes)
+
+#define CL_SIMD_SUFFIX SSE2
+#define CL_SIMD_TARGET
+#define CL_SIMD_WIDTH 4
+#define VF __m128
+#define VI __m128i
+#define VF_SET1(X) _mm_set1_ps(X)
+#define VF_LOADU(P) _mm_loadu_ps(P)
+#define VF_STOREU(P, V) _mm_storeu_ps(P, V)
+#define VF_ADD(A, B) _mm_add_ps(A, B)
+#define VF_SUB(A, B) _mm_sub_ps(A, B)
+#define VF_MUL(A, B) _mm_mul_ps(A, B)
+#define VF_DIV(A, B) _mm_div_ps(A, B)
+#define VF_MULADD(A, B, C) _mm_add_ps(_mm_mul_ps(A, B), C)
+#define VF_MIN(A, B) _mm_min_ps(A, B)
+#define VF_MAX(A, B) _mm_max_ps(A, B)
+#define VF_SQRT(A) _mm_sqrt_ps(A)
+#define VF_LT(A, B) _mm_cmplt_ps(A, B)
+#define VF_LE(A, B) _mm_cmple_ps(A, B)
+#define VF_GT(A, B) _mm_cmpgt_ps(A, B)
+#define VF_SELECT(M, A, B) _mm_or_ps(_mm_and_ps(M, A), _mm_andnot_ps(M, B))
+#define VF_AS_VI(A) _mm_castps_si128(A)
+#define VI_AS_VF(A) _mm_castsi128_ps(A)
+#define VF_ROUND_TO_VI(A) _mm_cvtps_epi32(A)
+#define VI_TO_VF(A) _mm_cvtepi32_ps(A)
+#define VI_SET1(X) _mm_set1_epi32(X)
+#define VI_ADD(A, B) _mm_add_epi32(A, B)
+#define VI_SUB(A, B) _mm_sub_epi32(A, B)
+#define VI_AND(A, B) _mm_and_si128(A, B)
+#define VI_OR(A, B) _mm_or_si128(A, B)
+#define VI_SRLI(A, N) _mm_srli_epi32(A, N)
+#define VI_SLLI(A, N) _mm_slli_epi32(A, N)
+#include "transform_simd_kernel.h"
+#undef CL_SIMD_SUFFIX
+#undef CL_SIMD_TARGET
+#undef CL_SIMD_WIDTH
+#undef VF
+#undef VI
+#undef VF_SET1
+#undef VF_LOADU
+#undef VF_STOREU
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_MULADD
+#undef VF_MIN
+#undef VF_MAX
+#undef VF_SQRT
+#undef VF_LT
+#undef VF_LE
+#undef VF_GT
+#undef VF_SELECT
+#undef VF_AS_VI
+#undef VI_AS_VF
+#undef VF_ROUND_TO_VI
+#undef VI_TO_VF
+#undef VI_SET1
+#undef VI_ADD
+#undef VI_SUB
+#undef VI_AND
+#undef VI_OR
+#undef VI_SRLI
+#undef VI_SLLI
+
+// ----------------------------------------------------------------------------
+// AVX2 + FMA (8 lanes)
+
+#define CL_SIMD_SUFFIX AVX2
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CL_SIMD_TARGET
+#else
+#define CL_SIMD_TARGET __attribute__((target("avx2,fma")))
+#endif
+#define CL_SIMD_WIDTH 8
+#define VF __m256
+#define VI __m256i
+#define VF_SET1(X) _mm256_set1_ps(X)
+#define VF_LOADU(P) _mm256_loadu_ps(P)
+#define VF_STOREU(P, V) _mm256_storeu_ps(P, V)
+#define VF_ADD(A, B) _mm256_add_ps(A, B)
+#define VF_SUB(A, B) _mm256_sub_ps(A, B)
+#define VF_MUL(A, B) _mm256_mul_ps(A, B)
+#define VF_DIV(A, B) _mm256_div_ps(A, B)
+#define VF_MULADD(A, B, C) _mm256_fmadd_ps(A, B, C)
+#define VF_MIN(A, B) _mm256_min_ps(A, B)
+#define VF_MAX(A, B) _mm256_max_ps(A, B)
+#define VF_SQRT(A) _mm256_sqrt_ps(A)
+#define VF_LT(A, B) _mm256_cmp_ps(A, B, _CMP_LT_OQ)
+#define VF_LE(A, B) _mm256_cmp_ps(A, B, _CMP_LE_OQ)
+#define VF_GT(A, B) _mm256_cmp_ps(A, B, _CMP_GT_OQ)
+#define VF_SELECT(M, A, B) _mm256_blendv_ps(B, A, M)
+#define VF_AS_VI(A) _mm256_castps_si256(A)
+#define VI_AS_VF(A) _mm256_castsi256_ps(A)
+#define VF_ROUND_TO_VI(A) _mm256_cvtps_epi32(A)
+#define VI_TO_VF(A) _mm256_cvtepi32_ps(A)
+#define VI_SET1(X) _mm256_set1_epi32(X)
+#define VI_ADD(A, B) _mm256_add_epi32(A, B)
+#define VI_SUB(A, B) _mm256_sub_epi32(A, B)
+#define VI_AND(A, B) _mm256_and_si256(A, B)
+#define VI_OR(A, B) _mm256_or_si256(A, B)
+#define VI_SRLI(A, N) _mm256_srli_epi32(A, N)
+#define VI_SLLI(A, N) _mm256_slli_epi32(A, N)
+#include "transform_simd_kernel.h"
+
+static clBool cpuHasAVX2(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return clFalse;
+    }
+    __cpuid(info, 1);
+    // FMA, OSXSAVE, AVX
+    if ((info[2] & ((1 << 12) | (1 << 27) | (1 << 28))) != ((1 << 12) | (1 << 27) | (1 << 28))) {
+        return clFalse;
+    }
+    // The OS must be saving the YMM registers
+    if ((_xgetbv(0) & 6) != 6) {
+        return clFalse;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) ? clTrue : clFalse;
+#else
+    __builtin_cpu_init();
+    return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? clTrue : clFalse;
+#endif
+}
+
+#endif /* if defined(COLORIST_SIMD_X64) */
+
+// ----------------------------------------------------------------------------
+// Dispatch
+
+// Detection is idempotent, so racing threads all write the same values here.
+static int simdDetected = 0;
+static clSIMDConvertFunc simdConvertFunc = NULL;
+static const char * simdName = "none";
+
+static void detectSIMD(void)
+{
+    if (simdDetected) {
+        return;
+    }
+#if defined(COLORIST_SIMD_X64)
+    if (cpuHasAVX2()) {
+        simdConvertFunc = simdConvertAVX2;
+        simdName = "avx2";
+    } else {
+        simdConvertFunc = simdConvertSSE2;
+        simdName = "sse2";
+    }
+#endif
+    simdDetected = 1;
+}
+
+const char * clTransformSIMDName(struct clContext * C)
+{
+    COLORIST_UNUSED(C);
+
+    detectSIMD();
+    return simdName;
+}
+
+clBool clTransformSIMDConvert(struct clContext * C,
+                              clTransform * transform,
+                              const float * srcPixels,
+                              int srcChannelCount,
+                              float * dstPixels,
+                              int dstChannelCount,
+                              int pixelCount)
+{
+    clSIMDParams params;
+
+    if (!C->simdAllowed) {
+        return clFalse;
+    }
+    detectSIMD();
+    if (!simdConvertFunc) {
+        return clFalse;
+    }
+
+    COLORIST_ASSERT(transform->ccmmReady);
+
+    params.srcEOTF = transform->ccmmSrcEOTF;
+    params.dstOETF = transform->ccmmDstOETF;
+    params.srcEOTFLUT = transform->lutSrcEOTF;
+    params.srcEOTFLUTMaxIndex = (1 << transform->lutSrcDepth) - 1;
+    if (params.srcEOTFLUT) {
+        params.srcEOTF = CL_XTF_NONE;
+    }
+    params.srcGamma = transform->ccmmSrcGamma;
+    params.dstInvGamma = transform->ccmmDstInvGamma;
+    params.hlgExponent = 1.2f + (0.42f * log10f(transform->ccmmHLGLuminance / 1000.0f));
+    memcpy(params.srcToXYZ, transform->ccmmSrcToXYZ.e, sizeof(params.srcToXYZ));
+    memcpy(params.xyzToDst, transform->ccmmXYZToDst.e, sizeof(params.xyzToDst));
+    params.clampDst = transform->dstProfile ? clTrue : clFalse;
+    params.luminanceScaleEnabled = transform->luminanceScaleEnabled;
+    params.tonemapEnabled = transform->tonemapEnabled;
+    params.srcCurveScale = transform->srcCurveScale;
+    params.srcLuminanceScale = transform->srcLuminanceScale;
+    params.dstLuminanceScale = transform->dstLuminanceScale;
+    params.dstCurveScale = transform->dstCurveScale;
+    params.whitePointX = transform->whitePointX;
+    params.whitePointY = transform->whitePointY;
+    memcpy(&params.tonemapParams, &transform->tonemapParams, sizeof(params.tonemapParams));
+
+    simdConvertFunc(&params, srcPixels, srcChannelCount, dstPixels, dstChannelCount, pixelCount);
+    return clTrue;
+}
@@ -0,0 +1,270 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+// No include guard: transform_simd.c includes this once per instruction set, after defining
+// CL_SIMD_SUFFIX, CL_SIMD_TARGET, CL_SIMD_WIDTH and the VF_* / VI_* vector macros.
+
+// ----------------------------------------------------------------------------
+// Math approximations
+
+// Valid for positive, normal x
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdLog2)(VF x)
+{
+    // Split x into m * 2^e with m in [sqrt(0.5), sqrt(2))
+    VI bits = VF_AS_VI(x);
+    VF e = VI_TO_VF(VI_SUB(VI_SRLI(bits, 23), VI_SET1(127)));
+    VF m = VI_AS_VF(VI_OR(VI_AND(bits, VI_SET1(0x007fffff)), VI_SET1(0x3f800000)));
+    VF big = VF_GT(m, VF_SET1(1.41421356f));
+    m = VF_SELECT(big, VF_MUL(m, VF_SET1(0.5f)), m);
+    e = VF_ADD(e, VF_SELECT(big, VF_SET1(1.0f), VF_SET1(0.0f)));
+
+    // log2(m) = 2/ln(2) * atanh(t), t = (m-1)/(m+1), |t| < 0.172
+    VF t = VF_DIV(VF_SUB(m, VF_SET1(1.0f)), VF_ADD(m, VF_SET1(1.0f)));
+    VF t2 = VF_MUL(t, t);
+    VF p = VF_SET1(1.0f / 11.0f);
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 9.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 7.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 5.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 3.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f));
+    return VF_MULADD(VF_MUL(p, t), VF_SET1(2.88539008f), e); // 2/ln(2)
+}
+
+// log2(1 + u) for small |u|, without the rounding error of forming 1 + u first
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdLog2OnePlus)(VF u)
+{
+    // log2(1+u) = 2/ln(2) * atanh(t), t = u/(2+u)
+    VF t = VF_DIV(u, VF_ADD(VF_SET1(2.0f), u));
+    VF t2 = VF_MUL(t, t);
+    VF p = VF_SET1(1.0f / 11.0f);
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 9.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 7.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 5.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f / 3.0f));
+    p = VF_MULADD(p, t2, VF_SET1(1.0f));
+    return VF_MUL(VF_MUL(p, t), VF_SET1(2.88539008f));
+}
+
+// 2^x - 1 for x in roughly [-0.5, 0.5], without the rounding error of subtracting 1 afterwards
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdExp2Minus1)(VF x)
+{
+    VF z = VF_MUL(x, VF_SET1(0.693147181f));
+    VF p = VF_SET1(1.0f / 362880.0f);
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 40320.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 5040.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 720.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 120.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 24.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 6.0f));
+    p = VF_MULADD(p, z, VF_SET1(0.5f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f));
+    return VF_MUL(p, z);
+}
+
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdExp2)(VF x)
+{
+    x = VF_MIN(VF_MAX(x, VF_SET1(-126.0f)), VF_SET1(127.0f));
+
+    // 2^x = 2^n * e^(f*ln(2)), f in [-0.5, 0.5]
+    VI n = VF_ROUND_TO_VI(x);
+    VF z = VF_MUL(VF_SUB(x, VI_TO_VF(n)), VF_SET1(0.693147181f));
+    VF p = VF_SET1(1.0f / 5040.0f);
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 720.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 120.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 24.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f / 6.0f));
+    p = VF_MULADD(p, z, VF_SET1(0.5f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f));
+    p = VF_MULADD(p, z, VF_SET1(1.0f));
+    return VF_MUL(p, VI_AS_VF(VI_SLLI(VI_ADD(n, VI_SET1(127)), 23)));
+}
+
+// Matches powf() for x >= 0; returns 0 for x <= 0
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdPow)(VF x, float y)
+{
+    VF positive = VF_GT(x, VF_SET1(0.0f));
+    VF safeX = VF_SELECT(positive, x, VF_SET1(1.0f));
+    VF r = CL_SIMD_NAME(simdExp2)(VF_MUL(CL_SIMD_NAME(simdLog2)(safeX), VF_SET1(y)));
+    return VF_SELECT(positive, r, VF_SET1(0.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Transfer functions (see their scalar versions in transform.c)
+
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdEOTF)(const clSIMDParams * params, VF N)
+{
+    N = VF_MAX(N, VF_SET1(0.0f));
+    switch (params->srcEOTF) {
+        case CL_XTF_GAMMA:
+            return CL_SIMD_NAME(simdPow)(N, params->srcGamma);
+
+        case CL_XTF_HLG: {
+            VF lo = VF_DIV(VF_MUL(N, N), VF_SET1(3.0f));
+            VF ex = VF_MUL(VF_DIV(VF_SUB(N, VF_SET1(SIMD_HLG_C)), VF_SET1(SIMD_HLG_A)), VF_SET1(1.44269504f)); // log2(e)
+            VF hi = VF_DIV(VF_ADD(CL_SIMD_NAME(simdExp2)(ex), VF_SET1(SIMD_HLG_B)), VF_SET1(12.0f));
+            VF L = VF_SELECT(VF_LT(N, VF_SET1(0.5f)), lo, hi);
+            return CL_SIMD_NAME(simdPow)(L, params->hlgExponent);
+        }
+
+        case CL_XTF_PQ: {
+            // Same rearrangement as clTransformEOTF_PQ(). N^(1/m2) - c1 only matters while
+            // N^(1/m2) > c1, where log2(N)/m2 is in [-0.26, 0].
+            VF positive = VF_GT(N, VF_SET1(0.0f));
+            VF ex = VF_MUL(CL_SIMD_NAME(simdLog2)(VF_SELECT(positive, N, VF_SET1(1.0f))), VF_SET1(1 / SIMD_PQ_M2));
+            VF N1m2Minus1 = CL_SIMD_NAME(simdExp2Minus1)(VF_MAX(ex, VF_SET1(-0.5f)));
+            VF N1m2c1 = VF_MAX(VF_ADD(N1m2Minus1, VF_SET1(1.0f - SIMD_PQ_C1)), VF_SET1(0.0f));
+            VF c2c3N1m2 = VF_SUB(VF_SET1(SIMD_PQ_C2 - SIMD_PQ_C3), VF_MUL(VF_SET1(SIMD_PQ_C3), N1m2Minus1));
+            N1m2c1 = VF_SELECT(positive, N1m2c1, VF_SET1(0.0f));
+            return CL_SIMD_NAME(simdPow)(VF_DIV(N1m2c1, c2c3N1m2), 1 / SIMD_PQ_M1);
+        }
+
+        case CL_XTF_NONE:
+        default:
+            break;
+    }
+    return N;
+}
+
+static inline CL_SIMD_TARGET VF CL_SIMD_NAME(simdOETF)(const clSIMDParams * params, VF L)
+{
+    VF zero = VF_SET1(0.0f);
+    switch (params->dstOETF) {
+        case CL_XTF_NONE:
+            if (params->clampDst) {
+                L = VF_MAX(L, zero); // clamp (allow overranging)
+            }
+            return L;
+
+        case CL_XTF_GAMMA:
+            return CL_SIMD_NAME(simdPow)(VF_MAX(L, zero), params->dstInvGamma);
+
+        case CL_XTF_HLG: {
+            VF N, lo, hi;
+            if (params->clampDst) {
+                L = VF_MIN(L, VF_SET1(1.0f));
+            }
+            N = CL_SIMD_NAME(simdPow)(VF_MAX(L, zero), 1.0f / params->hlgExponent);
+            lo = VF_SQRT(VF_MUL(VF_SET1(3.0f), N));
+            hi = VF_SUB(VF_MUL(VF_SET1(12.0f), N), VF_SET1(SIMD_HLG_B));
+            hi = VF_SELECT(VF_GT(hi, zero), hi, VF_SET1(1.0f)); // only used when N > 1/12
+            hi = VF_MULADD(VF_SET1(SIMD_HLG_A * 0.693147181f), CL_SIMD_NAME(simdLog2)(hi), VF_SET1(SIMD_HLG_C)); // ln(2)
+            return VF_SELECT(VF_LE(N, VF_SET1(1.0f / 12.0f)), lo, hi);
+        }
+
+        case CL_XTF_PQ: {
+            // Same rearrangement as clTransformOETF_PQ()
+            VF Lm1, u;
+            if (params->clampDst) {
+                L = VF_MIN(L, VF_SET1(1.0f));
+            }
+            Lm1 = CL_SIMD_NAME(simdPow)(VF_MAX(L, zero), SIMD_PQ_M1);
+            u = VF_DIV(VF_MUL(VF_SET1(SIMD_PQ_C1 - 1.0f), VF_SUB(VF_SET1(1.0f), Lm1)), VF_MULADD(VF_SET1(SIMD_PQ_C3), Lm1, VF_SET1(1.0f)));
+            return CL_SIMD_NAME(simdExp2)(VF_MUL(CL_SIMD_NAME(simdLog2OnePlus)(u), VF_SET1(SIMD_PQ_M2)));
+        }
+
+        default:
+            break;
+    }
+    return L;
+}
+
+// ----------------------------------------------------------------------------
+// Conversion
+
+static CL_SIMD_TARGET void CL_SIMD_NAME(simdConvert)(const clSIMDParams * params,
+                                                     const float * srcPixels,
+                                                     int srcChannelCount,
+                                                     float * dstPixels,
+                                                     int dstChannelCount,
+                                                     int pixelCount)
+{
+    const float * m1 = params->srcToXYZ;
+    const float * m2 = params->xyzToDst;
+    float r[CL_SIMD_WIDTH];
+    float g[CL_SIMD_WIDTH];
+    float b[CL_SIMD_WIDTH];
+
+    for (int base = 0; base < pixelCount; base += CL_SIMD_WIDTH) {
+        int count = CL_MIN(CL_SIMD_WIDTH, pixelCount - base);
+        VF R, G, B, X, Y, Z;
+
+        // Deinterleave (zero padding any leftover lanes)
+        for (int i = 0; i < CL_SIMD_WIDTH; ++i) {
+            if (i < count) {
+                const float * srcPixel = &srcPixels[(base + i) * srcChannelCount];
+                if (params->srcEOTFLUT) {
+                    r[i] = params->srcEOTFLUT[simdLUTIndex(params, srcPixel[0])];
+                    g[i] = params->srcEOTFLUT[simdLUTIndex(params, srcPixel[1])];
+                    b[i] = params->srcEOTFLUT[simdLUTIndex(params, srcPixel[2])];
+                } else {
+                    r[i] = srcPixel[0];
+                    g[i] = srcPixel[1];
+                    b[i] = srcPixel[2];
+                }
+            } else {
+                r[i] = 0.0f;
+                g[i] = 0.0f;
+                b[i] = 0.0f;
+            }
+        }
+
+        R = CL_SIMD_NAME(simdEOTF)(params, VF_LOADU(r));
+        G = CL_SIMD_NAME(simdEOTF)(params, VF_LOADU(g));
+        B = CL_SIMD_NAME(simdEOTF)(params, VF_LOADU(b));
+
+        X = VF_MULADD(VF_SET1(m1[0]), R, VF_MULADD(VF_SET1(m1[1]), G, VF_MUL(VF_SET1(m1[2]), B)));
+        Y = VF_MULADD(VF_SET1(m1[3]), R, VF_MULADD(VF_SET1(m1[4]), G, VF_MUL(VF_SET1(m1[5]), B)));
+        Z = VF_MULADD(VF_SET1(m1[6]), R, VF_MULADD(VF_SET1(m1[7]), G, VF_MUL(VF_SET1(m1[8]), B)));
+
+        if (params->luminanceScaleEnabled) {
+            VF zero = VF_SET1(0.0f);
+            VF sum = VF_ADD(VF_ADD(X, Y), Z);
+            VF valid = VF_GT(sum, zero);
+            VF x = VF_SELECT(valid, VF_DIV(X, sum), VF_SET1(params->whitePointX));
+            VF y = VF_SELECT(valid, VF_DIV(Y, sum), VF_SET1(params->whitePointY));
+            VF L = VF_SELECT(valid, Y, zero);
+            VF lit;
+
+            L = VF_MUL(L, VF_SET1(params->srcCurveScale));
+            L = VF_MUL(L, VF_SET1(params->srcLuminanceScale));
+            L = VF_DIV(L, VF_SET1(params->dstLuminanceScale));
+            L = VF_DIV(L, VF_SET1(params->dstCurveScale));
+
+            if (params->tonemapEnabled) {
+                VF z = CL_SIMD_NAME(simdPow)(L, params->tonemapParams.contrast);
+                VF zp = CL_SIMD_NAME(simdPow)(z, params->tonemapParams.power);
+                L = VF_DIV(z, VF_MULADD(zp, VF_SET1(params->tonemapParams.clipPoint), VF_SET1(params->tonemapParams.speed)));
+            }
+
+            lit = VF_GT(L, zero);
+            y = VF_SELECT(lit, y, VF_SET1(1.0f));
+            X = VF_SELECT(lit, VF_DIV(VF_MUL(x, L), y), zero);
+            Y = VF_SELECT(lit, L, zero);
+            Z = VF_SELECT(lit, VF_DIV(VF_MUL(VF_SUB(VF_SUB(VF_SET1(1.0f), x), y), L), y), zero);
+        }
+
+        R = VF_MULADD(VF_SET1(m2[0]), X, VF_MULADD(VF_SET1(m2[1]), Y, VF_MUL(VF_SET1(m2[2]), Z)));
+        G = VF_MULADD(VF_SET1(m2[3]), X, VF_MULADD(VF_SET1(m2[4]), Y, VF_MUL(VF_SET1(m2[5]), Z)));
+        B = VF_MULADD(VF_SET1(m2[6]), X, VF_MULADD(VF_SET1(m2[7]), Y, VF_MUL(VF_SET1(m2[8]), Z)));
+
+        VF_STOREU(r, CL_SIMD_NAME(simdOETF)(params, R));
+        VF_STOREU(g, CL_SIMD_NAME(simdOETF)(params, G));
+        VF_STOREU(b, CL_SIMD_NAME(simdOETF)(params, B));
+
+        // Reinterleave, honoring src/dst alpha
+        for (int i = 0; i < count; ++i) {
+            const float * srcPixel = &srcPixels[(base + i) * srcChannelCount];
+            float * dstPixel = &dstPixels[(base + i) * dstChannelCount];
+            dstPixel[0] = r[i];
+            dstPixel[1] = g[i];
+            dstPixel[2] = b[i];
+            if (dstChannelCount > 3) {
+                dstPixel[3] = (srcChannelCount > 3) ? srcPixel[3] : 1.0f;
+            }
+        }
+    }
+}